@@ -2,6 +2,7 @@
 #include <time.h>
 
 #include "cache.h"
+#include "sr_log.h"
 
 
 void cache_push(struct cache_item* pFirstItem, struct cache_item* pNewItem)
@@ -47,7 +48,7 @@ struct cache_item* cache_search(struct cache_item* pFirstItem, uint32_t IP)
     return NULL;
 }
 
-struct cache_item* cache_create_item(uint32_t ip, unsigned char mac[ETHER_ADDR_LEN], int time_stamp)
+struct cache_item* cache_create_item(uint32_t ip, unsigned char mac[ETHER_ADDR_LEN], uint64_t expires)
 {
     struct cache_item* cache_new_item = ((cache_item*)(malloc(sizeof(cache_item))));
     cache_new_item->ip = ip;
@@ -55,16 +56,15 @@ struct cache_item* cache_create_item(uint32_t ip, unsigned char mac[ETHER_ADDR_L
     {
         cache_new_item->mac[i] = mac[i];
     }
-    cache_new_item->time_stamp = time_stamp;
+    cache_new_item->expires = expires;
     cache_new_item->next_item = NULL;
     return cache_new_item;
 }
 
-void check_cache(struct cache_item* pFirstItem)
+/* -- removes the expired entries, returns the next expiry or 0 when empty -- */
+uint64_t check_cache(struct cache_item* pFirstItem, uint64_t now)
 {
-    time_t time_stamp;
-    time(&time_stamp);
-    int current_time_stamp = ((int)(time_stamp));
+    uint64_t next_expiry = 0;
 
     struct cache_item* ptr = pFirstItem;
 
@@ -75,32 +75,33 @@ void check_cache(struct cache_item* pFirstItem)
             break;
         }
 
-        if (current_time_stamp - ptr->next_item->time_stamp >= 15)
+        if (ptr->next_item->expires <= now)
         {
             in_addr ip_addr;
             ip_addr.s_addr = ptr->next_item->ip;
-            Debug("\n\n**** Removing cache entry, [%s, ", inet_ntoa(ip_addr));
-            DebugMAC(ptr->next_item->mac);
-            Debug("] *****\n\n");
+            Log(LOG_ARP, LOG_DEBUG, "**** Removing cache entry, [%I, %M] *****", ip_addr.s_addr, ptr->next_item->mac);
 
             remove_cache_item(ptr);
 
+            continue;
+        }
+
+        if ((next_expiry == 0) || (ptr->next_item->expires < next_expiry))
+        {
+            next_expiry = ptr->next_item->expires;
         }
 
         ptr = ptr->next_item;
     }
+
+    return next_expiry;
 }
 
 void remove_cache_item(struct cache_item* previous_item)
 {
-    if (previous_item->next_item->next_item != NULL)
-    {
-        previous_item->next_item = previous_item->next_item->next_item;
-    }
-    else
-    {
-        previous_item->next_item = NULL;
-    }
+    struct cache_item* item = previous_item->next_item;
+
+    previous_item->next_item = item->next_item;
 
-    free(previous_item->next_item);
+    free(item);
 }
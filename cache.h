@@ -8,17 +8,19 @@
 
 #include "sr_protocol.h"
 
+#define CACHE_ITEM_TIMEOUT 15000 /* ms */
+
 struct cache_item
 {
     uint32_t ip;
     unsigned char mac[ETHER_ADDR_LEN];
-    int time_stamp;
+    uint64_t expires;           /* monotonic ms */
     struct cache_item* next_item;
 } __attribute__ ((packed)) ;
 
 void cache_push(struct cache_item*, struct cache_item*);
 struct cache_item* cache_pop(struct cache_item*);
-struct cache_item* cache_search(struct cache_item*, uint32_t);struct cache_item* cache_create_item(uint32_t ip, unsigned char mac[ETHER_ADDR_LEN], int time_stamp);
-void check_cache(struct cache_item*);
+struct cache_item* cache_search(struct cache_item*, uint32_t);struct cache_item* cache_create_item(uint32_t ip, unsigned char mac[ETHER_ADDR_LEN], uint64_t expires);
+uint64_t check_cache(struct cache_item*, uint64_t);
 void remove_cache_item(struct cache_item*);
 #endif	//CACHE_H
@@ -2,16 +2,12 @@
 #include <time.h>
 
 #include "dijkstra_stack.h"
+#include "pwospf_topology.h"
 
 
 void dijkstra_stack_push(struct dijkstra_item* dijkstra_first_item, struct dijkstra_item* dijkstra_new_item)
 {
-    if (dijkstra_first_item->next != NULL)
-    {
-        dijkstra_new_item->next = dijkstra_first_item->next;
-        dijkstra_first_item->next = dijkstra_new_item;
-    }
-
+    dijkstra_new_item->next = dijkstra_first_item->next;
     dijkstra_first_item->next = dijkstra_new_item;
 }
 
@@ -54,7 +50,56 @@ struct dijkstra_item* dijkstra_stack_pop(struct dijkstra_item* dijkstra_first_it
     }
 }
 
-struct dijkstra_item* create_dikjstra_item(struct ospfv2_topology_entry* new_topology_entry, uint8_t cost)
+/* Items are links, the router an item reaches is the neighbor of the link.
+ * A next hop of 0 matches any next hop. */
+struct dijkstra_item* dijkstra_stack_search(struct dijkstra_item* dijkstra_first_item, uint32_t router_id, uint32_t next_hop)
+{
+    struct dijkstra_item* ptr = dijkstra_first_item->next;
+    while (ptr != NULL)
+    {
+        if ((ptr->topology_entry->neighbor_id.s_addr == router_id) &&
+            ((next_hop == 0) || (ptr->topology_entry->next_hop.s_addr == next_hop)))
+        {
+            return ptr;
+        }
+
+        ptr = ptr->next;
+    }
+
+    return NULL;
+}
+
+uint8_t dijkstra_stack_count(struct dijkstra_item* dijkstra_first_item, uint32_t router_id)
+{
+    uint8_t count = 0;
+
+    struct dijkstra_item* ptr = dijkstra_first_item->next;
+    while (ptr != NULL)
+    {
+        if (ptr->topology_entry->neighbor_id.s_addr == router_id)
+        {
+            count++;
+        }
+
+        ptr = ptr->next;
+    }
+
+    return count;
+}
+
+void dijkstra_stack_free(struct dijkstra_item* dijkstra_first_item)
+{
+    struct dijkstra_item* ptr = dijkstra_first_item;
+    while (ptr != NULL)
+    {
+        struct dijkstra_item* temp = ptr->next;
+        free(ptr->topology_entry);
+        free(ptr);
+        ptr = temp;
+    }
+}
+
+struct dijkstra_item* create_dikjstra_item(struct ospfv2_topology_entry* new_topology_entry, uint32_t cost)
 {
     struct dijkstra_item* dijkstra_new_item = ((dijkstra_item*)(malloc(sizeof(dijkstra_item))));
     dijkstra_new_item->topology_entry = new_topology_entry;
@@ -11,7 +11,7 @@
 struct dijkstra_item
 {
     struct ospfv2_topology_entry* topology_entry;
-    uint8_t cost;
+    uint32_t cost;
     struct dijkstra_item* parent;
     struct dijkstra_item* next;
 } __attribute__ ((packed)) ;
@@ -19,5 +19,8 @@ struct dijkstra_item
 void dijkstra_stack_push(struct dijkstra_item*, struct dijkstra_item*);
 void dijkstra_stack_reorder(struct dijkstra_item*);
 struct dijkstra_item* dijkstra_stack_pop(struct dijkstra_item*);
-struct dijkstra_item* create_dikjstra_item(struct ospfv2_topology_entry*, uint8_t);
+struct dijkstra_item* dijkstra_stack_search(struct dijkstra_item*, uint32_t, uint32_t);
+uint8_t dijkstra_stack_count(struct dijkstra_item*, uint32_t);
+void dijkstra_stack_free(struct dijkstra_item*);
+struct dijkstra_item* create_dikjstra_item(struct ospfv2_topology_entry*, uint32_t);
 #endif	//DIJKSTRA_STACK_H
@@ -1,5 +1,6 @@
 #include "pwospf_neighbors.h"
 #include "pwospf_protocol.h"
+#include "sr_log.h"
 
 void add_neighbor(ospfv2_neighbor* first_neighbor, ospfv2_neighbor* new_neighbor)
 {
@@ -30,9 +31,14 @@ void delete_neighbor(ospfv2_neighbor* previous_neighbor)
     free(temp);
 }
 
-void check_neighbors_alive(ospfv2_neighbor* first_neighbor)
+/* Expired neighbors are unlinked and returned as a list, the caller
+ * tears down their adjacencies and frees them. next_expiry is set to the
+ * first expiry of the remaining ones, 0 if none. */
+struct ospfv2_neighbor* check_neighbors_alive(ospfv2_neighbor* first_neighbor, uint64_t now, uint64_t* next_expiry)
 {
     struct ospfv2_neighbor* ptr = first_neighbor;
+    struct ospfv2_neighbor* expired = NULL;
+    *next_expiry = 0;
 
     while(ptr != NULL)
     {
@@ -41,46 +47,55 @@ void check_neighbors_alive(ospfv2_neighbor* first_neighbor)
             break;
         }
 
-        if (ptr->next->alive == 0)
+        if (ptr->next->expires <= now)
         {
-            Debug("\n\n**** PWOSPF: Removing the neighbor, [ID = %s] from the alive neighbors table\n\n", inet_ntoa(ptr->next->neighbor_id));
+            Log(LOG_OSPF, LOG_INFO, "**** PWOSPF: Removing the neighbor, [ID = %I] from the alive neighbors table",
+                ptr->next->neighbor_id.s_addr);
 
-            delete_neighbor(ptr);
+            struct ospfv2_neighbor* temp = ptr->next;
+            ptr->next = temp->next;
+            temp->next = expired;
+            expired = temp;
+            continue;
         }
-        else
+        else if ((*next_expiry == 0) || (ptr->next->expires < *next_expiry))
         {
-            ptr->next->alive--;
+            *next_expiry = ptr->next->expires;
         }
 
         ptr = ptr->next;
     }
+
+    return expired;
 }
 
-void refresh_neighbors_alive(ospfv2_neighbor* first_neighbor, in_addr neighbor_id)
+void refresh_neighbors_alive(ospfv2_neighbor* first_neighbor, in_addr neighbor_id, in_addr neighbor_ip)
 {
     struct ospfv2_neighbor* ptr = first_neighbor;
     while(ptr != NULL)
     {
-        if (ptr->neighbor_id.s_addr == neighbor_id.s_addr)
+        if ((ptr->neighbor_id.s_addr == neighbor_id.s_addr) && (ptr->neighbor_ip.s_addr == neighbor_ip.s_addr))
         {
-            Debug("-> PWOSPF: Refreshing the neighbor, [ID = %s] in the alive neighbors table\n", inet_ntoa(neighbor_id));
-            ptr->alive = OSPF_NEIGHBOR_TIMEOUT;
+            Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Refreshing the neighbor, [ID = %I] in the alive neighbors table",
+                neighbor_id.s_addr);
+            ptr->expires = sr_timer_now() + (OSPF_NEIGHBOR_TIMEOUT * 1000);
             return;
         }
 
         ptr = ptr->next;
     }
 
-    Debug("-> PWOSPF: Adding the neighbor, [ID = %s] to the alive neighbors table\n", inet_ntoa(neighbor_id));
-    add_neighbor(first_neighbor, create_ospfv2_neighbor(neighbor_id));
+    Log(LOG_OSPF, LOG_INFO, "PWOSPF: Adding the neighbor, [ID = %I] to the alive neighbors table", neighbor_id.s_addr);
+    add_neighbor(first_neighbor, create_ospfv2_neighbor(neighbor_id, neighbor_ip));
 }
 
-struct ospfv2_neighbor* create_ospfv2_neighbor(in_addr neighbor_id)
+struct ospfv2_neighbor* create_ospfv2_neighbor(in_addr neighbor_id, in_addr neighbor_ip)
 {
     struct ospfv2_neighbor* new_neighbor = ((ospfv2_neighbor*)(malloc(sizeof(ospfv2_neighbor))));
 
     new_neighbor->neighbor_id.s_addr = neighbor_id.s_addr;
-    new_neighbor->alive = OSPF_NEIGHBOR_TIMEOUT;
+    new_neighbor->neighbor_ip.s_addr = neighbor_ip.s_addr;
+    new_neighbor->expires = sr_timer_now() + (OSPF_NEIGHBOR_TIMEOUT * 1000);
     new_neighbor->next = NULL;
 
     return new_neighbor;
@@ -21,16 +21,17 @@
 struct ospfv2_neighbor
 {
     struct in_addr neighbor_id; /* -- the neighbor id -- */
-    uint8_t alive;        /* -- alive since [in seconds] -- */
+    struct in_addr neighbor_ip; /* -- the neighbor address on the link -- */
+    uint64_t expires;     /* -- dead after [monotonic ms] -- */
     struct ospfv2_neighbor* next;
 }__attribute__ ((packed));
 
 
 void add_neighbor(struct ospfv2_neighbor*, struct ospfv2_neighbor*);
 void delete_neighbor(struct ospfv2_neighbor*);
-void check_neighbors_alive(ospfv2_neighbor*);
-void refresh_neighbors_alive(ospfv2_neighbor*, in_addr);
-struct ospfv2_neighbor* create_ospfv2_neighbor(in_addr);
+struct ospfv2_neighbor* check_neighbors_alive(ospfv2_neighbor*, uint64_t, uint64_t*);
+void refresh_neighbors_alive(ospfv2_neighbor*, in_addr, in_addr);
+struct ospfv2_neighbor* create_ospfv2_neighbor(in_addr, in_addr);
 
 
 #endif  /* --  PWOSPF_NEIGHBORS -- */
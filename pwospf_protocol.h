@@ -24,7 +24,10 @@ static const uint8_t OSPF_DEFAULT_HELLOINT  =  5; /* seconds */
 static const uint8_t OSPF_DEFAULT_LSUINT    = 30; /* seconds */
 static const uint8_t OSPF_NEIGHBOR_TIMEOUT  = 20; /* seconds */ 
 
-static const uint8_t OSPF_TOPO_ENTRY_TIMEOUT = 35; /* seconds */ 
+static const uint8_t OSPF_MIN_LSU_INTERVAL  =  5; /* seconds between originations */
+static const uint8_t OSPF_LSU_REFRESH_INT   = 60; /* seconds, jittered by +-25% */
+
+static const uint8_t OSPF_TOPO_ENTRY_TIMEOUT = 180; /* seconds, 3 refreshes */ 
 
 static const uint8_t OSPF_DEFAULT_AUTHKEY  =  0; /* ignored */
 
@@ -1,5 +1,6 @@
 #include "pwospf_topology.h"
 #include "pwospf_protocol.h"
+#include "sr_log.h"
 
 void add_topology_entry(struct ospfv2_topology_entry* first_entry, struct ospfv2_topology_entry* new_entry)
 {
@@ -30,11 +31,14 @@ void delete_topology_entry(struct ospfv2_topology_entry* previous_entry)
     free(temp);
 }
 
-uint8_t check_topology_age(struct ospfv2_topology_entry* first_entry)
+/* Removes the entries not refreshed for OSPF_TOPO_ENTRY_TIMEOUT, next_expiry
+ * is set to the first expiry of the remaining ones, 0 if none. */
+uint8_t check_topology_age(struct ospfv2_topology_entry* first_entry, uint64_t now, uint64_t* next_expiry)
 {
     struct ospfv2_topology_entry* ptr = first_entry;
 
     uint8_t deleted = 0;
+    *next_expiry = 0;
     while(ptr != NULL)
     {
         if (ptr->next == NULL)
@@ -42,21 +46,21 @@ uint8_t check_topology_age(struct ospfv2_topology_entry* first_entry)
             break;
         }
 
-        if (ptr->next->age == OSPF_TOPO_ENTRY_TIMEOUT)
+        uint64_t expires = ptr->next->refreshed + (OSPF_TOPO_ENTRY_TIMEOUT * 1000);
+        if (expires <= now)
         {
-            Debug("\n\n**** PWOSPF: Removing a topology entry from the topology table *****\n");
-            Debug("        [Network = %s]\n", inet_ntoa(ptr->next->net_num));
-            Debug("        [Mask = %s]\n", inet_ntoa(ptr->next->net_mask));
-            Debug("        [Neighbor ID = %s]\n", inet_ntoa(ptr->next->neighbor_id));
-            Debug("        [Age = %d]\n\n", ptr->next->age);
+            Log(LOG_OSPF, LOG_DEBUG, "**** PWOSPF: Removing a topology entry from the topology table [Network = %I] [Mask = %I] [Neighbor ID = %I] [Age = %d]",
+                ptr->next->net_num.s_addr, ptr->next->net_mask.s_addr, ptr->next->neighbor_id.s_addr,
+                ((int)((now - ptr->next->refreshed) / 1000)));
 
             delete_topology_entry(ptr);
 
             deleted = 1;
+            continue;
         }
-        else
+        else if ((*next_expiry == 0) || (expires < *next_expiry))
         {
-            ptr->next->age++;
+            *next_expiry = expires;
         }
 
         ptr = ptr->next;
@@ -65,7 +69,9 @@ uint8_t check_topology_age(struct ospfv2_topology_entry* first_entry)
     return deleted;
 }
 
-void refresh_topology_entry(struct ospfv2_topology_entry* first_entry, struct in_addr router_id, struct in_addr net_num, struct in_addr net_mask,
+/* Returns 1 when the topology changed, refreshing an identical entry
+ * is not a change. */
+uint8_t refresh_topology_entry(struct ospfv2_topology_entry* first_entry, struct in_addr router_id, struct in_addr net_num, struct in_addr net_mask,
     struct in_addr neighbor_id, struct in_addr next_hop, uint16_t sequence_num)
 {
     struct ospfv2_topology_entry* ptr = first_entry->next;
@@ -75,44 +81,87 @@ void refresh_topology_entry(struct ospfv2_topology_entry* first_entry, struct in
         {
             if (ptr->router_id.s_addr == router_id.s_addr)
             {
-                Debug("-> PWOSPF: Refreshing a topology entry in the toplogy table\n");
-                Debug("        [Network = %s]\n", inet_ntoa(ptr->net_num));
-                Debug("        [Mask = %s]\n", inet_ntoa(ptr->net_mask));
-                Debug("        [Neighbor ID = %s]\n", inet_ntoa(ptr->neighbor_id));
+                Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Refreshing a topology entry in the toplogy table [Network = %I] [Mask = %I] [Neighbor ID = %I]",
+                    ptr->net_num.s_addr, ptr->net_mask.s_addr, ptr->neighbor_id.s_addr);
 
-                ptr->age = 0; //OSPF_TOPO_ENTRY_TIMEOUT
+                uint8_t changed = (ptr->neighbor_id.s_addr != neighbor_id.s_addr);
+
+                ptr->refreshed = sr_timer_now();
                 ptr->sequence_num = sequence_num;
                 ptr->neighbor_id.s_addr = neighbor_id.s_addr;
-                return;
+                return changed;
             }
             /* first condition */
             else if ((ptr->neighbor_id.s_addr != 0) && ((ptr->router_id.s_addr != neighbor_id.s_addr) || (ptr->neighbor_id.s_addr != router_id.s_addr)))
             {
-                Debug("-> PWOSPF: Droping a topology entry: Invalid entry neighbor\n");
-                Debug("        [Network = %s]\n", inet_ntoa(net_num));
-                Debug("        [Mask = %s]\n", inet_ntoa(net_mask));
-                Debug("        [Neighbor ID = %s]\n", inet_ntoa(neighbor_id));
-                return;
+                Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Droping a topology entry: Invalid entry neighbor [Network = %I] [Mask = %I] [Neighbor ID = %I]",
+                    net_num.s_addr, net_mask.s_addr, neighbor_id.s_addr);
+                return 0;
             }
             /* second condition */
             else if ((ptr->neighbor_id.s_addr == router_id.s_addr) && (ptr->net_mask.s_addr != net_mask.s_addr))
             {
-                Debug("-> PWOSPF: Droping a topology entry: Invalid entry subnet mask\n");
-                Debug("        [Network = %s]\n", inet_ntoa(net_num));
-                Debug("        [Mask = %s]\n", inet_ntoa(net_mask));
-                Debug("        [Neighbor ID = %s]\n", inet_ntoa(neighbor_id));
-                return;
+                Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Droping a topology entry: Invalid entry subnet mask [Network = %I] [Mask = %I] [Neighbor ID = %I]",
+                    net_num.s_addr, net_mask.s_addr, neighbor_id.s_addr);
+                return 0;
             }
         }
 
         ptr = ptr->next;
     }
 
-    Debug("-> PWOSPF: Adding a topology entry in the toplogy table\n");
-    Debug("        [Network = %s]\n", inet_ntoa(net_num));
-    Debug("        [Mask = %s]\n", inet_ntoa(net_mask));
-    Debug("        [Neighbor ID = %s]\n", inet_ntoa(neighbor_id));
+    Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Adding a topology entry in the toplogy table [Network = %I] [Mask = %I] [Neighbor ID = %I]",
+        net_num.s_addr, net_mask.s_addr, neighbor_id.s_addr);
     add_topology_entry(first_entry, create_ospfv2_topology_entry(router_id, net_num, net_mask, neighbor_id, next_hop, sequence_num));
+    return 1;
+}
+
+/* An LSU carries all the links of its router, the entries of that router
+ * that were not refreshed with its sequence number have been withdrawn. */
+uint8_t remove_stale_topology_entries(struct ospfv2_topology_entry* first_entry, struct in_addr router_id, uint16_t sequence_num)
+{
+    struct ospfv2_topology_entry* ptr = first_entry;
+
+    uint8_t deleted = 0;
+    while(ptr->next != NULL)
+    {
+        if ((ptr->next->router_id.s_addr == router_id.s_addr) && (ptr->next->sequence_num != sequence_num))
+        {
+            Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Removing a withdrawn topology entry from the topology table [Network = %I] [Mask = %I] [Neighbor ID = %I]",
+                ptr->next->net_num.s_addr, ptr->next->net_mask.s_addr, ptr->next->neighbor_id.s_addr);
+
+            delete_topology_entry(ptr);
+
+            deleted = 1;
+            continue;
+        }
+
+        ptr = ptr->next;
+    }
+
+    return deleted;
+}
+
+uint8_t check_topology_sequence(struct ospfv2_topology_entry* first_entry, struct in_addr router_id, uint16_t sequence_num)
+{
+    struct ospfv2_topology_entry* entry = first_entry->next;
+    while(entry != NULL)
+    {
+        if (entry->router_id.s_addr == router_id.s_addr)
+        {
+            /* Sequence numbers wrap, newer is less than half the space ahead */
+            int16_t diff = ((int16_t)(sequence_num - entry->sequence_num));
+            if (diff == 0)
+            {
+                return 1;
+            }
+            return (diff < 0) ? 2 : 0;
+        }
+
+        entry = entry->next;
+    }
+
+    return 0;
 }
 
 struct ospfv2_topology_entry* create_ospfv2_topology_entry(struct in_addr router_id, struct in_addr net_num, struct in_addr net_mask,
@@ -126,7 +175,7 @@ struct ospfv2_topology_entry* create_ospfv2_topology_entry(struct in_addr router
     new_entry->neighbor_id.s_addr = neighbor_id.s_addr;
     new_entry->next_hop.s_addr = next_hop.s_addr;
     new_entry->sequence_num = sequence_num;
-    new_entry->age = 0;
+    new_entry->refreshed = sr_timer_now();
     new_entry->next = NULL;
 
     return new_entry;
@@ -142,7 +191,7 @@ struct ospfv2_topology_entry* clone_ospfv2_topology_entry(struct ospfv2_topology
     copy_entry->neighbor_id.s_addr = entry->neighbor_id.s_addr;
     copy_entry->next_hop.s_addr = entry->next_hop.s_addr;
     copy_entry->sequence_num = entry->sequence_num;
-    copy_entry->age = entry->age;
+    copy_entry->refreshed = entry->refreshed;
     copy_entry->next = entry->next;
 
     return copy_entry;
@@ -150,32 +199,33 @@ struct ospfv2_topology_entry* clone_ospfv2_topology_entry(struct ospfv2_topology
 
 void print_topolgy_table(struct ospfv2_topology_entry* first_entry)
 {
-    //Debug("--------------------------------------------------------------------------------------------------------\n");
-    Debug("========================================================================================================\n");
-    Debug("%-18s%-18s%-18s%-18s%-18s%-11sAge\n", "Router ID", "Subnet", "Subnet Mask", "Neighbor ID", "Next Hop", "Sequence");
-    Debug("%-18s%-18s%-18s%-18s%-18s%-11s---\n", "---------", "------", "-----------", "-----------", "--------", "--------");
+    /* One record per row, nothing to walk if nobody reads it */
+    if (!sr_log_enabled(LOG_OSPF, LOG_DEBUG))
+    {
+        return;
+    }
+
+    Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Topology table");
+    Log(LOG_OSPF, LOG_DEBUG, "%-18s%-18s%-18s%-18s%-18s%-11sAge", "Router ID", "Subnet", "Subnet Mask", "Neighbor ID", "Next Hop",
+        "Sequence");
 
+    uint64_t now = sr_timer_now();
     struct ospfv2_topology_entry* entry = first_entry->next;
     if (entry == NULL)
     {
-        Debug("The topology table is empty");
+        Log(LOG_OSPF, LOG_DEBUG, "The topology table is empty");
     }
     else
     {
         while(entry != NULL)
         {
-            Debug("%-18s",inet_ntoa(entry->router_id));
-            Debug("%-18s",inet_ntoa(entry->net_num));
-            Debug("%-18s",inet_ntoa(entry->net_mask));
-            Debug("%-18s",inet_ntoa(entry->neighbor_id));
-            Debug("%-18s",inet_ntoa(entry->next_hop));
-            Debug("%-11d",entry->sequence_num);
-            Debug("%d\n",entry->age);
+            Log(LOG_OSPF, LOG_DEBUG, "%-18I%-18I%-18I%-18I%-18I%-11d%d", entry->router_id.s_addr, entry->net_num.s_addr,
+                entry->net_mask.s_addr, entry->neighbor_id.s_addr, entry->next_hop.s_addr, entry->sequence_num,
+                ((int)((now - entry->refreshed) / 1000)));
 
             entry = entry->next; 
         }
     }
-    Debug("========================================================================================================\n");
 }
 
 uint8_t search_topolgy_table(struct ospfv2_topology_entry* first_entry, uint32_t subnet)
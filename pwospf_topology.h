@@ -25,15 +25,17 @@ struct ospfv2_topology_entry
     struct in_addr neighbor_id;   /* -- network mask -- */
     struct in_addr next_hop;      /* -- next hop -- */
     uint16_t sequence_num;        /* -- sequence number of the LSU -- */
-    int age;                      /* -- LSA age -- */
+    uint64_t refreshed;           /* -- last LSU [monotonic ms] -- */
     struct ospfv2_topology_entry* next;
 }__attribute__ ((packed));
 
 
 void add_topology_entry(struct ospfv2_topology_entry*, struct ospfv2_topology_entry*);
 void delete_topology_entry(struct ospfv2_topology_entry*);
-uint8_t check_topology_age(struct ospfv2_topology_entry*);
-void refresh_topology_entry(struct ospfv2_topology_entry*, struct in_addr, struct in_addr, struct in_addr, struct in_addr, struct in_addr, uint16_t);
+uint8_t check_topology_age(struct ospfv2_topology_entry*, uint64_t, uint64_t*);
+uint8_t refresh_topology_entry(struct ospfv2_topology_entry*, struct in_addr, struct in_addr, struct in_addr, struct in_addr, struct in_addr, uint16_t);
+uint8_t remove_stale_topology_entries(struct ospfv2_topology_entry*, struct in_addr, uint16_t);
+uint8_t check_topology_sequence(struct ospfv2_topology_entry*, struct in_addr, uint16_t);
 struct ospfv2_topology_entry* create_ospfv2_topology_entry(struct in_addr, struct in_addr, struct in_addr, struct in_addr, struct in_addr, uint16_t);
 struct ospfv2_topology_entry* clone_ospfv2_topology_entry(struct ospfv2_topology_entry*);
 void print_topolgy_table(struct ospfv2_topology_entry*);
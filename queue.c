@@ -40,12 +40,14 @@ struct queue_item* queue_pop(struct queue_item* pFirstItem)
 
 struct queue_item* queue_create_item(uint8_t* packet, unsigned int length, char* interface)
 {
-    struct queue_item* queue_new_item = ((queue_item*)(malloc(sizeof(queue_item))));
+    /* -- as long as the packet, a jumbo frame or a bare ARP reply -- */
+    struct queue_item* queue_new_item = ((queue_item*)(malloc(sizeof(queue_item) + length)));
 
     memcpy(queue_new_item->packet, packet, length);
     queue_new_item->length = length;
     queue_new_item->interface = interface;
     queue_new_item->next_item = NULL;
+    queue_new_item->queued_at = 0;
     return queue_new_item;
 }
 
@@ -60,3 +62,17 @@ uint8_t queue_is_empty(struct queue_item* pFirstItem)
         return 0;
     }
 }
+
+unsigned int queue_length(struct queue_item* pFirstItem)
+{
+    unsigned int length = 0;
+    struct queue_item* ptr = pFirstItem->next_item;
+
+    while(ptr != NULL)
+    {
+        length++;
+        ptr = ptr->next_item;
+    }
+
+    return length;
+}
@@ -7,10 +7,11 @@
 
 struct queue_item
 {
-    uint8_t packet[1500];
     unsigned int length;
     char* interface;
     struct queue_item* next_item;
+    uint64_t queued_at; /* ns, monotonic */
+    uint8_t packet[1]; /* length bytes, allocated with the item */
 } __attribute__ ((packed)) ;
 
 
@@ -18,4 +19,5 @@ void queue_push(struct queue_item*, struct queue_item*);
 struct queue_item* queue_pop(struct queue_item*);
 struct queue_item* queue_create_item(uint8_t*, unsigned int, char*);
 uint8_t queue_is_empty(struct queue_item*);
+unsigned int queue_length(struct queue_item*);
 #endif	//QUEUE_H
@@ -0,0 +1,729 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_acl.c
+ *
+ * Description:
+ *
+ * Rule file, tuple space classifier and rule set swap, see sr_acl.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_acl.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_stats.h"
+
+static const struct
+{
+    const char* name;
+    int proto;
+} acl_proto_names[] =
+{
+    { "icmp", IP_PROTO_ICMP },
+    { "tcp", IP_PROTO_TCP },
+    { "udp", IP_PROTO_UDP },
+    { "ospf", IP_PROTO_OSPFv2 }
+};
+#define ACL_PROTO_NAME_NUM 4
+
+
+/*-----------------------------------------------------------------------------
+ * Method: acl_parse_prefix / acl_parse_ports
+ *
+ * a.b.c.d[/len] and lo[-hi], return 0 or -1.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int acl_parse_prefix(const char* text, uint32_t* addr, uint8_t* len)
+{
+    char buf[32];
+    char* end;
+    snprintf(buf, sizeof(buf), "%s", text);
+
+    *len = 32;
+    char* slash = strchr(buf, '/');
+    if (slash != NULL)
+    {
+        *slash = '\0';
+        unsigned long value = strtoul(slash + 1, &end, 10);
+        if ((*end != '\0') || (end == slash + 1) || (value > 32))
+        {
+            return -1;
+        }
+        *len = value;
+    }
+
+    struct in_addr in;
+    if (inet_aton(buf, &in) == 0)
+    {
+        return -1;
+    }
+    *addr = in.s_addr & ((*len == 0) ? 0 : htonl(0xffffffff << (32 - *len)));
+    return 0;
+} /* -- acl_parse_prefix -- */
+
+static
+int acl_parse_ports(const char* text, uint16_t* lo, uint16_t* hi)
+{
+    char* end;
+    unsigned long first = strtoul(text, &end, 10);
+    unsigned long last = first;
+    if (*end == '-')
+    {
+        const char* second = end + 1;
+        last = strtoul(second, &end, 10);
+        if (end == second)
+        {
+            return -1;
+        }
+    }
+    if ((*end != '\0') || (end == text) || (first > last) || (last > 65535))
+    {
+        return -1;
+    }
+    *lo = first;
+    *hi = last;
+    return 0;
+} /* -- acl_parse_ports -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: acl_parse_rule
+ *
+ * One line of the rule file, already split into words. Returns 0 or -1.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int acl_parse_rule(struct sr_acl_rule* rule, char** words, int word_num)
+{
+    memset(rule, 0, sizeof(struct sr_acl_rule));
+    rule->proto = -1;
+    rule->sport_hi = 65535;
+    rule->dport_hi = 65535;
+
+    if ((word_num < 2) || ((word_num % 2) != 0))
+    {
+        return -1;
+    }
+
+    if (strcmp(words[0], "permit") == 0)
+    { rule->action = ACL_PERMIT; }
+    else if (strcmp(words[0], "deny") == 0)
+    { rule->action = ACL_DENY; }
+    else
+    { return -1; }
+
+    if (strcmp(words[1], "in") == 0)
+    { rule->dir = ACL_IN; }
+    else if (strcmp(words[1], "out") == 0)
+    { rule->dir = ACL_OUT; }
+    else
+    { return -1; }
+
+    for (int i = 2; i < word_num; i += 2)
+    {
+        const char* field = words[i];
+        const char* value = words[i + 1];
+        if (strcmp(field, "iface") == 0)
+        {
+            if (strlen(value) >= sr_IFACE_NAMELEN)
+            {
+                return -1;
+            }
+            strcpy(rule->iface, value);
+        }
+        else if (strcmp(field, "proto") == 0)
+        {
+            for (int j = 0; j < ACL_PROTO_NAME_NUM; j++)
+            {
+                if (strcmp(value, acl_proto_names[j].name) == 0)
+                {
+                    rule->proto = acl_proto_names[j].proto;
+                }
+            }
+            if (rule->proto < 0)
+            {
+                char* end;
+                unsigned long proto = strtoul(value, &end, 10);
+                if ((*end != '\0') || (end == value) || (proto > 255))
+                {
+                    return -1;
+                }
+                rule->proto = proto;
+            }
+        }
+        else if (strcmp(field, "src") == 0)
+        {
+            if (acl_parse_prefix(value, &rule->src, &rule->src_len) != 0)
+            { return -1; }
+        }
+        else if (strcmp(field, "dst") == 0)
+        {
+            if (acl_parse_prefix(value, &rule->dst, &rule->dst_len) != 0)
+            { return -1; }
+        }
+        else if (strcmp(field, "sport") == 0)
+        {
+            if (acl_parse_ports(value, &rule->sport_lo, &rule->sport_hi) != 0)
+            { return -1; }
+        }
+        else if (strcmp(field, "dport") == 0)
+        {
+            if (acl_parse_ports(value, &rule->dport_lo, &rule->dport_hi) != 0)
+            { return -1; }
+        }
+        else
+        {
+            return -1;
+        }
+    }
+
+    /* -- ports only mean something for TCP and UDP -- */
+    int ports = (rule->sport_lo != 0) || (rule->sport_hi != 65535) || (rule->dport_lo != 0) || (rule->dport_hi != 65535);
+    if (ports && (rule->proto != IP_PROTO_TCP) && (rule->proto != IP_PROTO_UDP))
+    {
+        return -1;
+    }
+    return 0;
+} /* -- acl_parse_rule -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: acl_hash
+ *
+ *---------------------------------------------------------------------------*/
+
+static inline
+uint32_t acl_hash(const struct sr_acl_key* key)
+{
+    uint64_t a = (((uint64_t)(key->src)) << 32) | key->dst;
+    uint64_t b = (((uint64_t)(key->flags)) << 48) | (((uint64_t)(key->sport)) << 32) | (((uint64_t)(key->dport)) << 16) |
+        (key->proto << 8) | key->iface;
+    uint64_t h = (a ^ (b * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+    return ((uint32_t)(h >> 32)) ^ ((uint32_t)(h));
+} /* -- acl_hash -- */
+
+static inline
+void acl_mask_key(struct sr_acl_key* out, const struct sr_acl_key* key, const struct sr_acl_key* mask)
+{
+    out->src = key->src & mask->src;
+    out->dst = key->dst & mask->dst;
+    out->sport = key->sport & mask->sport;
+    out->dport = key->dport & mask->dport;
+    out->proto = key->proto & mask->proto;
+    out->iface = key->iface & mask->iface;
+    out->flags = key->flags & mask->flags;
+    out->pad = 0;
+}
+
+static inline
+int acl_key_equal(const struct sr_acl_key* a, const struct sr_acl_key* b)
+{
+    return (a->src == b->src) && (a->dst == b->dst) && (a->sport == b->sport) &&
+        (a->dport == b->dport) && (a->proto == b->proto) && (a->iface == b->iface) && (a->flags == b->flags);
+}
+
+
+/*-----------------------------------------------------------------------------
+ * Method: acl_tuple_insert
+ *
+ * Adds the entry of a rule to a tuple, unless an earlier rule has the
+ * same key there: that one shadows it. Grows the table at half full.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void acl_tuple_insert(struct sr_acl_tuple* tuple, const struct sr_acl_key* key, uint32_t rule)
+{
+    if ((tuple->used + 1) * 2 > tuple->size)
+    {
+        struct sr_acl_entry* old = tuple->entries;
+        uint32_t old_size = tuple->size;
+
+        tuple->size = (old_size == 0) ? 8 : old_size * 2;
+        tuple->entries = ((struct sr_acl_entry*)(malloc(tuple->size * sizeof(struct sr_acl_entry))));
+        for (uint32_t i = 0; i < tuple->size; i++)
+        {
+            tuple->entries[i].rule = ACL_NO_MATCH;
+        }
+        tuple->used = 0;
+        for (uint32_t i = 0; i < old_size; i++)
+        {
+            if (old[i].rule != ACL_NO_MATCH)
+            {
+                acl_tuple_insert(tuple, &old[i].key, old[i].rule);
+            }
+        }
+        free(old);
+    }
+
+    uint32_t index = acl_hash(key) & (tuple->size - 1);
+    while (tuple->entries[index].rule != ACL_NO_MATCH)
+    {
+        if (acl_key_equal(&tuple->entries[index].key, key))
+        {
+            return;
+        }
+        index = (index + 1) & (tuple->size - 1);
+    }
+    tuple->entries[index].key = *key;
+    tuple->entries[index].rule = rule;
+    tuple->used++;
+    if (rule < tuple->first)
+    {
+        tuple->first = rule;
+    }
+} /* -- acl_tuple_insert -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: acl_port_blocks
+ *
+ * Splits lo..hi into the fewest aligned blocks of 2^n ports, as (first
+ * port, prefix length) pairs. Returns how many, at most 30.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int acl_port_blocks(uint16_t lo, uint16_t hi, uint16_t* ports, uint8_t* lens)
+{
+    int num = 0;
+    uint32_t port = lo;
+    while (port <= hi)
+    {
+        uint32_t len = 16;
+        while ((len > 0) && ((port & ((1u << (17 - len)) - 1)) == 0) && (port + (1u << (17 - len)) - 1 <= hi))
+        {
+            len--;
+        }
+        ports[num] = port;
+        lens[num] = len;
+        num++;
+        port += 1u << (16 - len);
+    }
+    return num;
+} /* -- acl_port_blocks -- */
+
+static
+int acl_compare_tuples(const void* a, const void* b)
+{
+    uint32_t x = ((const struct sr_acl_tuple*)(a))->first;
+    uint32_t y = ((const struct sr_acl_tuple*)(b))->first;
+    return (x > y) - (x < y);
+}
+
+
+/*-----------------------------------------------------------------------------
+ * Method: acl_compile
+ *
+ * Builds the tuples of both directions from the rules. A rule naming
+ * an interface the router does not have is left out, it cannot match.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void acl_compile(struct sr_instance* sr, struct sr_acl* acl)
+{
+    uint32_t tuple_size[ACL_DIR_NUM] = { 0, 0 };
+
+    for (uint32_t r = 0; r < acl->rule_num; r++)
+    {
+        struct sr_acl_rule* rule = &acl->rules[r];
+        int dir = rule->dir;
+
+        struct sr_acl_key key;
+        struct sr_acl_key mask;
+        memset(&key, 0, sizeof(key));
+        memset(&mask, 0, sizeof(mask));
+        if (rule->iface[0] != '\0')
+        {
+            struct sr_if* iface = sr_get_interface(sr, rule->iface);
+            if (iface == NULL)
+            {
+                fprintf(stderr, "*warning* acl line %d: no interface %s\n", rule->line, rule->iface);
+                continue;
+            }
+            key.iface = iface->index;
+            mask.iface = 0xff;
+        }
+        if (rule->proto >= 0)
+        {
+            key.proto = rule->proto;
+            mask.proto = 0xff;
+        }
+        key.src = rule->src;
+        mask.src = (rule->src_len == 0) ? 0 : htonl(0xffffffff << (32 - rule->src_len));
+        key.dst = rule->dst;
+        mask.dst = (rule->dst_len == 0) ? 0 : htonl(0xffffffff << (32 - rule->dst_len));
+
+        uint16_t sports[32], dports[32];
+        uint8_t sport_lens[32], dport_lens[32];
+        int sport_num = acl_port_blocks(rule->sport_lo, rule->sport_hi, sports, sport_lens);
+        int dport_num = acl_port_blocks(rule->dport_lo, rule->dport_hi, dports, dport_lens);
+
+        for (int s = 0; s < sport_num; s++)
+        {
+            for (int d = 0; d < dport_num; d++)
+            {
+                key.sport = sports[s];
+                mask.sport = (sport_lens[s] == 0) ? 0 : ((uint16_t)(0xffff << (16 - sport_lens[s])));
+                key.dport = dports[d];
+                mask.dport = (dport_lens[d] == 0) ? 0 : ((uint16_t)(0xffff << (16 - dport_lens[d])));
+
+                /* -- a packet without ports must not match port 0 -- */
+                key.flags = ((mask.sport | mask.dport) != 0) ? ACL_KEY_PORTS : 0;
+                mask.flags = key.flags;
+
+                struct sr_acl_tuple* tuple = NULL;
+                for (uint32_t t = 0; t < acl->tuple_num[dir]; t++)
+                {
+                    if (acl_key_equal(&acl->tuples[dir][t].mask, &mask))
+                    {
+                        tuple = &acl->tuples[dir][t];
+                        break;
+                    }
+                }
+                if (tuple == NULL)
+                {
+                    if (acl->tuple_num[dir] == tuple_size[dir])
+                    {
+                        tuple_size[dir] = (tuple_size[dir] == 0) ? 8 : tuple_size[dir] * 2;
+                        acl->tuples[dir] = ((struct sr_acl_tuple*)(realloc(acl->tuples[dir],
+                            tuple_size[dir] * sizeof(struct sr_acl_tuple))));
+                    }
+                    tuple = &acl->tuples[dir][acl->tuple_num[dir]++];
+                    memset(tuple, 0, sizeof(struct sr_acl_tuple));
+                    tuple->mask = mask;
+                    tuple->first = ACL_NO_MATCH;
+                }
+                acl_tuple_insert(tuple, &key, r);
+            }
+        }
+    }
+
+    /* -- the tuples of the first rules are tried first -- */
+    for (int dir = 0; dir < ACL_DIR_NUM; dir++)
+    {
+        if (acl->tuple_num[dir] > 0)
+        {
+            qsort(acl->tuples[dir], acl->tuple_num[dir], sizeof(struct sr_acl_tuple), acl_compare_tuples);
+        }
+    }
+} /* -- acl_compile -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_acl_load
+ *
+ * Reads the rule file and compiles it for the interfaces of sr. With sr
+ * NULL only checks the file, the rules are then not compiled. Returns
+ * NULL if the file cannot be read or a line does not parse.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_acl* sr_acl_load(struct sr_instance* sr, const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    struct sr_acl* acl = ((struct sr_acl*)(calloc(1, sizeof(struct sr_acl))));
+    uint32_t rule_size = 0;
+    char line[512];
+    int line_num = 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        line_num++;
+        char* comment = strchr(line, '#');
+        if (comment != NULL)
+        {
+            *comment = '\0';
+        }
+
+        char* words[32];
+        int word_num = 0;
+        char* save;
+        for (char* word = strtok_r(line, " \t\r\n", &save); word != NULL; word = strtok_r(NULL, " \t\r\n", &save))
+        {
+            if (word_num == 32)
+            {
+                break;
+            }
+            words[word_num++] = word;
+        }
+        if (word_num == 0)
+        {
+            continue;
+        }
+
+        if (acl->rule_num == rule_size)
+        {
+            rule_size = (rule_size == 0) ? 64 : rule_size * 2;
+            acl->rules = ((struct sr_acl_rule*)(realloc(acl->rules, rule_size * sizeof(struct sr_acl_rule))));
+        }
+        if ((word_num == 32) || (acl_parse_rule(&acl->rules[acl->rule_num], words, word_num) != 0))
+        {
+            fprintf(stderr, "%s line %d: cannot parse the rule\n", path, line_num);
+            fclose(fp);
+            sr_acl_destroy(acl);
+            return NULL;
+        }
+        acl->rules[acl->rule_num].line = line_num;
+        acl->rule_num++;
+    }
+    fclose(fp);
+
+    if (sr != NULL)
+    {
+        acl_compile(sr, acl);
+    }
+    return acl;
+} /* -- sr_acl_load -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_acl_reload
+ *
+ * Loads the -A file again for the rules to be swapped in before the next
+ * packet, see sr_acl_commit(). Returns 0, or -1 and the rules in use
+ * stay.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_acl_reload(struct sr_instance* sr)
+{
+    if (sr->acl_path == NULL)
+    {
+        return -1;
+    }
+
+    struct sr_acl* acl = sr_acl_load(sr, sr->acl_path);
+    if (acl == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&sr->acl_lock);
+    struct sr_acl* pending = sr->acl_pending;
+    __atomic_store_n(&sr->acl_pending, acl, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&sr->acl_lock);
+
+    if (pending != NULL)
+    {
+        sr_acl_destroy(pending);
+    }
+    return 0;
+} /* -- sr_acl_reload -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_acl_commit
+ *
+ * Called by the event loop, between two packets, once a new rule set is
+ * pending: no packet holds the old one any more, it is freed at once.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_acl_commit(struct sr_instance* sr)
+{
+    pthread_mutex_lock(&sr->acl_lock);
+    struct sr_acl* old = sr->acl;
+    sr->acl = sr->acl_pending;
+    sr->acl_pending = NULL;
+    pthread_mutex_unlock(&sr->acl_lock);
+
+    if (old != NULL)
+    {
+        sr_acl_destroy(old);
+    }
+} /* -- sr_acl_commit -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_acl_classify
+ *
+ * The first rule of direction dir matching the packet, ACL_NO_MATCH if
+ * none does. len is the length of the IP packet.
+ *
+ *---------------------------------------------------------------------------*/
+
+uint32_t sr_acl_classify(struct sr_acl* acl, int dir, struct sr_if* iface, struct ip* ip_hdr, unsigned int len)
+{
+    struct sr_acl_key key;
+    key.src = ip_hdr->ip_src.s_addr;
+    key.dst = ip_hdr->ip_dst.s_addr;
+    key.proto = ip_hdr->ip_p;
+    key.iface = iface->index;
+    key.sport = 0;
+    key.dport = 0;
+    key.flags = 0;
+    key.pad = 0;
+
+    unsigned int hdr_len = ip_hdr->ip_hl * 4;
+    if (((key.proto == IP_PROTO_TCP) || (key.proto == IP_PROTO_UDP)) &&
+        ((ntohs(ip_hdr->ip_off) & IP_OFFMASK) == 0) && (len >= hdr_len + 4))
+    {
+        uint16_t* ports = ((uint16_t*)(((uint8_t*)(ip_hdr)) + hdr_len));
+        key.sport = ntohs(ports[0]);
+        key.dport = ntohs(ports[1]);
+        key.flags = ACL_KEY_PORTS;
+    }
+
+    uint32_t match = ACL_NO_MATCH;
+    struct sr_acl_tuple* tuples = acl->tuples[dir];
+    for (uint32_t t = 0; t < acl->tuple_num[dir]; t++)
+    {
+        struct sr_acl_tuple* tuple = &tuples[t];
+        if (tuple->first >= match)
+        {
+            break;
+        }
+
+        struct sr_acl_key masked;
+        acl_mask_key(&masked, &key, &tuple->mask);
+        uint32_t index = acl_hash(&masked) & (tuple->size - 1);
+        while (tuple->entries[index].rule != ACL_NO_MATCH)
+        {
+            if (acl_key_equal(&tuple->entries[index].key, &masked))
+            {
+                if (tuple->entries[index].rule < match)
+                {
+                    match = tuple->entries[index].rule;
+                }
+                break;
+            }
+            index = (index + 1) & (tuple->size - 1);
+        }
+    }
+    return match;
+} /* -- sr_acl_classify -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_acl_check
+ *
+ * ACL_PERMIT or ACL_DENY for a packet going dir through iface, counts
+ * the hit of the rule that decided.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_acl_check(struct sr_instance* sr, int dir, struct sr_if* iface, struct ip* ip_hdr, unsigned int len)
+{
+    if (__atomic_load_n(&sr->acl_pending, __ATOMIC_ACQUIRE) != NULL)
+    {
+        sr_acl_commit(sr);
+    }
+
+    struct sr_acl* acl = sr->acl;
+    if ((acl == NULL) || (iface == NULL))
+    {
+        return ACL_PERMIT;
+    }
+
+    uint32_t rule = sr_acl_classify(acl, dir, iface, ip_hdr, len);
+    if (rule == ACL_NO_MATCH)
+    {
+        return ACL_PERMIT;
+    }
+    __atomic_fetch_add(&acl->rules[rule].hits, 1, __ATOMIC_RELAXED);
+    return acl->rules[rule].action;
+} /* -- sr_acl_check -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_acl_format
+ *
+ * The rules in use with their hits, for the stats socket.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_acl_format(struct sr_instance* sr, struct stats_buf* buf)
+{
+    pthread_mutex_lock(&sr->acl_lock);
+
+    struct sr_acl* acl = sr->acl;
+    if (acl == NULL)
+    {
+        stats_printf(buf, "no acl\n");
+    }
+    else
+    {
+        stats_printf(buf, "%u rules, %u in and %u out tuples\n", acl->rule_num,
+            acl->tuple_num[ACL_IN], acl->tuple_num[ACL_OUT]);
+    }
+    if (sr->acl_pending != NULL)
+    {
+        stats_printf(buf, "new rules pending, in use from the next packet\n");
+    }
+
+    for (uint32_t r = 0; (acl != NULL) && (r < acl->rule_num); r++)
+    {
+        struct sr_acl_rule* rule = &acl->rules[r];
+        struct in_addr src, dst;
+        src.s_addr = rule->src;
+        dst.s_addr = rule->dst;
+
+        stats_printf(buf, "%4d %-6s %-3s", rule->line, (rule->action == ACL_DENY) ? "deny" : "permit",
+            (rule->dir == ACL_IN) ? "in" : "out");
+        if (rule->iface[0] != '\0')
+        {
+            stats_printf(buf, " iface %s", rule->iface);
+        }
+        if (rule->proto >= 0)
+        {
+            stats_printf(buf, " proto %d", rule->proto);
+        }
+        if (rule->src_len > 0)
+        {
+            stats_printf(buf, " src %s/%d", inet_ntoa(src), rule->src_len);
+        }
+        if (rule->dst_len > 0)
+        {
+            stats_printf(buf, " dst %s/%d", inet_ntoa(dst), rule->dst_len);
+        }
+        if ((rule->sport_lo != 0) || (rule->sport_hi != 65535))
+        {
+            stats_printf(buf, " sport %d-%d", rule->sport_lo, rule->sport_hi);
+        }
+        if ((rule->dport_lo != 0) || (rule->dport_hi != 65535))
+        {
+            stats_printf(buf, " dport %d-%d", rule->dport_lo, rule->dport_hi);
+        }
+        stats_printf(buf, " hits %llu\n", ((unsigned long long)(__atomic_load_n(&rule->hits, __ATOMIC_RELAXED))));
+    }
+
+    pthread_mutex_unlock(&sr->acl_lock);
+} /* -- sr_acl_format -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_acl_destroy
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_acl_destroy(struct sr_acl* acl)
+{
+    for (int dir = 0; dir < ACL_DIR_NUM; dir++)
+    {
+        for (uint32_t t = 0; t < acl->tuple_num[dir]; t++)
+        {
+            free(acl->tuples[dir][t].entries);
+        }
+        free(acl->tuples[dir]);
+    }
+    free(acl->rules);
+    free(acl);
+} /* -- sr_acl_destroy -- */
@@ -0,0 +1,117 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_acl.h
+ *
+ * Description:
+ *
+ * Access control lists on the IP packets a router receives (in) and
+ * forwards (out). The rules are read from the file given with -A, one
+ * per line, '#' starts a comment:
+ *
+ *   permit|deny in|out [iface <name>] [proto icmp|tcp|udp|ospf|<number>]
+ *       [src <ip>[/<len>]] [dst <ip>[/<len>]]
+ *       [sport <port>[-<port>]] [dport <port>[-<port>]]
+ *
+ * The first rule that matches decides, a packet no rule matches is
+ * permitted. Ports are those of TCP and UDP, non-first fragments have
+ * none and only match rules without ports. Out rules see the packets
+ * the router forwards, not those it sends itself.
+ *
+ * The rules are compiled into a tuple space classifier: the rules with
+ * the same prefix lengths, port range blocks and wildcards share a hash
+ * table keyed by the masked fields. A packet costs one probe per such
+ * tuple, tried in the order of the first rule they hold so the search
+ * stops at the first tuple that cannot beat the match found, whatever
+ * the number of rules. A port range is split into the aligned blocks
+ * that cover it, the rule then has an entry in the tuple of each.
+ *
+ * The compiled rules are replaced as a whole ("acl reload" on the stats
+ * socket): the new set waits in acl_pending and the event loop, the
+ * only one classifying, takes it between two packets.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ACL_H
+#define SR_ACL_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include "sr_if.h"
+
+#define ACL_IN 0
+#define ACL_OUT 1
+#define ACL_DIR_NUM 2
+
+#define ACL_PERMIT 0
+#define ACL_DENY 1
+
+#define ACL_NO_MATCH 0xffffffff
+
+#define ACL_KEY_PORTS 0x01      /* the packet has ports, a rule with ports needs them */
+
+struct sr_instance;
+struct stats_buf;
+struct ip;
+
+/* -- the fields a packet is matched on, masked by a tuple -- */
+struct sr_acl_key
+{
+    uint32_t src;
+    uint32_t dst;
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t proto;
+    uint8_t iface;      /* index in the interface list */
+    uint8_t flags;      /* ACL_KEY_ */
+    uint8_t pad;
+};
+
+struct sr_acl_rule
+{
+    uint8_t action;
+    uint8_t dir;
+    char iface[sr_IFACE_NAMELEN];   /* empty for any */
+    int proto;          /* -1 for any */
+    uint32_t src;
+    uint8_t src_len;
+    uint32_t dst;
+    uint8_t dst_len;
+    uint16_t sport_lo, sport_hi;
+    uint16_t dport_lo, dport_hi;
+    int line;
+    uint64_t hits;
+};
+
+struct sr_acl_entry
+{
+    struct sr_acl_key key;
+    uint32_t rule;      /* ACL_NO_MATCH for an empty slot */
+};
+
+struct sr_acl_tuple
+{
+    struct sr_acl_key mask;
+    uint32_t first;     /* the first rule with an entry here */
+    uint32_t size;      /* slots, a power of two */
+    uint32_t used;
+    struct sr_acl_entry* entries;
+};
+
+struct sr_acl
+{
+    struct sr_acl_rule* rules;
+    uint32_t rule_num;
+    struct sr_acl_tuple* tuples[ACL_DIR_NUM];     /* by first rule */
+    uint32_t tuple_num[ACL_DIR_NUM];
+};
+
+struct sr_acl* sr_acl_load(struct sr_instance*, const char*);
+int sr_acl_reload(struct sr_instance*);
+void sr_acl_commit(struct sr_instance*);
+uint32_t sr_acl_classify(struct sr_acl*, int, struct sr_if*, struct ip*, unsigned int);
+int sr_acl_check(struct sr_instance*, int, struct sr_if*, struct ip*, unsigned int);
+void sr_acl_format(struct sr_instance*, struct stats_buf*);
+void sr_acl_destroy(struct sr_acl*);
+
+#endif /* -- SR_ACL_H -- */
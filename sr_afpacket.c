@@ -0,0 +1,376 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_afpacket.c
+ *
+ * Description:
+ *
+ * AF_PACKET data plane with PACKET_MMAP rings, see sr_afpacket.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#include "sr_afpacket.h"
+#include "sr_router.h"
+#include "sr_acl.h"
+#include "sr_sched.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING 23
+#endif
+
+/* -- where the frame starts in a TX slot -- */
+#define AFPACKET_TX_DATA (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+static int afpacket_port_read(struct sr_instance*, void*);
+
+
+/*-----------------------------------------------------------------------------
+ * Method: afpacket_port_open
+ *
+ * Reads the address of the Linux interface into the router interface
+ * just added, and binds a socket with its rings to it
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int afpacket_port_open(struct sr_instance* sr, struct sr_afpacket_port* port)
+{
+    port->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (port->fd < 0)
+    {
+        perror("socket(AF_PACKET)");
+        return -1;
+    }
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, port->dev, IFNAMSIZ - 1);
+    if (ioctl(port->fd, SIOCGIFINDEX, &ifr) < 0)
+    {
+        fprintf(stderr, "No interface %s\n", port->dev);
+        return -1;
+    }
+    port->ifindex = ifr.ifr_ifindex;
+
+    sr_add_interface(sr, port->name);
+    if (ioctl(port->fd, SIOCGIFHWADDR, &ifr) == 0)
+    {
+        sr_set_ether_addr(sr, ((unsigned char*)(ifr.ifr_hwaddr.sa_data)));
+    }
+    if (ioctl(port->fd, SIOCGIFADDR, &ifr) == 0)
+    {
+        sr_set_ether_ip(sr, ((struct sockaddr_in*)(&ifr.ifr_addr))->sin_addr.s_addr);
+    }
+    else
+    {
+        fprintf(stderr, "*warning* %s has no IPv4 address\n", port->dev);
+    }
+    if (ioctl(port->fd, SIOCGIFNETMASK, &ifr) == 0)
+    {
+        sr_set_ether_mask(sr, ((struct sockaddr_in*)(&ifr.ifr_netmask))->sin_addr.s_addr);
+    }
+    if (ioctl(port->fd, SIOCGIFMTU, &ifr) == 0)
+    {
+        sr_set_ether_mtu(sr, ifr.ifr_mtu);
+    }
+
+    /* -- a slot holds the headers and a frame of the MTU, with a VLAN tag -- */
+    unsigned int mtu = sr_get_interface(sr, port->name)->mtu;
+    port->frame_size = AFPACKET_FRAME_SIZE;
+    while (port->frame_size < TPACKET_ALIGN(TPACKET2_HDRLEN) + sizeof(struct sr_ethernet_hdr) + 4 + mtu)
+    {
+        port->frame_size *= 2;
+    }
+
+    /* -- our own transmissions are not to be read back -- */
+    int one = 1;
+    setsockopt(port->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+
+    int version = TPACKET_V2;
+    if (setsockopt(port->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+    {
+        perror("setsockopt(PACKET_VERSION)");
+        return -1;
+    }
+
+    struct tpacket_req req;
+    req.tp_block_size = AFPACKET_BLOCK_SIZE;
+    req.tp_block_nr = AFPACKET_FRAME_NUM / (AFPACKET_BLOCK_SIZE / port->frame_size);
+    req.tp_frame_size = port->frame_size;
+    req.tp_frame_nr = AFPACKET_FRAME_NUM;
+    if ((setsockopt(port->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) ||
+        (setsockopt(port->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0))
+    {
+        perror("setsockopt(PACKET_RX_RING/PACKET_TX_RING)");
+        return -1;
+    }
+
+    /* -- one mapping, the RX ring followed by the TX ring -- */
+    size_t ring_size = ((size_t)(AFPACKET_BLOCK_SIZE)) * req.tp_block_nr;
+    void* map = mmap(NULL, 2 * ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, port->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap(AF_PACKET rings)");
+        return -1;
+    }
+    port->ring_size = ring_size;
+    port->rx_ring = ((uint8_t*)(map));
+    port->tx_ring = ((uint8_t*)(map)) + ring_size;
+    port->rx_head = 0;
+    port->tx_head = 0;
+    pthread_mutex_init(&port->tx_lock, NULL);
+
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = port->ifindex;
+    if (bind(port->fd, ((struct sockaddr*)(&addr)), sizeof(addr)) < 0)
+    {
+        perror("bind(AF_PACKET)");
+        return -1;
+    }
+
+    return 0;
+} /* -- afpacket_port_open -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_afpacket_open
+ *
+ * spec is a comma separated list of iface[=linux iface]. Fills the
+ * interface list like a VNSHWINFO would. Returns 0 on success.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_afpacket_open(struct sr_instance* sr, const char* spec)
+{
+    struct sr_afpacket* afpacket = ((struct sr_afpacket*)(calloc(1, sizeof(struct sr_afpacket))));
+    sr->afpacket = afpacket;
+
+    const char* item = spec;
+    while (*item != '\0')
+    {
+        unsigned int len = strcspn(item, ",");
+        if (afpacket->port_num == AFPACKET_MAX_PORTS)
+        {
+            fprintf(stderr, "More than %d interfaces\n", AFPACKET_MAX_PORTS);
+            return -1;
+        }
+
+        struct sr_afpacket_port* port = &afpacket->ports[afpacket->port_num];
+        const char* equal = ((const char*)(memchr(item, '=', len)));
+        unsigned int name_len = (equal != NULL) ? ((unsigned int)(equal - item)) : len;
+        snprintf(port->name, sizeof(port->name), "%.*s", name_len, item);
+        if (equal != NULL)
+        {
+            snprintf(port->dev, sizeof(port->dev), "%.*s", len - name_len - 1, equal + 1);
+        }
+        else
+        {
+            snprintf(port->dev, sizeof(port->dev), "%s", port->name);
+        }
+
+        if ((afpacket_port_open(sr, port) != 0) ||
+            (sr_event_add_fd(sr, port->fd, afpacket_port_read, port) != 0))
+        {
+            return -1;
+        }
+        afpacket->port_num++;
+
+        item += len;
+        if (*item == ',')
+        {
+            item++;
+        }
+    }
+
+    if (sr->mtu_spec != NULL)
+    {
+        sr_set_mtus(sr, sr->mtu_spec);
+    }
+    if (sr->sched_spec != NULL)
+    {
+        sr_sched_config(sr, sr->sched_spec);
+    }
+    if ((sr->acl_path != NULL) && (sr_acl_reload(sr) != 0))
+    {
+        fprintf(stderr, "*warning* no access control lists\n");
+    }
+    sr_print_if_list(sr);
+
+    /* flag that hardware has been initialized */
+    sr->hw_init = 1;
+
+    return 0;
+} /* -- sr_afpacket_open -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: afpacket_complete_cksum
+ *
+ * A frame sent by the kernel of the other end of a veth may still carry
+ * a partial TCP or UDP checksum (the pseudo header sum only), left for
+ * the hardware; a forwarded frame needs it complete.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void afpacket_complete_cksum(uint8_t* frame, unsigned int len)
+{
+    struct sr_ethernet_hdr* e_hdr = ((struct sr_ethernet_hdr*)(frame));
+    if ((htons(e_hdr->ether_type) != ETHERTYPE_IP) || (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct ip)))
+    {
+        return;
+    }
+
+    struct ip* ip_hdr = ((struct ip*)(frame + sizeof(struct sr_ethernet_hdr)));
+    unsigned int ip_len = ntohs(ip_hdr->ip_len);
+    unsigned int hdr_len = ip_hdr->ip_hl * 4;
+    if ((ip_len > len - sizeof(struct sr_ethernet_hdr)) || (ip_len < hdr_len + 8))
+    {
+        return;
+    }
+
+    uint8_t* l4 = ((uint8_t*)(ip_hdr)) + hdr_len;
+    uint16_t* cksum;
+    if (ip_hdr->ip_p == IP_PROTO_UDP)
+    {
+        cksum = ((uint16_t*)(l4 + 6));
+    }
+    else if ((ip_hdr->ip_p == IP_PROTO_TCP) && (ip_len >= hdr_len + 20))
+    {
+        cksum = ((uint16_t*)(l4 + 16));
+    }
+    else
+    {
+        return;
+    }
+
+    *cksum = calc_cksum(l4, ip_len - hdr_len);
+    if ((*cksum == 0) && (ip_hdr->ip_p == IP_PROTO_UDP))
+    {
+        *cksum = 0xffff;
+    }
+} /* -- afpacket_complete_cksum -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: afpacket_port_read
+ *
+ * Event loop callback of a port, hands every frame waiting on its RX
+ * ring to the router. Returns 1, the same as sr_read_from_server().
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int afpacket_port_read(struct sr_instance* sr, void* arg)
+{
+    struct sr_afpacket_port* port = ((struct sr_afpacket_port*)(arg));
+
+    /* -- every frame the kernel handed over, then the slots go back -- */
+    while (1)
+    {
+        struct tpacket2_hdr* hdr = ((struct tpacket2_hdr*)(port->rx_ring + (port->rx_head * port->frame_size)));
+        if ((__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+        {
+            break;
+        }
+
+        struct sockaddr_ll* from = ((struct sockaddr_ll*)(((uint8_t*)(hdr)) + TPACKET_ALIGN(sizeof(struct tpacket2_hdr))));
+        uint8_t* frame = ((uint8_t*)(hdr)) + hdr->tp_mac;
+        if ((from->sll_pkttype != PACKET_OUTGOING) && (hdr->tp_snaplen >= sizeof(struct sr_ethernet_hdr)))
+        {
+            if (hdr->tp_status & TP_STATUS_CSUMNOTREADY)
+            {
+                afpacket_complete_cksum(frame, hdr->tp_snaplen);
+            }
+            sr_log_packet(sr, frame, hdr->tp_snaplen);
+            sr_handlepacket(sr, frame, hdr->tp_snaplen, port->name);
+        }
+
+        __atomic_store_n(&hdr->tp_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        port->rx_head = (port->rx_head + 1) % AFPACKET_FRAME_NUM;
+    }
+
+    return 1;
+} /* -- afpacket_port_read -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_afpacket_send
+ *
+ * Copies the frame in the next TX slot of the interface and asks the
+ * kernel to send it. Returns -1 if the ring is full.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_afpacket_send(struct sr_instance* sr, uint8_t* buf, unsigned int len, const char* iface)
+{
+    struct sr_afpacket* afpacket = sr->afpacket;
+    struct sr_afpacket_port* port = NULL;
+    for (unsigned int i = 0; i < afpacket->port_num; i++)
+    {
+        if (strncmp(afpacket->ports[i].name, iface, sr_IFACE_NAMELEN) == 0)
+        {
+            port = &afpacket->ports[i];
+            break;
+        }
+    }
+    if ((port == NULL) || (len > port->frame_size - AFPACKET_TX_DATA))
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&port->tx_lock);
+
+    struct tpacket2_hdr* hdr = ((struct tpacket2_hdr*)(port->tx_ring + (port->tx_head * port->frame_size)));
+    if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE)
+    {
+        pthread_mutex_unlock(&port->tx_lock);
+        return -1;
+    }
+
+    memcpy(((uint8_t*)(hdr)) + AFPACKET_TX_DATA, buf, len);
+    hdr->tp_len = len;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    port->tx_head = (port->tx_head + 1) % AFPACKET_FRAME_NUM;
+
+    int ret = send(port->fd, NULL, 0, MSG_DONTWAIT);
+
+    pthread_mutex_unlock(&port->tx_lock);
+
+    if ((ret < 0) && (errno != EAGAIN) && (errno != ENOBUFS))
+    {
+        perror("send(..):sr_afpacket_send");
+        return -1;
+    }
+    return 0;
+} /* -- sr_afpacket_send -- */
+
+
+void sr_afpacket_close(struct sr_instance* sr)
+{
+    struct sr_afpacket* afpacket = sr->afpacket;
+    for (unsigned int i = 0; i < afpacket->port_num; i++)
+    {
+        munmap(afpacket->ports[i].rx_ring, 2 * afpacket->ports[i].ring_size);
+        close(afpacket->ports[i].fd);
+    }
+    free(afpacket);
+    sr->afpacket = NULL;
+} /* -- sr_afpacket_close -- */
@@ -0,0 +1,66 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_afpacket.h
+ *
+ * Description:
+ *
+ * Data plane on Linux interfaces instead of the VNS server. Every router
+ * interface is bound to a Linux interface (a veth or a tap, usually in
+ * a network namespace of its own) through an AF_PACKET socket with
+ * memory mapped TPACKET_V2 RX and TX rings. The interface list is read
+ * from the kernel, and sr_handlepacket()/sr_send_packet() are served on
+ * top of the rings as they are on top of the VNS connection.
+ *
+ *   sr -i eth0=veth1,eth1=veth3,eth2=veth5 -r rtable.empty
+ *
+ * The router interfaces take the names left of the "=", "-i eth0" alone
+ * binds eth0 to the Linux interface of the same name. The address and
+ * mask of each router interface are those of the Linux interface, so
+ * keep the kernel of that namespace from answering in its place:
+ *
+ *   sysctl net.ipv4.ip_forward=0 net.ipv4.icmp_echo_ignore_all=1
+ *   sysctl net.ipv4.conf.all.arp_ignore=8
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_AFPACKET_H
+#define SR_AFPACKET_H
+
+#include <pthread.h>
+#include <net/if.h>
+
+#include "sr_if.h"
+
+#define AFPACKET_MAX_PORTS 16
+#define AFPACKET_FRAME_SIZE 2048       /* smallest slot, doubled until the MTU fits */
+#define AFPACKET_BLOCK_SIZE (64 * 1024)
+#define AFPACKET_FRAME_NUM 512          /* slots per ring whatever their size */
+
+struct sr_instance;
+
+struct sr_afpacket_port
+{
+    char name[sr_IFACE_NAMELEN];    /* router interface */
+    char dev[IFNAMSIZ];             /* Linux interface */
+    int ifindex;
+    int fd;
+
+    unsigned int frame_size;        /* slot size, from the MTU of the Linux interface */
+    size_t ring_size;
+    uint8_t* rx_ring;
+    unsigned int rx_head;
+    uint8_t* tx_ring;
+    unsigned int tx_head;
+    pthread_mutex_t tx_lock;        /* sr_send_packet is called from many threads */
+};
+
+struct sr_afpacket
+{
+    struct sr_afpacket_port ports[AFPACKET_MAX_PORTS];
+    unsigned int port_num;
+};
+
+int sr_afpacket_open(struct sr_instance*, const char*);
+int sr_afpacket_send(struct sr_instance*, uint8_t*, unsigned int, const char*);
+void sr_afpacket_close(struct sr_instance*);
+
+#endif /* -- SR_AFPACKET_H -- */
@@ -0,0 +1,796 @@
+/**********************************************************************
+ * file:  sr_bench.c
+ *
+ * Description:
+ *
+ * Microbenchmarks of the forwarding plane. The router code is linked
+ * against a stub sr_send_packet and a synthetic sr_instance, so no VNS
+ * server is needed. Reports packets per second, nanoseconds and
+ * mallocs per packet for sr_handlepacket, and the cost of the kernels
+ * it is made of (calc_cksum, route lookup, cache_search, chk_ip_addr)
+ * across table sizes. The log levels are off, except for the cases
+ * measuring the logging itself, written to /dev/null. The access
+ * control list cases classify against 10 to 10000 generated rules. The transmit
+ * cases write VNSPACKET commands through sr_txbuf to a socket drained
+ * by another thread, a write per frame or one per batch of frames.
+ *
+ * Usage: sr_bench [milliseconds per case]
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_pwospf.h"
+#include "cache.h"
+#include "queue.h"
+#include "sr_stats.h"
+#include "sr_log.h"
+#include "sr_dumper.h"
+#include "sr_txbuf.h"
+#include "sr_icmp_limit.h"
+#include "sr_acl.h"
+#include "sr_flow.h"
+#include "vnscommand.h"
+
+#define BENCH_PACKET_LEN 98
+
+static long long bench_time_ns = 200000000LL;
+static unsigned long malloc_calls = 0;
+static unsigned long sent_packets = 0;
+static volatile unsigned long bench_sink = 0;
+static int bench_icmp_limit = 0;    /* instances get the default ICMP limits */
+static int bench_acl_rules = 0;     /* instances get an ACL of that many rules */
+
+
+/*---------------------------------------------------------------------
+ * Link time wrapper of malloc (-Wl,--wrap=malloc), counts the
+ * allocations of the code under test.
+ *---------------------------------------------------------------------*/
+
+extern "C" void* __real_malloc(size_t);
+
+extern "C" void* __wrap_malloc(size_t size)
+{
+    malloc_calls++;
+    return __real_malloc(size);
+}
+
+
+/*---------------------------------------------------------------------
+ * Stubs of the VNS connection and of the pwospf subsystem
+ *---------------------------------------------------------------------*/
+
+int sr_send_packet(struct sr_instance* sr, uint8_t* buf, unsigned int len, const char* iface)
+{
+    sent_packets++;
+    bench_sink += buf[len - 1];
+    return 0;
+}
+
+int sr_send_frame(struct sr_instance* sr, uint8_t* buf, unsigned int len, const char* iface)
+{
+    return sr_send_packet(sr, buf, len, iface);
+}
+
+int pwospf_init(struct sr_instance* sr)
+{
+    return 0;
+}
+
+void handling_ospfv2_packets(struct sr_instance* sr, uint8_t* packet, unsigned int length, struct sr_if* rx_if)
+{
+}
+
+void sr_snapshot_start(struct sr_instance* sr)
+{
+}
+
+
+static
+long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)(ts.tv_sec)) * 1000000000LL + ts.tv_nsec;
+}
+
+static
+uint32_t ip_addr(const char* addr)
+{
+    struct in_addr in;
+    inet_aton(addr, &in);
+    return in.s_addr;
+}
+
+
+/*---------------------------------------------------------------------
+ * Method: build_acl
+ *
+ * rule_num rules over 172.16/12 to 192.168/16 with a mix of prefix
+ * lengths, ports and protocols, so they spread over a dozen tuples.
+ * None matches the packets of build_packet() but the last one, which
+ * takes the UDP ones to 192.168.0.1.
+ *
+ *---------------------------------------------------------------------*/
+
+static
+struct sr_acl* build_acl(struct sr_instance* sr, int rule_num)
+{
+    char path[] = "/tmp/sr_bench_acl.XXXXXX";
+    int fd = mkstemp(path);
+    FILE* fp = fdopen(fd, "w");
+    static const int src_lens[] = {32, 24, 16};
+    static const int dst_lens[] = {32, 24};
+
+    for (int i = 0; i < rule_num - 1; i++)
+    {
+        uint32_t src = 0xac100000 + (i * 2654435761u >> 12);     /* 172.16/12 */
+        uint32_t dst = 0xc0a80000 + ((i * 40503u) & 0xffff);     /* 192.168/16 */
+        int src_len = src_lens[i % 3];
+        int dst_len = dst_lens[(i / 3) % 2];
+        fprintf(fp, "%s in proto %s src %d.%d.%d.%d/%d dst %d.%d.%d.%d/%d", (i % 5 == 0) ? "permit" : "deny",
+            (i % 7 == 0) ? "tcp" : "udp", src >> 24, (src >> 16) & 0xff, (src >> 8) & 0xff, src & 0xff, src_len,
+            dst >> 24, (dst >> 16) & 0xff, (dst >> 8) & 0xff, dst & 0xff, dst_len);
+        if (i % 2 == 0)
+        {
+            fprintf(fp, " dport %d", 1024 + (i % 60000));
+        }
+        fprintf(fp, "\n");
+    }
+    fprintf(fp, "permit in proto udp src 10.0.0.0/31 dst 192.168.0.1 dport 53\n");
+    fclose(fp);
+
+    struct sr_acl* acl = sr_acl_load(sr, path);
+    unlink(path);
+    return acl;
+} /* -- build_acl -- */
+
+
+/*---------------------------------------------------------------------
+ * Method: build_instance
+ *
+ * if_num interfaces 10.0.i.1/31 with the neighbor 10.0.i.0 each, the
+ * connected routes, then route_num - 1 filler routes and the route of
+ * 192.168.0.0/31 via eth1 last, so the lookup walks the whole table.
+ * The ARP cache holds cache_num entries with the neighbors at the tail.
+ *
+ *---------------------------------------------------------------------*/
+
+static
+void build_instance(struct sr_instance* sr, int if_num, int route_num, int cache_num)
+{
+    memset(sr, 0, sizeof(struct sr_instance));
+    strcpy(sr->f_interface, "no");
+    sr->ecmp_width = DEFAULT_ECMP_WIDTH;
+    sr_stats_init(sr, NULL);
+    if (bench_icmp_limit)
+    {
+        sr->icmp_limit = sr_icmp_limit_create(NULL);
+    }
+
+    for (int i = 0; i < if_num; i++)
+    {
+        char name[sr_IFACE_NAMELEN];
+        unsigned char mac[ETHER_ADDR_LEN] = {0x00, 0x16, 0x3e, 0x00, 0x00, 0x00};
+        snprintf(name, sizeof(name), "eth%d", i);
+        mac[5] = i + 1;
+
+        sr_add_interface(sr, name);
+        sr_set_ether_addr(sr, mac);
+        sr_set_ether_ip(sr, htonl(0x0a000001 + (i << 8)));   /* 10.0.i.1 */
+        sr_set_ether_mask(sr, htonl(0xfffffffe));
+        sr_get_interface(sr, name)->neighbor_ip = htonl(0x0a000000 + (i << 8));
+    }
+
+    struct in_addr dest, gw, mask;
+    mask.s_addr = htonl(0xfffffffe);
+    gw.s_addr = 0;
+    for (struct sr_if* iface = sr->if_list; iface != NULL; iface = iface->next)
+    {
+        dest.s_addr = iface->ip & mask.s_addr;
+        sr_add_rt_entry(sr, dest, gw, mask, iface->name, 1);
+    }
+    for (int i = 0; i < route_num - 1; i++)
+    {
+        dest.s_addr = htonl(0xac100000 + (i << 1));            /* 172.16.x.y */
+        sr_add_rt_entry(sr, dest, gw, mask, (char*)"eth2", 110);
+    }
+    dest.s_addr = ip_addr("192.168.0.0");
+    gw.s_addr = ip_addr("10.0.1.0");
+    sr_add_rt_entry(sr, dest, gw, mask, (char*)"eth1", 110);
+
+
+    /* cache_push() pushes at the head, the real entries end up last */
+    unsigned char mac[ETHER_ADDR_LEN] = {0x00, 0x16, 0x3e, 0xff, 0x00, 0x00};
+    sr->arp_cache = cache_create_item(0, mac, 0);
+    for (int i = 0; i < 3; i++)
+    {
+        mac[5] = i + 1;
+        cache_push(sr->arp_cache, cache_create_item(htonl(0x0a000000 + (i << 8)), mac, ((uint64_t)(-1))));
+    }
+    for (int i = 0; i < cache_num - 3; i++)
+    {
+        cache_push(sr->arp_cache, cache_create_item(htonl(0xac200000 + i), mac, ((uint64_t)(-1))));
+    }
+
+    if (bench_acl_rules > 0)
+    {
+        sr->acl = build_acl(sr, bench_acl_rules);
+    }
+} /* -- build_instance -- */
+
+static
+void free_instance(struct sr_instance* sr)
+{
+    while (sr->routing_table != NULL)
+    {
+        struct sr_rt* entry = sr->routing_table;
+        sr->routing_table = entry->next;
+        free(entry);
+    }
+    while (sr->if_list != NULL)
+    {
+        struct sr_if* iface = sr->if_list;
+        sr->if_list = iface->next;
+        free(iface->packet_queue);
+        free(iface);
+    }
+    while (sr->arp_cache != NULL)
+    {
+        struct cache_item* item = sr->arp_cache;
+        sr->arp_cache = item->next_item;
+        free(item);
+    }
+    free(sr->stats);
+    if (sr->icmp_limit != NULL)
+    {
+        sr_icmp_limit_destroy(sr->icmp_limit);
+    }
+    if (sr->acl != NULL)
+    {
+        sr_acl_destroy(sr->acl);
+    }
+} /* -- free_instance -- */
+
+
+/*---------------------------------------------------------------------
+ * Method: build_packet
+ *
+ * An IP packet from the host behind eth0 with a valid checksum, the
+ * payload is an ICMP header (echo request) or a UDP header. A proto of 0
+ * gives a broadcast ARP request for dst instead.
+ *
+ *---------------------------------------------------------------------*/
+
+static
+void build_packet(struct sr_instance* sr, uint8_t* packet, uint8_t proto, uint32_t dst)
+{
+    memset(packet, 0xa5, BENCH_PACKET_LEN);
+
+    struct sr_if* eth0 = sr_get_interface(sr, "eth0");
+    struct sr_ethernet_hdr* e_hdr = ((sr_ethernet_hdr*)(packet));
+    for (int i = 0; i < ETHER_ADDR_LEN; i++)
+    {
+        e_hdr->ether_dhost[i] = eth0->addr[i];
+        e_hdr->ether_shost[i] = 0x42;
+    }
+    e_hdr->ether_type = htons(ETHERTYPE_IP);
+
+    if (proto == 0)
+    {
+        struct sr_arphdr* arp_hdr = ((sr_arphdr*)(packet + sizeof(sr_ethernet_hdr)));
+        memset(e_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN);
+        e_hdr->ether_type = htons(ETHERTYPE_ARP);
+        arp_hdr->ar_hrd = htons(ARPHDR_ETHER);
+        arp_hdr->ar_pro = htons(ETHERTYPE_IP);
+        arp_hdr->ar_hln = ETHER_ADDR_LEN;
+        arp_hdr->ar_pln = 4;
+        arp_hdr->ar_op = htons(ARP_REQUEST);
+        memset(arp_hdr->ar_sha, 0x42, ETHER_ADDR_LEN);
+        arp_hdr->ar_sip = eth0->neighbor_ip;
+        memset(arp_hdr->ar_tha, 0, ETHER_ADDR_LEN);
+        arp_hdr->ar_tip = dst;
+        return;
+    }
+
+    struct ip* ip_hdr = ((ip*)(packet + sizeof(sr_ethernet_hdr)));
+    ip_hdr->ip_v = 4;
+    ip_hdr->ip_hl = 5;
+    ip_hdr->ip_tos = 0;
+    ip_hdr->ip_len = htons(BENCH_PACKET_LEN - sizeof(sr_ethernet_hdr));
+    ip_hdr->ip_id = htons(1);
+    ip_hdr->ip_off = 0;
+    ip_hdr->ip_ttl = 64;
+    ip_hdr->ip_p = proto;
+    ip_hdr->ip_src.s_addr = eth0->neighbor_ip;
+    ip_hdr->ip_dst.s_addr = dst;
+    ip_hdr->ip_sum = 0;
+    ip_hdr->ip_sum = calc_cksum(((uint8_t*)(ip_hdr)), sizeof(ip));
+
+    uint8_t* l4 = packet + sizeof(sr_ethernet_hdr) + sizeof(ip);
+    if (proto == IP_PROTO_ICMP)
+    {
+        struct sr_icmphdr* icmp_hdr = ((sr_icmphdr*)(l4));
+        icmp_hdr->type = ICMP_ECHO_REQUEST_TYPE;
+        icmp_hdr->code = ICMP_ECHO_REQUEST_CODE;
+        icmp_hdr->cksum = 0;
+        icmp_hdr->cksum = calc_cksum(l4, BENCH_PACKET_LEN - sizeof(sr_ethernet_hdr) - sizeof(ip));
+    }
+    else
+    {
+        l4[0] = 0x30; l4[1] = 0x39;     /* 12345 */
+        l4[2] = 0x00; l4[3] = 0x35;     /* 53 */
+    }
+} /* -- build_packet -- */
+
+
+/*---------------------------------------------------------------------
+ * Method: bench_handlepacket
+ *
+ * The packet is copied back before every call since forwarding
+ * rewrites it in place, the copy is part of the figures.
+ *
+ *---------------------------------------------------------------------*/
+
+static
+void bench_handlepacket(const char* name, int route_num, int cache_num, uint8_t proto, const char* dst)
+{
+    struct sr_instance sr;
+    build_instance(&sr, 3, route_num, cache_num);
+
+    uint8_t packet[BENCH_PACKET_LEN];
+    uint8_t buf[BENCH_PACKET_LEN];
+    build_packet(&sr, packet, proto, ip_addr(dst));
+
+    unsigned long packets = 0;
+    unsigned long mallocs = malloc_calls;
+    unsigned long sent = sent_packets;
+    long long start = now_ns();
+    long long elapsed;
+    do
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            memcpy(buf, packet, BENCH_PACKET_LEN);
+            sr_handlepacket(&sr, buf, BENCH_PACKET_LEN, (char*)"eth0");
+        }
+        packets += 256;
+        elapsed = now_ns() - start;
+    } while (elapsed < bench_time_ns);
+    mallocs = malloc_calls - mallocs;
+    sent = sent_packets - sent;
+
+    printf("  %-24s %7d %7d %12.0f %10.1f %10.2f %8.2f\n", name, route_num, cache_num,
+        packets * 1e9 / elapsed, ((double)(elapsed)) / packets, ((double)(mallocs)) / packets, ((double)(sent)) / packets);
+
+    free_instance(&sr);
+} /* -- bench_handlepacket -- */
+
+
+/*---------------------------------------------------------------------
+ * Method: bench_kernel
+ *
+ * Runs one kernel through the given function until the time is up and
+ * prints the nanoseconds per call. Returns the number of calls.
+ *
+ *---------------------------------------------------------------------*/
+
+struct bench_kernel_param
+{
+    struct sr_instance* sr;
+    uint8_t* buf;
+    int len;
+    uint32_t addr;
+    struct sr_dump* dump;
+    struct sr_acl* acl;
+    int flows;
+};
+
+static
+unsigned long bench_kernel(const char* name, int size, unsigned long (*kernel)(struct bench_kernel_param*), struct bench_kernel_param* param)
+{
+    unsigned long calls = 0;
+    unsigned long mallocs = malloc_calls;
+    long long start = now_ns();
+    long long elapsed;
+    do
+    {
+        for (int i = 0; i < 1024; i++)
+        {
+            bench_sink += kernel(param);
+        }
+        calls += 1024;
+        elapsed = now_ns() - start;
+    } while (elapsed < bench_time_ns);
+    mallocs = malloc_calls - mallocs;
+
+    printf("  %-24s %7d %12.1f %10.2f\n", name, size, ((double)(elapsed)) / calls, ((double)(mallocs)) / calls);
+    return calls;
+} /* -- bench_kernel -- */
+
+
+/*---------------------------------------------------------------------
+ * Method: bench_kernel_paced
+ *
+ * As bench_kernel, but calls the kernel at most pps times a second and
+ * only counts the time spent in it: the cost of handing work to a thread
+ * at a rate that thread keeps up with.
+ *
+ *---------------------------------------------------------------------*/
+
+static
+unsigned long bench_kernel_paced(const char* name, int size, unsigned long (*kernel)(struct bench_kernel_param*), struct bench_kernel_param* param,
+    long long pps)
+{
+    unsigned long calls = 0;
+    unsigned long mallocs = malloc_calls;
+    long long busy = 0;
+    long long start = now_ns();
+    long long now = start;
+    while (now - start < bench_time_ns)
+    {
+        long long begin = now_ns();
+        for (int i = 0; i < 64; i++)
+        {
+            bench_sink += kernel(param);
+        }
+        now = now_ns();
+        busy += now - begin;
+        calls += 64;
+
+        long long next = start + ((long long)(calls)) * 1000000000LL / pps;
+        while (now < next)
+        {
+            now = now_ns();
+        }
+    }
+    mallocs = malloc_calls - mallocs;
+
+    printf("  %-24s %7d %12.1f %10.2f\n", name, size, ((double)(busy)) / calls, ((double)(mallocs)) / calls);
+    return calls;
+} /* -- bench_kernel_paced -- */
+
+static
+unsigned long kernel_cksum(struct bench_kernel_param* param)
+{
+    return calc_cksum(param->buf, param->len);
+}
+
+static
+unsigned long kernel_lookup(struct bench_kernel_param* param)
+{
+    struct in_addr dst;
+    dst.s_addr = param->addr;
+    return ((unsigned long)(sr_lookup_rt(param->sr, dst)));
+}
+
+static
+unsigned long kernel_cache_search(struct bench_kernel_param* param)
+{
+    return ((unsigned long)(cache_search(param->sr->arp_cache, param->addr)));
+}
+
+static
+unsigned long kernel_chk_ip_addr(struct bench_kernel_param* param)
+{
+    return chk_ip_addr(((ip*)(param->buf + sizeof(sr_ethernet_hdr))), param->sr);
+}
+
+static
+unsigned long kernel_stats_record(struct bench_kernel_param* param)
+{
+    param->addr = (param->addr * 1103515245) + 12345;
+    sr_stats_record(param->sr, HIST_ARP_RESOLVE, param->addr % 1000000);
+    return 0;
+}
+
+static
+unsigned long kernel_stats_record_since(struct bench_kernel_param* param)
+{
+    sr_stats_record_since(param->sr, HIST_ARP_RESOLVE, sr_stats_now() - 1000);
+    return 0;
+}
+
+/* -- -l capture as it was, synchronous write and flush of each packet -- */
+static
+unsigned long kernel_dump_sync(struct bench_kernel_param* param)
+{
+    struct pcap_pkthdr h;
+    gettimeofday(&h.ts, 0);
+    h.caplen = param->len;
+    h.len = param->len;
+    sr_dump(param->dump->fp, &h, param->buf);
+    fflush(param->dump->fp);
+    return 0;
+}
+
+static
+unsigned long kernel_dump_ring(struct bench_kernel_param* param)
+{
+    return sr_dump_packet(param->dump, param->buf, param->len);
+}
+
+static
+unsigned long kernel_acl_classify(struct bench_kernel_param* param)
+{
+    return sr_acl_classify(param->acl, ACL_IN, param->sr->if_list, ((ip*)(param->buf + sizeof(sr_ethernet_hdr))),
+        BENCH_PACKET_LEN - sizeof(sr_ethernet_hdr));
+}
+
+/* -- packets of flows distinct by source address, round robin -- */
+static
+unsigned long kernel_flow_update(struct bench_kernel_param* param)
+{
+    ip* ip_hdr = ((ip*)(param->buf + sizeof(sr_ethernet_hdr)));
+    param->addr = (param->addr + 1) % param->flows;
+    ip_hdr->ip_src.s_addr = htonl(0x0b000000 + param->addr);
+    sr_flow_update(param->sr, param->sr->if_list, param->sr->if_list->next, ip_hdr,
+        BENCH_PACKET_LEN - sizeof(sr_ethernet_hdr));
+    return 0;
+}
+
+static
+unsigned long kernel_log(struct bench_kernel_param* param)
+{
+    Log(LOG_FWD, LOG_DEBUG, "ARP Cache entry found, [%I, %M]", param->addr, param->buf);
+    return 0;
+}
+
+
+/*---------------------------------------------------------------------
+ * Method: bench_tx
+ *
+ * Sends BENCH_PACKET_LEN byte frames as fast as the socket takes them,
+ * flushed every batch frames. The reader thread parses the commands
+ * back and measures the delay of each frame from its append, which
+ * includes the wait for the rest of its batch.
+ *
+ *---------------------------------------------------------------------*/
+
+struct bench_tx_reader
+{
+    int fd;
+    unsigned long frames;
+    long long delay_sum;
+    long long delay_max;
+};
+
+static
+void* bench_tx_read(void* arg)
+{
+    struct bench_tx_reader* reader = ((struct bench_tx_reader*)(arg));
+    static uint8_t buf[256 * 1024];
+    unsigned int len = 0;
+    int ret;
+
+    while ((ret = read(reader->fd, buf + len, sizeof(buf) - len)) > 0)
+    {
+        long long now = now_ns();
+        len += ret;
+
+        unsigned int off = 0;
+        while (len - off >= sizeof(c_packet_header))
+        {
+            unsigned int cmd_len = ntohl(((c_packet_header*)(buf + off))->mLen);
+            if (len - off < cmd_len)
+            {
+                break;
+            }
+            long long sent;
+            memcpy(&sent, buf + off + sizeof(c_packet_header), sizeof(sent));
+            reader->frames++;
+            reader->delay_sum += now - sent;
+            if (now - sent > reader->delay_max)
+            {
+                reader->delay_max = now - sent;
+            }
+            off += cmd_len;
+        }
+        memmove(buf, buf + off, len - off);
+        len -= off;
+    }
+    return NULL;
+} /* -- bench_tx_read -- */
+
+static
+void bench_tx(const char* name, int batch)
+{
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+    struct bench_tx_reader reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.fd = fds[1];
+    pthread_t thread;
+    pthread_create(&thread, NULL, bench_tx_read, &reader);
+
+    struct sr_txbuf* txbuf = sr_txbuf_create(fds[0], TXBUF_SIZE);
+    uint8_t frame[BENCH_PACKET_LEN];
+    memset(frame, 0x5a, sizeof(frame));
+    unsigned int syscalls = 0;
+    unsigned long frames = 0;
+
+    long long start = now_ns();
+    long long elapsed;
+    do
+    {
+        for (int i = 0; i < batch; i++)
+        {
+            long long now = now_ns();
+            memcpy(frame, &now, sizeof(now));
+            sr_txbuf_append(txbuf, frame, sizeof(frame), "eth0", &syscalls);
+        }
+        sr_txbuf_flush(txbuf, &syscalls);
+        frames += batch;
+        elapsed = now_ns() - start;
+    } while (elapsed < bench_time_ns);
+
+    shutdown(fds[0], SHUT_WR);
+    pthread_join(thread, NULL);
+    elapsed = now_ns() - start;
+    sr_txbuf_destroy(txbuf);
+    close(fds[0]);
+    close(fds[1]);
+
+    printf("  %-24s %7d %12.0f %10.1f %10.3f %10.1f %10.1f\n", name, batch, frames * 1e9 / elapsed, ((double)(elapsed)) / frames,
+        ((double)(syscalls)) / frames, reader.delay_sum / 1000.0 / reader.frames, reader.delay_max / 1000.0);
+} /* -- bench_tx -- */
+
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        bench_time_ns = atoll(argv[1]) * 1000000LL;
+    }
+
+    int sizes[] = {1, 16, 256, 4096};
+    int sizes_num = sizeof(sizes) / sizeof(sizes[0]);
+
+    sr_log_init("none", fopen("/dev/null", "w"));
+
+
+    printf("sr_handlepacket, %d byte packets\n", BENCH_PACKET_LEN);
+    printf("  %-24s %7s %7s %12s %10s %10s %8s\n", "case", "routes", "arp", "pps", "ns/pkt", "allocs/pkt", "tx/pkt");
+    for (int i = 0; i < sizes_num; i++)
+    {
+        bench_handlepacket("udp forward", sizes[i], 3, IP_PROTO_UDP, "192.168.0.1");
+    }
+    for (int i = 0; i < sizes_num; i++)
+    {
+        bench_handlepacket("udp forward", 16, sizes[i] + 3, IP_PROTO_UDP, "192.168.0.1");
+    }
+    bench_handlepacket("icmp echo request", 16, 3, IP_PROTO_ICMP, "10.0.0.1");
+    bench_handlepacket("arp request", 16, 3, 0, "10.0.0.1");
+    bench_handlepacket("udp to router", 16, 3, IP_PROTO_UDP, "10.0.0.1");
+    bench_icmp_limit = 1;
+    bench_handlepacket("udp to router, limited", 16, 3, IP_PROTO_UDP, "10.0.0.1");
+    bench_icmp_limit = 0;
+    bench_acl_rules = 10000;
+    bench_handlepacket("udp forward, acl", 16, 3, IP_PROTO_UDP, "192.168.0.1");
+    bench_acl_rules = 0;
+    sr_log_set("fwd=debug,arp=debug");
+    bench_handlepacket("udp forward, debug log", 16, 3, IP_PROTO_UDP, "192.168.0.1");
+    sr_log_set("none");
+
+
+    printf("\nkernels\n");
+    printf("  %-24s %7s %12s %10s\n", "case", "size", "ns/call", "allocs");
+
+    struct bench_kernel_param param;
+    uint8_t buf[1500];
+    memset(buf, 0x5a, sizeof(buf));
+    param.buf = buf;
+    int lens[] = {20, 64, 576, 1500};
+    for (int i = 0; i < 4; i++)
+    {
+        param.len = lens[i];
+        bench_kernel("calc_cksum", lens[i], kernel_cksum, &param);
+    }
+
+    for (int i = 0; i < sizes_num; i++)
+    {
+        struct sr_instance sr;
+        build_instance(&sr, 3, sizes[i], sizes[i] + 3);
+        param.sr = &sr;
+
+        param.addr = ip_addr("192.168.0.1");
+        bench_kernel("route lookup, last", sizes[i], kernel_lookup, &param);
+        param.addr = ip_addr("10.0.0.0");
+        bench_kernel("route lookup, first", sizes[i], kernel_lookup, &param);
+        param.addr = ip_addr("10.0.1.0");
+        bench_kernel("cache_search, hit last", sizes[i], kernel_cache_search, &param);
+        param.addr = ip_addr("10.9.9.9");
+        bench_kernel("cache_search, miss", sizes[i], kernel_cache_search, &param);
+
+        free_instance(&sr);
+    }
+
+    int if_nums[] = {3, 16, 64};
+    for (int i = 0; i < 3; i++)
+    {
+        struct sr_instance sr;
+        build_instance(&sr, if_nums[i], 1, 3);
+        build_packet(&sr, buf, IP_PROTO_UDP, ip_addr("192.168.0.1"));
+        param.sr = &sr;
+        bench_kernel("chk_ip_addr, not ours", if_nums[i], kernel_chk_ip_addr, &param);
+        free_instance(&sr);
+    }
+
+    int rule_nums[] = {10, 100, 1000, 10000};
+    for (int i = 0; i < 4; i++)
+    {
+        struct sr_instance sr;
+        build_instance(&sr, 3, 1, 3);
+        param.sr = &sr;
+        param.acl = build_acl(&sr, rule_nums[i]);
+        build_packet(&sr, buf, IP_PROTO_UDP, ip_addr("192.168.0.1"));
+        bench_kernel("acl, last rule", rule_nums[i], kernel_acl_classify, &param);
+        build_packet(&sr, buf, IP_PROTO_UDP, ip_addr("192.168.7.7"));
+        bench_kernel("acl, no match", rule_nums[i], kernel_acl_classify, &param);
+        sr_acl_destroy(param.acl);
+        free_instance(&sr);
+    }
+
+    struct sr_instance sr;
+    build_instance(&sr, 3, 1, 3);
+    param.sr = &sr;
+    param.addr = 0;
+    bench_kernel("histogram record", 1, kernel_stats_record, &param);
+    bench_kernel("histogram record + clock", 1, kernel_stats_record_since, &param);
+    param.dump = sr_dump_start("/dev/null", PACKET_DUMP_SIZE, 0, 0);
+    param.len = BENCH_PACKET_LEN;
+    bench_kernel("pcap, sync write", BENCH_PACKET_LEN, kernel_dump_sync, &param);
+    uint64_t drops = sr_dump_drops(param.dump);
+    unsigned long calls = bench_kernel_paced("pcap, ring, 1 Mpps", BENCH_PACKET_LEN, kernel_dump_ring, &param, 1000000);
+    drops = sr_dump_drops(param.dump) - drops;
+    printf("  %-24s %7s %11.1f%%\n", "pcap, ring full drops", "", 100.0 * drops / calls);
+    drops = sr_dump_drops(param.dump);
+    calls = bench_kernel("pcap, ring, saturated", BENCH_PACKET_LEN, kernel_dump_ring, &param);
+    drops = sr_dump_drops(param.dump) - drops;
+    sr_dump_stop(param.dump);
+    printf("  %-24s %7s %11.1f%%\n", "pcap, ring full drops", "", 100.0 * drops / calls);
+    bench_kernel("log, disabled", 1, kernel_log, &param);
+    sr_log_set("fwd=debug");
+    bench_kernel("log, enabled", 1, kernel_log, &param);
+    sr_log_set("none");
+
+    /* -- past FLOW_SHARDS * FLOW_BUCKETS * FLOW_WAYS flows every update evicts -- */
+    sr_event_init(&sr);
+    sr.flows = sr_flow_start(&sr, "/dev/null", FLOW_IDLE_TIMEOUT, FLOW_ACTIVE_TIMEOUT, 1);
+    build_packet(&sr, buf, IP_PROTO_UDP, ip_addr("192.168.0.1"));
+    int flow_nums[] = {1, 1024, 65536, 1048576};
+    for (int i = 0; i < 4; i++)
+    {
+        param.flows = flow_nums[i];
+        param.addr = 0;
+        bench_kernel("flow update", flow_nums[i], kernel_flow_update, &param);
+    }
+    sr_flow_stop(sr.flows);
+    sr.flows = NULL;
+    sr_event_destroy(&sr);
+    free_instance(&sr);
+
+
+    printf("\nVNS transmit, %d byte frames to a socket\n", BENCH_PACKET_LEN);
+    printf("  %-24s %7s %12s %10s %10s %10s %10s\n", "case", "batch", "frames/s", "ns/frame", "writes", "delay us", "max us");
+    bench_tx("write per frame", 1);
+    int batches[] = {8, 64, 512};
+    for (int i = 0; i < 3; i++)
+    {
+        bench_tx("coalesced", batches[i]);
+    }
+
+    return 0;
+}
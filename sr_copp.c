@@ -0,0 +1,271 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_copp.c
+ *
+ * Description:
+ *
+ * Token buckets in front of the packets punted to the router, see sr_copp.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <netinet/in.h>
+
+#include "sr_copp.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "pwospf_protocol.h"
+#include "sr_stats.h"
+#include "sr_event.h"
+#include "sr_if.h"
+
+static const char* copp_names[COPP_KIND_NUM] =
+{
+    "arp",
+    "icmp",
+    "hello",
+    "lsu",
+    "local",
+    "neighbor"
+};
+
+
+/*-----------------------------------------------------------------------------
+ * Method: copp_parse
+ *
+ * Applies a list of kind=rate/burst, or "off", to the limits. Returns 0
+ * or -1 if the list does not parse, the limits are then left half set.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int copp_parse(struct sr_copp* copp, const char* spec)
+{
+    const char* item = spec;
+    while (*item != '\0')
+    {
+        unsigned int len = strcspn(item, ",");
+        const char* equal = ((const char*)(memchr(item, '=', len)));
+
+        if ((equal == NULL) && (len == 3) && (strncmp(item, "off", 3) == 0))
+        {
+            memset(copp->rate, 0, sizeof(copp->rate));
+        }
+        else
+        {
+            int kind = -1;
+            for (int i = 0; (equal != NULL) && (i < COPP_KIND_NUM); i++)
+            {
+                if ((strlen(copp_names[i]) == ((unsigned int)(equal - item))) &&
+                    (strncmp(copp_names[i], item, equal - item) == 0))
+                {
+                    kind = i;
+                }
+            }
+            if (kind < 0)
+            {
+                return -1;
+            }
+
+            char* end;
+            unsigned long rate = strtoul(equal + 1, &end, 10);
+            unsigned long burst = rate;
+            if (*end == '/')
+            {
+                burst = strtoul(end + 1, &end, 10);
+            }
+            if ((end != item + len) || ((burst == 0) && (rate != 0)))
+            {
+                return -1;
+            }
+            copp->rate[kind] = rate;
+            copp->burst[kind] = burst;
+        }
+
+        item += len;
+        if (*item == ',')
+        {
+            item++;
+        }
+    }
+    return 0;
+} /* -- copp_parse -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_copp_create
+ *
+ * The limits of COPP_DEFAULT, changed by spec if not NULL. Returns NULL
+ * if spec does not parse.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_copp* sr_copp_create(const char* spec)
+{
+    struct sr_copp* copp = ((struct sr_copp*)(calloc(1, sizeof(struct sr_copp))));
+
+    copp_parse(copp, COPP_DEFAULT);
+    if ((spec != NULL) && (copp_parse(copp, spec) != 0))
+    {
+        free(copp);
+        return NULL;
+    }
+
+    /* -- buckets start full -- */
+    uint64_t now = sr_timer_now();
+    for (int i = 0; i < COPP_KIND_NUM; i++)
+    {
+        copp->buckets[i].tokens = ((uint64_t)(copp->burst[i])) * 1000;
+        copp->buckets[i].last = now;
+    }
+    pthread_mutex_init(&copp->lock, NULL);
+    return copp;
+} /* -- sr_copp_create -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: copp_take
+ *
+ * Refills the bucket of kind with what was earned since the last refill,
+ * up to the burst, and takes a token from it. Returns 1 if there was one.
+ * Called with the lock held.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int copp_take(struct sr_copp* copp, int kind, uint64_t now)
+{
+    if (copp->rate[kind] == 0)
+    {
+        return 1;
+    }
+
+    struct sr_copp_bucket* bucket = &copp->buckets[kind];
+    if (now > bucket->last)
+    {
+        /* -- rate per second is rate thousandths per ms -- */
+        bucket->tokens += (now - bucket->last) * copp->rate[kind];
+        if (bucket->tokens > ((uint64_t)(copp->burst[kind])) * 1000)
+        {
+            bucket->tokens = ((uint64_t)(copp->burst[kind])) * 1000;
+        }
+    }
+    bucket->last = now;
+
+    if (bucket->tokens < 1000)
+    {
+        return 0;
+    }
+    bucket->tokens -= 1000;
+    return 1;
+} /* -- copp_take -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: copp_classify
+ *
+ * The kind of a packet for the router, sets *known if it is OSPF from the
+ * neighbor of rx_if.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int copp_classify(struct sr_if* rx_if, uint8_t* packet, unsigned int len, int* known)
+{
+    struct sr_ethernet_hdr* e_hdr = ((sr_ethernet_hdr*)(packet));
+    *known = 0;
+
+    if (ntohs(e_hdr->ether_type) == ETHERTYPE_ARP)
+    {
+        return COPP_ARP;
+    }
+
+    struct ip* ip_hdr = ((ip*)(packet + sizeof(sr_ethernet_hdr)));
+    if (ip_hdr->ip_p == IP_PROTO_ICMP)
+    {
+        return COPP_ICMP;
+    }
+    if ((ip_hdr->ip_p != IP_PROTO_OSPFv2) || (len < sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr)))
+    {
+        return COPP_LOCAL;
+    }
+
+    /* -- the router id of an LSU is that of the router it originated from,
+     *    the neighbor relaying it is only known by its address -- */
+    struct ospfv2_hdr* ospf_hdr = ((struct ospfv2_hdr*)(packet + sizeof(sr_ethernet_hdr) + sizeof(ip)));
+    *known = (rx_if->neighbor_id != 0) && (ip_hdr->ip_src.s_addr == rx_if->neighbor_ip);
+    if (ospf_hdr->type == OSPF_TYPE_HELLO)
+    {
+        *known = *known && (ospf_hdr->rid == rx_if->neighbor_id);
+        return COPP_HELLO;
+    }
+    if (ospf_hdr->type == OSPF_TYPE_LSU)
+    {
+        return COPP_LSU;
+    }
+    return COPP_LOCAL;
+} /* -- copp_classify -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_copp_police
+ *
+ * Takes the token for a packet received on rx_if for the router itself.
+ * Returns 1 if it may be processed, 0 if it was counted and is to be
+ * dropped. Without limits (sr->copp NULL) every packet passes.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_copp_police(struct sr_instance* sr, struct sr_if* rx_if, uint8_t* packet, unsigned int len)
+{
+    struct sr_copp* copp = sr->copp;
+    if (copp == NULL)
+    {
+        return 1;
+    }
+
+    int known;
+    int kind = copp_classify(rx_if, packet, len, &known);
+    uint64_t now = sr_timer_now();
+    if (known && (kind == COPP_LSU) && (now < rx_if->copp_sync))
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&copp->lock);
+    int pass = (known && copp_take(copp, COPP_NEIGHBOR, now)) || copp_take(copp, kind, now);
+    pthread_mutex_unlock(&copp->lock);
+
+    if (!pass)
+    {
+        sr_stats_inc(sr, ((enum sr_stats_counter)(STATS_DROP_COPP_ARP + kind)));
+    }
+    return pass;
+} /* -- sr_copp_police -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_copp_sync
+ *
+ * The adjacency on rx_if just came up, the LSUs of the neighbor pass for
+ * COPP_SYNC_MS.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_copp_sync(struct sr_if* rx_if)
+{
+    rx_if->copp_sync = sr_timer_now() + COPP_SYNC_MS;
+} /* -- sr_copp_sync -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_copp_destroy
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_copp_destroy(struct sr_copp* copp)
+{
+    pthread_mutex_destroy(&copp->lock);
+    free(copp);
+} /* -- sr_copp_destroy -- */
@@ -0,0 +1,76 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_copp.h
+ *
+ * Description:
+ *
+ * Control plane policing of the packets the router takes for itself. ARP,
+ * ICMP to the router, OSPF and the TCP and UDP it answers with port
+ * unreachable are all handled on the thread receiving, so a flood of any
+ * of them would stall forwarding and the adjacencies with it. Each packet
+ * punted to the router must get a token from the bucket of its kind,
+ * before any of its processing, or is dropped and counted
+ * (drop_copp_<kind>).
+ *
+ * OSPF from the neighbor known on the interface it arrives on (address
+ * of its hellos, and router id for a hello) is charged to the neighbor
+ * bucket first and only falls back to the hello or lsu bucket once that
+ * is empty, so a flood of OSPF from elsewhere does not take the
+ * adjacencies down. A new neighbor sends its whole LSDB at once, one LSU
+ * per router and never again until the refreshes: for COPP_SYNC_MS after
+ * the adjacency comes up its LSUs are not policed, so the sync of an
+ * LSDB larger than the bursts is not cut short.
+ *
+ * The limits are given with -P as a comma separated list of kind=rate/burst,
+ * in packets per second and packets, e.g. arp=200/50,lsu=1000/300. The
+ * kinds are arp, icmp, hello, lsu, local (TCP, UDP and anything else to
+ * the router) and neighbor. "off" lifts all the limits.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_COPP_H
+#define SR_COPP_H
+
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#define COPP_DEFAULT "arp=500/100,icmp=500/100,hello=50/20,lsu=500/200,local=100/20,neighbor=1000/400"
+#define COPP_SYNC_MS 2000
+
+/* -- in the order of the drop_copp_ counters, neighbor has none -- */
+enum sr_copp_kind
+{
+    COPP_ARP,
+    COPP_ICMP,
+    COPP_HELLO,
+    COPP_LSU,
+    COPP_LOCAL,
+    COPP_NEIGHBOR,
+    COPP_KIND_NUM
+};
+
+struct sr_copp_bucket
+{
+    uint64_t tokens;            /* thousandths of a packet */
+    uint64_t last;              /* ms of the last refill */
+};
+
+struct sr_copp
+{
+    pthread_mutex_t lock;
+    uint32_t rate[COPP_KIND_NUM];       /* packets per second, 0 for no limit */
+    uint32_t burst[COPP_KIND_NUM];
+    struct sr_copp_bucket buckets[COPP_KIND_NUM];
+};
+
+struct sr_instance;
+struct sr_if;
+
+struct sr_copp* sr_copp_create(const char*);
+int sr_copp_police(struct sr_instance*, struct sr_if*, uint8_t*, unsigned int);
+void sr_copp_sync(struct sr_if*);
+void sr_copp_destroy(struct sr_copp*);
+
+#endif /* -- SR_COPP_H -- */
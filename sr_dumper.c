@@ -2,7 +2,14 @@
 #include <sys/types.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include "sr_dumper.h"
+#include "sr_ring.h"
 
 static void
 sf_write_header(FILE *fp, int linktype, int thiszone, int snaplen)
@@ -69,3 +76,262 @@ sr_dump_close(FILE *fp)
   fclose(fp);
 }
 
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_dump_start
+ *
+ * Opens the first file and starts the writer thread. Returns NULL if the
+ * file cannot be opened.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int dump_open(struct sr_dump* dump)
+{
+    char name[sizeof(dump->fname) + 16];
+    if (dump->file_num == 0)
+    {
+        snprintf(name, sizeof(name), "%s", dump->fname);
+    }
+    else
+    {
+        snprintf(name, sizeof(name), "%s.%u", dump->fname, dump->file_num);
+    }
+
+    dump->fp = sr_dump_open(name, 0, dump->snaplen);
+    if (dump->fp == NULL)
+    {
+        return -1;
+    }
+    /* -- the batches are the buffering, one write each -- */
+    setvbuf(dump->fp, NULL, _IONBF, 0);
+    dump->file_bytes = sizeof(struct pcap_file_header);
+    dump->file_opened = time(NULL);
+    return 0;
+}
+
+struct sr_dump* sr_dump_start(const char* fname, int snaplen, unsigned long rotate_bytes, unsigned int rotate_secs)
+{
+    struct sr_dump* dump = (struct sr_dump*)(calloc(1, sizeof(struct sr_dump)));
+    snprintf(dump->fname, sizeof(dump->fname), "%s", fname);
+    dump->snaplen = snaplen;
+    if (strcmp(fname, "-") != 0)
+    {
+        dump->rotate_bytes = rotate_bytes;
+        dump->rotate_secs = rotate_secs;
+    }
+
+    dump->ring = sr_ring_create(DUMP_RING_SLOTS, sizeof(struct pcap_sf_pkthdr) + snaplen);
+    dump->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((dump->ring == NULL) || (dump->efd < 0) || (dump_open(dump) != 0))
+    {
+        if (dump->ring != NULL)
+        {
+            sr_ring_destroy(dump->ring);
+        }
+        if (dump->efd >= 0)
+        {
+            close(dump->efd);
+        }
+        free(dump);
+        return NULL;
+    }
+
+    pthread_create(&dump->thread, NULL, sr_dump_thread, dump);
+    return dump;
+} /* -- sr_dump_start -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_dump_packet
+ *
+ * Called from the packet path, copies the packet into the ring and wakes
+ * the writer if DUMP_WAKE_SLOTS records wait for it. Returns -1 if the
+ * ring is full and the packet is not captured.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_dump_packet(struct sr_dump* dump, const uint8_t* buf, unsigned int len)
+{
+    struct pcap_sf_pkthdr* hdr = (struct pcap_sf_pkthdr*)(sr_ring_reserve(dump->ring));
+    if (hdr == NULL)
+    {
+        return -1;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, 0);
+    hdr->ts.tv_sec = now.tv_sec;
+    hdr->ts.tv_usec = now.tv_usec;
+    hdr->caplen = min(((unsigned int)(dump->snaplen)), len);
+    hdr->len = len;
+    memcpy(((uint8_t*)(hdr)) + sizeof(struct pcap_sf_pkthdr), buf, hdr->caplen);
+
+    sr_ring_commit(dump->ring, hdr);
+
+    /* -- the positions are only read while the writer sleeps, when they
+     *    are not moving under us -- */
+    if (__atomic_load_n(&dump->sleeping, __ATOMIC_SEQ_CST) &&
+        (__atomic_load_n(&dump->ring->enqueue_pos, __ATOMIC_RELAXED) -
+         __atomic_load_n(&dump->ring->dequeue_pos, __ATOMIC_RELAXED) >= DUMP_WAKE_SLOTS) &&
+        __atomic_exchange_n(&dump->sleeping, 0, __ATOMIC_SEQ_CST))
+    {
+        uint64_t one = 1;
+        if (write(dump->efd, &one, sizeof(one)) < 0)
+        {
+            /* -- the counter is full, the writer is being woken anyway -- */
+        }
+    }
+    return 0;
+} /* -- sr_dump_packet -- */
+
+uint64_t sr_dump_drops(struct sr_dump* dump)
+{
+    return __atomic_load_n(&dump->ring->drops, __ATOMIC_RELAXED);
+} /* -- sr_dump_drops -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_dump_thread
+ *
+ * Drains the ring into a batch, written when it is full, when its oldest
+ * record has waited DUMP_FLUSH_USEC, or before the file is rotated. On
+ * an empty ring it sleeps until woken or DUMP_SLEEP_MSEC have passed.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void dump_flush(struct sr_dump* dump, uint8_t* batch, unsigned int* batch_len)
+{
+    if (*batch_len > 0)
+    {
+        if (fwrite(batch, *batch_len, 1, dump->fp) != 1)
+        {
+            fprintf(stderr, "sr_dump: can't write %s\n", dump->fname);
+        }
+        dump->file_bytes += *batch_len;
+        *batch_len = 0;
+    }
+}
+
+static
+void dump_rotate(struct sr_dump* dump)
+{
+    sr_dump_close(dump->fp);
+    dump->file_num++;
+    if (dump_open(dump) != 0)
+    {
+        fprintf(stderr, "sr_dump: stopping the capture\n");
+        dump->fp = fopen("/dev/null", "w");
+    }
+}
+
+void* sr_dump_thread(void* arg)
+{
+    struct sr_dump* dump = (struct sr_dump*)(arg);
+    uint8_t* batch = (uint8_t*)(malloc(DUMP_BATCH_SIZE));
+    unsigned int batch_len = 0;
+    struct timeval batch_start;
+    gettimeofday(&batch_start, 0);
+
+    while (1)
+    {
+        struct pcap_sf_pkthdr* hdr = (struct pcap_sf_pkthdr*)(sr_ring_peek(dump->ring));
+        struct timeval now;
+        gettimeofday(&now, 0);
+
+        /* -- age rotation, only once the file holds some packets -- */
+        if ((dump->rotate_secs != 0) && (now.tv_sec - dump->file_opened >= dump->rotate_secs) &&
+            (dump->file_bytes + batch_len > sizeof(struct pcap_file_header)))
+        {
+            dump_flush(dump, batch, &batch_len);
+            dump_rotate(dump);
+        }
+
+        if (hdr != NULL)
+        {
+            unsigned int len = sizeof(struct pcap_sf_pkthdr) + hdr->caplen;
+            if ((dump->rotate_bytes != 0) && (dump->file_bytes + batch_len + len > dump->rotate_bytes) &&
+                (dump->file_bytes + batch_len > sizeof(struct pcap_file_header)))
+            {
+                dump_flush(dump, batch, &batch_len);
+                dump_rotate(dump);
+            }
+            if (batch_len + len > DUMP_BATCH_SIZE)
+            {
+                dump_flush(dump, batch, &batch_len);
+            }
+            if (batch_len == 0)
+            {
+                batch_start = now;
+            }
+            memcpy(batch + batch_len, hdr, len);
+            batch_len += len;
+            sr_ring_release(dump->ring, hdr);
+            continue;
+        }
+
+        if ((batch_len > 0) && ((dump->stop) ||
+            (((now.tv_sec - batch_start.tv_sec) * 1000000) + now.tv_usec - batch_start.tv_usec >= DUMP_FLUSH_USEC)))
+        {
+            dump_flush(dump, batch, &batch_len);
+        }
+        if (dump->stop)
+        {
+            break;
+        }
+
+        /* -- asleep only if nothing came in since the peek -- */
+        __atomic_store_n(&dump->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (sr_ring_peek(dump->ring) == NULL)
+        {
+            struct pollfd pfd;
+            pfd.fd = dump->efd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, DUMP_SLEEP_MSEC) > 0)
+            {
+                uint64_t count;
+                if (read(dump->efd, &count, sizeof(count)) < 0)
+                {
+                    /* -- nothing to read, woken by the timeout -- */
+                }
+            }
+        }
+        __atomic_store_n(&dump->sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    free(batch);
+    return NULL;
+} /* -- sr_dump_thread -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_dump_stop
+ *
+ * Writes out what is left in the ring and closes the file
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_dump_stop(struct sr_dump* dump)
+{
+    dump->stop = 1;
+    uint64_t one = 1;
+    if (write(dump->efd, &one, sizeof(one)) < 0)
+    {
+        /* -- the writer still stops within DUMP_SLEEP_MSEC -- */
+    }
+    pthread_join(dump->thread, NULL);
+    close(dump->efd);
+
+    if (sr_dump_drops(dump) != 0)
+    {
+        fprintf(stderr, "sr_dump: %llu packets not captured, ring full\n", (unsigned long long)(sr_dump_drops(dump)));
+    }
+    if (dump->fp != stdout)
+    {
+        sr_dump_close(dump->fp);
+    }
+    sr_ring_destroy(dump->ring);
+    free(dump);
+} /* -- sr_dump_stop -- */
@@ -1,8 +1,22 @@
 /** 
  * This header file defines data structures for logging packets in tcpdump
  * format as well as a set of operations for logging.
+ *
+ * sr_dump_start() captures asynchronously: sr_dump_packet() copies the
+ * snapped bytes into a lock-free ring and returns, a writer thread
+ * batches the records into large writes and rotates the file by size
+ * and by age. The writer sleeps up to DUMP_SLEEP_MSEC once the ring is
+ * empty; a packet finding DUMP_WAKE_SLOTS records waiting wakes it
+ * through an eventfd, so a burst does not fill the ring while it sleeps
+ * and a trickle costs no system call.
  */
 
+#ifndef SR_DUMPER_H
+#define SR_DUMPER_H
+
+#include <stdio.h>
+#include <pthread.h>
+
 
 #ifdef _LINUX_
 #include <stdint.h>
@@ -25,6 +39,12 @@
 
 #define min(a,b) ( (a) < (b) ? (a) : (b) ) 
 
+#define DUMP_RING_SLOTS 4096
+#define DUMP_BATCH_SIZE (256 * 1024)
+#define DUMP_FLUSH_USEC 100000    /* longest a record waits in the batch */
+#define DUMP_SLEEP_MSEC 10        /* longest the writer sleeps on an empty ring */
+#define DUMP_WAKE_SLOTS (DUMP_RING_SLOTS / 4)   /* records waiting that wake it */
+
 /* file header */
 struct pcap_file_header {
   uint32_t   magic;         /* magic number */
@@ -77,3 +97,36 @@ void sr_dump(FILE *fp, const struct pcap_pkthdr *h, const unsigned char *sp);
  * Close the file
  */
 void sr_dump_close(FILE *fp);
+
+/*
+ * Asynchronous capture to fname (or "-" for stdout), rotated to fname.1,
+ * fname.2, ... once rotate_bytes are written or rotate_secs have passed
+ * (0 disables either).
+ */
+struct sr_dump
+{
+    struct sr_ring* ring;
+    int snaplen;
+    char fname[256];
+    unsigned long rotate_bytes;
+    unsigned int rotate_secs;
+
+    /* -- writer thread only -- */
+    FILE* fp;
+    unsigned int file_num;
+    unsigned long file_bytes;
+    time_t file_opened;
+
+    int efd;                    /* eventfd, written to wake the writer */
+    uint32_t sleeping;          /* the writer waits on efd */
+    volatile uint8_t stop;
+    pthread_t thread;
+};
+
+struct sr_dump* sr_dump_start(const char*, int, unsigned long, unsigned int);
+int sr_dump_packet(struct sr_dump*, const uint8_t*, unsigned int);
+uint64_t sr_dump_drops(struct sr_dump*);
+void sr_dump_stop(struct sr_dump*);
+void* sr_dump_thread(void*);
+
+#endif /* -- SR_DUMPER_H -- */
@@ -0,0 +1,425 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_event.c
+ *
+ * Description:
+ *
+ * epoll and timerfd event loop, see sr_event.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "sr_event.h"
+#include "sr_router.h"
+#include "sr_stats.h"
+#include "sr_log.h"
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_timer_now
+ *
+ * Monotonic milliseconds, the clock of every timer
+ *
+ *---------------------------------------------------------------------------*/
+
+uint64_t sr_timer_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t)(ts.tv_sec)) * 1000) + (ts.tv_nsec / 1000000);
+} /* -- sr_timer_now -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_init
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_event_init(struct sr_instance* sr)
+{
+    struct sr_event_loop* loop = ((struct sr_event_loop*)(calloc(1, sizeof(struct sr_event_loop))));
+    pthread_mutex_init(&loop->lock, NULL);
+
+    if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        perror("epoll_create1(..):sr_event.c::sr_event_init");
+        free(loop);
+        return -1;
+    }
+    if ((loop->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+    {
+        perror("timerfd_create(..):sr_event.c::sr_event_init");
+        close(loop->epfd);
+        free(loop);
+        return -1;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;                 /* -- the timerfd -- */
+    epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->timerfd, &ev);
+
+    sr->loop = loop;
+    return 0;
+} /* -- sr_event_init -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_add_fd
+ *
+ * cb is called on the loop thread whenever fd is readable
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_event_add_fd(struct sr_instance* sr, int fd, sr_event_cb cb, void* arg)
+{
+    struct sr_event_loop* loop = sr->loop;
+
+    struct sr_event_fd* efd = NULL;
+    for (unsigned int i = 0; (efd == NULL) && (i < loop->fd_num); i++)
+    {
+        if (loop->fds[i]->fd < 0)
+        {
+            efd = loop->fds[i];
+        }
+    }
+    if (efd == NULL)
+    {
+        /* -- the slots stay where they are, only the table of them grows -- */
+        struct sr_event_fd** fds = ((struct sr_event_fd**)(realloc(loop->fds, (loop->fd_num + 1) * sizeof(struct sr_event_fd*))));
+        if (fds == NULL)
+        {
+            perror("realloc(..):sr_event.c::sr_event_add_fd");
+            return -1;
+        }
+        loop->fds = fds;
+        efd = ((struct sr_event_fd*)(malloc(sizeof(struct sr_event_fd))));
+        efd->fd = -1;
+        loop->fds[loop->fd_num++] = efd;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = efd;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        perror("epoll_ctl(..):sr_event.c::sr_event_add_fd");
+        return -1;
+    }
+
+    efd->fd = fd;
+    efd->cb = cb;
+    efd->arg = arg;
+    efd->sr = sr;
+    return 0;
+} /* -- sr_event_add_fd -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: event_arm_timerfd
+ *
+ * Arms the timerfd for the first timer, if that changed. Called with the
+ * loop lock held.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void event_arm_timerfd(struct sr_event_loop* loop)
+{
+    uint64_t due = (loop->timers != NULL) ? loop->timers->due : 0;
+    if (due == loop->timerfd_due)
+    {
+        return;
+    }
+    loop->timerfd_due = due;
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = due / 1000;
+    its.it_value.tv_nsec = (due % 1000) * 1000000;
+    timerfd_settime(loop->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+} /* -- event_arm_timerfd -- */
+
+static
+void event_unlink_timer(struct sr_event_loop* loop, struct sr_timer* timer)
+{
+    struct sr_timer** ptr = &loop->timers;
+    while (*ptr != NULL)
+    {
+        if (*ptr == timer)
+        {
+            *ptr = timer->next;
+            break;
+        }
+        ptr = &(*ptr)->next;
+    }
+    timer->next = NULL;
+    timer->due = 0;
+} /* -- event_unlink_timer -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_timer_init
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_timer_init(struct sr_timer* timer, sr_timer_cb cb, void* arg)
+{
+    timer->due = 0;
+    timer->cb = cb;
+    timer->arg = arg;
+    timer->sr = NULL;
+    timer->next = NULL;
+} /* -- sr_timer_init -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_timer_add_at
+ *
+ * Arms the timer for a monotonic time in ms, an armed timer is moved
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_timer_add_at(struct sr_instance* sr, struct sr_timer* timer, uint64_t due)
+{
+    struct sr_event_loop* loop = sr->loop;
+    if (due == 0)
+    {
+        due = 1;                        /* -- 0 means not armed -- */
+    }
+
+    pthread_mutex_lock(&loop->lock);
+
+    if (timer->due != 0)
+    {
+        event_unlink_timer(loop, timer);
+    }
+    timer->due = due;
+    timer->sr = sr;
+
+    struct sr_timer** ptr = &loop->timers;
+    while ((*ptr != NULL) && ((*ptr)->due <= due))
+    {
+        ptr = &(*ptr)->next;
+    }
+    timer->next = *ptr;
+    *ptr = timer;
+
+    event_arm_timerfd(loop);
+
+    pthread_mutex_unlock(&loop->lock);
+} /* -- sr_timer_add_at -- */
+
+void sr_timer_add(struct sr_instance* sr, struct sr_timer* timer, uint64_t delay)
+{
+    sr_timer_add_at(sr, timer, sr_timer_now() + delay);
+} /* -- sr_timer_add -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_timer_cancel
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_timer_cancel(struct sr_instance* sr, struct sr_timer* timer)
+{
+    struct sr_event_loop* loop = sr->loop;
+
+    pthread_mutex_lock(&loop->lock);
+    if (timer->due != 0)
+    {
+        event_unlink_timer(loop, timer);
+        event_arm_timerfd(loop);
+    }
+    pthread_mutex_unlock(&loop->lock);
+} /* -- sr_timer_cancel -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: event_run_timers
+ *
+ * Runs the timers that are due, without the loop lock: the callbacks arm
+ * timers themselves.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void event_run_timers(struct sr_event_loop* loop)
+{
+    uint64_t expirations;
+    int woken = (read(loop->timerfd, &expirations, sizeof(expirations)) > 0);
+
+    uint64_t now = sr_timer_now();
+
+    pthread_mutex_lock(&loop->lock);
+    while ((loop->timers != NULL) && (loop->timers->due <= now))
+    {
+        struct sr_timer* timer = loop->timers;
+        struct sr_instance* sr = timer->sr;
+        event_unlink_timer(loop, timer);
+        pthread_mutex_unlock(&loop->lock);
+
+        if (woken)
+        {
+            sr_stats_inc(sr, STATS_TIMER_WAKEUPS);   /* -- counted for the first router due -- */
+            woken = 0;
+        }
+        if (loop->shared)
+        {
+            sr_log_host = sr->host;
+        }
+        timer->cb(sr, timer->arg);
+
+        pthread_mutex_lock(&loop->lock);
+    }
+    loop->timerfd_due = 0;              /* -- expired, arm it again -- */
+    event_arm_timerfd(loop);
+    pthread_mutex_unlock(&loop->lock);
+} /* -- event_run_timers -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_dispatch
+ *
+ * Waits up to timeout ms (-1 forever) and handles what is ready. Returns
+ * 1 to go on, otherwise what a descriptor callback returned.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_event_dispatch(struct sr_instance* sr, int timeout)
+{
+    struct sr_event_loop* loop = sr->loop;
+    struct epoll_event events[EVENT_BATCH];
+
+    /* -- no event returned before can point to a detached slot any more -- */
+    if (loop->detached)
+    {
+        for (unsigned int i = 0; i < loop->fd_num; i++)
+        {
+            if (loop->fds[i]->cb == NULL)
+            {
+                loop->fds[i]->fd = -1;
+            }
+        }
+        loop->detached = 0;
+    }
+
+    int num = epoll_wait(loop->epfd, events, EVENT_BATCH, timeout);
+    if (num < 0)
+    {
+        if (errno == EINTR)
+        {
+            return 1;
+        }
+        perror("epoll_wait(..):sr_event.c::sr_event_dispatch");
+        return -1;
+    }
+
+    for (int i = 0; i < num; i++)
+    {
+        struct sr_event_fd* efd = ((struct sr_event_fd*)(events[i].data.ptr));
+        if (efd == NULL)
+        {
+            event_run_timers(loop);
+            continue;
+        }
+        if (efd->cb == NULL)
+        {
+            continue;                   /* -- detached by an earlier callback -- */
+        }
+
+        if (loop->shared)
+        {
+            sr_log_host = efd->sr->host;
+        }
+        int ret = efd->cb(efd->sr, efd->arg);
+        if (ret != 1)
+        {
+            return ret;
+        }
+    }
+
+    return 1;
+} /* -- sr_event_dispatch -- */
+
+int sr_event_run(struct sr_instance* sr)
+{
+    int ret;
+    while ((ret = sr_event_dispatch(sr, -1)) == 1);
+    return ret;
+} /* -- sr_event_run -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_detach
+ *
+ * Removes the descriptors and cancels the timers of one router, the
+ * others sharing the loop go on. Called on the loop thread.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_event_detach(struct sr_instance* sr)
+{
+    struct sr_event_loop* loop = sr->loop;
+
+    for (unsigned int i = 0; i < loop->fd_num; i++)
+    {
+        struct sr_event_fd* efd = loop->fds[i];
+        if ((efd->sr == sr) && (efd->cb != NULL))
+        {
+            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, efd->fd, NULL);
+            efd->cb = NULL;
+            loop->detached = 1;
+        }
+    }
+
+    pthread_mutex_lock(&loop->lock);
+    struct sr_timer** ptr = &loop->timers;
+    while (*ptr != NULL)
+    {
+        struct sr_timer* timer = *ptr;
+        if (timer->sr == sr)
+        {
+            *ptr = timer->next;
+            timer->next = NULL;
+            timer->due = 0;
+        }
+        else
+        {
+            ptr = &timer->next;
+        }
+    }
+    event_arm_timerfd(loop);
+    pthread_mutex_unlock(&loop->lock);
+} /* -- sr_event_detach -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_destroy
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_event_destroy(struct sr_instance* sr)
+{
+    struct sr_event_loop* loop = sr->loop;
+
+    close(loop->timerfd);
+    close(loop->epfd);
+    for (unsigned int i = 0; i < loop->fd_num; i++)
+    {
+        free(loop->fds[i]);
+    }
+    free(loop->fds);
+    free(loop);
+    sr->loop = 0;
+} /* -- sr_event_destroy -- */
@@ -0,0 +1,96 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_event.h
+ *
+ * Description:
+ *
+ * The event loop of the router. One thread waits in epoll on the
+ * sockets of the data plane and on a timerfd, and runs from there the
+ * packet handlers and every protocol timer (hellos, LSU origination,
+ * neighbor and topology aging, SPF, ARP retries and cache aging).
+ *
+ * Timers are kept in a list sorted by deadline, in monotonic
+ * milliseconds; the timerfd is armed for the first one, so the loop only
+ * wakes up when a packet arrives or a timer is due. A callback may arm
+ * its own timer again. Timers are armed and cancelled from the loop
+ * thread and, under the loop lock, from any other thread.
+ *
+ * With -U the io_uring waits instead of epoll_wait() and polls the epoll
+ * descriptor, see sr_uring.c.
+ *
+ * All the routers of a process (-v host1,host2,..) share one loop: a
+ * timer or a descriptor remembers the instance it was added for and its
+ * callback runs for that one. sr_event_detach() takes a router out of
+ * the loop when its session ends. The descriptor table grows with the
+ * routers; the slots of a detached router are reused once the events
+ * already returned for them are handled.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_EVENT_H
+#define SR_EVENT_H
+
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#define EVENT_BATCH 32          /* events handled per epoll_wait() */
+
+struct sr_instance;
+
+typedef void (*sr_timer_cb)(struct sr_instance*, void*);
+typedef int (*sr_event_cb)(struct sr_instance*, void*);    /* returns as sr_read_from_server() */
+
+struct sr_timer
+{
+    uint64_t due;               /* monotonic ms, 0 when not armed */
+    sr_timer_cb cb;
+    void* arg;
+    struct sr_instance* sr;     /* set when armed */
+    struct sr_timer* next;
+};
+
+struct sr_event_fd
+{
+    int fd;                     /* -1 for a free slot */
+    sr_event_cb cb;             /* NULL once detached */
+    void* arg;
+    struct sr_instance* sr;
+};
+
+struct sr_event_loop
+{
+    int epfd;
+    int timerfd;
+    uint64_t timerfd_due;       /* what the timerfd is armed for, 0 if nothing */
+
+    pthread_mutex_t lock;       /* the timer list */
+    struct sr_timer* timers;    /* armed timers, soonest first */
+
+    struct sr_event_fd** fds;   /* apart, epoll keeps pointers to them */
+    unsigned int fd_num;
+    uint8_t detached;           /* slots to free before the next wait */
+    uint8_t shared;             /* by several routers, see sr_log_host */
+};
+
+int sr_event_init(struct sr_instance*);
+int sr_event_add_fd(struct sr_instance*, int, sr_event_cb, void*);
+int sr_event_dispatch(struct sr_instance*, int);
+int sr_event_run(struct sr_instance*);
+void sr_event_detach(struct sr_instance*);
+void sr_event_destroy(struct sr_instance*);
+
+uint64_t sr_timer_now();
+void sr_timer_init(struct sr_timer*, sr_timer_cb, void*);
+void sr_timer_add(struct sr_instance*, struct sr_timer*, uint64_t);
+void sr_timer_add_at(struct sr_instance*, struct sr_timer*, uint64_t);
+void sr_timer_cancel(struct sr_instance*, struct sr_timer*);
+
+static inline
+int sr_timer_armed(struct sr_timer* timer)
+{
+    return (timer->due != 0);
+}
+
+#endif /* -- SR_EVENT_H -- */
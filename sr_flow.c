@@ -0,0 +1,585 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flow.c
+ *
+ * Description:
+ *
+ * Flow table and IPFIX export, see sr_flow.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "sr_flow.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_ring.h"
+#include "sr_stats.h"
+#include "sr_if.h"
+
+#define TCP_FIN 0x01
+#define TCP_RST 0x04
+
+/* -- the fields of a record, in order: information element and length -- */
+static const uint16_t flow_template[][2] =
+{
+    { 8, 4 },       /* sourceIPv4Address */
+    { 12, 4 },      /* destinationIPv4Address */
+    { 7, 2 },       /* sourceTransportPort */
+    { 11, 2 },      /* destinationTransportPort */
+    { 4, 1 },       /* protocolIdentifier */
+    { 5, 1 },       /* ipClassOfService */
+    { 6, 1 },       /* tcpControlBits */
+    { 10, 4 },      /* ingressInterface */
+    { 14, 4 },      /* egressInterface */
+    { 2, 8 },       /* packetDeltaCount */
+    { 1, 8 },       /* octetDeltaCount */
+    { 152, 8 },     /* flowStartMilliseconds */
+    { 153, 8 },     /* flowEndMilliseconds */
+    { 136, 1 }      /* flowEndReason */
+};
+
+#define FLOW_TEMPLATE_FIELDS (sizeof(flow_template) / sizeof(flow_template[0]))
+
+/* -- shards are handed out to threads in the order they first forward -- */
+static unsigned int flow_next_shard = 0;
+static __thread int flow_shard_index = -1;
+
+static void flow_sweep(struct sr_instance* sr, void* arg);
+static void* flow_thread(void* arg);
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flow_parse_timeouts
+ *
+ * Reads idle/active, in seconds. Returns 0, or -1 if spec does not parse.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_flow_parse_timeouts(const char* spec, unsigned int* idle, unsigned int* active)
+{
+    char* end;
+    unsigned long idle_secs = strtoul(spec, &end, 10);
+    if ((end == spec) || (*end != '/'))
+    {
+        return -1;
+    }
+    const char* next = end + 1;
+    unsigned long active_secs = strtoul(next, &end, 10);
+    if ((end == next) || (*end != '\0') || (idle_secs == 0) || (active_secs == 0) ||
+        (idle_secs > 86400) || (active_secs > 86400))
+    {
+        return -1;
+    }
+    *idle = idle_secs;
+    *active = active_secs;
+    return 0;
+} /* -- sr_flow_parse_timeouts -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: flow_open
+ *
+ * Opens the destination of the records: udp:host:port, or a file.
+ * Returns 0 or -1.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int flow_open(struct sr_flow_table* table)
+{
+    if (strncmp(table->dest, "udp:", 4) == 0)
+    {
+        char host[256];
+        strcpy(host, table->dest + 4);
+        char* port = strrchr(host, ':');
+        if (port == NULL)
+        {
+            fprintf(stderr, "sr_flow: no port in %s\n", table->dest);
+            return -1;
+        }
+        *port++ = '\0';
+
+        struct addrinfo hints;
+        struct addrinfo* res;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        if (getaddrinfo(host, port, &hints, &res) != 0)
+        {
+            fprintf(stderr, "sr_flow: unknown collector %s\n", table->dest);
+            return -1;
+        }
+        table->fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if ((table->fd < 0) || (connect(table->fd, res->ai_addr, res->ai_addrlen) != 0))
+        {
+            perror("connect(..):sr_flow.c::flow_open");
+            freeaddrinfo(res);
+            return -1;
+        }
+        freeaddrinfo(res);
+        return 0;
+    }
+
+    table->fd = open(table->dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (table->fd < 0)
+    {
+        perror("open(..):sr_flow.c::flow_open");
+        return -1;
+    }
+    return 0;
+} /* -- flow_open -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flow_start
+ *
+ * Creates the flow table of the router, its records going to dest with
+ * the given timeouts (seconds) and observation domain. Returns NULL if
+ * dest cannot be opened.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_flow_table* sr_flow_start(struct sr_instance* sr, const char* dest, unsigned int idle,
+        unsigned int active, uint32_t domain)
+{
+    struct sr_flow_table* table = ((struct sr_flow_table*)(calloc(1, sizeof(struct sr_flow_table))));
+    table->sr = sr;
+    table->base = sr_timer_now();
+    table->idle_ms = idle * 1000;
+    table->active_ms = active * 1000;
+    table->domain = domain;
+    table->fd = -1;
+    strncpy(table->dest, dest, sizeof(table->dest) - 1);
+
+    table->ring = sr_ring_create(FLOW_RING_SLOTS, sizeof(struct sr_flow_record));
+    if ((table->ring == NULL) || (flow_open(table) != 0))
+    {
+        if (table->ring != NULL)
+        {
+            sr_ring_destroy(table->ring);
+        }
+        if (table->fd >= 0)
+        {
+            close(table->fd);
+        }
+        free(table);
+        return NULL;
+    }
+
+    for (int i = 0; i < FLOW_SHARDS; i++)
+    {
+        struct sr_flow_shard* shard = &table->shards[i];
+        shard->entries = ((struct sr_flow_entry*)(calloc(FLOW_BUCKETS * FLOW_WAYS, sizeof(struct sr_flow_entry))));
+        sr_timer_init(&shard->timer, flow_sweep, shard);
+    }
+
+    pthread_create(&table->thread, NULL, flow_thread, table);
+    return table;
+} /* -- sr_flow_start -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: flow_shard
+ *
+ * The shard of the calling thread, NULL if there are more threads than
+ * shards and this one got none. The first call of a thread arms the sweep
+ * of its shard.
+ *
+ *---------------------------------------------------------------------------*/
+
+static inline
+struct sr_flow_shard* flow_shard(struct sr_flow_table* table)
+{
+    if (flow_shard_index < 0)
+    {
+        flow_shard_index = __atomic_fetch_add(&flow_next_shard, 1, __ATOMIC_RELAXED);
+    }
+    if (flow_shard_index >= FLOW_SHARDS)
+    {
+        return NULL;
+    }
+
+    struct sr_flow_shard* shard = &table->shards[flow_shard_index];
+    if (!sr_timer_armed(&shard->timer))
+    {
+        sr_timer_add(table->sr, &shard->timer, FLOW_SWEEP_MS);
+    }
+    return shard;
+} /* -- flow_shard -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: flow_export
+ *
+ * Hands the flow of the slot to the writer thread and frees the slot.
+ * With wait, retries until the ring has room instead of dropping it.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void flow_export(struct sr_flow_table* table, struct sr_flow_entry* entry, uint8_t reason, int wait)
+{
+    struct sr_flow_record* record;
+    while (((record = ((struct sr_flow_record*)(sr_ring_reserve(table->ring)))) == NULL) && wait)
+    {
+        usleep(1000);
+    }
+
+    if (record == NULL)
+    {
+        sr_stats_inc(table->sr, STATS_FLOW_EXPORT_DROPS);
+    }
+    else
+    {
+        record->key = entry->key;
+        record->bytes = entry->bytes;
+        record->packets = entry->packets;
+        record->first = table->base + entry->first;
+        record->last = table->base + entry->last;
+        record->egress = entry->egress;
+        record->tcp_flags = entry->tcp_flags;
+        record->tos = entry->tos;
+        record->reason = reason;
+        sr_ring_commit(table->ring, record);
+    }
+    entry->packets = 0;
+} /* -- flow_export -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flow_update
+ *
+ * Counts a packet of len bytes from the IP header on, forwarded from rx_if
+ * to tx_if, in the flow table of the router, if it has one.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_flow_update(struct sr_instance* sr, struct sr_if* rx_if, struct sr_if* tx_if, struct ip* ip_hdr,
+        unsigned int len)
+{
+    struct sr_flow_table* table = sr->flows;
+    if (table == NULL)
+    {
+        return;
+    }
+    struct sr_flow_shard* shard = flow_shard(table);
+    if (shard == NULL)
+    {
+        return;
+    }
+
+    struct sr_flow_key key;
+    uint8_t tcp_flags = 0;
+    key.src = ip_hdr->ip_src.s_addr;
+    key.dst = ip_hdr->ip_dst.s_addr;
+    key.sport = 0;
+    key.dport = 0;
+    key.proto = ip_hdr->ip_p;
+    key.iface = rx_if->index;
+    key.pad = 0;
+
+    unsigned int hdr_len = ip_hdr->ip_hl * 4;
+    uint8_t* l4 = ((uint8_t*)(ip_hdr)) + hdr_len;
+    if ((ntohs(ip_hdr->ip_off) & IP_OFFMASK) == 0)
+    {
+        if (((key.proto == IP_PROTO_TCP) || (key.proto == IP_PROTO_UDP)) && (len >= hdr_len + 4))
+        {
+            key.sport = (l4[0] << 8) | l4[1];
+            key.dport = (l4[2] << 8) | l4[3];
+            if ((key.proto == IP_PROTO_TCP) && (len >= hdr_len + 14))
+            {
+                tcp_flags = l4[13];
+            }
+        }
+        else if ((key.proto == IP_PROTO_ICMP) && (len >= hdr_len + 2))
+        {
+            key.dport = (l4[0] << 8) | l4[1];
+        }
+    }
+
+    uint64_t a = (((uint64_t)(key.src)) << 32) | key.dst;
+    uint64_t b = (((uint64_t)(key.sport)) << 32) | (((uint64_t)(key.dport)) << 16) | (key.proto << 8) | key.iface;
+    uint64_t hash = (a * 0x9e3779b97f4a7c15ULL) ^ (b * 0xc2b2ae3d27d4eb4fULL);
+    hash = (hash ^ (hash >> 32)) * 0x9e3779b97f4a7c15ULL;
+
+    /* -- the top bits, the only ones every field reaches -- */
+    struct sr_flow_entry* bucket = &shard->entries[(hash >> (64 - FLOW_BUCKET_BITS)) * FLOW_WAYS];
+    uint32_t now = ((uint32_t)(sr_timer_now() - table->base));
+    struct sr_flow_entry* entry = NULL;
+    struct sr_flow_entry* victim = NULL;
+
+    for (int i = 0; i < FLOW_WAYS; i++)
+    {
+        struct sr_flow_entry* way = &bucket[i];
+        if (way->packets == 0)
+        {
+            if ((victim == NULL) || (victim->packets != 0))
+            {
+                victim = way;
+            }
+        }
+        else if (memcmp(&way->key, &key, sizeof(key)) == 0)
+        {
+            entry = way;
+            break;
+        }
+        else if ((victim == NULL) || ((victim->packets != 0) && (now - way->last > now - victim->last)))
+        {
+            victim = way;
+        }
+    }
+
+    if ((entry != NULL) && (now - entry->first >= table->active_ms))
+    {
+        /* -- long lived, reported in parts -- */
+        flow_export(table, entry, FLOW_END_ACTIVE, 0);
+    }
+    else if (entry == NULL)
+    {
+        entry = victim;
+        if (entry->packets != 0)
+        {
+            flow_export(table, entry, FLOW_END_EVICTED, 0);
+            sr_stats_inc(sr, STATS_FLOWS_EVICTED);
+        }
+        entry->key = key;
+        sr_stats_inc(sr, STATS_FLOWS_CREATED);
+    }
+
+    if (entry->packets == 0)
+    {
+        entry->bytes = 0;
+        entry->first = now;
+        entry->tcp_flags = 0;
+    }
+    entry->packets++;
+    entry->bytes += ntohs(ip_hdr->ip_len);
+    entry->last = now;
+    entry->egress = tx_if->index;
+    entry->tcp_flags |= tcp_flags;
+    entry->tos = ip_hdr->ip_tos;
+
+    if (tcp_flags & (TCP_FIN | TCP_RST))
+    {
+        flow_export(table, entry, FLOW_END_DETECTED, 0);
+    }
+} /* -- sr_flow_update -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: flow_sweep
+ *
+ * Timer of a shard, run by the thread owning it: exports the idle flows
+ * of the next slice of buckets.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void flow_sweep(struct sr_instance* sr, void* arg)
+{
+    struct sr_flow_table* table = sr->flows;
+    struct sr_flow_shard* shard = ((struct sr_flow_shard*)(arg));
+    uint32_t now = ((uint32_t)(sr_timer_now() - table->base));
+    unsigned int slice = (FLOW_BUCKETS * FLOW_SWEEP_MS) / 1000;
+
+    for (unsigned int i = 0; i < slice; i++)
+    {
+        struct sr_flow_entry* bucket = &shard->entries[((shard->sweep_next + i) & (FLOW_BUCKETS - 1)) * FLOW_WAYS];
+        for (int j = 0; j < FLOW_WAYS; j++)
+        {
+            if ((bucket[j].packets != 0) && (now - bucket[j].last >= table->idle_ms))
+            {
+                flow_export(table, &bucket[j], FLOW_END_IDLE, 0);
+            }
+        }
+    }
+    shard->sweep_next = (shard->sweep_next + slice) & (FLOW_BUCKETS - 1);
+
+    sr_timer_add(sr, &shard->timer, FLOW_SWEEP_MS);
+} /* -- flow_sweep -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: flow_thread
+ *
+ * Drains the ring into an IPFIX message, sent when it is full, when its
+ * oldest record has waited FLOW_FLUSH_MSEC, or on stop.
+ *
+ *---------------------------------------------------------------------------*/
+
+static inline
+uint8_t* put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+    return p + 2;
+}
+
+static inline
+uint8_t* put32(uint8_t* p, uint32_t v)
+{
+    p = put16(p, v >> 16);
+    return put16(p, v);
+}
+
+static inline
+uint8_t* put64(uint8_t* p, uint64_t v)
+{
+    p = put32(p, v >> 32);
+    return put32(p, v);
+}
+
+static
+void flow_flush(struct sr_flow_table* table, uint8_t* records, unsigned int count)
+{
+    uint8_t msg[FLOW_MSG_SIZE];
+    uint8_t* p = msg + 16;
+    uint64_t now = sr_timer_now();
+
+    if ((table->template_sent == 0) || (now - table->template_sent >= FLOW_TEMPLATE_SECS * 1000))
+    {
+        p = put16(p, IPFIX_TEMPLATE_SET);
+        p = put16(p, 8 + (FLOW_TEMPLATE_FIELDS * 4));
+        p = put16(p, IPFIX_TEMPLATE_ID);
+        p = put16(p, FLOW_TEMPLATE_FIELDS);
+        for (unsigned int i = 0; i < FLOW_TEMPLATE_FIELDS; i++)
+        {
+            p = put16(p, flow_template[i][0]);
+            p = put16(p, flow_template[i][1]);
+        }
+        table->template_sent = now;
+    }
+
+    p = put16(p, IPFIX_TEMPLATE_ID);
+    p = put16(p, 4 + (count * IPFIX_RECORD_LEN));
+    memcpy(p, records, count * IPFIX_RECORD_LEN);
+    p += count * IPFIX_RECORD_LEN;
+
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    uint8_t* hdr = msg;
+    hdr = put16(hdr, IPFIX_VERSION);
+    hdr = put16(hdr, p - msg);
+    hdr = put32(hdr, tv.tv_sec);
+    hdr = put32(hdr, table->sequence);
+    hdr = put32(hdr, table->domain);
+
+    if (write(table->fd, msg, p - msg) != p - msg)
+    {
+        /* -- a collector not listening yet, or a full disk -- */
+        sr_stats_add(table->sr, STATS_FLOW_EXPORT_DROPS, count);
+    }
+    else
+    {
+        sr_stats_add(table->sr, STATS_FLOWS_EXPORTED, count);
+    }
+    table->sequence += count;
+}
+
+static
+void* flow_thread(void* arg)
+{
+    struct sr_flow_table* table = ((struct sr_flow_table*)(arg));
+    unsigned int max = (FLOW_MSG_SIZE - 16 - 4 - (8 + (FLOW_TEMPLATE_FIELDS * 4))) / IPFIX_RECORD_LEN;
+    uint8_t records[FLOW_MSG_SIZE];
+    unsigned int count = 0;
+    uint64_t msg_start = 0;
+
+    while (1)
+    {
+        struct sr_flow_record* record = ((struct sr_flow_record*)(sr_ring_peek(table->ring)));
+        uint64_t now = sr_timer_now();
+
+        if (record != NULL)
+        {
+            if (count == max)
+            {
+                flow_flush(table, records, count);
+                count = 0;
+            }
+            if (count == 0)
+            {
+                msg_start = now;
+            }
+
+            /* -- monotonic times to milliseconds since the epoch -- */
+            struct timeval tv;
+            gettimeofday(&tv, 0);
+            uint64_t epoch = (((uint64_t)(tv.tv_sec)) * 1000) + (tv.tv_usec / 1000) - now;
+
+            uint8_t* p = records + (count * IPFIX_RECORD_LEN);
+            memcpy(p, &record->key.src, 4);
+            memcpy(p + 4, &record->key.dst, 4);
+            p = put16(p + 8, record->key.sport);
+            p = put16(p, record->key.dport);
+            *p++ = record->key.proto;
+            *p++ = record->tos;
+            *p++ = record->tcp_flags;
+            p = put32(p, record->key.iface + 1);
+            p = put32(p, record->egress + 1);
+            p = put64(p, record->packets);
+            p = put64(p, record->bytes);
+            p = put64(p, epoch + record->first);
+            p = put64(p, epoch + record->last);
+            *p++ = record->reason;
+            count++;
+
+            sr_ring_release(table->ring, record);
+            continue;
+        }
+
+        if ((count > 0) && (table->stop || (now - msg_start >= FLOW_FLUSH_MSEC)))
+        {
+            flow_flush(table, records, count);
+            count = 0;
+        }
+        if (table->stop)
+        {
+            break;
+        }
+        usleep(1000);
+    }
+    return NULL;
+} /* -- flow_thread -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flow_stop
+ *
+ * Exports the flows still in the table, once nothing forwards any more,
+ * and stops the writer thread.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_flow_stop(struct sr_flow_table* table)
+{
+    for (int i = 0; i < FLOW_SHARDS; i++)
+    {
+        struct sr_flow_shard* shard = &table->shards[i];
+        sr_timer_cancel(table->sr, &shard->timer);
+        for (int j = 0; j < FLOW_BUCKETS * FLOW_WAYS; j++)
+        {
+            if (shard->entries[j].packets != 0)
+            {
+                flow_export(table, &shard->entries[j], FLOW_END_FORCED, 1);
+            }
+        }
+        free(shard->entries);
+    }
+
+    table->stop = 1;
+    pthread_join(table->thread, NULL);
+
+    close(table->fd);
+    sr_ring_destroy(table->ring);
+    free(table);
+} /* -- sr_flow_stop -- */
@@ -0,0 +1,139 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flow.h
+ *
+ * Description:
+ *
+ * Flow table of the packets a router forwards, exported as IPFIX
+ * (RFC 7011) records. A flow is keyed by addresses, protocol, ports and
+ * ingress interface (ICMP type and code stand in the destination port,
+ * non-first fragments have no ports) and counts packets and bytes.
+ *
+ * The table is split in shards, one per thread forwarding, so an update
+ * takes no lock and shares no cache line. A shard is a set associative
+ * table: a flow lives in one of the FLOW_WAYS slots of its bucket and a
+ * new flow takes the free or the least recently seen one, so an update
+ * costs one hash and at most FLOW_WAYS compares. A flow taken over, idle
+ * for the idle timeout, older than the active timeout, or ended by a TCP
+ * FIN or RST is exported. Every FLOW_SWEEP_MS the owner of a shard sweeps
+ * a slice of it, the whole shard in a second, for flows gone idle.
+ *
+ * Exported flows go through a lock-free ring to a writer thread, which
+ * packs them into messages of at most FLOW_MSG_SIZE bytes, written to a
+ * file or sent to a collector (-x file or -x udp:host:port). The template
+ * leads the first message and every FLOW_TEMPLATE_SECS after.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FLOW_H
+#define SR_FLOW_H
+
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include "sr_event.h"
+
+#define FLOW_SHARDS 4               /* threads that may forward */
+#define FLOW_BUCKET_BITS 12
+#define FLOW_BUCKETS (1 << FLOW_BUCKET_BITS)    /* per shard */
+#define FLOW_WAYS 4
+#define FLOW_SWEEP_MS 100
+#define FLOW_IDLE_TIMEOUT 15        /* seconds */
+#define FLOW_ACTIVE_TIMEOUT 60      /* seconds */
+
+#define FLOW_RING_SLOTS 8192
+#define FLOW_MSG_SIZE 1400          /* fits an Ethernet MTU with IP and UDP */
+#define FLOW_FLUSH_MSEC 1000        /* longest a record waits in a message */
+#define FLOW_TEMPLATE_SECS 30
+
+#define IPFIX_VERSION 10
+#define IPFIX_TEMPLATE_SET 2
+#define IPFIX_TEMPLATE_ID 256
+#define IPFIX_RECORD_LEN 56
+
+/* -- flowEndReason -- */
+#define FLOW_END_IDLE 1
+#define FLOW_END_ACTIVE 2
+#define FLOW_END_DETECTED 3
+#define FLOW_END_FORCED 4
+#define FLOW_END_EVICTED 5
+
+struct sr_instance;
+struct sr_if;
+struct ip;
+
+struct sr_flow_key
+{
+    uint32_t src;
+    uint32_t dst;
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t proto;
+    uint8_t iface;      /* ingress, index in the interface list */
+    uint16_t pad;
+};
+
+/* -- a slot of the table, times in ms since the table started -- */
+struct sr_flow_entry
+{
+    struct sr_flow_key key;
+    uint64_t bytes;
+    uint32_t packets;   /* 0 for a free slot */
+    uint32_t first;
+    uint32_t last;
+    uint8_t egress;
+    uint8_t tcp_flags;  /* ORed over the packets */
+    uint8_t tos;
+    uint8_t pad;
+};
+
+struct sr_flow_shard
+{
+    struct sr_flow_entry* entries;  /* FLOW_BUCKETS * FLOW_WAYS */
+    unsigned int sweep_next;        /* bucket the next sweep starts at */
+    struct sr_timer timer;
+};
+
+/* -- what goes through the ring, times in monotonic ms -- */
+struct sr_flow_record
+{
+    struct sr_flow_key key;
+    uint64_t bytes;
+    uint64_t packets;
+    uint64_t first;
+    uint64_t last;
+    uint8_t egress;
+    uint8_t tcp_flags;
+    uint8_t tos;
+    uint8_t reason;
+};
+
+struct sr_flow_table
+{
+    struct sr_instance* sr;
+    uint64_t base;                  /* monotonic ms the times count from */
+    uint32_t idle_ms;
+    uint32_t active_ms;
+    struct sr_flow_shard shards[FLOW_SHARDS];
+
+    struct sr_ring* ring;
+    uint32_t domain;                /* observation domain of the messages */
+    char dest[256];
+
+    /* -- writer thread only -- */
+    int fd;                         /* file, or UDP socket connected to the collector */
+    uint32_t sequence;              /* data records sent before this message */
+    uint64_t template_sent;         /* monotonic ms, 0 if never */
+
+    volatile uint8_t stop;
+    pthread_t thread;
+};
+
+int sr_flow_parse_timeouts(const char*, unsigned int*, unsigned int*);
+struct sr_flow_table* sr_flow_start(struct sr_instance*, const char*, unsigned int, unsigned int, uint32_t);
+void sr_flow_update(struct sr_instance*, struct sr_if*, struct sr_if*, struct ip*, unsigned int);
+void sr_flow_stop(struct sr_flow_table*);
+
+#endif /* -- SR_FLOW_H -- */
@@ -0,0 +1,224 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_icmp_limit.c
+ *
+ * Description:
+ *
+ * Token buckets in front of send_icmp_error(), see sr_icmp_limit.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <netinet/in.h>
+
+#include "sr_icmp_limit.h"
+#include "sr_protocol.h"
+
+static const char* icmp_limit_names[ICMP_LIMIT_KIND_NUM] =
+{
+    "ttl",
+    "port",
+    "host",
+    "frag",
+    "source"
+};
+
+
+/*-----------------------------------------------------------------------------
+ * Method: icmp_limit_parse
+ *
+ * Applies a list of kind=rate/burst, or "off", to the limits. Returns 0
+ * or -1 if the list does not parse, the limits are then left half set.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int icmp_limit_parse(struct sr_icmp_limit* limit, const char* spec)
+{
+    const char* item = spec;
+    while (*item != '\0')
+    {
+        unsigned int len = strcspn(item, ",");
+        const char* equal = ((const char*)(memchr(item, '=', len)));
+
+        if ((equal == NULL) && (len == 3) && (strncmp(item, "off", 3) == 0))
+        {
+            memset(limit->rate, 0, sizeof(limit->rate));
+        }
+        else
+        {
+            int kind = -1;
+            for (int i = 0; (equal != NULL) && (i < ICMP_LIMIT_KIND_NUM); i++)
+            {
+                if ((strlen(icmp_limit_names[i]) == ((unsigned int)(equal - item))) &&
+                    (strncmp(icmp_limit_names[i], item, equal - item) == 0))
+                {
+                    kind = i;
+                }
+            }
+            if (kind < 0)
+            {
+                return -1;
+            }
+
+            char* end;
+            unsigned long rate = strtoul(equal + 1, &end, 10);
+            unsigned long burst = rate;
+            if (*end == '/')
+            {
+                burst = strtoul(end + 1, &end, 10);
+            }
+            if ((end != item + len) || ((burst == 0) && (rate != 0)))
+            {
+                return -1;
+            }
+            limit->rate[kind] = rate;
+            limit->burst[kind] = burst;
+        }
+
+        item += len;
+        if (*item == ',')
+        {
+            item++;
+        }
+    }
+    return 0;
+} /* -- icmp_limit_parse -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_icmp_limit_create
+ *
+ * The limits of ICMP_LIMIT_DEFAULT, changed by spec if not NULL. Returns
+ * NULL if spec does not parse.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_icmp_limit* sr_icmp_limit_create(const char* spec)
+{
+    struct sr_icmp_limit* limit = ((struct sr_icmp_limit*)(calloc(1, sizeof(struct sr_icmp_limit))));
+
+    icmp_limit_parse(limit, ICMP_LIMIT_DEFAULT);
+    if ((spec != NULL) && (icmp_limit_parse(limit, spec) != 0))
+    {
+        free(limit);
+        return NULL;
+    }
+
+    /* -- buckets start full -- */
+    for (int i = 0; i < ICMP_LIMIT_SOURCE; i++)
+    {
+        limit->kinds[i].tokens = ((uint64_t)(limit->burst[i])) * 1000;
+    }
+    pthread_mutex_init(&limit->lock, NULL);
+    return limit;
+} /* -- sr_icmp_limit_create -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: icmp_bucket_refill
+ *
+ * Adds the tokens earned since the last refill, up to the burst. Returns
+ * 1 if the bucket holds a whole token.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int icmp_bucket_refill(struct sr_icmp_bucket* bucket, uint32_t rate, uint32_t burst, uint64_t now)
+{
+    if (now > bucket->last)
+    {
+        /* -- rate per second is rate thousandths per ms -- */
+        bucket->tokens += (now - bucket->last) * rate;
+        if (bucket->tokens > ((uint64_t)(burst)) * 1000)
+        {
+            bucket->tokens = ((uint64_t)(burst)) * 1000;
+        }
+    }
+    bucket->last = now;
+    return (bucket->tokens >= 1000);
+} /* -- icmp_bucket_refill -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_icmp_limit_allow
+ *
+ * Takes the tokens for an error of the given type and code caused by a
+ * packet from src (network order) at now (ms). Returns 1 if the error may
+ * be sent, 0 if it is to be suppressed. A suppressed error takes no
+ * token, so a source over its limit does not drain the shared bucket.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_icmp_limit_allow(struct sr_icmp_limit* limit, uint8_t type, uint8_t code, uint32_t src, uint64_t now)
+{
+    int kind = ICMP_LIMIT_HOST;
+    if (type == ICMP_TIME_EXCEEDED_TYPE)
+    {
+        kind = ICMP_LIMIT_TTL;
+    }
+    else if ((type == ICMP_DESTINATION_UNREACHABLE_TYPE) && (code == ICMP_PORT_UNREACHABLE_CODE))
+    {
+        kind = ICMP_LIMIT_PORT;
+    }
+    else if ((type == ICMP_DESTINATION_UNREACHABLE_TYPE) && (code == ICMP_FRAG_NEEDED_CODE))
+    {
+        kind = ICMP_LIMIT_FRAG;
+    }
+
+    pthread_mutex_lock(&limit->lock);
+
+    struct sr_icmp_bucket* source = NULL;
+    if (limit->rate[ICMP_LIMIT_SOURCE] != 0)
+    {
+        uint32_t hash = ntohl(src) * 2654435761u;
+        struct sr_icmp_source* entry = &limit->sources[(hash >> 16) % ICMP_LIMIT_SOURCES];
+        if (entry->ip == 0)
+        {
+            /* -- the first source of the bucket starts with it full -- */
+            entry->bucket.tokens = ((uint64_t)(limit->burst[ICMP_LIMIT_SOURCE])) * 1000;
+            entry->bucket.last = now;
+        }
+        /* -- one taking over the bucket gets what is left of it, so sources
+         *    changing on every packet do not get a burst each -- */
+        entry->ip = src;
+        source = &entry->bucket;
+        if (!icmp_bucket_refill(source, limit->rate[ICMP_LIMIT_SOURCE], limit->burst[ICMP_LIMIT_SOURCE], now))
+        {
+            pthread_mutex_unlock(&limit->lock);
+            return 0;
+        }
+    }
+
+    struct sr_icmp_bucket* shared = NULL;
+    if (limit->rate[kind] != 0)
+    {
+        shared = &limit->kinds[kind];
+        if (!icmp_bucket_refill(shared, limit->rate[kind], limit->burst[kind], now))
+        {
+            pthread_mutex_unlock(&limit->lock);
+            return 0;
+        }
+        shared->tokens -= 1000;
+    }
+    if (source != NULL)
+    {
+        source->tokens -= 1000;
+    }
+
+    pthread_mutex_unlock(&limit->lock);
+    return 1;
+} /* -- sr_icmp_limit_allow -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_icmp_limit_destroy
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_icmp_limit_destroy(struct sr_icmp_limit* limit)
+{
+    pthread_mutex_destroy(&limit->lock);
+    free(limit);
+} /* -- sr_icmp_limit_destroy -- */
@@ -0,0 +1,67 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_icmp_limit.h
+ *
+ * Description:
+ *
+ * Rate limiting of the ICMP errors the router generates (RFC 1812,
+ * 4.3.2.8). Every error must get a token from the bucket of its kind,
+ * shared by all sources, and from the bucket of the source of the packet
+ * that caused it. Errors without both tokens are counted, never built.
+ *
+ * The limits are given with -E as a comma separated list of kind=rate/burst,
+ * in errors per second and errors, e.g. ttl=500/50,source=5/5. The kinds
+ * are ttl (time exceeded), port and host (unreachable), frag (fragmentation
+ * needed) and source, the bucket of every source. "off" lifts all the
+ * limits. Sources share ICMP_LIMIT_SOURCES buckets by a hash of their
+ * address, a source whose bucket was another's takes it over as it is.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ICMP_LIMIT_H
+#define SR_ICMP_LIMIT_H
+
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#define ICMP_LIMIT_SOURCES 256          /* source buckets, direct mapped */
+#define ICMP_LIMIT_DEFAULT "ttl=1000/50,port=1000/50,host=1000/50,frag=1000/50,source=10/10"
+
+enum sr_icmp_limit_kind
+{
+    ICMP_LIMIT_TTL,
+    ICMP_LIMIT_PORT,
+    ICMP_LIMIT_HOST,
+    ICMP_LIMIT_FRAG,
+    ICMP_LIMIT_SOURCE,
+    ICMP_LIMIT_KIND_NUM
+};
+
+struct sr_icmp_bucket
+{
+    uint64_t tokens;            /* thousandths of an error */
+    uint64_t last;              /* ms of the last refill */
+};
+
+struct sr_icmp_source
+{
+    uint32_t ip;                /* 0 if the bucket was never used */
+    struct sr_icmp_bucket bucket;
+};
+
+struct sr_icmp_limit
+{
+    pthread_mutex_t lock;
+    uint32_t rate[ICMP_LIMIT_KIND_NUM];     /* errors per second, 0 for no limit */
+    uint32_t burst[ICMP_LIMIT_KIND_NUM];
+    struct sr_icmp_bucket kinds[ICMP_LIMIT_SOURCE];
+    struct sr_icmp_source sources[ICMP_LIMIT_SOURCES];
+};
+
+struct sr_icmp_limit* sr_icmp_limit_create(const char*);
+int sr_icmp_limit_allow(struct sr_icmp_limit*, uint8_t, uint8_t, uint32_t, uint64_t);
+void sr_icmp_limit_destroy(struct sr_icmp_limit*);
+
+#endif /* -- SR_ICMP_LIMIT_H -- */
@@ -24,6 +24,7 @@
 
 #include "sr_if.h"
 #include "sr_router.h"
+#include "queue.h"
 
 /*--------------------------------------------------------------------- 
  * Method: sr_get_interface
@@ -77,6 +78,13 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
         assert(sr->if_list);
         sr->if_list->next = 0;
         strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
+        sr->if_list->index = 0;
+        sr->if_list->mtu = sr_IFACE_DEFAULT_MTU;
+        sr->if_list->sched = 0;
+        sr->if_list->packet_queue = queue_create_item(NULL, 0, NULL);
+        sr->if_list->arp_requests = 0;
+        sr->if_list->arp_request_time = 0;
+        sr->if_list->copp_sync = 0;
         return;
     }
 
@@ -87,8 +95,15 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
 
     if_walker->next = (struct sr_if*)malloc(sizeof(struct sr_if));
     assert(if_walker->next);
+    if_walker->next->index = if_walker->index + 1;
     if_walker = if_walker->next;
     strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
+    if_walker->mtu = sr_IFACE_DEFAULT_MTU;
+    if_walker->sched = 0;
+    if_walker->packet_queue = queue_create_item(NULL, 0, NULL);
+    if_walker->arp_requests = 0;
+    if_walker->arp_request_time = 0;
+    if_walker->copp_sync = 0;
     if_walker->next = 0;
 } /* -- sr_add_interface -- */ 
 
@@ -164,6 +179,83 @@ void sr_set_ether_mask(struct sr_instance* sr, uint32_t mask_nbo)
 
 } /* -- sr_set_ether_mask -- */
 
+/*--------------------------------------------------------------------- 
+ * Method: sr_set_ether_mtu(..)
+ * Scope: Global
+ *
+ * set the MTU of the LAST interface in the interface list, as learned
+ * from the server or the Linux interface
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_set_ether_mtu(struct sr_instance* sr, uint32_t mtu)
+{
+    struct sr_if* if_walker = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr->if_list);
+    
+    if_walker = sr->if_list;
+    while(if_walker->next)
+    {if_walker = if_walker->next; }
+
+    if(mtu < 576)
+    { mtu = 576; }
+    if(mtu > sr_IFACE_MAX_MTU)
+    { mtu = sr_IFACE_MAX_MTU; }
+    if_walker->mtu = mtu;
+
+} /* -- sr_set_ether_mtu -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_set_mtus(..)
+ * Scope: Global
+ *
+ * Applies a comma separated list of iface=mtu (-m) over the MTUs the
+ * interfaces were given. With sr NULL only checks the list. Returns 0,
+ * or -1 if the list does not parse or names an MTU out of 576..9000.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_set_mtus(struct sr_instance* sr, const char* spec)
+{
+    const char* item = spec;
+    while(*item != '\0')
+    {
+        unsigned int len = strcspn(item, ",");
+        const char* equal = ((const char*)(memchr(item, '=', len)));
+        if((equal == NULL) || (equal == item) || (equal - item >= sr_IFACE_NAMELEN))
+        { return -1; }
+
+        char* end;
+        unsigned long mtu = strtoul(equal + 1, &end, 10);
+        if((end != item + len) || (mtu < 576) || (mtu > sr_IFACE_MAX_MTU))
+        { return -1; }
+
+        if(sr != 0)
+        {
+            char name[sr_IFACE_NAMELEN];
+            memcpy(name, item, equal - item);
+            name[equal - item] = '\0';
+
+            struct sr_if* iface = sr_get_interface(sr, name);
+            if(iface == 0)
+            {
+                fprintf(stderr, "*warning* no interface %s for its MTU\n", name);
+            }
+            else
+            {
+                iface->mtu = mtu;
+            }
+        }
+
+        item += len;
+        if(*item == ',')
+        { item++; }
+    }
+    return 0;
+} /* -- sr_set_mtus -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_print_if_list(..)
  * Scope: Global
@@ -215,4 +307,5 @@ void sr_print_if(struct sr_if* iface)
     DebugMAC(iface->addr);
     Debug("\n");
     Debug("\tinet addr %s\n",inet_ntoa(ip_addr));
+    Debug("\tmtu %u\n",iface->mtu);
 } /* -- sr_print_if -- */
@@ -25,8 +25,13 @@
 #endif
 
 #define sr_IFACE_NAMELEN 32
+#define sr_IFACE_DEFAULT_MTU 1500
+#define sr_IFACE_MAX_MTU 9000   /* jumbo frames */
 
 struct sr_instance;
+struct sr_sched;
+struct queue_item;
+struct sr_arp_request;
 
 /* ----------------------------------------------------------------------------
  * struct sr_if
@@ -42,12 +47,19 @@ struct sr_if
     uint32_t ip;
     uint32_t speed;
     volatile uint32_t mask;
+    uint32_t mtu; /* largest IP packet sent out of the interface */
     struct sr_if* next;
+    uint8_t index; /* position in the interface list */
+    struct sr_sched* sched; /* output queues when shaped (-Q), NULL to send right away */
+    struct queue_item* packet_queue; /* waiting for ARP */
+    struct sr_arp_request* arp_requests; /* unanswered ARP REQUESTs */
+    uint64_t arp_request_time; /* first unanswered request, 0 if none */
 
     /**** New Fields ****/
     uint8_t helloint;
     uint32_t neighbor_id;
     uint32_t neighbor_ip;
+    uint64_t copp_sync;  /* ms, the LSUs of a new neighbor are not policed until then */
     /********************/
 };
 
@@ -56,6 +68,8 @@ void sr_add_interface(struct sr_instance*, const char*);
 void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t ip_nbo);
 void sr_set_ether_mask(struct sr_instance*, uint32_t ip_nbo);
+void sr_set_ether_mtu(struct sr_instance*, uint32_t);
+int sr_set_mtus(struct sr_instance*, const char*);
 void sr_print_if_list(struct sr_instance*);
 void sr_print_if(struct sr_if*);
 
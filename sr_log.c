@@ -0,0 +1,605 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.c
+ *
+ * Description:
+ *
+ * Asynchronous logging, see sr_log.h. Levels are set with -L, e.g.
+ * "-L debug" or "-L fwd=debug,ospf=info", and can be changed at runtime
+ * through the stats socket with "log <spec>".
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "sr_log.h"
+#include "sr_ring.h"
+
+#define LOG_LINE_SIZE 1024
+#define LOG_BATCH_SIZE 65536
+
+volatile uint8_t sr_log_levels[LOG_CATEGORY_NUM] = {LOG_INFO, LOG_INFO, LOG_INFO, LOG_INFO};
+__thread const char* sr_log_host = NULL;
+
+static const char* log_category_names[LOG_CATEGORY_NUM] = {"arp", "fwd", "ospf", "spf"};
+static const char* log_level_names[LOG_LEVEL_NUM] = {"none", "error", "warn", "info", "debug"};
+
+struct sr_log_record
+{
+    uint64_t time;          /* ns since sr_log_init */
+    const char* format;
+    const char* host;       /* sr_log_host when logged */
+    uint16_t len;           /* bytes of args used */
+    uint8_t category;
+    uint8_t level;
+    uint8_t truncated;
+    uint8_t args[LOG_RECORD_SIZE - 32];
+};
+
+static struct sr_ring* log_ring = NULL;
+static FILE* log_file = NULL;
+static uint64_t log_start = 0;
+static pthread_t log_thread;
+
+
+static
+uint64_t log_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t)(ts.tv_sec)) * 1000000000ULL) + ts.tv_nsec - log_start;
+}
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_init
+ *
+ * Sets the levels from spec (NULL keeps the defaults) and starts the
+ * thread writing the records to out. Returns 0 on success.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_log_init(const char* spec, FILE* out)
+{
+    if ((spec != NULL) && (sr_log_set(spec) != 0))
+    {
+        return -1;
+    }
+
+    log_start = log_now();
+    log_file = out;
+    log_ring = sr_ring_create(LOG_RING_SLOTS, sizeof(struct sr_log_record));
+    if (log_ring == NULL)
+    {
+        return -1;
+    }
+    pthread_create(&log_thread, NULL, sr_log_thread, NULL);
+
+    return 0;
+} /* -- sr_log_init -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_set
+ *
+ * spec is either a level for all the categories, or a comma separated
+ * list of category=level. Returns 0 on success.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int log_level(const char* name, unsigned int len)
+{
+    for (int i = 0; i < LOG_LEVEL_NUM; i++)
+    {
+        if ((strlen(log_level_names[i]) == len) && (strncmp(log_level_names[i], name, len) == 0))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int sr_log_set(const char* spec)
+{
+    uint8_t levels[LOG_CATEGORY_NUM];
+    for (int i = 0; i < LOG_CATEGORY_NUM; i++)
+    {
+        levels[i] = sr_log_levels[i];
+    }
+
+    const char* item = spec;
+    while (*item != '\0')
+    {
+        unsigned int len = strcspn(item, ",\n ");
+        const char* equal = ((const char*)(memchr(item, '=', len)));
+        if (equal == NULL)
+        {
+            int level = log_level(item, len);
+            if (level < 0)
+            {
+                return -1;
+            }
+            for (int i = 0; i < LOG_CATEGORY_NUM; i++)
+            {
+                levels[i] = level;
+            }
+        }
+        else
+        {
+            int category = -1;
+            for (int i = 0; i < LOG_CATEGORY_NUM; i++)
+            {
+                if ((strlen(log_category_names[i]) == ((unsigned int)(equal - item))) &&
+                    (strncmp(log_category_names[i], item, equal - item) == 0))
+                {
+                    category = i;
+                }
+            }
+            int level = log_level(equal + 1, len - (equal + 1 - item));
+            if ((category < 0) || (level < 0))
+            {
+                return -1;
+            }
+            levels[category] = level;
+        }
+
+        item += len;
+        while ((*item == ',') || (*item == ' ') || (*item == '\n'))
+        {
+            item++;
+        }
+    }
+
+    for (int i = 0; i < LOG_CATEGORY_NUM; i++)
+    {
+        sr_log_levels[i] = levels[i];
+    }
+    return 0;
+} /* -- sr_log_set -- */
+
+void sr_log_get(char* buf, unsigned int size)
+{
+    unsigned int len = 0;
+    buf[0] = '\0';
+    for (int i = 0; (i < LOG_CATEGORY_NUM) && (len < size); i++)
+    {
+        len += snprintf(buf + len, size - len, "%s%s=%s", (i == 0) ? "" : ",", log_category_names[i],
+            log_level_names[sr_log_levels[i]]);
+    }
+} /* -- sr_log_get -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: log_encode
+ *
+ * Walks the conversions of the format and copies the arguments into the
+ * record, 8 bytes each, strings as a length byte and their characters.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void log_put(struct sr_log_record* record, const void* value, unsigned int len)
+{
+    if (record->len + len > sizeof(record->args))
+    {
+        record->truncated = 1;
+        return;
+    }
+    memcpy(record->args + record->len, value, len);
+    record->len += len;
+}
+
+static
+void log_encode(struct sr_log_record* record, const char* format, va_list args)
+{
+    for (const char* p = format; *p != '\0'; p++)
+    {
+        if (*p != '%')
+        {
+            continue;
+        }
+        p++;
+        if (*p == '%')
+        {
+            continue;
+        }
+
+        int64_t value = 0;
+        while ((*p != '\0') && (strchr("-+ #0", *p) != NULL))
+        {
+            p++;
+        }
+        if (*p == '*')
+        {
+            value = va_arg(args, int);
+            log_put(record, &value, 8);
+            p++;
+        }
+        while ((*p >= '0') && (*p <= '9'))
+        {
+            p++;
+        }
+        if (*p == '.')
+        {
+            p++;
+            if (*p == '*')
+            {
+                value = va_arg(args, int);
+                log_put(record, &value, 8);
+                p++;
+            }
+            while ((*p >= '0') && (*p <= '9'))
+            {
+                p++;
+            }
+        }
+        int longs = 0;
+        while ((*p == 'l') || (*p == 'h') || (*p == 'z'))
+        {
+            longs += (*p == 'h') ? 0 : 1;
+            p++;
+        }
+
+        switch (*p)
+        {
+            case 'd':
+            case 'i':
+                value = (longs == 0) ? va_arg(args, int) : (longs == 1) ? va_arg(args, long) : va_arg(args, long long);
+                log_put(record, &value, 8);
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'c':
+                value = (longs == 0) ? va_arg(args, unsigned int) : (longs == 1) ? va_arg(args, unsigned long) :
+                    va_arg(args, unsigned long long);
+                log_put(record, &value, 8);
+                break;
+            case 'f':
+            case 'g':
+            case 'e':
+            case 'G':
+            case 'E':
+            {
+                double d = va_arg(args, double);
+                log_put(record, &d, 8);
+                break;
+            }
+            case 'p':
+            {
+                void* ptr = va_arg(args, void*);
+                log_put(record, &ptr, 8);
+                break;
+            }
+            case 'I':
+                value = va_arg(args, uint32_t);
+                log_put(record, &value, 8);
+                break;
+            case 'M':
+            {
+                uint8_t mac[8] = {0};
+                memcpy(mac, va_arg(args, const uint8_t*), 6);
+                log_put(record, mac, 8);
+                break;
+            }
+            case 's':
+            {
+                const char* s = va_arg(args, const char*);
+                if (s == NULL)
+                {
+                    s = "(null)";
+                }
+                uint8_t len = strnlen(s, LOG_MAX_STRING);
+                log_put(record, &len, 1);
+                log_put(record, s, len);
+                break;
+            }
+            case '\0':
+                return;
+        }
+    }
+} /* -- log_encode -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: log_format
+ *
+ * Formats a record into a line, in the drain thread. Returns its length.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int64_t log_get(struct sr_log_record* record, unsigned int* offset)
+{
+    int64_t value = 0;
+    if (*offset + 8 <= record->len)
+    {
+        memcpy(&value, record->args + *offset, 8);
+    }
+    *offset += 8;
+    return value;
+}
+
+static
+unsigned int log_format(struct sr_log_record* record, char* line, unsigned int size)
+{
+    unsigned int offset = 0;
+    unsigned int len = snprintf(line, size, "%4llu.%06llu %-4s ", ((unsigned long long)(record->time / 1000000000ULL)),
+        ((unsigned long long)((record->time / 1000) % 1000000)), log_category_names[record->category]);
+    if (record->host != NULL)
+    {
+        len += snprintf(line + len, size - len, "%s ", record->host);
+    }
+
+    for (const char* p = record->format; (*p != '\0') && (len < size - 2); p++)
+    {
+        if (*p != '%')
+        {
+            line[len++] = *p;
+            continue;
+        }
+        if (*(p + 1) == '%')
+        {
+            line[len++] = '%';
+            p++;
+            continue;
+        }
+
+        /* Rebuilds the conversion with the widths resolved and the
+         * integers widened to long long */
+        char spec[32];
+        unsigned int spec_len = 0;
+        spec[spec_len++] = *p++;
+        while ((*p != '\0') && (strchr("-+ #0", *p) != NULL) && (spec_len < 8))
+        {
+            spec[spec_len++] = *p++;
+        }
+        if (*p == '*')
+        {
+            spec_len += snprintf(spec + spec_len, 12, "%d", ((int)(log_get(record, &offset))));
+            p++;
+        }
+        while ((*p >= '0') && (*p <= '9') && (spec_len < 20))
+        {
+            spec[spec_len++] = *p++;
+        }
+        if (*p == '.')
+        {
+            spec[spec_len++] = *p++;
+            if (*p == '*')
+            {
+                spec_len += snprintf(spec + spec_len, 8, "%d", ((int)(log_get(record, &offset))));
+                p++;
+            }
+            while ((*p >= '0') && (*p <= '9') && (spec_len < 28))
+            {
+                spec[spec_len++] = *p++;
+            }
+        }
+        while ((*p == 'l') || (*p == 'h') || (*p == 'z'))
+        {
+            p++;
+        }
+        if (*p == '\0')
+        {
+            break;
+        }
+
+        char text[64];
+        int64_t value;
+        switch (*p)
+        {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                spec[spec_len++] = 'l';
+                spec[spec_len++] = 'l';
+                spec[spec_len++] = *p;
+                spec[spec_len] = '\0';
+                value = log_get(record, &offset);
+                len += snprintf(line + len, size - len, spec, ((long long)(value)));
+                break;
+            case 'c':
+                spec[spec_len++] = 'c';
+                spec[spec_len] = '\0';
+                len += snprintf(line + len, size - len, spec, ((int)(log_get(record, &offset))));
+                break;
+            case 'f':
+            case 'g':
+            case 'e':
+            case 'G':
+            case 'E':
+            {
+                double d;
+                value = log_get(record, &offset);
+                memcpy(&d, &value, 8);
+                spec[spec_len++] = *p;
+                spec[spec_len] = '\0';
+                len += snprintf(line + len, size - len, spec, d);
+                break;
+            }
+            case 'p':
+                spec[spec_len++] = 'p';
+                spec[spec_len] = '\0';
+                value = log_get(record, &offset);
+                len += snprintf(line + len, size - len, spec, ((void*)(value)));
+                break;
+            case 'I':
+            {
+                struct in_addr addr;
+                addr.s_addr = ((uint32_t)(log_get(record, &offset)));
+                inet_ntop(AF_INET, &addr, text, sizeof(text));
+                spec[spec_len++] = 's';
+                spec[spec_len] = '\0';
+                len += snprintf(line + len, size - len, spec, text);
+                break;
+            }
+            case 'M':
+            {
+                uint8_t mac[8];
+                value = log_get(record, &offset);
+                memcpy(mac, &value, 8);
+                snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+                spec[spec_len++] = 's';
+                spec[spec_len] = '\0';
+                len += snprintf(line + len, size - len, spec, text);
+                break;
+            }
+            case 's':
+            {
+                unsigned int text_len = 0;
+                if (offset < record->len)
+                {
+                    text_len = record->args[offset];
+                    if (offset + 1 + text_len > record->len)
+                    {
+                        text_len = 0;
+                    }
+                    memcpy(text, record->args + offset + 1, text_len);
+                }
+                text[text_len] = '\0';
+                offset += 1 + text_len;
+                spec[spec_len++] = 's';
+                spec[spec_len] = '\0';
+                len += snprintf(line + len, size - len, spec, text);
+                break;
+            }
+            default:
+                break;
+        }
+        if (len > size - 2)
+        {
+            len = size - 2;
+        }
+    }
+
+    if (record->truncated && (len + 4 < size - 2))
+    {
+        memcpy(line + len, " ...", 4);
+        len += 4;
+    }
+    line[len++] = '\n';
+    line[len] = '\0';
+    return len;
+} /* -- log_format -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_write
+ *
+ * Called through Log() once the level is known to be enabled. Before
+ * sr_log_init() the record is written right away.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_write(enum sr_log_category category, enum sr_log_level level, const char* format, ...)
+{
+    struct sr_log_record local;
+    struct sr_log_record* record = &local;
+    if (log_ring != NULL)
+    {
+        record = ((struct sr_log_record*)(sr_ring_reserve(log_ring)));
+        if (record == NULL)
+        {
+            return;
+        }
+    }
+
+    record->time = log_now();
+    record->format = format;
+    record->host = sr_log_host;
+    record->len = 0;
+    record->category = category;
+    record->level = level;
+    record->truncated = 0;
+
+    va_list args;
+    va_start(args, format);
+    log_encode(record, format, args);
+    va_end(args);
+
+    if (log_ring != NULL)
+    {
+        sr_ring_commit(log_ring, record);
+    }
+    else
+    {
+        char line[LOG_LINE_SIZE];
+        fwrite(line, 1, log_format(record, line, sizeof(line)), stdout);
+    }
+} /* -- sr_log_write -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_thread
+ *
+ * Drains the ring, batching the formatted lines into large writes
+ *
+ *---------------------------------------------------------------------------*/
+
+void* sr_log_thread(void* arg)
+{
+    char* batch = ((char*)(malloc(LOG_BATCH_SIZE)));
+    unsigned int batch_len = 0;
+    uint64_t drops = 0;
+
+    while (1)
+    {
+        struct sr_log_record* record = ((struct sr_log_record*)(sr_ring_peek(log_ring)));
+        if (record != NULL)
+        {
+            if (batch_len + LOG_LINE_SIZE > LOG_BATCH_SIZE)
+            {
+                fwrite(batch, 1, batch_len, log_file);
+                batch_len = 0;
+            }
+            batch_len += log_format(record, batch + batch_len, LOG_LINE_SIZE);
+            sr_ring_release(log_ring, record);
+            continue;
+        }
+
+        uint64_t ring_drops = __atomic_load_n(&log_ring->drops, __ATOMIC_RELAXED);
+        if (ring_drops != drops)
+        {
+            batch_len += snprintf(batch + batch_len, LOG_LINE_SIZE, "log: %llu records dropped, ring full\n",
+                ((unsigned long long)(ring_drops - drops)));
+            drops = ring_drops;
+        }
+        if (batch_len > 0)
+        {
+            fwrite(batch, 1, batch_len, log_file);
+            fflush(log_file);
+            batch_len = 0;
+        }
+        usleep(1000);
+    }
+
+    return NULL;
+} /* -- sr_log_thread -- */
+
+/* Waits for the records logged so far to be written */
+void sr_log_flush()
+{
+    if (log_ring == NULL)
+    {
+        fflush(stdout);
+        return;
+    }
+    uint64_t pos = __atomic_load_n(&log_ring->enqueue_pos, __ATOMIC_RELAXED);
+    while (((int64_t)(__atomic_load_n(&log_ring->dequeue_pos, __ATOMIC_RELAXED) - pos)) < 0)
+    {
+        usleep(1000);
+    }
+    usleep(2000);
+} /* -- sr_log_flush -- */
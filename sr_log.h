@@ -0,0 +1,82 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.h
+ *
+ * Description:
+ *
+ * Asynchronous logging with levels set per category at runtime. Log()
+ * checks the level of the category and, only if enabled, copies the
+ * format pointer and the raw arguments into a lock-free ring; a
+ * background thread formats and writes the records. A disabled message
+ * costs one branch.
+ *
+ * The format must be a string literal, it is only read when the record
+ * is drained. On top of the printf conversions (no %n) it takes:
+ *
+ *   %I  IPv4 address, a uint32_t in network byte order
+ *   %M  MAC address, a pointer to 6 bytes (copied)
+ *
+ * %s strings are copied, truncated to LOG_MAX_STRING characters.
+ *
+ * When a process runs several routers the event loop sets sr_log_host to
+ * the router it is working for, the lines then give it after the
+ * category and the trace events are on a thread named after it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_LOG_H
+#define SR_LOG_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _SOLARIS_
+#include </usr/include/sys/int_types.h>
+#endif /* SOLARIS */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif
+
+#define LOG_RING_SLOTS 8192
+#define LOG_RECORD_SIZE 240
+#define LOG_MAX_STRING 63
+
+enum sr_log_level
+{
+    LOG_NONE,
+    LOG_ERROR,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG,
+    LOG_LEVEL_NUM
+};
+
+enum sr_log_category
+{
+    LOG_ARP,
+    LOG_FWD,
+    LOG_OSPF,
+    LOG_SPF,
+    LOG_CATEGORY_NUM
+};
+
+extern volatile uint8_t sr_log_levels[LOG_CATEGORY_NUM];
+
+#define sr_log_enabled(category, level) ((level) <= sr_log_levels[category])
+
+#define Log(category, level, x, args...) \
+  do { if (sr_log_enabled(category, level)) sr_log_write(category, level, x, ## args); } while (0)
+
+extern __thread const char* sr_log_host;    /* NULL with a single router */
+
+int sr_log_init(const char*, FILE*);
+int sr_log_set(const char*);
+void sr_log_get(char*, unsigned int);
+void sr_log_write(enum sr_log_category, enum sr_log_level, const char*, ...);
+void sr_log_flush();
+void* sr_log_thread(void*);
+
+#endif /* -- SR_LOG_H -- */
@@ -33,6 +33,20 @@
 #include "sr_router.h"
 #include "sr_rt.h"
 #include "sr_pwospf.h"
+#include "sr_stats.h"
+#include "sr_log.h"
+#include "sr_trace.h"
+#include "sr_afpacket.h"
+#include "sr_uring.h"
+#include "sr_txbuf.h"
+#include "sr_shm.h"
+#include "sr_icmp_limit.h"
+#include "sr_copp.h"
+#include "sr_snapshot.h"
+#include "sr_acl.h"
+#include "sr_flow.h"
+#include "sr_sched.h"
+#include "sr_event.h"
 
 extern char* optarg;
 
@@ -45,12 +59,18 @@ extern char* optarg;
 #define DEFAULT_SERVER "171.67.71.18"
 #define DEFAULT_RTABLE "rtable"
 #define DEFAULT_TOPO 0
+#define MAX_INSTANCES 64 /* routers in one process, one per host of -v */
 
 static void usage(char* );
 static void sr_init_instance(struct sr_instance* );
 static void sr_destroy_instance(struct sr_instance* );
 static void sr_set_user(struct sr_instance* );
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable);
+static int sr_split_hosts(char* list, char** hosts);
+static int sr_read_from_session(struct sr_instance* sr, void* arg);
+static void sr_shutdown(struct sr_instance* instances, int sr_num);
+
+static int sessions_open = 0; /* routers still connected to their server */
 
 /*-----------------------------------------------------------------------------
  *---------------------------------------------------------------------------*/
@@ -66,7 +86,28 @@ int main(int argc, char **argv)
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
-    struct sr_instance sr;
+    unsigned long rotate_bytes = 0;
+    unsigned int rotate_secs = 0;
+    char *stats_path = 0;
+    char *log_spec = 0;
+    char *trace_path = 0;
+    char *afpacket_spec = 0;
+    int use_uring = 0;
+    int tx_deadline = -1;
+    char *icmp_spec = 0;
+    char *copp_spec = 0;
+    char *snapshot_path = 0;
+    char *mtu_spec = 0;
+    char *acl_path = 0;
+    char *sched_spec = 0;
+    char *flow_dest = 0;
+    unsigned int flow_idle = FLOW_IDLE_TIMEOUT;
+    unsigned int flow_active = FLOW_ACTIVE_TIMEOUT;
+    int ecmp_width;
+    struct sr_instance sr; /* options common to every router */
+    char* hosts[MAX_INSTANCES];
+    int sr_num;
+    char path[256];
 
     sr.f_interface[0] = 'n';
     sr.f_interface[1] = 'o';
@@ -74,10 +115,12 @@ int main(int argc, char **argv)
 
     sr.number_of_lsus = 5;
 
+    sr.ecmp_width = DEFAULT_ECMP_WIDTH;
+
 
     printf("Using %s\n", VERSION_INFO);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:f:c:")) != EOF)
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:C:G:T:f:c:e:S:L:J:i:Ub:E:m:A:x:X:Q:P:W:")) != EOF)
     {
         switch (c)
         {
@@ -103,6 +146,12 @@ int main(int argc, char **argv)
             case 'l':
                 logfile = optarg;
                 break;
+            case 'C':
+                rotate_bytes = strtoul(optarg, NULL, 10) * 1000000UL;
+                break;
+            case 'G':
+                rotate_secs = atoi((char *) optarg);
+                break;
             case 'r':
                 rtable = optarg;
                 break;
@@ -122,41 +171,252 @@ int main(int argc, char **argv)
                 sr.number_of_lsus = atoi((char *) optarg);
                 break;
 
+            case 'e':
+                ecmp_width = atoi((char *) optarg);
+                if (ecmp_width < 1)
+                {
+                    ecmp_width = 1;
+                }
+                else if (ecmp_width > SR_RT_MAX_NEXTHOPS)
+                {
+                    ecmp_width = SR_RT_MAX_NEXTHOPS;
+                }
+                sr.ecmp_width = ecmp_width;
+                break;
+
+            case 'S':
+                stats_path = optarg;
+                break;
+
+            case 'L':
+                log_spec = optarg;
+                break;
+
+            case 'J':
+                trace_path = optarg;
+                break;
+
+            case 'i':
+                afpacket_spec = optarg;
+                break;
+            case 'U':
+                use_uring = 1;
+                break;
+            case 'b':
+                tx_deadline = atoi((char *) optarg);
+                if (tx_deadline < 0)
+                {
+                    tx_deadline = 0;
+                }
+                break;
+            case 'E':
+                icmp_spec = optarg;
+                break;
+            case 'P':
+                copp_spec = optarg;
+                break;
+            case 'W':
+                snapshot_path = optarg;
+                break;
+            case 'm':
+                mtu_spec = optarg;
+                if (sr_set_mtus(0, mtu_spec) != 0)
+                {
+                    fprintf(stderr,"Error in MTUs %s\n", mtu_spec);
+                    exit(1);
+                }
+                break;
+            case 'A':
+                acl_path = optarg;
+                break;
+            case 'x':
+                flow_dest = optarg;
+                break;
+            case 'Q':
+                sched_spec = optarg;
+                if (sr_sched_config(0, sched_spec) != 0)
+                {
+                    fprintf(stderr,"Error in shaped rates %s\n", sched_spec);
+                    exit(1);
+                }
+                break;
+            case 'X':
+                if (sr_flow_parse_timeouts(optarg, &flow_idle, &flow_active) != 0)
+                {
+                    fprintf(stderr,"Error in flow timeouts %s\n", optarg);
+                    exit(1);
+                }
+                break;
+
         } /* switch */
     } /* -- while -- */
 
-    /* -- zero out sr instance -- */
-    sr_init_instance(&sr);
+    /* -- the rules are compiled once the interfaces are known, checked now -- */
+    if(acl_path != 0)
+    {
+        struct sr_acl* acl = sr_acl_load(0, acl_path);
+        if(acl == 0)
+        {
+            exit(1);
+        }
+        sr_acl_destroy(acl);
+    }
 
-    /* -- set up routing table from file -- */
-    if(sr_template == NULL) {
-        sr.sr_template[0] = '\0';
-        sr_load_rt_wrap(&sr, rtable);
+    /* -- log levels, records are written by a background thread -- */
+    if(sr_log_init(log_spec, stdout) != 0)
+    {
+        fprintf(stderr,"Error in log levels %s\n", log_spec);
+        exit(1);
+    }
+
+    /* -- one router per host, all of them in this process -- */
+    if((sr_num = sr_split_hosts(host, hosts)) < 0)
+    {
+        fprintf(stderr,"Error: more than %d hosts in %s\n", MAX_INSTANCES, host);
+        exit(1);
     }
-    else
-        strncpy(sr.sr_template, sr_template, 30);
 
-    sr.topo_id = topo;
-    strncpy(sr.host,host,32);
+    /* -- control plane timeline, off unless a file was given -- */
+    if((trace_path != 0) && (sr_trace_init(trace_path, (sr_num > 1) ? "sr" : host) != 0))
+    {
+        fprintf(stderr,"Error opening up trace file %s\n", trace_path);
+        exit(1);
+    }
+    if((sr_num > 1) && ((afpacket_spec != 0) || use_uring))
+    {
+        fprintf(stderr,"Error: -i and -U take a single host\n");
+        exit(1);
+    }
 
-    if(! user )
-    { sr_set_user(&sr); }
-    else
-    { strncpy(sr.user, user, 32); }
+    struct sr_instance* instances = ((struct sr_instance*)(calloc(sr_num, sizeof(struct sr_instance))));
 
-    /* -- set up file pointer for logging of raw packets -- */
-    if(logfile != 0)
+    for(int i = 0; i < sr_num; i++)
     {
-        sr.logfile = sr_dump_open(logfile,0,PACKET_DUMP_SIZE);
-        if(!sr.logfile)
+        struct sr_instance* inst = &instances[i];
+
+        /* -- zero out sr instance -- */
+        sr_init_instance(inst);
+        strcpy(inst->f_interface, sr.f_interface);
+        inst->number_of_lsus = sr.number_of_lsus;
+        inst->ecmp_width = sr.ecmp_width;
+        inst->mtu_spec = mtu_spec;
+        inst->acl_path = acl_path;
+        inst->sched_spec = sched_spec;
+
+        /* -- set up routing table from file -- */
+        if(sr_template == NULL) {
+            inst->sr_template[0] = '\0';
+            sr_load_rt_wrap(inst, rtable);
+        }
+        else
+            strncpy(inst->sr_template, sr_template, 30);
+
+        inst->topo_id = topo;
+        strncpy(inst->host,hosts[i],32);
+
+        if(! user )
+        { sr_set_user(inst); }
+        else
+        { strncpy(inst->user, user, 32); }
+
+        /* -- counters, served on a local socket if one was given -- */
+        if((stats_path != 0) && (sr_num > 1))
+        {
+            snprintf(path, sizeof(path), "%s.%s", stats_path, inst->host);
+        }
+        if(sr_stats_init(inst, (stats_path == 0) ? NULL : ((sr_num > 1) ? path : stats_path)) != 0)
+        {
+            fprintf(stderr,"Error opening up stats socket %s\n", stats_path);
+            exit(1);
+        }
+
+        /* -- limits on the ICMP errors this router sends -- */
+        if((inst->icmp_limit = sr_icmp_limit_create(icmp_spec)) == NULL)
+        {
+            fprintf(stderr,"Error in ICMP limits %s\n", icmp_spec);
+            exit(1);
+        }
+
+        /* -- limits on what is punted to the router -- */
+        if((inst->copp = sr_copp_create(copp_spec)) == NULL)
         {
-            fprintf(stderr,"Error opening up dump file %s\n",
-                    logfile);
+            fprintf(stderr,"Error in control plane limits %s\n", copp_spec);
             exit(1);
         }
+
+        /* -- warm restart, the snapshot is read once the interfaces are known -- */
+        if(snapshot_path != 0)
+        {
+            if(sr_num > 1)
+            {
+                snprintf(path, sizeof(path), "%s.%s", snapshot_path, inst->host);
+            }
+            inst->snapshot = sr_snapshot_create((sr_num > 1) ? path : snapshot_path);
+        }
+
+        /* -- the event loop, packets and timers of every router run from it -- */
+        if(i == 0)
+        {
+            if(sr_event_init(inst) != 0)
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            inst->loop = instances[0].loop;
+            inst->loop->shared = 1;
+        }
+
+        /* -- set up the capture of raw packets, written by its own thread -- */
+        if(logfile != 0)
+        {
+            if(sr_num > 1)
+            {
+                snprintf(path, sizeof(path), "%s.%s", logfile, inst->host);
+            }
+            inst->logfile = sr_dump_start((sr_num > 1) ? path : logfile,PACKET_DUMP_SIZE,rotate_bytes,rotate_secs);
+            if(!inst->logfile)
+            {
+                fprintf(stderr,"Error opening up dump file %s\n",
+                        logfile);
+                exit(1);
+            }
+        }
+
+        /* -- flow table, records exported by its own thread -- */
+        if(flow_dest != 0)
+        {
+            if((sr_num > 1) && (strncmp(flow_dest, "udp:", 4) != 0))
+            {
+                snprintf(path, sizeof(path), "%s.%s", flow_dest, inst->host);
+            }
+            inst->flows = sr_flow_start(inst, ((sr_num > 1) && (strncmp(flow_dest, "udp:", 4) != 0)) ? path : flow_dest,
+                    flow_idle, flow_active, i + 1);
+            if(!inst->flows)
+            {
+                fprintf(stderr,"Error opening up flow export %s\n", flow_dest);
+                exit(1);
+            }
+        }
+    }
+
+    /* -- Linux interfaces instead of a VNS server -- */
+    if(afpacket_spec != 0)
+    {
+        if(sr_afpacket_open(&instances[0], afpacket_spec) != 0)
+        {
+            return 1;
+        }
+        sr_verify_routing_table(&instances[0]);
+        sr_init(&instances[0]);
+
+        sr_event_run(&instances[0]);
+
+        sr_shutdown(instances, sr_num);
+        return 0;
     }
 
-    Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
     if(sr_template)
         Debug("Requesting topology template %s\n", sr_template);
     else {
@@ -165,24 +425,63 @@ int main(int argc, char **argv)
         Debug("(falling back to original port for -t type connection)\n");
     }
 
-    /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,port,server) == -1)
+    for(int i = 0; i < sr_num; i++)
     {
-        return 1;
-    }
+        struct sr_instance* inst = &instances[i];
+        sr_log_host = (sr_num > 1) ? inst->host : NULL;
 
-    if(sr_template != NULL) { /* we've recv'd the rtable now, so read it in */
-        Debug("Connected to new instantiation of topology template %s\n", sr_template);
-        sr_load_rt_wrap(&sr, ((char*)("rtable.vrhost")));
-    }
+        /* connect to server and negotiate session */
+        Debug("Client %s connecting to Server %s:%d\n", inst->user, server, port);
+        if(sr_connect_to_server(inst,port,server) == -1)
+        {
+            return 1;
+        }
+
+        if(sr_template != NULL) { /* we've recv'd the rtable now, so read it in */
+            Debug("Connected to new instantiation of topology template %s\n", sr_template);
+            sr_load_rt_wrap(inst, ((char*)("rtable.vrhost")));
+        }
+
+        /* -- packets through shared memory with a server on this machine -- */
+        if((server[0] == '/') && !use_uring && (sr_shm_offer(inst) != 0))
+        {
+            fprintf(stderr,"Shared memory unavailable, packets stay on the socket\n");
+        }
 
-    /* call router init (for arp subsystem etc.) */
-    sr_init(&sr);
+        /* -- batched reads and writes on the connection -- */
+        if(use_uring && (sr_uring_open(inst) != 0))
+        {
+            return 1;
+        }
+        else if(!use_uring && (tx_deadline >= 0) && (sr_coalesce_tx(inst, tx_deadline) != 0))
+        {
+            return 1;
+        }
+
+        /* call router init (for arp subsystem etc.) */
+        sr_init(inst);
+    }
 
     /* -- whizbang main loop ;-) */
-    while( sr_read_from_server(&sr) == 1);
+    if(instances[0].uring)
+    {
+        while( sr_uring_read(&instances[0]) == 1);
+    }
+    else
+    {
+        for(int i = 0; i < sr_num; i++)
+        {
+            if(sr_event_add_fd(&instances[i], instances[i].sockfd, sr_read_from_session, NULL) != 0)
+            {
+                fprintf(stderr,"Error: cannot wait on the session of %s\n", instances[i].host);
+                return 1;
+            }
+            sessions_open++;
+        }
+        sr_event_run(&instances[0]);
+    }
 
-    sr_destroy_instance(&sr);
+    sr_shutdown(instances, sr_num);
 
     return 0;
 }/* -- main -- */
@@ -195,10 +494,33 @@ int main(int argc, char **argv)
 static void usage(char* argv0)
 {
     printf("Simple Router Client\n");
-    printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
+    printf("Format: %s [-h] [-v host,...] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
     printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
+    printf("           [-l log file] [-C rotate MB] [-G rotate secs] \n");
+    printf("           [-e ecmp width] \n");
+    printf("           [-S stats socket] [-L log levels] [-J trace file] \n");
+    printf("           [-i iface=linux iface,...] (AF_PACKET, no server) \n");
+    printf("           [-U] (io_uring on the server connection) \n");
+    printf("           [-b deadline ms] (frames to the server share writes) \n");
+    printf("           [-E kind=rate/burst,...] (ICMP error limits) \n");
+    printf("           [-P kind=rate/burst,...] (control plane limits) \n");
+    printf("           [-m iface=mtu,...] (MTUs, 576 to %d) \n", sr_IFACE_MAX_MTU);
+    printf("           [-A acl file] (permit/deny rules, see sr_acl.h) \n");
+    printf("           [-x flow file|udp:host:port] [-X idle/active secs] \n");
+    printf("           [-Q iface=Mbit/s,...] (shaped, ARP and OSPF first) \n");
+    printf("           [-W snapshot file] (warm restart, LSDB, routes and ARP) \n");
+    printf("   a server given as a path is a Unix socket, packets then go\n");
+    printf("   through shared memory (unless -U), the port is ignored\n");
+    printf("   several hosts run as many routers in this process, stats\n");
+    printf("   socket, log, flow and snapshot file names then end in .host\n");
+    printf("   log levels: none, error, warn, info or debug, for all of\n");
+    printf("   arp, fwd, ospf, spf or per category, e.g. fwd=debug,ospf=info\n");
+    printf("   ICMP error limits per second: ttl, port, host, frag and per source, or\n");
+    printf("   off, default %s\n", ICMP_LIMIT_DEFAULT);
+    printf("   control plane limits in packets per second: arp, icmp, hello, lsu,\n");
+    printf("   local, neighbor, or off, default %s\n", COPP_DEFAULT);
+    printf("   flows are exported as IPFIX, timeouts default %d/%d\n", FLOW_IDLE_TIMEOUT, FLOW_ACTIVE_TIMEOUT);
     printf("   defaults server=%s port=%d host=%s  \n",
             DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
 } /* -- usage -- */
@@ -240,16 +562,93 @@ static void sr_destroy_instance(struct sr_instance* sr)
     /* REQUIRES */
     assert(sr);
 
+    if(sr->snapshot)
+    {
+        sr_snapshot_destroy(sr);
+    }
+
     if(sr->logfile)
     {
-        sr_dump_close(sr->logfile);
+        sr_dump_stop(sr->logfile);
     }
 
+    if(sr->flows)
+    {
+        sr_flow_stop(sr->flows);
+    }
+
+    if(sr->afpacket)
+    {
+        sr_afpacket_close(sr);
+    }
+
+    if(sr->uring)
+    {
+        sr_uring_close(sr);
+    }
+
+    if(sr->txbuf)
+    {
+        sr_txbuf_destroy(sr->txbuf);
+    }
+
+    if(sr->shm)
+    {
+        sr_shm_close(sr);
+    }
+
+    if(sr->icmp_limit)
+    {
+        sr_icmp_limit_destroy(sr->icmp_limit);
+    }
+
+    if(sr->copp)
+    {
+        sr_copp_destroy(sr->copp);
+    }
+
+    sr_sched_destroy(sr);
+
+    if(sr->acl)
+    {
+        sr_acl_destroy(sr->acl);
+    }
+    if(sr->acl_pending)
+    {
+        sr_acl_destroy(sr->acl_pending);
+    }
+
+    sr_stats_destroy(sr);
+
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
     */
 } /* -- sr_destroy_instance -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_shutdown(..)
+ * Scope: Local
+ *
+ * Destroys every router, then what they shared
+ *
+ *----------------------------------------------------------------------------*/
+
+static void sr_shutdown(struct sr_instance* instances, int sr_num)
+{
+    for(int i = 0; i < sr_num; i++)
+    {
+        sr_log_host = (sr_num > 1) ? instances[i].host : NULL;
+        sr_destroy_instance(&instances[i]);
+    }
+    sr_log_host = NULL;
+
+    sr_event_destroy(&instances[0]);
+    sr_trace_stop();
+    sr_log_flush();
+
+    free(instances);
+} /* -- sr_shutdown -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_init_instance(..)
  * Scope: Local
@@ -263,12 +662,30 @@ static void sr_init_instance(struct sr_instance* sr)
     assert(sr);
 
     sr->sockfd = -1;
+    pthread_mutex_init(&sr->sock_lock, NULL);
     sr->user[0] = 0;
     sr->host[0] = 0;
     sr->topo_id = 0;
     sr->if_list = 0;
     sr->routing_table = 0;
     sr->logfile = 0;
+    sr->stats = 0;
+    sr->afpacket = 0;
+    sr->uring = 0;
+    sr->txbuf = 0;
+    sr->shm = 0;
+    sr->icmp_limit = 0;
+    sr->copp = 0;
+    sr->snapshot = 0;
+    sr->flows = 0;
+    sr->mtu_spec = 0;
+    sr->sched_spec = 0;
+    sr->acl_path = 0;
+    sr->acl = 0;
+    sr->acl_pending = 0;
+    pthread_mutex_init(&sr->acl_lock, NULL);
+    sr->tx_in_batch = 0;
+    sr->loop = 0;
 } /* -- sr_init_instance -- */
 
 /*-----------------------------------------------------------------------------
@@ -335,3 +752,57 @@ static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
     sr_print_routing_table(sr);
     //printf("-----------------------------------------------------------------------\n");
 }
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_split_hosts(..)
+ * Scope: Local
+ *
+ * Splits the comma separated hosts of -v, returns how many or -1 if more
+ * than MAX_INSTANCES
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_split_hosts(char* list, char** hosts)
+{
+    int num = 0;
+    char* copy = strdup(list);
+
+    for(char* name = strtok(copy, ","); name != NULL; name = strtok(NULL, ","))
+    {
+        if(num == MAX_INSTANCES)
+        {
+            return -1;
+        }
+        hosts[num++] = name;
+    }
+    if(num == 0)
+    {
+        hosts[num++] = list;
+    }
+
+    return num;
+} /* -- sr_split_hosts -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_session(..)
+ * Scope: Local
+ *
+ * Reads a router's connection from the shared event loop. A session that
+ * ends takes its router out of the loop, the loop itself ends with the
+ * last one.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_read_from_session(struct sr_instance* sr, void* arg)
+{
+    int ret = sr_read_from_server_ready(sr, arg);
+
+    if((ret == 1) || (--sessions_open == 0))
+    {
+        return ret;
+    }
+
+    Debug("Session of %s closed, %d routers left\n", sr->host, sessions_open);
+    sr_event_detach(sr);
+    return 1;
+} /* -- sr_read_from_session -- */
@@ -200,6 +200,7 @@ struct sr_arphdr
 #define ICMP_DESTINATION_UNREACHABLE_TYPE 3
 #define ICMP_HOST_UNREACHABLE_CODE 1
 #define ICMP_PORT_UNREACHABLE_CODE 3
+#define ICMP_FRAG_NEEDED_CODE 4
 
 #define ICMP_TIME_EXCEEDED_TYPE 11
 #define ICMP_TIME_EXCEEDED_CODE 0
@@ -220,15 +221,7 @@ struct sr_icmphdr
 
 #define ARP_REQUESTS_NUM 5
 #define ARP_REQUEST_PKT_LEN 42
-
-struct sr_arp_thread_param
-{
-    struct sr_instance* sr;
-    uint8_t   counter;
-    uint8_t   packet[ARP_REQUEST_PKT_LEN];
-    char interface[sr_IFACE_NAMELEN];
-    uint32_t target_ip;
-} __attribute__ ((packed)) ;
+#define ARP_REQUEST_INTERVAL 5000 /* ms between two ARP REQUESTs */
 /***************************************************************************/
 
 
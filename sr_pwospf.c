@@ -25,36 +25,19 @@
 #include "pwospf_neighbors.h"
 #include "pwospf_topology.h"
 #include "dijkstra_stack.h"
+#include "sr_stats.h"
+#include "sr_log.h"
+#include "sr_trace.h"
+#include "sr_copp.h"
 //#include "dijkstra_heap.h"
 
 
-//pthread_t hello_thread;
-pthread_t hello_packet_thread;
-pthread_t all_lsu_thread;
-pthread_t lsu_thread;
-pthread_t neighbors_thread;
-pthread_t topology_entries_thread;
-pthread_t rx_lsu_thread;
-pthread_t dijkstra_thread;
+static const uint8_t ospf_multicast_mac[ETHER_ADDR_LEN] = {0x01, 0x00, 0x5e, 0x00, 0x00, 0x05};
 
-pthread_mutex_t dijkstra_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-in_addr router_id;
-uint8_t ospf_multicast_mac[ETHER_ADDR_LEN];
-struct ospfv2_neighbor* first_neighbor;
-struct ospfv2_topology_entry* first_topology_entry;
-uint16_t sequence_num;
-
-struct dijkstra_item* dijkstra_stack;
-struct dijkstra_item* dijkstra_heap;
-//int dijkstra_heap_empty_item_index;
-
-uint8_t fault_count;
-uint8_t int_down;
-
-
-/* -- declaration of main thread function for pwospf subsystem --- */
-static void* pwospf_run_thread(void* arg);
+/* -- declaration of the timer callbacks started by pwospf_init --- */
+static void pwospf_start(struct sr_instance*, void*);
+static void spf_expired(struct sr_instance*, void*);
 
 /*---------------------------------------------------------------------
  * Method: pwospf_init(..)
@@ -75,29 +58,33 @@ int pwospf_init(struct sr_instance* sr)
     assert(sr->ospf_subsys);
     pthread_mutex_init(&(sr->ospf_subsys->lock), 0);
 
+    sr->ospf_subsys->lsu_pending = 0;
+    sr->ospf_subsys->last_lsu = 0;
+    sr->ospf_subsys->lsu_rx_time = 0;
+
+    sr_timer_init(&sr->ospf_subsys->start_timer, pwospf_start, NULL);
+    sr_timer_init(&sr->ospf_subsys->hello_timer, send_hellos, NULL);
+    sr_timer_init(&sr->ospf_subsys->lsu_timer, send_all_lsu, NULL);
+    sr_timer_init(&sr->ospf_subsys->neighbor_timer, check_neighbors_life, NULL);
+    sr_timer_init(&sr->ospf_subsys->topology_timer, check_topology_entries_age, NULL);
+    sr_timer_init(&sr->ospf_subsys->spf_timer, spf_expired, NULL);
 
-    /* -- handle subsystem initialization here! -- */
-    router_id.s_addr = 0;
 
-    ospf_multicast_mac[0] = 0x01;
-    ospf_multicast_mac[1] = 0x00;
-    ospf_multicast_mac[2] = 0x5e;
-    ospf_multicast_mac[3] = 0x00;
-    ospf_multicast_mac[4] = 0x00;
-    ospf_multicast_mac[5] = 0x05;
+    /* -- handle subsystem initialization here! -- */
+    sr->ospf_subsys->router_id.s_addr = 0;
 
-    first_neighbor = NULL;
+    sr->ospf_subsys->first_neighbor = NULL;
 
-    sequence_num = 0;
+    sr->ospf_subsys->sequence_num = 0;
 
 
     struct in_addr zero;
     zero.s_addr = 0;
-    first_neighbor = create_ospfv2_neighbor(zero);
-    first_topology_entry = create_ospfv2_topology_entry(zero, zero, zero, zero, zero, 0);
+    sr->ospf_subsys->first_neighbor = create_ospfv2_neighbor(zero, zero);
+    sr->ospf_subsys->first_topology_entry = create_ospfv2_topology_entry(zero, zero, zero, zero, zero, 0);
 
-    fault_count = 0;
-    int_down = 0;
+    sr->ospf_subsys->fault_count = 0;
+    sr->ospf_subsys->int_down = 0;
 
     /*dijkstra_heap_init(dijkstra_heap);
     dijkstra_heap_empty_item_index = 0;*/
@@ -115,11 +102,8 @@ int pwospf_init(struct sr_instance* sr)
         int_temp = int_temp->next;
     }*/
 
-    /* -- start thread subsystem -- */
-    if( pthread_create(&sr->ospf_subsys->thread, 0, pwospf_run_thread, sr)) { 
-        perror("pthread_create");
-        assert(0);
-    }
+    /* -- start the subsystem once the interfaces are up -- */
+    sr_timer_add(sr, &sr->ospf_subsys->start_timer, OSPF_START_DELAY);
 
     return 0; /* success */
 } /* -- pwospf_init -- */
@@ -152,38 +136,37 @@ void pwospf_unlock(struct pwospf_subsys* subsys)
 } /* -- pwospf_subsys -- */
 
 /*---------------------------------------------------------------------
- * Method: pwospf_run_thread
+ * Method: pwospf_start
  *
- * Main thread of pwospf subsystem. 
+ * Start timer of pwospf subsystem, OSPF_START_DELAY ms after
+ * pwospf_init(). Starts the HELLO and LSU timers.
  *
  *---------------------------------------------------------------------*/
 
 static
-void* pwospf_run_thread(void* arg)
+void pwospf_start(struct sr_instance* sr, void* arg)
 {
-    sleep(5);
-
-    struct sr_instance* sr = (struct sr_instance*)arg;
-
-    while(router_id.s_addr == 0)
+    struct sr_if* int_temp = sr->if_list;
+    while(int_temp != NULL)
     {
-        struct sr_if* int_temp = sr->if_list;
-        while(int_temp != NULL)
+        if (int_temp->ip > sr->ospf_subsys->router_id.s_addr)
         {
-            if (int_temp->ip > router_id.s_addr)
-            {
-                router_id.s_addr = int_temp->ip;
-            }
-
-            int_temp = int_temp->next;
+            sr->ospf_subsys->router_id.s_addr = int_temp->ip;
         }
+
+        int_temp = int_temp->next;
+    }
+    if (sr->ospf_subsys->router_id.s_addr == 0)
+    {
+        /* -- no address yet, try again -- */
+        sr_timer_add(sr, &sr->ospf_subsys->start_timer, 1000);
+        return;
     }
-    Debug("\n\nPWOSPF: Selecting the highest IP address on a router as the router ID [according to Cisco]\n");
-    Debug("-> PWOSPF: The router ID is [%s]\n", inet_ntoa(router_id));
+    /* Highest IP address on the router, as Cisco does */
+    Log(LOG_OSPF, LOG_INFO, "PWOSPF: The router ID is [%I]", sr->ospf_subsys->router_id.s_addr);
 
 
-    Debug("\nPWOSPF: Detecting the router interfaces and adding their networks to the routing table\n");
-    struct sr_if* int_temp = sr->if_list;
+    int_temp = sr->if_list;
     while(int_temp != NULL)
     {
         struct in_addr ip;
@@ -199,86 +182,61 @@ void* pwospf_run_thread(void* arg)
 
         if (check_route(sr, network) == 0)
         {
-            Debug("-> PWOSPF: Adding the directly connected network [%s, ", inet_ntoa(network));
-            Debug("%s] to the routing table\n", inet_ntoa(mask));
+            Log(LOG_OSPF, LOG_INFO, "PWOSPF: Adding the directly connected network [%I, %I] to the routing table",
+                network.s_addr, mask.s_addr);
             sr_add_rt_entry(sr, network, gw, mask, int_temp->name, 1);
         }
         int_temp = int_temp->next;
     }
     
-    Debug("\n-> PWOSPF: Printing the forwarding table\n");
     print_routing_table(sr);
 
 
-    pthread_create(&hello_packet_thread, NULL, send_hellos, sr);
-    pthread_create(&all_lsu_thread, NULL, send_all_lsu, sr);
-    pthread_create(&neighbors_thread, NULL, check_neighbors_life, NULL);
-    pthread_create(&topology_entries_thread, NULL, check_topology_entries_age, sr);
+    /* -- LSU refreshes jittered by +-25% so that the routers do not flood in lockstep -- */
+    uint64_t now = sr_timer_now();
+    pwospf_lock(sr->ospf_subsys);
+    sr->ospf_subsys->next_refresh = now + (((OSPF_LSU_REFRESH_INT * 3) / 4) * 1000) + (rand() % (((OSPF_LSU_REFRESH_INT / 2) * 1000) + 1));
+    sr->ospf_subsys->next_fault = now + (OSPF_DEFAULT_LSUINT * 1000);
+    pwospf_unlock(sr->ospf_subsys);
 
-    return NULL;
-} /* -- run_ospf_thread -- */
+    sr_timer_add(sr, &sr->ospf_subsys->hello_timer, 0);
+    sr_timer_add(sr, &sr->ospf_subsys->lsu_timer, 0);
+} /* -- pwospf_start -- */
 
 
 /*---------------------------------------------------------------------
- * Method: send_hello_packet
+ * Method: send_hellos
  *
- * Constructing and Sending HELLO packets. 
+ * HELLO timer, sends a HELLO packet out of every interface every
+ * OSPF_DEFAULT_HELLOINT seconds
  *
  *---------------------------------------------------------------------*/
 
-void* send_hellos(void* arg)
+void send_hellos(struct sr_instance* sr, void* arg)
 {
-    struct sr_instance* sr = (struct sr_instance*)arg;
+    pwospf_lock(sr->ospf_subsys);
 
-    while(1)
+    /* Checking all the interfaces for sending HELLO packet */
+    struct sr_if* int_temp = sr->if_list;
+    while(int_temp != NULL)
     {
-        /* -- PWOSPF subsystem functionality should start  here! -- */
-
-        /*pwospf_lock(sr->ospf_subsys);
-        printf(" pwospf subsystem sleeping \n");
-        pwospf_unlock(sr->ospf_subsys);
-        sleep(2);
-        printf(" pwospf subsystem awake \n");*/
-
-
-        usleep(1000000);
-        pwospf_lock(sr->ospf_subsys);
-
-
-        /* Checking all the interfaces for sending HELLO packet */
-        struct sr_if* int_temp = sr->if_list;
-        while(int_temp != NULL)
+        if (sr->ospf_subsys->int_down == 1)
         {
-            if (int_down == 1)
-            {
-                if (strcmp(int_temp->name, sr->f_interface) == 0)
-                {
-                    int_temp = int_temp->next;
-                    continue;
-                }
-            }
-            
-            if (int_temp->helloint > 0)
+            if (strcmp(int_temp->name, sr->f_interface) == 0)
             {
-                int_temp->helloint--;
+                int_temp = int_temp->next;
+                continue;
             }
-            else
-            {
-                struct powspf_hello_lsu_param* hello_param = ((powspf_hello_lsu_param*)(malloc(sizeof(powspf_hello_lsu_param))));
-                hello_param->sr = sr;
-                hello_param->interface = int_temp;
-                pthread_create(&hello_packet_thread, NULL, send_hello_packet, hello_param);
+        }
 
-                int_temp->helloint = OSPF_DEFAULT_HELLOINT;
-            }
+        send_hello_packet(sr, int_temp);
 
-            int_temp = int_temp->next;
-        }
+        int_temp = int_temp->next;
+    }
 
-        pwospf_unlock(sr->ospf_subsys);
-    };
+    pwospf_unlock(sr->ospf_subsys);
 
-    return NULL;
+    sr_timer_add(sr, &sr->ospf_subsys->hello_timer, OSPF_DEFAULT_HELLOINT * 1000);
 } /* -- send_hellos -- */
 
 
@@ -289,11 +247,9 @@ void* send_hellos(void* arg)
  *
  *---------------------------------------------------------------------*/
 
-void* send_hello_packet(void* arg)
+void send_hello_packet(struct sr_instance* sr, struct sr_if* interface)
 {
-    struct powspf_hello_lsu_param* hello_param = ((struct powspf_hello_lsu_param*)(arg));
-
-    Debug("\n\nPWOSPF: Constructing HELLO packet for interface %s: \n", hello_param->interface->name);
+    Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Constructing HELLO packet for interface %s", interface->name);
     struct sr_ethernet_hdr* tx_e_hdr = ((sr_ethernet_hdr*)(malloc(sizeof(sr_ethernet_hdr))));
     struct ip* tx_ip_hdr = ((ip*)(malloc(sizeof(ip))));
     struct ospfv2_hdr* tx_ospf_hdr = ((ospfv2_hdr*)(malloc(sizeof(ospfv2_hdr))));
@@ -312,7 +268,7 @@ void* send_hello_packet(void* arg)
     /* Source address */
     for (int i = 0; i < ETHER_ADDR_LEN; i++)
     {
-        tx_e_hdr->ether_shost[i] = ((uint8_t)(hello_param->interface->addr[i]));
+        tx_e_hdr->ether_shost[i] = ((uint8_t)(interface->addr[i]));
     }         
 
     /* Type */
@@ -348,7 +304,7 @@ void* send_hello_packet(void* arg)
     tx_ip_hdr->ip_sum = 0;
 
     /* Source IP address */
-    tx_ip_hdr->ip_src.s_addr = hello_param->interface->ip;
+    tx_ip_hdr->ip_src.s_addr = interface->ip;
 
     /* Destination IP address */
     tx_ip_hdr->ip_dst.s_addr = htonl(OSPF_AllSPFRouters);
@@ -367,10 +323,10 @@ void* send_hello_packet(void* arg)
     tx_ospf_hdr->len = htons(sizeof(ospfv2_hdr) + sizeof(ospfv2_hello_hdr));
 
     /* Router ID */
-    tx_ospf_hdr->rid = router_id.s_addr;    //It is the highest IP address on a router [according to Cisco]
+    tx_ospf_hdr->rid = sr->ospf_subsys->router_id.s_addr;    //It is the highest IP address on a router [according to Cisco]
 
     /* Area ID */
-    tx_ospf_hdr->aid = htonl(171); //((uint8_t)(hello_param->interface->ip));    //Since we only have one Area which is Area0
+    tx_ospf_hdr->aid = htonl(171); //((uint8_t)(interface->ip));    //Since we only have one Area which is Area0
 
     /* Checksum */
     tx_ospf_hdr->csum = 0;
@@ -405,11 +361,17 @@ void* send_hello_packet(void* arg)
     ((ospfv2_hdr*)(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip)))->csum =
         calc_cksum(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip), sizeof(ospfv2_hdr) + sizeof(ospfv2_hello_hdr));
 
-    Debug("-> PWOSPF: Sending HELLO Packet of length = %d, out of the interface: %s\n", packet_len, hello_param->interface->name);
-    sr_send_packet(hello_param->sr, ((uint8_t*)(tx_packet)), packet_len, hello_param->interface->name);
+    Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Sending HELLO Packet of length = %d, out of the interface: %s",
+        packet_len, interface->name);
+    sr_send_packet(sr, ((uint8_t*)(tx_packet)), packet_len, interface->name);
+    sr_stats_inc(sr, STATS_OSPF_HELLO_TX);
+    TraceInstant("hello tx", "ospf", interface->name, 0);
 
-
-    return NULL;
+    free(tx_packet);
+    free(tx_ospf_hello_hdr);
+    free(tx_ospf_hdr);
+    free(tx_ip_hdr);
+    free(tx_e_hdr);
 } /* -- send_hello_packet -- */
 
 
@@ -427,19 +389,20 @@ void handling_ospfv2_packets(struct sr_instance* sr, uint8_t* packet, unsigned i
     switch(rx_ospfv2_hdr->type)
     {
         case OSPF_TYPE_HELLO:
+            sr_stats_inc(sr, STATS_OSPF_HELLO_RX);
             handling_ospfv2_hello_packets(sr, packet, length, rx_if);
             break;
 
         case OSPF_TYPE_LSU:
-            struct powspf_rx_lsu_param* rx_lsu_param = ((powspf_rx_lsu_param*)(malloc(sizeof(powspf_rx_lsu_param))));
+            sr_stats_inc(sr, STATS_OSPF_LSU_RX);
+            TraceInstant("lsu rx", "ospf", rx_if->name, rx_ospfv2_hdr->rid);
+            struct powspf_rx_lsu_param* rx_lsu_param = ((powspf_rx_lsu_param*)(malloc(sizeof(powspf_rx_lsu_param) + length)));
             rx_lsu_param->sr = sr;
-            for (unsigned int i = 0; i < length; i++)
-            {
-                rx_lsu_param->packet[i] = packet[i];
-            }
+            memcpy(rx_lsu_param->packet, packet, length);
             rx_lsu_param->length = length;
             rx_lsu_param->rx_if = rx_if;
-            pthread_create(&rx_lsu_thread, NULL, handling_ospfv2_lsu_packets, rx_lsu_param);
+            rx_lsu_param->rx_time = sr_stats_now();
+            handling_ospfv2_lsu_packets(rx_lsu_param);
             break;
     }
 } /* -- handling_ospfv2_packets -- */
@@ -462,10 +425,8 @@ void handling_ospfv2_hello_packets(struct sr_instance* sr, uint8_t* packet, unsi
     neighbor_id.s_addr = rx_ospfv2_hdr->rid;
     struct in_addr net_mask;
     net_mask.s_addr = rx_ospfv2_hello_hdr->nmask;
-    Debug("-> PWOSPF: Detecting PWOSPF HELLO Packet from:\n");
-    Debug("      [Neighbor ID = %s]\n", inet_ntoa(neighbor_id));
-    Debug("      [Neighbor IP = %s]\n", inet_ntoa(rx_ip_hdr->ip_src));
-    Debug("      [Network Mask = %s]\n", inet_ntoa(net_mask));
+    Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Detecting PWOSPF HELLO Packet from [Neighbor ID = %I] [Neighbor IP = %I] [Network Mask = %I]",
+        neighbor_id.s_addr, rx_ip_hdr->ip_src.s_addr, net_mask.s_addr);
 
     /* Checking checksum */
     uint16_t rx_checksum = rx_ospfv2_hdr->csum;
@@ -473,23 +434,25 @@ void handling_ospfv2_hello_packets(struct sr_instance* sr, uint8_t* packet, unsi
     uint16_t calc_checksum = calc_cksum(packet + sizeof(sr_ethernet_hdr) + sizeof(ip), sizeof(ospfv2_hdr) + sizeof(ospfv2_hello_hdr));
     if (calc_checksum != rx_checksum)
     {
-        Debug("-> PWOSPF: HELLO Packet dropped, invalid checksum\n");
+        Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: HELLO Packet dropped, invalid checksum");
         return;
     }
     rx_ospfv2_hdr->csum = rx_checksum;
 
     if (rx_ospfv2_hello_hdr->nmask != rx_if->mask)
     {
-        Debug("-> PWOSPF: HELLO Packet dropped, invalid hello network mask\n");
+        Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: HELLO Packet dropped, invalid hello network mask");
         return;
     }
 
     if (rx_ospfv2_hello_hdr->helloint != htons(OSPF_DEFAULT_HELLOINT))
     {
-        Debug("-> PWOSPF: HELLO Packet dropped, invalid hello interval\n");
+        Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: HELLO Packet dropped, invalid hello interval");
         return;
     }
 
+    TraceInstant("hello rx", "ospf", rx_if->name, neighbor_id.s_addr);
+
     /* Set the neighbor id and ip of the interface at which the HELLO packet is received */
     int new_neighbor = 0;
     if (rx_if->neighbor_id != rx_ospfv2_hdr->rid)
@@ -499,14 +462,31 @@ void handling_ospfv2_hello_packets(struct sr_instance* sr, uint8_t* packet, unsi
     }
     rx_if->neighbor_ip = rx_ip_hdr->ip_src.s_addr;
 
-    refresh_neighbors_alive(first_neighbor, neighbor_id);
+    pwospf_lock(sr->ospf_subsys);
+    refresh_neighbors_alive(sr->ospf_subsys->first_neighbor, neighbor_id, rx_ip_hdr->ip_src);
+    pwospf_unlock(sr->ospf_subsys);
+
+    /* Expiries only move later, the timer checks them when it is due */
+    if (!sr_timer_armed(&sr->ospf_subsys->neighbor_timer))
+    {
+        sr_timer_add(sr, &sr->ospf_subsys->neighbor_timer, OSPF_NEIGHBOR_TIMEOUT * 1000);
+    }
 
+    /* A new adjacency changes our link state, the neighbor also gets our
+     * topology table right away instead of waiting for the refreshes. A
+     * hello goes first so the neighbor knows us when the LSUs arrive, and
+     * the LSDB it sends us in turn is not policed */
     if (new_neighbor == 1)
     {
-        struct powspf_hello_lsu_param* lsu_param = ((powspf_hello_lsu_param*)(malloc(sizeof(powspf_hello_lsu_param))));
-        lsu_param->sr = sr;
-        lsu_param->interface = rx_if;
-        pthread_create(&lsu_thread, NULL, send_lsu, lsu_param);
+        TraceInstant("neighbor up", "ospf", rx_if->name, neighbor_id.s_addr);
+        sr_copp_sync(rx_if);
+        pwospf_lock(sr->ospf_subsys);
+        schedule_lsu(sr);
+        send_hello_packet(sr, rx_if);
+        send_lsdb(sr, rx_if);
+        pwospf_unlock(sr->ospf_subsys);
+
+        schedule_dijkstra(sr);
     }
 } /* -- handling_ospfv2_hello_packets -- */
 
@@ -518,9 +498,8 @@ void handling_ospfv2_hello_packets(struct sr_instance* sr, uint8_t* packet, unsi
  *
  *---------------------------------------------------------------------*/
 
-void* handling_ospfv2_lsu_packets(void* arg)
+void handling_ospfv2_lsu_packets(struct powspf_rx_lsu_param* rx_lsu_param)
 {
-    struct powspf_rx_lsu_param* rx_lsu_param = ((struct powspf_rx_lsu_param*)(arg));
 
     struct ip* rx_ip_hdr = ((struct ip*)(rx_lsu_param->packet + sizeof(sr_ethernet_hdr)));
     struct ospfv2_hdr* rx_ospfv2_hdr = ((struct ospfv2_hdr*)(rx_lsu_param->packet + sizeof(sr_ethernet_hdr) + sizeof(ip)));
@@ -530,14 +509,7 @@ void* handling_ospfv2_lsu_packets(void* arg)
 
     struct in_addr neighbor_id;
     neighbor_id.s_addr = rx_ospfv2_hdr->rid;
-    Debug("-> PWOSPF: Detecting LSU Packet from [Neighbor ID = %s]\n", inet_ntoa(neighbor_id));
-
-    /* Check the Router ID */
-    if (rx_ospfv2_hdr->rid == router_id.s_addr)
-    {
-        Debug("-> PWOSPF: LSU Packet dropped, originated by this router\n");
-        return NULL;        
-    }
+    Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Detecting LSU Packet from [Neighbor ID = %I]", neighbor_id.s_addr);
 
     /* Checking checksum */
     uint16_t rx_checksum = rx_ospfv2_hdr->csum;
@@ -545,12 +517,54 @@ void* handling_ospfv2_lsu_packets(void* arg)
     uint16_t calc_checksum = calc_cksum(rx_lsu_param->packet + sizeof(sr_ethernet_hdr) + sizeof(ip), htons(rx_ospfv2_hdr->len));
     if (calc_checksum != rx_checksum)
     {
-        Debug("-> PWOSPF: LSU Packet dropped, invalid checksum\n");
-        return NULL;
+        Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: LSU Packet dropped, invalid checksum");
+        free(rx_lsu_param);
+        return;
     }
     rx_ospfv2_hdr->csum = rx_checksum;
 
 
+    pwospf_lock(rx_lsu_param->sr->ospf_subsys);
+
+    /* Check the Router ID. An LSU of ours newer than our last one is from
+     * before a restart, ours must take over its sequence number or the
+     * others drop them as older until the old one ages out */
+    if (rx_ospfv2_hdr->rid == rx_lsu_param->sr->ospf_subsys->router_id.s_addr)
+    {
+        if (((int16_t)(htons(rx_ospfv2_lsu_hdr->seq) - rx_lsu_param->sr->ospf_subsys->sequence_num)) > 0)
+        {
+            Log(LOG_OSPF, LOG_INFO, "PWOSPF: LSU of this router with a newer sequence number %u, sending a newer one",
+                htons(rx_ospfv2_lsu_hdr->seq));
+            rx_lsu_param->sr->ospf_subsys->sequence_num = htons(rx_ospfv2_lsu_hdr->seq);
+            schedule_lsu(rx_lsu_param->sr);
+        }
+        pwospf_unlock(rx_lsu_param->sr->ospf_subsys);
+        Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: LSU Packet dropped, originated by this router");
+        free(rx_lsu_param);
+        return;
+    }
+
+    /* Only an LSU newer than the one we have is processed and flooded. The
+     * sender of an older one gets ours back, a duplicate is just dropped */
+    uint8_t known = check_topology_sequence(rx_lsu_param->sr->ospf_subsys->first_topology_entry, neighbor_id, htons(rx_ospfv2_lsu_hdr->seq));
+    if (known != 0)
+    {
+        if (known == 2)
+        {
+            struct ospfv2_topology_entry* entry = rx_lsu_param->sr->ospf_subsys->first_topology_entry->next;
+            while (entry->router_id.s_addr != neighbor_id.s_addr)
+            {
+                entry = entry->next;
+            }
+            send_router_lsu(rx_lsu_param->sr, rx_lsu_param->rx_if, entry);
+        }
+        pwospf_unlock(rx_lsu_param->sr->ospf_subsys);
+        Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: LSU Packet dropped, %s", (known == 2) ? "older than ours" : "already received");
+        free(rx_lsu_param);
+        return;
+    }
+
+    uint8_t changed = 0;
     for (unsigned int i = 0; i < htonl(rx_ospfv2_lsu_hdr->num_adv); i++)
     {
         rx_ospfv2_lsa = ((struct ospfv2_lsa*)(rx_lsu_param->packet + sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr) +
@@ -564,19 +578,46 @@ void* handling_ospfv2_lsu_packets(void* arg)
         net_mask.s_addr = rx_ospfv2_lsa->mask;
         struct in_addr neighbor_id;
         neighbor_id.s_addr = rx_ospfv2_lsa->rid;
-        refresh_topology_entry(first_topology_entry, router_id, net_num, net_mask, neighbor_id, rx_ip_hdr->ip_src, htons(rx_ospfv2_lsu_hdr->seq));
+        changed |= refresh_topology_entry(rx_lsu_param->sr->ospf_subsys->first_topology_entry, router_id, net_num, net_mask, neighbor_id, rx_ip_hdr->ip_src,
+            htons(rx_ospfv2_lsu_hdr->seq));
     }
+    changed |= remove_stale_topology_entries(rx_lsu_param->sr->ospf_subsys->first_topology_entry, neighbor_id, htons(rx_ospfv2_lsu_hdr->seq));
 
-    Debug("\n-> PWOSPF: Printing the topology table\n");
-    print_topolgy_table(first_topology_entry);
+    if (changed != 0)
+    {
+        if (rx_lsu_param->sr->ospf_subsys->lsu_rx_time == 0)
+        {
+            rx_lsu_param->sr->ospf_subsys->lsu_rx_time = rx_lsu_param->rx_time;
+        }
+        TraceInstant("lsdb change", "ospf", rx_lsu_param->rx_if->name, neighbor_id.s_addr);
 
+        print_topolgy_table(rx_lsu_param->sr->ospf_subsys->first_topology_entry);
+    }
 
-    /* Running Dijkstra thread */
-    Debug("\n-> PWOSPF: Running the Dijkstra algorithm\n\n");
-    struct dijkstra_param* dij_param = ((dijkstra_param*)(malloc(sizeof(dijkstra_param))));
-    dij_param->sr = rx_lsu_param->sr;
-    dij_param->first_topology_entry = first_topology_entry;
-    pthread_create(&dijkstra_thread, NULL, run_dijkstra, dij_param);
+    pwospf_unlock(rx_lsu_param->sr->ospf_subsys);
+
+    /* Refreshed entries only age later, the timer checks them when it is due */
+    if (!sr_timer_armed(&rx_lsu_param->sr->ospf_subsys->topology_timer))
+    {
+        sr_timer_add(rx_lsu_param->sr, &rx_lsu_param->sr->ospf_subsys->topology_timer, OSPF_TOPO_ENTRY_TIMEOUT * 1000);
+    }
+
+    /* A refresh of an unchanged link state does not need new routes */
+    if (changed != 0)
+    {
+        Log(LOG_SPF, LOG_DEBUG, "PWOSPF: Running the Dijkstra algorithm");
+        schedule_dijkstra(rx_lsu_param->sr);
+    }
+
+
+    /* LSU TTL */
+    ((ospfv2_lsu_hdr*)(rx_lsu_param->packet + sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr)))->ttl--;
+    if (((ospfv2_lsu_hdr*)(rx_lsu_param->packet + sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr)))->ttl == 0)
+    {
+        Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: LSU Packet not flooded, TTL expired");
+        free(rx_lsu_param);
+        return;
+    }
 
 
     /* Flooding the LSU packet */
@@ -612,52 +653,277 @@ void* handling_ospfv2_lsu_packets(void* arg)
             /* OSPF Checksum */
             ((ospfv2_hdr*)(rx_lsu_param->packet + sizeof(sr_ethernet_hdr) + sizeof(ip)))->csum = 0;
 
-
-            /* LSU TTL */
-            ((ospfv2_lsu_hdr*)(rx_lsu_param->packet + sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr)))->ttl--;
-
             /* Re-Calculate checksum of the LSU header */
             /* Updating the new checksum in tx_packet */
             ((ospfv2_hdr*)(rx_lsu_param->packet + sizeof(sr_ethernet_hdr) + sizeof(ip)))->csum =
                 calc_cksum(rx_lsu_param->packet + sizeof(sr_ethernet_hdr) + sizeof(ip), htons(((ospfv2_hdr*)(rx_lsu_param->packet +
                 sizeof(sr_ethernet_hdr) + sizeof(ip)))->len));
 
-            Debug("-> PWOSPF: Flooding LSU Update of length = %d, out of the interface: %s\n", rx_lsu_param->length, temp_int->name);
+            Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Flooding LSU Update of length = %d, out of the interface: %s",
+                rx_lsu_param->length, temp_int->name);
             sr_send_packet(rx_lsu_param->sr, ((uint8_t*)(rx_lsu_param->packet)), rx_lsu_param->length, temp_int->name);
+            sr_stats_inc(rx_lsu_param->sr, STATS_OSPF_LSU_TX);
+            TraceInstant("lsu flood", "ospf", temp_int->name, rx_lsu_param->rx_if->neighbor_id);
         }
 
         temp_int = temp_int->next;
     }
 
-    return NULL;
+    free(rx_lsu_param);
 } /* -- handling_ospfv2_lsu_packets -- */
 
 
 /*---------------------------------------------------------------------
- * Method: send_lsu
+ * Method: send_all_lsu
+ *
+ * LSU timer, originating the LSU of this router. A new LSU is sent when
+ * our link state changes, at most once every OSPF_MIN_LSU_INTERVAL
+ * seconds, and otherwise only refreshed every OSPF_LSU_REFRESH_INT
+ * seconds jittered by +-25% so that the routers do not flood in
+ * lockstep.
+ *
+ *---------------------------------------------------------------------*/
+
+void send_all_lsu(struct sr_instance* sr, void* arg)
+{
+    struct pwospf_subsys* subsys = sr->ospf_subsys;
+    uint64_t now = sr_timer_now();
+
+    pwospf_lock(subsys);
+
+    /* The fault injection keeps its LSU interval ticks */
+    if ((strcmp(sr->f_interface, "no\0") != 0) && (now >= subsys->next_fault))
+    {
+        subsys->next_fault = now + (OSPF_DEFAULT_LSUINT * 1000);
+
+        sr->ospf_subsys->fault_count++;
+        if (sr->ospf_subsys->fault_count % sr->number_of_lsus == 0)
+        {
+            sr->ospf_subsys->fault_count = 0;
+            if (sr->ospf_subsys->int_down == 0)
+            {
+                sr->ospf_subsys->int_down = 1;
+                Log(LOG_OSPF, LOG_INFO, "***** Interface %s is now down *****", sr->f_interface);
+            }
+            else if (sr->ospf_subsys->int_down == 1)
+            {
+                sr->ospf_subsys->int_down = 0;
+                Log(LOG_OSPF, LOG_INFO, "***** Interface %s is now up *****", sr->f_interface);
+            }
+            subsys->lsu_pending = 1;
+        }
+    }
+
+
+    if (((subsys->lsu_pending == 1) && (now >= subsys->last_lsu + (OSPF_MIN_LSU_INTERVAL * 1000))) || (now >= subsys->next_refresh))
+    {
+        flood_lsu(sr);
+
+        subsys->lsu_pending = 0;
+        subsys->last_lsu = now;
+        subsys->next_refresh = now + (((OSPF_LSU_REFRESH_INT * 3) / 4) * 1000) + (rand() % (((OSPF_LSU_REFRESH_INT / 2) * 1000) + 1));
+    }
+
+
+    /* Due again at the next deadline, or earlier from schedule_lsu() */
+    uint64_t wakeup = subsys->next_refresh;
+    if ((strcmp(sr->f_interface, "no\0") != 0) && (subsys->next_fault < wakeup))
+    {
+        wakeup = subsys->next_fault;
+    }
+    if ((subsys->lsu_pending == 1) && (subsys->last_lsu + (OSPF_MIN_LSU_INTERVAL * 1000) < wakeup))
+    {
+        wakeup = subsys->last_lsu + (OSPF_MIN_LSU_INTERVAL * 1000);
+    }
+
+    pwospf_unlock(subsys);
+
+    sr_timer_add_at(sr, &subsys->lsu_timer, wakeup);
+} /* -- send_all_lsu -- */
+
+
+/*---------------------------------------------------------------------
+ * Method: schedule_lsu
+ *
+ * Our link state changed, brings the LSU timer forward to the earliest
+ * origination allowed. The caller holds the subsystem lock.
+ *
+ *---------------------------------------------------------------------*/
+
+void schedule_lsu(struct sr_instance* sr)
+{
+    struct pwospf_subsys* subsys = sr->ospf_subsys;
+    subsys->lsu_pending = 1;
+
+    /* Before pwospf_start() the first run of the timer sends it */
+    if (sr->ospf_subsys->router_id.s_addr == 0)
+    {
+        return;
+    }
+
+    uint64_t due = subsys->last_lsu + (OSPF_MIN_LSU_INTERVAL * 1000);
+    uint64_t now = sr_timer_now();
+    if (due < now)
+    {
+        due = now;
+    }
+    if (!sr_timer_armed(&subsys->lsu_timer) || (due < subsys->lsu_timer.due))
+    {
+        sr_timer_add_at(sr, &subsys->lsu_timer, due);
+    }
+} /* -- schedule_lsu -- */
+
+
+/*---------------------------------------------------------------------
+ * Method: send_lsdb
+ *
+ * Sending the topology table to a new neighbor: one LSU per router we
+ * know about, with the sequence number of that router, so the neighbor
+ * does not wait for the next refreshes to compute its routes. The
+ * caller holds the subsystem lock.
+ *
+ *---------------------------------------------------------------------*/
+
+void send_lsdb(struct sr_instance* sr, struct sr_if* interface)
+{
+    struct ospfv2_topology_entry* router = sr->ospf_subsys->first_topology_entry->next;
+    while (router != NULL)
+    {
+        /* Only the first entry of every router builds an LSU */
+        struct ospfv2_topology_entry* ptr = sr->ospf_subsys->first_topology_entry->next;
+        while (ptr->router_id.s_addr != router->router_id.s_addr)
+        {
+            ptr = ptr->next;
+        }
+        if (ptr == router)
+        {
+            send_router_lsu(sr, interface, router);
+        }
+
+        router = router->next;
+    }
+} /* -- send_lsdb -- */
+
+
+/*---------------------------------------------------------------------
+ * Method: send_router_lsu
  *
- * Constructing and Sending LSU out of a specific interface
+ * Sending the LSU of the router of the topology entry, which is the
+ * first entry of that router, out of the interface as we have it in
+ * the topology table. The caller holds the subsystem lock.
  *
  *---------------------------------------------------------------------*/
 
-void* send_lsu(void* arg)
+void send_router_lsu(struct sr_instance* sr, struct sr_if* interface, struct ospfv2_topology_entry* router)
 {
-    struct powspf_hello_lsu_param* lsu_param = ((struct powspf_hello_lsu_param*)(arg));
+    struct ospfv2_topology_entry* ptr;
+    unsigned int lsa_num = 0;
+    for (ptr = router; ptr != NULL; ptr = ptr->next)
+    {
+        if (ptr->router_id.s_addr == router->router_id.s_addr)
+        {
+            lsa_num++;
+        }
+    }
+
+    unsigned int packet_len = sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) + (sizeof(ospfv2_lsa) * lsa_num);
+    uint8_t* tx_packet = ((uint8_t*)(calloc(1, packet_len)));
+    struct sr_ethernet_hdr* tx_e_hdr = ((sr_ethernet_hdr*)(tx_packet));
+    struct ip* tx_ip_hdr = ((ip*)(tx_packet + sizeof(sr_ethernet_hdr)));
+    struct ospfv2_hdr* tx_ospf_hdr = ((ospfv2_hdr*)(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip)));
+    struct ospfv2_lsu_hdr* tx_ospf_lsu_hdr = ((ospfv2_lsu_hdr*)(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr)));
 
-    if (lsu_param->interface->neighbor_ip == 0)
+
+    /* Ethernet addresses and type */
+    for (int i = 0; i < ETHER_ADDR_LEN; i++)
     {
-        return NULL;
+        tx_e_hdr->ether_dhost[i] = ospf_multicast_mac[i];
+        tx_e_hdr->ether_shost[i] = ((uint8_t)(interface->addr[i]));
     }
+    tx_e_hdr->ether_type = htons(ETHERTYPE_IP);
+
+
+    /* IP header */
+    tx_ip_hdr->ip_v = 4;
+    tx_ip_hdr->ip_hl = 5;
+    tx_ip_hdr->ip_tos = 0;
+    tx_ip_hdr->ip_len = htons(packet_len - sizeof(sr_ethernet_hdr));
+    tx_ip_hdr->ip_id = rand();
+    tx_ip_hdr->ip_off = htons(IP_NO_FRAGMENT);
+    tx_ip_hdr->ip_ttl = 64;
+    tx_ip_hdr->ip_p = IP_PROTO_OSPFv2;
+    tx_ip_hdr->ip_src.s_addr = interface->ip;
+    tx_ip_hdr->ip_dst.s_addr = htonl(OSPF_AllSPFRouters);
+    tx_ip_hdr->ip_sum = 0;
+    tx_ip_hdr->ip_sum = calc_cksum(((uint8_t*)(tx_ip_hdr)), sizeof(ip));
 
+
+    /* OSPFv2 header, on behalf of the originating router */
+    tx_ospf_hdr->version = OSPF_V2;
+    tx_ospf_hdr->type = OSPF_TYPE_LSU;
+    tx_ospf_hdr->len = htons(packet_len - sizeof(sr_ethernet_hdr) - sizeof(ip));
+    tx_ospf_hdr->rid = router->router_id.s_addr;
+    tx_ospf_hdr->aid = htonl(171);
+    tx_ospf_hdr->csum = 0;
+    tx_ospf_hdr->autype = 0;
+    tx_ospf_hdr->audata = 0;
+
+
+    /* LSU header */
+    tx_ospf_lsu_hdr->seq = htons(router->sequence_num);
+    tx_ospf_lsu_hdr->unused = 0;
+    tx_ospf_lsu_hdr->ttl = 64;
+    tx_ospf_lsu_hdr->num_adv = htonl(lsa_num);
+
+
+    /* Advertisements */
+    unsigned int i = 0;
+    for (ptr = router; ptr != NULL; ptr = ptr->next)
+    {
+        if (ptr->router_id.s_addr == router->router_id.s_addr)
+        {
+            struct ospfv2_lsa* tx_ospf_lsa = ((ospfv2_lsa*)(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr) +
+                sizeof(ospfv2_lsu_hdr) + (sizeof(ospfv2_lsa) * i)));
+            tx_ospf_lsa->subnet = ptr->net_num.s_addr;
+            tx_ospf_lsa->mask = ptr->net_mask.s_addr;
+            tx_ospf_lsa->rid = ptr->neighbor_id.s_addr;
+            i++;
+        }
+    }
+
+    tx_ospf_hdr->csum = calc_cksum(((uint8_t*)(tx_ospf_hdr)), packet_len - sizeof(sr_ethernet_hdr) - sizeof(ip));
+
+    Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Sending the LSU of router %I out of the interface: %s",
+        router->router_id.s_addr, interface->name);
+    sr_send_packet(sr, tx_packet, packet_len, interface->name);
+    sr_stats_inc(sr, STATS_OSPF_LSU_TX);
+    TraceInstant("lsdb sync", "ospf", interface->name, router->router_id.s_addr);
+
+    free(tx_packet);
+} /* -- send_router_lsu -- */
+
+
+/*---------------------------------------------------------------------
+ * Method: flood_lsu
+ *
+ * Constructing the LSU of this router and sending it out of every
+ * interface with a neighbor. The caller holds the subsystem lock.
+ *
+ *---------------------------------------------------------------------*/
+
+void flood_lsu(struct sr_instance* sr)
+{
     /* Constructing LSU */
-    Debug("\n\nPWOSPF: Constructing LSU packet\n");
+    Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Constructing LSU packet");
     struct sr_ethernet_hdr* tx_e_hdr = ((sr_ethernet_hdr*)(malloc(sizeof(sr_ethernet_hdr))));
     struct ip* tx_ip_hdr = ((ip*)(malloc(sizeof(ip))));
     struct ospfv2_hdr* tx_ospf_hdr = ((ospfv2_hdr*)(malloc(sizeof(ospfv2_hdr))));
     struct ospfv2_lsu_hdr* tx_ospf_lsu_hdr = ((ospfv2_lsu_hdr*)(malloc(sizeof(ospfv2_lsu_hdr))));
     struct ospfv2_lsa* tx_ospf_lsa = ((ospfv2_lsa*)(malloc(sizeof(ospfv2_lsa))));
 
-    int routes_num = count_routes(lsu_param->sr, 0);
+    int routes_num;
+    routes_num = count_routes(sr, sr->ospf_subsys->int_down);
+//printf("*********************************************************************** %d\n", routes_num);
     int packet_len = sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) + (sizeof(ospfv2_lsa) * routes_num);
     uint8_t* tx_packet;
 
@@ -669,10 +935,7 @@ void* send_lsu(void* arg)
     }  
 
     /* Source address */
-    for (int i = 0; i < ETHER_ADDR_LEN; i++)
-    {
-        tx_e_hdr->ether_shost[i] = ((uint8_t)(lsu_param->interface->addr[i]));
-    }         
+    /* Later in this function, depending on the interface */
 
     /* Type */
     tx_e_hdr->ether_type = htons(ETHERTYPE_IP);
@@ -689,10 +952,7 @@ void* send_lsu(void* arg)
     tx_ip_hdr->ip_len = htons(sizeof(ip) + sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) + (sizeof(ospfv2_lsa) * routes_num));
 
     /* Identification */
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    srand(tv.tv_sec * tv.tv_usec);
-    tx_ip_hdr->ip_id = rand();
+    /* Later in this function */
 
     /* Fragment */
     tx_ip_hdr->ip_off = htons(IP_NO_FRAGMENT);
@@ -704,16 +964,16 @@ void* send_lsu(void* arg)
     tx_ip_hdr->ip_p = IP_PROTO_OSPFv2;  // which is 89 = OSPFv2
 
     /* Checksum */
-    tx_ip_hdr->ip_sum = 0;
+    /* Later in this function */
 
     /* Source IP address */
-    tx_ip_hdr->ip_src.s_addr = lsu_param->interface->ip;
+    /* Later in this function */;
 
     /* Destination IP address */
     tx_ip_hdr->ip_dst.s_addr = htonl(OSPF_AllSPFRouters);
 
     /* Re-Calculate checksum of the IP header */
-    tx_ip_hdr->ip_sum = calc_cksum(((uint8_t*)(tx_ip_hdr)), sizeof(ip));
+    /* Later in this function */;
 
 
     /* OSPFv2 Version */
@@ -726,10 +986,10 @@ void* send_lsu(void* arg)
     tx_ospf_hdr->len = htons(sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) + (sizeof(ospfv2_lsa) * routes_num));
 
     /* Router ID */
-    tx_ospf_hdr->rid = router_id.s_addr;    //It is the highest IP address on a router [according to Cisco]
+    tx_ospf_hdr->rid = sr->ospf_subsys->router_id.s_addr;    //It is the highest IP address on a router [according to Cisco]
 
     /* Area ID */
-    tx_ospf_hdr->aid = htonl(171); //((uint8_t)(lsu_param->interface->ip));    //Since we only have one Area which is Area0
+    tx_ospf_hdr->aid = htonl(171);    //Since we only have one Area which is Area0
 
     /* Checksum */
     tx_ospf_hdr->csum = 0;
@@ -742,8 +1002,8 @@ void* send_lsu(void* arg)
 
 
     /* Sequence */
-    sequence_num++;
-    tx_ospf_lsu_hdr->seq = htons(sequence_num);
+    sr->ospf_subsys->sequence_num++;
+    tx_ospf_lsu_hdr->seq = htons(sr->ospf_subsys->sequence_num);
 
     /* Unused */
     tx_ospf_lsu_hdr->unused = 0;
@@ -763,10 +1023,34 @@ void* send_lsu(void* arg)
     memcpy(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip), tx_ospf_hdr, sizeof(ospfv2_hdr));
     memcpy(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr), tx_ospf_lsu_hdr, sizeof(ospfv2_lsu_hdr));
 
+
+    struct sr_if* f_int = NULL;
+    if (sr->ospf_subsys->int_down == 1)
+    {
+        f_int = sr_get_interface(sr, sr->f_interface);
+    }
     int i = 0;
-    struct sr_rt* entry = lsu_param->sr->routing_table;
+    struct sr_rt* entry = sr->routing_table;
     while (entry != NULL)
     {
+        if (sr->ospf_subsys->int_down == 1)
+        {
+            int entry_con = 0;
+            if (f_int != NULL)
+            {
+                if ((f_int->ip & htonl(0x0fffffffe)) == entry->dest.s_addr)
+                {
+                    entry_con = 1;
+                }
+            }
+
+            if (entry_con == 1)
+            {
+                entry = entry->next;
+                continue;
+            }
+        }
+
         if (entry->admin_dst <= 1)
         {
             /* Subnet */
@@ -776,7 +1060,7 @@ void* send_lsu(void* arg)
             tx_ospf_lsa->mask = entry->mask.s_addr;
 
             /* Router ID */
-            tx_ospf_lsa->rid = sr_get_interface(lsu_param->sr, entry->interface)->neighbor_id; //lsu_param->interface->neighbor_id;
+            tx_ospf_lsa->rid = sr_get_interface(sr, entry->interface)->neighbor_id;
 
             memcpy(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) + (sizeof(ospfv2_lsa) * i),
                 tx_ospf_lsa, sizeof(ospfv2_lsa));
@@ -790,94 +1074,55 @@ void* send_lsu(void* arg)
     /* Re-Calculate checksum of the LSU header */
     /* Updating the new checksum in tx_packet */
     ((ospfv2_hdr*)(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip)))->csum =
-        calc_cksum(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip), sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) + (sizeof(ospfv2_lsa) * routes_num));
-
-
-    Debug("-> PWOSPF: Sending LSU Packet of length = %d, out of the interface: %s\n", packet_len, lsu_param->interface->name);
-    sr_send_packet(lsu_param->sr, ((uint8_t*)(tx_packet)), packet_len, lsu_param->interface->name);
-
-    
-    free(tx_packet);
-
+        calc_cksum(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip), sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) +
+        (sizeof(ospfv2_lsa) * routes_num));
 
-    /* Constructing LSU Update */
-    Debug("\n\nPWOSPF: Constructing LSU update\n");
-
-    /***** Creating the transmitted packet *****/
-    packet_len = sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) + sizeof(ospfv2_lsa);
-    tx_packet = ((uint8_t*)(malloc(packet_len)));
-    
-    /* LSA Update */
-    /* Subnet */
-    tx_ospf_lsa->subnet = lsu_param->interface->ip & htonl(0xfffffffe);
-
-    /* Mask */
-    tx_ospf_lsa->mask = htonl(0xfffffffe);
-
-    /* Router ID */
-    tx_ospf_lsa->rid = sr_get_interface(lsu_param->sr, lsu_param->interface->name)->neighbor_id;
-
-
-    struct sr_if* temp_int = lsu_param->sr->if_list;
+    struct sr_if* temp_int = sr->if_list;
     while (temp_int != NULL)
     {
-        if ((strcmp(temp_int->name, lsu_param->interface->name) != 0) /*&& (temp_int->neighbor_id != 0)*/)
+        int int_con = 0;
+        if (f_int != NULL)
         {
-            /* Ehternet Source address */
-            for (int i = 0; i < ETHER_ADDR_LEN; i++)
+            if ((f_int->ip & htonl(0x0fffffffe)) == temp_int->ip)
             {
-                tx_e_hdr->ether_shost[i] = ((uint8_t)(temp_int->addr[i]));
+                int_con = 1;
             }
+        }
 
-            
-            /* IP Total length */
-            tx_ip_hdr->ip_len = htons(sizeof(ip) + sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) + sizeof(ospfv2_lsa));
+        if (int_con == 1)
+        {
+            temp_int = temp_int->next;
+            continue;
+        }
 
+        if (temp_int->neighbor_id != 0)
+        {
+            /* Ehternet Source address */
+            for (int i = 0; i < ETHER_ADDR_LEN; i++)
+            {
+                ((sr_ethernet_hdr*)(tx_packet))->ether_shost[i] = ((uint8_t)(temp_int->addr[i]));
+            }
+        
             /* IP Identification */
             struct timeval tv;
             gettimeofday(&tv, NULL);
             srand(tv.tv_sec * tv.tv_usec);
-            tx_ip_hdr->ip_id = rand();
-    
+            ((ip*)(tx_packet + sizeof(sr_ethernet_hdr)))->ip_id = rand();
+
             /* IP Checksum */
-            tx_ip_hdr->ip_sum = 0;
+            ((ip*)(tx_packet + sizeof(sr_ethernet_hdr)))->ip_sum = 0;
 
             /* Source IP address */
-            tx_ip_hdr->ip_src.s_addr = temp_int->ip;
+            ((ip*)(tx_packet + sizeof(sr_ethernet_hdr)))->ip_src.s_addr = temp_int->ip;
 
             /* Re-Calculate checksum of the IP header */
-            tx_ip_hdr->ip_sum = calc_cksum(((uint8_t*)(tx_ip_hdr)), sizeof(ip));
-
-
-            /* OSPF Packet Length */
-            tx_ospf_hdr->len = htons(sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) + sizeof(ospfv2_lsa));
-
-            /* OSPF Checksum */
-            tx_ospf_hdr->csum = 0;
-
-
-            /* LSU Sequence */
-            sequence_num++;
-            tx_ospf_lsu_hdr->seq = htons(sequence_num);
-
-            /* LSU Number of advertisememts */
-            tx_ospf_lsu_hdr->num_adv = htonl(1);
-
-
-            memcpy(tx_packet, tx_e_hdr, sizeof(sr_ethernet_hdr));
-            memcpy(tx_packet + sizeof(sr_ethernet_hdr), tx_ip_hdr, sizeof(ip));
-            memcpy(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip), tx_ospf_hdr, sizeof(ospfv2_hdr));
-            memcpy(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr), tx_ospf_lsu_hdr, sizeof(ospfv2_lsu_hdr));
-            memcpy(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr), tx_ospf_lsa, sizeof(ospfv2_lsa));
+            ((ip*)(tx_packet + sizeof(sr_ethernet_hdr)))->ip_sum = calc_cksum(((uint8_t*)(tx_packet + sizeof(sr_ethernet_hdr))), sizeof(ip));
 
-
-            /* Re-Calculate checksum of the LSU header */
-            /* Updating the new checksum in tx_packet */
-            ((ospfv2_hdr*)(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip)))->csum =
-                calc_cksum(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip), sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) + sizeof(ospfv2_lsa));
-
-            Debug("-> PWOSPF: Sending LSU Update of length = %d, out of the interface: %s\n", packet_len, temp_int->name);
-            sr_send_packet(lsu_param->sr, ((uint8_t*)(tx_packet)), packet_len, temp_int->name);
+            Log(LOG_OSPF, LOG_DEBUG, "PWOSPF: Sending LSU Update of length = %d, out of the interface: %s",
+                packet_len, temp_int->name);
+            sr_send_packet(sr, ((uint8_t*)(tx_packet)), packet_len, temp_int->name);
+            sr_stats_inc(sr, STATS_OSPF_LSU_TX);
+            TraceInstant("lsu originate", "ospf", temp_int->name, sr->ospf_subsys->router_id.s_addr);
         }
 
         temp_int = temp_int->next;
@@ -889,564 +1134,328 @@ void* send_lsu(void* arg)
     free(tx_ospf_hdr);
     free(tx_ip_hdr);
     free(tx_e_hdr);
-
-    return NULL;
-} /* -- send_lsu -- */
+} /* -- flood_lsu -- */
 
 
 /*---------------------------------------------------------------------
- * Method: send_all_lsu
+ * Method: run_dijkstra
  *
- * Constructing and Sending LSUs every 30 seconds 
+ * Run Dijkstra algorithm
+ *
+ * The routers are settled in cost order starting from our alive
+ * neighbors. Every item carries the next hop of the first link of its
+ * path, so a router reached over several equal-cost paths keeps up to
+ * ecmp_width distinct next hops and passes them on to the routers
+ * behind it.
  *
  *---------------------------------------------------------------------*/
 
-void* send_all_lsu(void* arg)
+void* run_dijkstra(void* arg)
 {
-    struct sr_instance* sr = (struct sr_instance*)arg;
-
-    while(1)
-    {
-        usleep(OSPF_DEFAULT_LSUINT * 1000000);
+    struct dijkstra_param* dij_param = ((dijkstra_param*)(arg));
+    struct sr_instance* sr = dij_param->sr;
+    struct ospfv2_topology_entry* first_topology_entry = dij_param->first_topology_entry;
 
-        pwospf_lock(sr->ospf_subsys);
+    /* The LSU handler and the aging thread edit the topology table */
+    pwospf_lock(sr->ospf_subsys);
 
+    sr_stats_inc(sr, STATS_SPF_RUNS);
+    TraceBegin("spf", "spf");
+    uint64_t spf_start = sr_stats_now();
+    uint64_t lsu_rx_time = sr->ospf_subsys->lsu_rx_time;
+    sr->ospf_subsys->lsu_rx_time = 0;
 
-        if (strcmp(sr->f_interface, "no\0") != 0)
-        {
-            fault_count++;
-            if (fault_count % sr->number_of_lsus == 0)
-            {
-                fault_count = 0;
-                if (int_down == 0)
-                {
-                    int_down = 1;
-                    Debug("\n\n**************************************\n");
-                    Debug("***** Interface %s is now down *****\n", sr->f_interface);
-                    Debug("**************************************\n");
-                }
-                else if (int_down == 1)
-                {
-                    int_down = 0;
-                    Debug("\n\n************************************\n");
-                    Debug("***** Interface %s is now up *****\n", sr->f_interface);
-                    Debug("************************************\n");
-                }
-            }
-        }
-
+    struct in_addr zero;
+    zero.s_addr = 0;
+    struct dijkstra_item* dijkstra_stack = create_dikjstra_item(create_ospfv2_topology_entry(zero, zero, zero, zero, zero, 0), 0);
+    struct dijkstra_item* dijkstra_heap = create_dikjstra_item(create_ospfv2_topology_entry(zero, zero, zero, zero, zero, 0), 0);
 
-        /* Constructing LSU */
-        Debug("\n\nPWOSPF: Constructing LSU packet\n");
-        struct sr_ethernet_hdr* tx_e_hdr = ((sr_ethernet_hdr*)(malloc(sizeof(sr_ethernet_hdr))));
-        struct ip* tx_ip_hdr = ((ip*)(malloc(sizeof(ip))));
-        struct ospfv2_hdr* tx_ospf_hdr = ((ospfv2_hdr*)(malloc(sizeof(ospfv2_hdr))));
-        struct ospfv2_lsu_hdr* tx_ospf_lsu_hdr = ((ospfv2_lsu_hdr*)(malloc(sizeof(ospfv2_lsu_hdr))));
-        struct ospfv2_lsa* tx_ospf_lsa = ((ospfv2_lsa*)(malloc(sizeof(ospfv2_lsa))));
 
-        int routes_num;
-        routes_num = count_routes(sr, int_down);
-//printf("*********************************************************************** %d\n", routes_num);
-        int packet_len = sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) + (sizeof(ospfv2_lsa) * routes_num);
-        uint8_t* tx_packet;
+    /* Cleaing the routing table */
+    clear_routes(sr);
 
 
-        /* Destination address */
-        for (int i = 0; i < ETHER_ADDR_LEN; i++)
+    /* Pushing the links to the alive neighbors */
+    struct sr_if* temp_int = sr->if_list;
+    while (temp_int != NULL)
+    {
+        if ((temp_int->neighbor_id != 0) &&
+            (search_topolgy_table(first_topology_entry, (temp_int->ip & htonl(0xfffffffe))) == 1))
         {
-            tx_e_hdr->ether_dhost[i] = ospf_multicast_mac[i];
-        }  
-
-        /* Source address */
-        /* Later in this function, depending on the interface */
+            struct in_addr mask;	    mask.s_addr = htonl(0xfffffffe);
+            struct in_addr subnet;	    subnet.s_addr = temp_int->ip & mask.s_addr;
+            struct in_addr neighbor_id;	    neighbor_id.s_addr = temp_int->neighbor_id;
+            struct in_addr next_hop;	    next_hop.s_addr = temp_int->neighbor_ip;
 
-        /* Type */
-        tx_e_hdr->ether_type = htons(ETHERTYPE_IP);
-
-
-        /* Version + Header length */
-        tx_ip_hdr->ip_v = 4;
-        tx_ip_hdr->ip_hl = 5;
-
-        /* DS */
-        tx_ip_hdr->ip_tos = 0;
-
-        /* Total length */
-        tx_ip_hdr->ip_len = htons(sizeof(ip) + sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) + (sizeof(ospfv2_lsa) * routes_num));
-
-        /* Identification */
-        /* Later in this function */
-
-        /* Fragment */
-        tx_ip_hdr->ip_off = htons(IP_NO_FRAGMENT);
-
-        /* TTL */
-        tx_ip_hdr->ip_ttl = 64;
-
-        /* Protocol */
-        tx_ip_hdr->ip_p = IP_PROTO_OSPFv2;  // which is 89 = OSPFv2
-
-        /* Checksum */
-        /* Later in this function */
-
-        /* Source IP address */
-        /* Later in this function */;
-
-        /* Destination IP address */
-        tx_ip_hdr->ip_dst.s_addr = htonl(OSPF_AllSPFRouters);
-
-        /* Re-Calculate checksum of the IP header */
-        /* Later in this function */;
-
-
-        /* OSPFv2 Version */
-        tx_ospf_hdr->version = OSPF_V2;
-
-        /* OSPFv2 Type */
-        tx_ospf_hdr->type = OSPF_TYPE_LSU;
-
-        /* Packet Length */
-        tx_ospf_hdr->len = htons(sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) + (sizeof(ospfv2_lsa) * routes_num));
-
-        /* Router ID */
-        tx_ospf_hdr->rid = router_id.s_addr;    //It is the highest IP address on a router [according to Cisco]
-
-        /* Area ID */
-        tx_ospf_hdr->aid = htonl(171);    //Since we only have one Area which is Area0
-
-        /* Checksum */
-        tx_ospf_hdr->csum = 0;
-
-        /* Authentication Type */
-        tx_ospf_hdr->autype = 0;
-
-        /* Authentication Data */
-        tx_ospf_hdr->audata = 0;
-
-
-        /* Sequence */
-        sequence_num++;
-        tx_ospf_lsu_hdr->seq = htons(sequence_num);
-
-        /* Unused */
-        tx_ospf_lsu_hdr->unused = 0;
-
-        /* TTL */
-        tx_ospf_lsu_hdr->ttl = 64;
-
-        /* Number of advertisememts */
-        tx_ospf_lsu_hdr->num_adv = htonl(routes_num);
-
-
-        /***** Creating the transmitted packet *****/
-        tx_packet = ((uint8_t*)(malloc(packet_len)));
+            dijkstra_stack_push(dijkstra_heap, create_dikjstra_item(create_ospfv2_topology_entry(sr->ospf_subsys->router_id, subnet, mask, neighbor_id,
+                next_hop, 0), 1));
+        }
 
-        memcpy(tx_packet, tx_e_hdr, sizeof(sr_ethernet_hdr));
-        memcpy(tx_packet + sizeof(sr_ethernet_hdr), tx_ip_hdr, sizeof(ip));
-        memcpy(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip), tx_ospf_hdr, sizeof(ospfv2_hdr));
-        memcpy(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr), tx_ospf_lsu_hdr, sizeof(ospfv2_lsu_hdr));
+        temp_int = temp_int->next;
+    }
 
 
-        struct sr_if* f_int;
-        if (int_down == 1)
+    /* Settling the routers, the settled items are kept in the stack */
+    struct dijkstra_item* dijkstra_popped_item;
+    while ((dijkstra_popped_item = dijkstra_stack_pop(dijkstra_heap)) != NULL)
+    {
+        struct ospfv2_topology_entry* link = dijkstra_popped_item->topology_entry;
+        struct dijkstra_item* settled = dijkstra_stack_search(dijkstra_stack, link->neighbor_id.s_addr, 0);
+
+        if ((link->neighbor_id.s_addr == sr->ospf_subsys->router_id.s_addr) ||
+            ((settled != NULL) &&
+             ((settled->cost < dijkstra_popped_item->cost) ||
+              (dijkstra_stack_count(dijkstra_stack, link->neighbor_id.s_addr) >= sr->ecmp_width) ||
+              (dijkstra_stack_search(dijkstra_stack, link->neighbor_id.s_addr, link->next_hop.s_addr) != NULL))))
         {
-            f_int = sr_get_interface(sr, sr->f_interface);
+            free(link);
+            free(dijkstra_popped_item);
+            continue;
         }
-        int i = 0;
-        struct sr_rt* entry = sr->routing_table;
-        while (entry != NULL)
-        {
-            if (int_down == 1)
-            {
-                int entry_con = 0;
-                if (f_int != NULL)
-                {
-                    if ((f_int->ip & htonl(0x0fffffffe)) == entry->dest.s_addr)
-                    {
-                        entry_con = 1;
-                    }
-                }
 
-                if (entry_con == 1)
-                {
-                    entry = entry->next;
-                    continue;
-                }
-            }
-
-            if (entry->admin_dst <= 1)
-            {
-                /* Subnet */
-                tx_ospf_lsa->subnet = entry->dest.s_addr;
+        dijkstra_stack_push(dijkstra_stack, dijkstra_popped_item);
 
-                /* Mask */
-                tx_ospf_lsa->mask = entry->mask.s_addr;
 
-                /* Router ID */
-                tx_ospf_lsa->rid = sr_get_interface(sr, entry->interface)->neighbor_id;
+        /* Relaxing the links of the settled router */
+        struct ospfv2_topology_entry* ptr = first_topology_entry->next;
+        while(ptr != NULL)
+        {
+            if ((ptr->router_id.s_addr == link->neighbor_id.s_addr) &&
+                (ptr->neighbor_id.s_addr != 0) &&
+                (ptr->neighbor_id.s_addr != link->router_id.s_addr))
+            {
+                struct ospfv2_topology_entry* clone = clone_ospfv2_topology_entry(ptr);
+                clone->next = NULL;
+                clone->next_hop.s_addr = link->next_hop.s_addr;
 
-                memcpy(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) + (sizeof(ospfv2_lsa) * i),
-                    tx_ospf_lsa, sizeof(ospfv2_lsa));
+                struct dijkstra_item* to_be_pushed = create_dikjstra_item(clone, dijkstra_popped_item->cost + 1);
+                to_be_pushed->parent = dijkstra_popped_item;
 
-                i++;
+                dijkstra_stack_push(dijkstra_heap, to_be_pushed);
+                dijkstra_stack_reorder(dijkstra_heap);
             }
 
-            entry = entry->next;
+            ptr = ptr->next;
         }
+    }
 
-        /* Re-Calculate checksum of the LSU header */
-        /* Updating the new checksum in tx_packet */
-        ((ospfv2_hdr*)(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip)))->csum =
-            calc_cksum(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip), sizeof(ospfv2_hdr) + sizeof(ospfv2_lsu_hdr) +
-            (sizeof(ospfv2_lsa) * routes_num));
 
-        struct sr_if* temp_int = sr->if_list;
-        while (temp_int != NULL)
+    /* Routing every subnet through the nearest routers advertising it */
+    struct ospfv2_topology_entry* topo_entry = first_topology_entry->next;
+    while(topo_entry != NULL)
+    {
+        if (check_route(sr, topo_entry->net_num) == 0)
         {
-            int int_con = 0;
-            if (f_int != NULL)
+            uint32_t best_cost = 0;
+            struct ospfv2_topology_entry* ptr = first_topology_entry->next;
+            while (ptr != NULL)
             {
-                if ((f_int->ip & htonl(0x0fffffffe)) == temp_int->ip)
+                if (ptr->net_num.s_addr == topo_entry->net_num.s_addr)
                 {
-                    int_con = 1;
+                    struct dijkstra_item* settled = dijkstra_stack_search(dijkstra_stack, ptr->router_id.s_addr, 0);
+                    if ((settled != NULL) && ((best_cost == 0) || (settled->cost < best_cost)))
+                    {
+                        best_cost = settled->cost;
+                    }
                 }
-            }
 
-            if (int_con == 1)
-            {
-                temp_int = temp_int->next;
-                continue;
+                ptr = ptr->next;
             }
 
-            if (temp_int->neighbor_id != 0)
+            struct sr_rt* route = NULL;
+            ptr = first_topology_entry->next;
+            while ((ptr != NULL) && (best_cost != 0))
             {
-                /* Ehternet Source address */
-                for (int i = 0; i < ETHER_ADDR_LEN; i++)
+                if (ptr->net_num.s_addr == topo_entry->net_num.s_addr)
                 {
-                    ((sr_ethernet_hdr*)(tx_packet))->ether_shost[i] = ((uint8_t)(temp_int->addr[i]));
+                    struct dijkstra_item* final_item = dijkstra_stack->next;
+                    while (final_item != NULL)
+                    {
+                        if ((final_item->topology_entry->neighbor_id.s_addr == ptr->router_id.s_addr) &&
+                            (final_item->cost == best_cost))
+                        {
+                            struct sr_if* next_hop_int = dij_param->sr->if_list;
+                            while (next_hop_int != NULL)
+                            {
+                                if ((next_hop_int->ip & htonl(0xfffffffe)) == (final_item->topology_entry->next_hop.s_addr & htonl(0xfffffffe)))
+                                {
+                                    break;
+                                }
+
+                                next_hop_int = next_hop_int->next;
+                            }
+
+                            if (next_hop_int != NULL)
+                            {
+                                if (route == NULL)
+                                {
+                                    route = sr_add_rt_entry(sr, topo_entry->net_num, final_item->topology_entry->next_hop,
+                                        topo_entry->net_mask, next_hop_int->name, 110);
+                                }
+                                else if (route->nexthop_num < sr->ecmp_width)
+                                {
+                                    sr_add_rt_nexthop(route, final_item->topology_entry->next_hop, next_hop_int->name);
+                                }
+                            }
+                        }
+
+                        final_item = final_item->next;
+                    }
                 }
-            
-                /* IP Identification */
-                struct timeval tv;
-                gettimeofday(&tv, NULL);
-                srand(tv.tv_sec * tv.tv_usec);
-                ((ip*)(tx_packet + sizeof(sr_ethernet_hdr)))->ip_id = rand();
-    
-                /* IP Checksum */
-                ((ip*)(tx_packet + sizeof(sr_ethernet_hdr)))->ip_sum = 0;
 
-                /* Source IP address */
-                ((ip*)(tx_packet + sizeof(sr_ethernet_hdr)))->ip_src.s_addr = temp_int->ip;
+                ptr = ptr->next;
+            }
+        }
 
-                /* Re-Calculate checksum of the IP header */
-                ((ip*)(tx_packet + sizeof(sr_ethernet_hdr)))->ip_sum = calc_cksum(((uint8_t*)(tx_packet + sizeof(sr_ethernet_hdr))), sizeof(ip));
+        topo_entry = topo_entry->next;
+    }
 
-                Debug("-> PWOSPF: Sending LSU Update of length = %d, out of the interface: %s\n", packet_len, temp_int->name);
-                sr_send_packet(sr, ((uint8_t*)(tx_packet)), packet_len, temp_int->name);
-            }
+    dijkstra_stack_free(dijkstra_stack);
+    dijkstra_stack_free(dijkstra_heap);
 
-            temp_int = temp_int->next;
-        }
+    sr_stats_record_since(sr, HIST_SPF_RUN, spf_start);
+    sr_stats_record_since(sr, HIST_LSU_TO_FIB, lsu_rx_time);
+    TraceInstant("fib publish", "spf", NULL, 0);
+    TraceEnd("spf", "spf");
 
-        free(tx_packet);
-        free(tx_ospf_lsa);
-        free(tx_ospf_lsu_hdr);
-        free(tx_ospf_hdr);
-        free(tx_ip_hdr);
-        free(tx_e_hdr);
+    Log(LOG_SPF, LOG_DEBUG, "PWOSPF: Dijkstra algorithm completed");
+    print_routing_table(sr);
 
 
-        pwospf_unlock(sr->ospf_subsys);
-    };
+    pwospf_unlock(sr->ospf_subsys);
 
     return NULL;
-} /* -- send_all_lsu -- */
+} /* -- run_dijkstra -- */
 
 
 /*---------------------------------------------------------------------
- * Method: run_dijkstra
+ * Method: check_neighbors_life
  *
- * Run Dijkstra algorithm
+ * Neighbor timer, due when the first alive neighbor may expire
  *
  *---------------------------------------------------------------------*/
 
-void* run_dijkstra(void* arg)
+void check_neighbors_life(struct sr_instance* sr, void* arg)
 {
-    struct dijkstra_param* dij_param = ((dijkstra_param*)(arg));
+    uint64_t next_expiry;
 
-    pthread_mutex_lock(&dijkstra_mutex);
+    pwospf_lock(sr->ospf_subsys);
+    struct ospfv2_neighbor* expired = check_neighbors_alive(sr->ospf_subsys->first_neighbor, sr_timer_now(), &next_expiry);
+    pwospf_unlock(sr->ospf_subsys);
 
+    if (next_expiry != 0)
+    {
+        sr_timer_add_at(sr, &sr->ospf_subsys->neighbor_timer, next_expiry);
+    }
 
-    struct in_addr zero;
-    zero.s_addr = 0;
-    dijkstra_stack = create_dikjstra_item(create_ospfv2_topology_entry(zero, zero, zero, zero, zero, 0), 0);
-    dijkstra_heap = create_dikjstra_item(create_ospfv2_topology_entry(zero, zero, zero, zero, zero, 0), 0);
+    while (expired != NULL)
+    {
+        struct ospfv2_neighbor* temp = expired->next;
+        neighbor_down(sr, expired->neighbor_id, expired->neighbor_ip);
+        free(expired);
+        expired = temp;
+    }
+} /* -- check_neighbors_life -- */
 
 
-    /* Cleaing the routing table */
-//printf("1111111111111111111111111111111111111111111111111111111111111111111111111111111111\n");
-/*    Debug("\n-> PWOSPF: Printing the forwarding table\n");
-    print_routing_table(dij_param->sr);*/
+/*---------------------------------------------------------------------
+ * Method: neighbor_down
+ *
+ * Tearing down the adjacency with an expired neighbor: the link is
+ * withdrawn from our LSA by clearing the interface neighbor, a new
+ * LSU is scheduled right away and the routes are recomputed, instead of
+ * waiting for the neighbor topology entries to age out.
+ *
+ *---------------------------------------------------------------------*/
 
-    clear_routes(dij_param->sr);
-/*    Debug("\n-> PWOSPF: Printing the forwarding table\n");
-    print_routing_table(dij_param->sr);*/
+void neighbor_down(struct sr_instance* sr, struct in_addr neighbor_id, struct in_addr neighbor_ip)
+{
+    uint8_t changed = 0;
 
-//printf("2222222222222222222222222222222222222222222222222222222222222222222222222222222222\n");
+    pwospf_lock(sr->ospf_subsys);
 
-    /* Run Dijkstra algorithm */
-    struct ospfv2_topology_entry* topo_entry = first_topology_entry->next;
-    while(topo_entry != NULL)
+    struct sr_if* temp_int = sr->if_list;
+    while (temp_int != NULL)
     {
-//printf("*********************************************************\n");
-        if (check_route(dij_param->sr, topo_entry->net_num) == 0)
+        if ((temp_int->neighbor_id == neighbor_id.s_addr) && (temp_int->neighbor_ip == neighbor_ip.s_addr))
         {
-            struct sr_if* temp_int = dij_param->sr->if_list;
-            while (temp_int != NULL)
-            {
-/*struct in_addr x;	x.s_addr = temp_int->ip & htonl(0xfffffffe);
-printf("************************************************* %s\n", inet_ntoa(x));*/
-
-                if (search_topolgy_table(first_topology_entry, (temp_int->ip & htonl(0xfffffffe))) == 0)
-                {
-//printf("************************************************* continue\n");
-                    temp_int = temp_int->next;
-                    continue;
-                }
-
-                if (temp_int->neighbor_id != 0)
-                {
-                    struct in_addr mask;	    mask.s_addr = htonl(0xfffffffe);
-                    struct in_addr subnet;	    subnet.s_addr = temp_int->ip & mask.s_addr;
-                    struct in_addr neighbor_id;	    neighbor_id.s_addr = temp_int->neighbor_id;
-                    struct in_addr next_hop;	    next_hop.s_addr = temp_int->neighbor_ip;
-
-/*Debug("Push in heap: ");
-Debug("%-18s",inet_ntoa(router_id));
-Debug("%-18s",inet_ntoa(subnet));
-Debug("%-18s",inet_ntoa(mask));
-Debug("%-18s",inet_ntoa(neighbor_id));
-Debug("%-18s",inet_ntoa(next_hop));
-Debug("%-11d",0);
-Debug("%d\n",0);*/
-
-                    dijkstra_stack_push(dijkstra_heap, create_dikjstra_item(create_ospfv2_topology_entry(router_id, subnet, mask, neighbor_id,
-                        next_hop, 0), 1));
-                }
-
-                temp_int = temp_int->next;
-            }
-
-            struct dijkstra_item* dijkstra_popped_item;
-            uint8_t stop = 0;
-            while(1)
-            {
-                while(1)
-                {
-                    /* Pop from the heap */
-                    dijkstra_popped_item = dijkstra_stack_pop(dijkstra_heap);
-
-                    if (dijkstra_popped_item == NULL)
-                    {
-//printf("******* Stack is Empty\n");
-                        stop = 1;
-                        break;
-                    }
-
-/*Debug("Pop from heap: ");
-Debug("%-18s",inet_ntoa(dijkstra_popped_item->topology_entry->router_id));
-Debug("%-18s",inet_ntoa(dijkstra_popped_item->topology_entry->net_num));
-Debug("%-18s",inet_ntoa(dijkstra_popped_item->topology_entry->net_mask));
-Debug("%-18s",inet_ntoa(dijkstra_popped_item->topology_entry->neighbor_id));
-Debug("%-18s",inet_ntoa(dijkstra_popped_item->topology_entry->next_hop));
-Debug("%-11d",dijkstra_popped_item->topology_entry->sequence_num);
-Debug("%d\n",dijkstra_popped_item->topology_entry->age);*/
-
-                    if (dijkstra_popped_item->topology_entry->net_num.s_addr == topo_entry->net_num.s_addr)
-                    {
-//printf("******* Entry found\n");
-                        stop = 1;
-                        break;
-                    }
-
-                    if (dijkstra_popped_item->topology_entry->neighbor_id.s_addr != 0)
-                    {
-                        break;
-                    }
-                }
-
-                /* Push popped item in stack */
-                if (dijkstra_popped_item != NULL)
-                {
-                    dijkstra_stack_push(dijkstra_stack, dijkstra_popped_item);
-                }
-
-
-                /* stopping criteria here */
-                if (stop == 1)
-                {
-                    break;
-                }
-
-
-                /* Relaxing the popped item */
-                struct ospfv2_topology_entry* ptr = first_topology_entry->next;
-                while(ptr != NULL)
-                {
-/*printf("Begin\n");
-printf("%s, ", inet_ntoa(ptr->router_id));
-printf("%s\n", inet_ntoa(dijkstra_popped_item->topology_entry->neighbor_id));
-
-printf("%s, ", inet_ntoa(ptr->net_num));
-printf("%s\n", inet_ntoa(dijkstra_popped_item->topology_entry->router_id));
-
-printf("%s, ", inet_ntoa(ptr->neighbor_id));
-printf("%s\n", inet_ntoa(dijkstra_popped_item->topology_entry->router_id));
-
-printf("End\n");*/
-
-                    if ((ptr->router_id.s_addr == dijkstra_popped_item->topology_entry->neighbor_id.s_addr) &&
-                        (ptr->net_num.s_addr != dijkstra_popped_item->topology_entry->net_num.s_addr) &&
-                        (ptr->neighbor_id.s_addr != dijkstra_popped_item->topology_entry->neighbor_id.s_addr))
-                    {
-                        struct ospfv2_topology_entry* clone = clone_ospfv2_topology_entry(ptr);
-
-                        struct dijkstra_item* to_be_pushed = create_dikjstra_item(clone, dijkstra_popped_item->cost + 1);
-                        to_be_pushed->parent = dijkstra_popped_item;
-
-
-/*Debug("Push from heap: ");
-Debug("%-18s",inet_ntoa(to_be_pushed->topology_entry->router_id));
-Debug("%-18s",inet_ntoa(to_be_pushed->topology_entry->net_num));
-Debug("%-18s",inet_ntoa(to_be_pushed->topology_entry->net_mask));
-Debug("%-18s",inet_ntoa(to_be_pushed->topology_entry->neighbor_id));
-Debug("%-18s",inet_ntoa(to_be_pushed->topology_entry->next_hop));
-Debug("%-11d",to_be_pushed->topology_entry->sequence_num);
-Debug("%d\n",to_be_pushed->topology_entry->age);*/
-
-                        dijkstra_stack_push(dijkstra_heap, to_be_pushed);
-                        dijkstra_stack_reorder(dijkstra_heap);
-                    }
-
-                    ptr = ptr->next;
-                }
-            }
-
-
-//Debug("**********************************************************************************\n");
-            struct dijkstra_item* final_item = dijkstra_stack_pop(dijkstra_stack);
-
-            if (final_item != NULL)
-            {
-/*Debug("final_item: ");
-Debug("%-18s",inet_ntoa(final_item->topology_entry->router_id));
-Debug("%-18s",inet_ntoa(final_item->topology_entry->net_num));
-Debug("%-18s",inet_ntoa(final_item->topology_entry->net_mask));
-Debug("%-18s",inet_ntoa(final_item->topology_entry->neighbor_id));
-Debug("%-18s",inet_ntoa(final_item->topology_entry->next_hop));
-Debug("%-11d",final_item->topology_entry->sequence_num);
-Debug("%d\n",final_item->topology_entry->age);*/
-
-                while (final_item->parent != NULL)
-                {
-                    final_item = final_item->parent; //dijkstra_stack_pop(dijkstra_stack);
-
-/*Debug("final_item: ");
-Debug("%-18s",inet_ntoa(final_item->topology_entry->router_id));
-Debug("%-18s",inet_ntoa(final_item->topology_entry->net_num));
-Debug("%-18s",inet_ntoa(final_item->topology_entry->net_mask));
-Debug("%-18s",inet_ntoa(final_item->topology_entry->neighbor_id));
-Debug("%-18s",inet_ntoa(final_item->topology_entry->next_hop));
-Debug("%-11d",final_item->topology_entry->sequence_num);
-Debug("%d\n",final_item->topology_entry->age);*/
-                }
-//Debug("**********************************************************************************\n");
-
-
-
-                struct sr_if* next_hop_int = dij_param->sr->if_list;
-                while (next_hop_int != NULL)
-                {
-//printf("**** %d, %d\n", (next_hop_int->ip & htonl(0xfffffffe)), (final_item->topology_entry->next_hop.s_addr & htonl(0xfffffffe)));
-                    if ((next_hop_int->ip & htonl(0xfffffffe)) == (final_item->topology_entry->next_hop.s_addr & htonl(0xfffffffe)))
-                    {
-                        break;
-                    }
-
-                    next_hop_int = next_hop_int->next;
-                }
-
-//printf("****** next_hop_int->name = %s\n", next_hop_int->name);
-            
-
-            
-                sr_add_rt_entry(dij_param->sr, topo_entry->net_num, final_item->topology_entry->next_hop,
-                    /*final_item->topology_entry*/topo_entry->net_mask, next_hop_int->name, 110);
-            }
+            Log(LOG_OSPF, LOG_INFO, "PWOSPF: Adjacency on interface %s is down [Neighbor ID = %I]", temp_int->name,
+                neighbor_id.s_addr);
+            TraceInstant("neighbor down", "ospf", temp_int->name, neighbor_id.s_addr);
+            temp_int->neighbor_id = 0;
+            temp_int->neighbor_ip = 0;
+            changed = 1;
         }
 
-        topo_entry = topo_entry->next;
+        temp_int = temp_int->next;
     }
 
-    Debug("\n-> PWOSPF: Dijkstra algorithm completed\n\n");
-    Debug("\n-> PWOSPF: Printing the forwarding table\n");
-    print_routing_table(dij_param->sr);
-
-
+    if (changed == 1)
+    {
+        schedule_lsu(sr);
+    }
 
-    pthread_mutex_unlock(&dijkstra_mutex);
+    pwospf_unlock(sr->ospf_subsys);
 
-    return NULL;
-} /* -- run_dijkstra -- */
+    if (changed == 1)
+    {
+        schedule_dijkstra(sr);
+    }
+} /* -- neighbor_down -- */
 
 
 /*---------------------------------------------------------------------
- * Method: check_neighbors_life
+ * Method: schedule_dijkstra
  *
- * Check if the neighbors are alive 
+ * Recompute the routes once the event loop is done with what woke it
+ * up, the changes of one batch of packets share a single run
  *
  *---------------------------------------------------------------------*/
 
-void* check_neighbors_life(void* arg)
+void schedule_dijkstra(struct sr_instance* sr)
 {
-    while(1)
+    if (!sr_timer_armed(&sr->ospf_subsys->spf_timer))
     {
-        usleep(1000000);
-        check_neighbors_alive(first_neighbor);
-    };
+        sr_timer_add(sr, &sr->ospf_subsys->spf_timer, 0);
+    }
+} /* -- schedule_dijkstra -- */
 
-    return NULL;
-} /* -- check_neighbors_life -- */
+static
+void spf_expired(struct sr_instance* sr, void* arg)
+{
+    struct dijkstra_param dij_param;
+    dij_param.sr = sr;
+    dij_param.first_topology_entry = sr->ospf_subsys->first_topology_entry;
+    run_dijkstra(&dij_param);
+} /* -- spf_expired -- */
 
 
 /*---------------------------------------------------------------------
  * Method: check_topology_entries_age
  *
- * Check if the topology entries are alive 
+ * Topology timer, due when the first topology entry may age out
  *
  *---------------------------------------------------------------------*/
 
-void* check_topology_entries_age(void* arg)
+void check_topology_entries_age(struct sr_instance* sr, void* arg)
 {
-    struct sr_instance* sr = (struct sr_instance*)arg;
+    uint64_t next_expiry;
 
-    while(1)
+    pwospf_lock(sr->ospf_subsys);
+    uint8_t deleted = check_topology_age(sr->ospf_subsys->first_topology_entry, sr_timer_now(), &next_expiry);
+    pwospf_unlock(sr->ospf_subsys);
+
+    if (next_expiry != 0)
     {
-        usleep(1000000);
-        if (check_topology_age(first_topology_entry) == 1)
-        {
-            Debug("\n-> PWOSPF: Printing the topology table\n");
-            print_topolgy_table(first_topology_entry);
-            Debug("\n");
-
-            struct dijkstra_param* dij_param = ((dijkstra_param*)(malloc(sizeof(dijkstra_param))));
-            dij_param->sr = sr;
-            dij_param->first_topology_entry = first_topology_entry;
-            pthread_create(&dijkstra_thread, NULL, run_dijkstra, dij_param);
-        }
-    };
+        sr_timer_add_at(sr, &sr->ospf_subsys->topology_timer, next_expiry);
+    }
 
-    return NULL;
+    if (deleted == 1)
+    {
+        print_topolgy_table(sr->ospf_subsys->first_topology_entry);
+
+        schedule_dijkstra(sr);
+    }
 } /* -- check_topology_entries_age -- */
 
 
@@ -1457,28 +1466,33 @@ void* check_topology_entries_age(void* arg)
 
 void print_routing_table(struct sr_instance* sr)
 {
-    //Debug("-----------------------------------------------------------------------\n");
-    Debug("=======================================================================\n");
-    Debug("%-18s%-18s%-18s%-8sAdmin Dis\n", "Destination", "Gateway", "Subnet Mask", "Iface");
-    Debug("%-18s%-18s%-18s%-8s---------\n", "-----------", "-------", "-----------", "-----");
+    /* One record per row, nothing to walk if nobody reads it */
+    if (!sr_log_enabled(LOG_SPF, LOG_DEBUG))
+    {
+        return;
+    }
+
+    Log(LOG_SPF, LOG_DEBUG, "PWOSPF: Forwarding table");
+    Log(LOG_SPF, LOG_DEBUG, "%-18s%-18s%-18s%-8sAdmin Dis", "Destination", "Gateway", "Subnet Mask", "Iface");
 
     struct sr_rt* entry = sr->routing_table;
     if (entry == NULL)
     {
-        Debug("The forwarding table is empty");
+        Log(LOG_SPF, LOG_DEBUG, "The forwarding table is empty");
     }
     else
     {
         while(entry != NULL)
         {
-            Debug("%-18s",inet_ntoa(entry->dest));
-            Debug("%-18s",inet_ntoa(entry->gw));
-            Debug("%-18s",inet_ntoa(entry->mask));
-            Debug("%-8s",entry->interface);
-            Debug("%d\n",entry->admin_dst);
+            Log(LOG_SPF, LOG_DEBUG, "%-18I%-18I%-18I%-8s%d", entry->dest.s_addr, entry->gw.s_addr, entry->mask.s_addr,
+                entry->interface, entry->admin_dst);
+
+            for (int i = 1; i < entry->nexthop_num; i++)
+            {
+                Log(LOG_SPF, LOG_DEBUG, "%-18s%-18I%-18s%-8s", "", entry->nexthop[i].gw.s_addr, "", entry->nexthop[i].interface);
+            }
 
             entry = entry->next; 
         }
     }
-    Debug("=======================================================================\n");
 } /* -- print_routing_table -- */
@@ -11,34 +11,59 @@
 #define SR_PWOSPF_H
 
 #include <pthread.h>
+#include <time.h>
 #include "sr_protocol.h"
+#include "sr_event.h"
 
 
+#define OSPF_START_DELAY 5000 /* ms from pwospf_init() to the first HELLO */
+
 /* forward declare */
 struct sr_instance;
+struct ospfv2_neighbor;
+struct ospfv2_topology_entry;
 
 struct pwospf_subsys
 {
     /* -- pwospf subsystem state variables here -- */
+    struct in_addr router_id;
+    struct ospfv2_neighbor* first_neighbor;
+    struct ospfv2_topology_entry* first_topology_entry;
+    uint16_t sequence_num;    /* of the last LSU we originated */
+
+    /* -- interface fault emulation, see send_all_lsu() -- */
+    uint8_t fault_count;
+    uint8_t int_down;
+
+    /* -- LSU origination, protected by the subsystem lock -- */
+    uint8_t lsu_pending;  /* our link state changed since the last LSU */
+    uint64_t last_lsu;    /* monotonic ms of the last origination */
+    uint64_t next_refresh;
+    uint64_t next_fault;
+
+    /* -- arrival (ns) of the oldest LSU not yet in the routing table -- */
+    uint64_t lsu_rx_time;
 
+    /* -- timers, run by the event loop -- */
+    struct sr_timer start_timer;
+    struct sr_timer hello_timer;
+    struct sr_timer lsu_timer;
+    struct sr_timer neighbor_timer;
+    struct sr_timer topology_timer;
+    struct sr_timer spf_timer;
 
-    /* -- thread and single lock for pwospf subsystem -- */
-    pthread_t thread;
+
+    /* -- single lock for pwospf subsystem -- */
     pthread_mutex_t lock;
 };
 
-struct powspf_hello_lsu_param
-{
-    struct sr_instance* sr;
-    struct sr_if* interface;
-}__attribute__ ((packed));
-
 struct powspf_rx_lsu_param
 {
     struct sr_instance* sr;
-    uint8_t packet[1500];
     unsigned int length;
     struct sr_if* rx_if;
+    uint64_t rx_time;
+    uint8_t packet[1]; /* length bytes, allocated with the param */
 }__attribute__ ((packed));
 
 struct dijkstra_param
@@ -48,18 +73,25 @@ struct dijkstra_param
 }__attribute__ ((packed));
 
 int pwospf_init(struct sr_instance* sr);
+void pwospf_lock(struct pwospf_subsys*);
+void pwospf_unlock(struct pwospf_subsys*);
 
 
-void* send_hellos(void*);
-void* send_hello_packet(void*);
+void send_hellos(struct sr_instance*, void*);
+void send_hello_packet(struct sr_instance*, struct sr_if*);
 void handling_ospfv2_packets(struct sr_instance*, uint8_t*, unsigned int, struct sr_if*);
 void handling_ospfv2_hello_packets(struct sr_instance*, uint8_t*, unsigned int, struct sr_if*);
-void* handling_ospfv2_lsu_packets(void*);
-void* send_lsu(void*);
-void* send_all_lsu(void*);
+void handling_ospfv2_lsu_packets(struct powspf_rx_lsu_param*);
+void send_all_lsu(struct sr_instance*, void*);
+void schedule_lsu(struct sr_instance*);
+void flood_lsu(struct sr_instance*);
+void send_lsdb(struct sr_instance*, struct sr_if*);
+void send_router_lsu(struct sr_instance*, struct sr_if*, struct ospfv2_topology_entry*);
 void* run_dijkstra(void*);
-void* check_neighbors_life(void*);
-void* check_topology_entries_age(void*);
+void schedule_dijkstra(struct sr_instance*);
+void check_neighbors_life(struct sr_instance*, void*);
+void neighbor_down(struct sr_instance*, struct in_addr, struct in_addr);
+void check_topology_entries_age(struct sr_instance*, void*);
 void print_routing_table(struct sr_instance*);
 
 
@@ -0,0 +1,141 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ring.c
+ *
+ * Description:
+ *
+ * Bounded lock-free MPSC ring, see sr_ring.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sr_ring.h"
+
+static inline
+struct sr_ring_slot* sr_ring_slot(struct sr_ring* ring, uint64_t pos)
+{
+    return ((struct sr_ring_slot*)(ring->slots + ((pos & ring->mask) * ring->slot_size)));
+}
+
+static inline
+struct sr_ring_slot* sr_ring_header(void* data)
+{
+    return ((struct sr_ring_slot*)(((uint8_t*)(data)) - sizeof(struct sr_ring_slot)));
+}
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_ring_create
+ *
+ * slot_num is rounded up to a power of two, data_size to whole cache
+ * lines with the slot header
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_ring* sr_ring_create(unsigned int slot_num, unsigned int data_size)
+{
+    void* mem;
+    if (posix_memalign(&mem, SR_RING_CACHE_LINE, sizeof(struct sr_ring)) != 0)
+    {
+        return NULL;
+    }
+    struct sr_ring* ring = ((struct sr_ring*)(mem));
+    memset(ring, 0, sizeof(struct sr_ring));
+
+    uint64_t num = 1;
+    while (num < slot_num)
+    {
+        num <<= 1;
+    }
+    ring->mask = num - 1;
+    ring->slot_size = (sizeof(struct sr_ring_slot) + data_size + SR_RING_CACHE_LINE - 1) & ~(SR_RING_CACHE_LINE - 1);
+    ring->data_size = ring->slot_size - sizeof(struct sr_ring_slot);
+
+    if (posix_memalign(&mem, SR_RING_CACHE_LINE, num * ring->slot_size) != 0)
+    {
+        free(ring);
+        return NULL;
+    }
+    ring->slots = ((uint8_t*)(mem));
+    for (uint64_t i = 0; i < num; i++)
+    {
+        sr_ring_slot(ring, i)->seq = i;
+    }
+
+    return ring;
+} /* -- sr_ring_create -- */
+
+void sr_ring_destroy(struct sr_ring* ring)
+{
+    free(ring->slots);
+    free(ring);
+} /* -- sr_ring_destroy -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_ring_reserve
+ *
+ * Returns a slot to write, or NULL (and counts a drop) if the ring is full
+ *
+ *---------------------------------------------------------------------------*/
+
+void* sr_ring_reserve(struct sr_ring* ring)
+{
+    uint64_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+    while (1)
+    {
+        struct sr_ring_slot* slot = sr_ring_slot(ring, pos);
+        int64_t diff = ((int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE))) - ((int64_t)(pos));
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&ring->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                slot->pos = pos;
+                return slot->data;
+            }
+        }
+        else if (diff < 0)
+        {
+            __atomic_fetch_add(&ring->drops, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        else
+        {
+            pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+} /* -- sr_ring_reserve -- */
+
+void sr_ring_commit(struct sr_ring* ring, void* data)
+{
+    struct sr_ring_slot* slot = sr_ring_header(data);
+    __atomic_store_n(&slot->seq, slot->pos + 1, __ATOMIC_RELEASE);
+} /* -- sr_ring_commit -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_ring_peek
+ *
+ * Returns the oldest committed slot, or NULL if there is none. Only the
+ * consumer thread calls it.
+ *
+ *---------------------------------------------------------------------------*/
+
+void* sr_ring_peek(struct sr_ring* ring)
+{
+    uint64_t pos = ring->dequeue_pos;
+    struct sr_ring_slot* slot = sr_ring_slot(ring, pos);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+    {
+        return NULL;
+    }
+    return slot->data;
+} /* -- sr_ring_peek -- */
+
+void sr_ring_release(struct sr_ring* ring, void* data)
+{
+    struct sr_ring_slot* slot = sr_ring_header(data);
+    ring->dequeue_pos = slot->pos + 1;
+    __atomic_store_n(&slot->seq, slot->pos + ring->mask + 1, __ATOMIC_RELEASE);
+} /* -- sr_ring_release -- */
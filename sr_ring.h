@@ -0,0 +1,59 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ring.h
+ *
+ * Description:
+ *
+ * Bounded lock-free ring of fixed size slots, many producers and a single
+ * consumer. Every slot carries a sequence number telling whether it is
+ * free, being written or ready (D. Vyukov's bounded queue), so producers
+ * only contend on one CAS and write their record in place.
+ *
+ * Producer:  slot = sr_ring_reserve(ring); fill it; sr_ring_commit(ring, slot);
+ * Consumer:  slot = sr_ring_peek(ring); read it; sr_ring_release(ring, slot);
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RING_H
+#define SR_RING_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _SOLARIS_
+#include </usr/include/sys/int_types.h>
+#endif /* SOLARIS */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif
+
+#define SR_RING_CACHE_LINE 64
+
+struct sr_ring_slot
+{
+    uint64_t seq;
+    uint64_t pos;
+    uint8_t data[0];
+};
+
+struct sr_ring
+{
+    uint8_t* slots;
+    unsigned int slot_size;     /* header included */
+    unsigned int data_size;
+    uint64_t mask;
+
+    uint64_t enqueue_pos __attribute__ ((aligned (SR_RING_CACHE_LINE)));
+    uint64_t drops;             /* reservations refused, ring full */
+    uint64_t dequeue_pos __attribute__ ((aligned (SR_RING_CACHE_LINE)));
+};
+
+struct sr_ring* sr_ring_create(unsigned int, unsigned int);
+void sr_ring_destroy(struct sr_ring*);
+void* sr_ring_reserve(struct sr_ring*);
+void sr_ring_commit(struct sr_ring*, void*);
+void* sr_ring_peek(struct sr_ring*);
+void sr_ring_release(struct sr_ring*, void*);
+
+#endif /* -- SR_RING_H -- */
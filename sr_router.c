@@ -28,20 +28,22 @@
 #include "sr_protocol.h"
 #include "pwospf_protocol.h"
 #include "sr_pwospf.h"
+#include "sr_stats.h"
+#include "sr_log.h"
+#include "sr_trace.h"
+#include "sr_icmp_limit.h"
+#include "sr_copp.h"
+#include "sr_snapshot.h"
+#include "sr_acl.h"
+#include "sr_flow.h"
 
 #include "queue.h"
 #include "cache.h"
 
 
-struct queue_item* packet_queue[3];
-struct cache_item* arp_cache;
-pthread_t cache_thread;
-pthread_t arp_thread[3];
-int stop_arp_thread[3];
-
 //uint32_t default_gateway_addr = 290068652;
 
-uint8_t sr_multicast_mac[ETHER_ADDR_LEN];
+static const uint8_t sr_multicast_mac[ETHER_ADDR_LEN] = {0x01, 0x00, 0x5e, 0x00, 0x00, 0x05};
 
 /*--------------------------------------------------------------------- 
  * Method: sr_init(void)
@@ -59,37 +61,35 @@ void sr_init(struct sr_instance* sr)
     pwospf_init(sr);
 
     /* Add initialization code here! */
-    sr_multicast_mac[0] = 0x01;
-    sr_multicast_mac[1] = 0x00;
-    sr_multicast_mac[2] = 0x5e;
-    sr_multicast_mac[3] = 0x00;
-    sr_multicast_mac[4] = 0x00;
-    sr_multicast_mac[5] = 0x05;
-
-    packet_queue[0] = queue_create_item(NULL, 0, NULL);
-    packet_queue[1] = queue_create_item(NULL, 0, NULL);
-    packet_queue[2] = queue_create_item(NULL, 0, NULL);
-
     unsigned char empty_mac[ETHER_ADDR_LEN] = {0};
-    arp_cache = cache_create_item(0, empty_mac, 0);
+    sr->arp_cache = cache_create_item(0, empty_mac, 0);
+
+    sr_timer_init(&sr->arp_cache_timer, arp_cache_expired, NULL);
 
-    pthread_create(&cache_thread, NULL, check_cache, NULL);
+    /* -- state of the last run, if there is a snapshot of it and the
+     * interfaces are known already (AF_PACKET) -- */
+    if (sr->snapshot != NULL)
+    {
+        sr_snapshot_start(sr);
+    }
 } /* -- sr_init -- */
 
 
 /*--------------------------------------------------------------------- 
- * Method: check_cache
+ * Method: arp_cache_expired
+ *
+ * Timer of the ARP cache, armed for the next entry to expire
  *
  *---------------------------------------------------------------------*/
 
-void* check_cache(void* args)
+void arp_cache_expired(struct sr_instance* sr, void* args)
 {
-    while(1)
+    uint64_t next_expiry = check_cache(sr->arp_cache, sr_timer_now());
+    if (next_expiry != 0)
     {
-        usleep(1000000);
-        check_cache(arp_cache);
+        sr_timer_add_at(sr, &sr->arp_cache_timer, next_expiry);
     }
-}/* end check_cache */
+}/* end arp_cache_expired */
 
 
 /*---------------------------------------------------------------------
@@ -121,15 +121,22 @@ void sr_handlepacket(struct sr_instance* sr,
     struct sr_if* rx_if = sr_get_interface(sr, interface);
     struct sr_ethernet_hdr* rx_e_hdr = (struct sr_ethernet_hdr*)packet;
 
+    sr_stats_if_add(sr, rx_if, STATS_IF_RX_PACKETS, len);
 
     if (chk_ether_addr(rx_e_hdr, rx_if) == 0)
     {
+        sr_stats_inc(sr, STATS_DROP_NOT_FOR_US);
         return;
     }
 
     switch (htons(rx_e_hdr->ether_type))
     {
         case ETHERTYPE_ARP:
+            if (sr_copp_police(sr, rx_if, packet, len) == 0)
+            {
+                Log(LOG_ARP, LOG_DEBUG, "ARP Packet dropped: over the control plane limit");
+                return;
+            }
             handle_arp_packet(sr, packet, len, rx_if, rx_e_hdr);
             break;
 
@@ -138,7 +145,7 @@ void sr_handlepacket(struct sr_instance* sr,
             break;
 
         default:
-            Debug("\nReceived Unknow Packet, length = %d\n", len);
+            Log(LOG_FWD, LOG_DEBUG, "Received Unknow Packet, length = %d", len);
             break;
     }
 }/* end sr_handlepacket */
@@ -151,142 +158,93 @@ void sr_handlepacket(struct sr_instance* sr,
 
 void handle_arp_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct sr_if* rx_if, struct sr_ethernet_hdr* rx_e_hdr)
 {
-    struct sr_ethernet_hdr* tx_e_hdr = ((sr_ethernet_hdr*)(malloc(sizeof(sr_ethernet_hdr))));
-    uint8_t* tx_packet;
-    int queue_index;
-
     /***** Getting the ARP header *****/
     struct sr_arphdr* rx_arp_hdr = ((sr_arphdr*)(packet + sizeof(sr_ethernet_hdr)));
-    struct sr_arphdr* tx_arp_hdr = ((sr_arphdr*)(malloc(sizeof(sr_arphdr))));
+    uint32_t sender_ip;
 
 
     switch (htons(rx_arp_hdr->ar_op))
     {
         case ARP_REQUEST:
-            Debug("\nReceived ARP REQUEST Packet, length = %d\n", len);
-
-            Debug("-> Constructing ARP REPLY Packet\n");
-            /* Destination address */
-            for (int i = 0; i < ETHER_ADDR_LEN; i++)
-            {
-                tx_e_hdr->ether_dhost[i] = rx_e_hdr->ether_shost[i];
-            }
-
-            /* Source address */
-            for (int i = 0; i < ETHER_ADDR_LEN; i++)
-            {
-                tx_e_hdr->ether_shost[i] = ((uint8_t)(rx_if->addr[i]));
-            }
-	    
-            /* Type */
-            tx_e_hdr->ether_type = rx_e_hdr->ether_type;
-
-
-            /* Hardware type */
-            tx_arp_hdr->ar_hrd = rx_arp_hdr->ar_hrd;
-
-            /* Protocol type */
-            tx_arp_hdr->ar_pro = rx_arp_hdr->ar_pro;
-
-            /* Hardware address length */
-            tx_arp_hdr->ar_hln = rx_arp_hdr->ar_hln;
-
-	    /* Protocol address length */
-	    tx_arp_hdr->ar_pln = rx_arp_hdr->ar_pln;
-
-	    /* Operation code */
-	    tx_arp_hdr->ar_op = htons(ARP_REPLY);
-
-	    /* Source hardware address */
-            for (int i = 0; i < ETHER_ADDR_LEN; i++)
-            {
-                tx_arp_hdr->ar_sha[i] = ((uint8_t)(rx_if->addr[i]));
-            }
-
-	    /* Source protocol address */
-	    tx_arp_hdr->ar_sip = rx_arp_hdr->ar_tip;
-
-	    /* Target hardware address */
-            for (int i = 0; i < ETHER_ADDR_LEN; i++)
-            {
-                tx_arp_hdr->ar_tha[i] = rx_arp_hdr->ar_sha[i];
-            }
-
-	    /* Target protocol address */
-	    tx_arp_hdr->ar_tip = rx_arp_hdr->ar_sip;
-
-
-	    /***** Creating the transmitted packet *****/
-	    tx_packet = ((uint8_t*)(malloc(sizeof(sr_ethernet_hdr) + sizeof(sr_arphdr))));
-	    memcpy(tx_packet, tx_e_hdr, sizeof(sr_ethernet_hdr));
-	    memcpy(tx_packet + sizeof(sr_ethernet_hdr), tx_arp_hdr, sizeof(sr_arphdr));
-
-
-            Debug("-> Sending ARP REPLY Packet, length = %d\n", sizeof(sr_ethernet_hdr) + sizeof(sr_arphdr));
-            sr_send_packet(sr, ((uint8_t*)(tx_packet)), sizeof(sr_ethernet_hdr) + sizeof(sr_arphdr), rx_if->name);
-
-
-            free(tx_packet);
-            free(tx_arp_hdr);
-            free(tx_e_hdr);
+            Log(LOG_ARP, LOG_DEBUG, "Received ARP REQUEST Packet, length = %d", len);
+
+            /***** The reply is the request turned around, built in place *****/
+            Log(LOG_ARP, LOG_DEBUG, "Constructing ARP REPLY Packet");
+            memcpy(rx_e_hdr->ether_dhost, rx_e_hdr->ether_shost, ETHER_ADDR_LEN);
+            memcpy(rx_e_hdr->ether_shost, rx_if->addr, ETHER_ADDR_LEN);
+
+            rx_arp_hdr->ar_op = htons(ARP_REPLY);
+            memcpy(rx_arp_hdr->ar_tha, rx_arp_hdr->ar_sha, ETHER_ADDR_LEN);
+            memcpy(rx_arp_hdr->ar_sha, rx_if->addr, ETHER_ADDR_LEN);
+            sender_ip = rx_arp_hdr->ar_sip;
+            rx_arp_hdr->ar_sip = rx_arp_hdr->ar_tip;
+            rx_arp_hdr->ar_tip = sender_ip;
+
+            Log(LOG_ARP, LOG_DEBUG, "Sending ARP REPLY Packet, length = %zu", sizeof(sr_ethernet_hdr) + sizeof(sr_arphdr));
+            sr_send_packet(sr, packet, sizeof(sr_ethernet_hdr) + sizeof(sr_arphdr), rx_if->name);
             break;
 
         case ARP_REPLY:
-            Debug("\nReceived ARP REPLY Packet, length = %d\n", len);
+            Log(LOG_ARP, LOG_DEBUG, "Received ARP REPLY Packet, length = %d", len);
+            TraceInstant("arp reply", "arp", rx_if->name, rx_arp_hdr->ar_sip);
 
             /* Checking the ARP cache */
             struct in_addr ip_address;
 
             ip_address.s_addr = rx_arp_hdr->ar_sip;
-            if (cache_search(arp_cache, rx_arp_hdr->ar_sip) == NULL)
+            if (cache_search(sr->arp_cache, rx_arp_hdr->ar_sip) == NULL)
             {
-                Debug("-> Updating the ARP Cache, [%s, ", inet_ntoa(ip_address));
-                DebugMAC(rx_arp_hdr->ar_sha);
-                Debug("]\n");
+                Log(LOG_ARP, LOG_DEBUG, "Updating the ARP Cache, [%I, %M]", ip_address.s_addr, rx_arp_hdr->ar_sha);
 
-                if (arp_cache == NULL)
+                uint64_t expires = sr_timer_now() + CACHE_ITEM_TIMEOUT;
+                if (sr->arp_cache == NULL)
                 {
-                    time_t time_stamp;
-                    time(&time_stamp);
-                    arp_cache = cache_create_item(rx_arp_hdr->ar_sip, rx_arp_hdr->ar_sha, ((int)(time_stamp)));
+                    sr->arp_cache = cache_create_item(rx_arp_hdr->ar_sip, rx_arp_hdr->ar_sha, expires);
                 }
                 else
                 {
-                    time_t time_stamp;
-                    time(&time_stamp);
-                    cache_push(arp_cache, cache_create_item(rx_arp_hdr->ar_sip, rx_arp_hdr->ar_sha, ((int)(time_stamp))));
+                    cache_push(sr->arp_cache, cache_create_item(rx_arp_hdr->ar_sip, rx_arp_hdr->ar_sha, expires));
+                }
+                if (!sr_timer_armed(&sr->arp_cache_timer))
+                {
+                    sr_timer_add_at(sr, &sr->arp_cache_timer, expires);
                 }
             }
             else
             {
-                Debug("-> Entry already exists in the ARP Cache, [%s, ", inet_ntoa(ip_address));
-                DebugMAC(rx_arp_hdr->ar_sha);
-                Debug("]\n");
+                Log(LOG_ARP, LOG_DEBUG, "Entry already exists in the ARP Cache, [%I, %M]", ip_address.s_addr, rx_arp_hdr->ar_sha);
             }
 
-            queue_index = ((int)(rx_if->name[strlen(rx_if->name) - 1])) - 48;
+            sr_stats_record_since(sr, HIST_ARP_RESOLVE, rx_if->arp_request_time);
+            rx_if->arp_request_time = 0;
 
-            /***** Stop the ARP_THREAD *****/
-            if (stop_arp_thread[queue_index] == 0)
+            /***** Stop the ARP REQUESTs *****/
+            if (rx_if->arp_requests != NULL)
             {
-                Debug("-> Stopping the ARP REQUESTs thread\n");
-                stop_arp_thread[queue_index] = 1;
-                //pthread_cancel(arp_thread[queue_index]);
+                Log(LOG_ARP, LOG_DEBUG, "Stopping the ARP REQUESTs");
+                while (rx_if->arp_requests != NULL)
+                {
+                    struct sr_arp_request* request = rx_if->arp_requests;
+                    rx_if->arp_requests = request->next;
+                    sr_timer_cancel(sr, &request->timer);
+                    free(request);
+                }
             }
 
-            if (queue_is_empty(packet_queue[queue_index]) == 0)
+            if (queue_is_empty(rx_if->packet_queue) == 0)
             {
-                struct queue_item* item = queue_pop(packet_queue[queue_index]);
-                Debug("-> Popping a packet from the queue, length = %d\n", item->length);
+                struct queue_item* item = queue_pop(rx_if->packet_queue);
+                Log(LOG_FWD, LOG_DEBUG, "Popping a packet from the queue, length = %d", item->length);
 
-                Debug("-> Updating the popped packet\n");    
+                Log(LOG_FWD, LOG_DEBUG, "Updating the popped packet");    
                 for (int i = 0; i < ETHER_ADDR_LEN; i++)
                 {
                     item->packet[i] = rx_arp_hdr->ar_sha[i];
                 }
 
-                Debug("-> Sending the popped packet, length = %d\n", item->length);
+                Log(LOG_FWD, LOG_DEBUG, "Sending the popped packet, length = %d", item->length);
                 sr_send_packet(sr, item->packet, item->length, item->interface);
+                sr_stats_record_since(sr, HIST_ARP_QUEUE, item->queued_at);
 
                 free(item);
             }
@@ -302,18 +260,13 @@ void handle_arp_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len
 
 void handle_ip_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct sr_if* rx_if, struct sr_ethernet_hdr* rx_e_hdr)
 {
-    Debug("\nReceived IP Packet, length = %d\n", len);
+    Log(LOG_FWD, LOG_DEBUG, "Received IP Packet, length = %d", len);
 
 
-    struct sr_ethernet_hdr* tx_e_hdr = ((sr_ethernet_hdr*)(malloc(sizeof(sr_ethernet_hdr))));
     struct sr_icmphdr* rx_icmp_hdr;
-    struct sr_icmphdr* tx_icmp_hdr;
-    uint8_t* tx_packet;
-    int queue_index;
 
     /***** Getting the IP header *****/
     ip* rx_ip_hdr = ((ip*)(packet + sizeof(sr_ethernet_hdr)));
-    ip* tx_ip_hdr = ((ip*)(malloc(sizeof(ip))));
 
     /***** Checking the received Checksum *****/
     int rx_sum_temp = rx_ip_hdr->ip_sum;
@@ -322,7 +275,16 @@ void handle_ip_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len,
     rx_ip_hdr->ip_sum = rx_sum_temp;
     if (rx_sum != rx_sum_temp)
     {
-        Debug("-> Packet dropped: invalid checksum\n");
+        Log(LOG_FWD, LOG_DEBUG, "Packet dropped: invalid checksum");
+        sr_stats_inc(sr, STATS_DROP_BAD_CKSUM);
+        return;
+    }
+
+    /***** Access control lists, in *****/
+    if (sr_acl_check(sr, ACL_IN, rx_if, rx_ip_hdr, len - sizeof(sr_ethernet_hdr)) == ACL_DENY)
+    {
+        Log(LOG_FWD, LOG_DEBUG, "Packet dropped: denied in on %s", rx_if->name);
+        sr_stats_inc(sr, STATS_DROP_ACL);
         return;
     }
 
@@ -332,23 +294,32 @@ void handle_ip_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len,
         /***** Checking the received TTL *****/
         if (rx_ip_hdr->ip_ttl <= 1)
         {
-            Debug("-> Packet dropped: invalid TTL\n");
-            send_icmp_error(sr, packet, len, rx_if, ICMP_TIME_EXCEEDED_TYPE, ICMP_TIME_EXCEEDED_CODE);
+            Log(LOG_FWD, LOG_DEBUG, "Packet dropped: invalid TTL");
+            sr_stats_inc(sr, STATS_DROP_TTL_EXPIRED);
+            send_icmp_error(sr, packet, len, rx_if, ICMP_TIME_EXCEEDED_TYPE, ICMP_TIME_EXCEEDED_CODE, 0);
         }
         else
         {
-            Debug("-> Forwarding packet, length = %d\n", len);
-            forward_packet(sr, packet, len);
+            Log(LOG_FWD, LOG_DEBUG, "Forwarding packet, length = %d", len);
+            forward_packet(sr, packet, len, rx_if);
         }
 
         return;
     }
 
+    /***** Control plane policing, before any local processing *****/
+    if (sr_copp_police(sr, rx_if, packet, len) == 0)
+    {
+        Log(LOG_FWD, LOG_DEBUG, "Packet dropped: over the control plane limit");
+        return;
+    }
+
     /***** Checking the received TTL *****/
     if (rx_ip_hdr->ip_ttl <= 1)
     {
-        Debug("-> Packet dropped: invalid TTL\n");
-        send_icmp_error(sr, packet, len, rx_if, ICMP_DESTINATION_UNREACHABLE_TYPE, ICMP_PORT_UNREACHABLE_CODE);
+        Log(LOG_FWD, LOG_DEBUG, "Packet dropped: invalid TTL");
+        sr_stats_inc(sr, STATS_DROP_TTL_EXPIRED);
+        send_icmp_error(sr, packet, len, rx_if, ICMP_DESTINATION_UNREACHABLE_TYPE, ICMP_PORT_UNREACHABLE_CODE, 0);
 
         return;
     }
@@ -358,149 +329,37 @@ void handle_ip_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len,
          case IP_PROTO_ICMP:
             /***** Getting the ICMP header *****/
 	    rx_icmp_hdr = ((sr_icmphdr*)(packet + sizeof(sr_ethernet_hdr) + sizeof(ip)));
-            tx_icmp_hdr = ((sr_icmphdr*)(malloc(sizeof(sr_icmphdr))));
 
             if ((rx_icmp_hdr->type == ICMP_ECHO_REQUEST_TYPE) & (rx_icmp_hdr->code == ICMP_ECHO_REQUEST_CODE))
             {
-                Debug("-> The IP Packet is ICMP ECHO REQUEST\n");
-
-                Debug("-> Constructing ICMP ECHO REPLY Packet\n");
-                /* Destination address */
-                for (int i = 0; i < ETHER_ADDR_LEN; i++)
-                {
-                    tx_e_hdr->ether_dhost[i] = 255;
-                }
-
-                /* Source address */   
-                for (int i = 0; i < ETHER_ADDR_LEN; i++)
-                {
-                    tx_e_hdr->ether_shost[i] = ((uint8_t)(rx_if->addr[i]));
-                }         
-                
-                /* Type */
-                tx_e_hdr->ether_type = rx_e_hdr->ether_type;
-
-
-                /* Version + Header length */
-                tx_ip_hdr->ip_v = rx_ip_hdr->ip_v;
-                tx_ip_hdr->ip_hl = rx_ip_hdr->ip_hl;
-
-                /* DS */
-                tx_ip_hdr->ip_tos = rx_ip_hdr->ip_tos;
-
-                /* Total length */
-                tx_ip_hdr->ip_len = rx_ip_hdr->ip_len;
-
-                /* Identification */
-                tx_ip_hdr->ip_id = rx_ip_hdr->ip_id;
-
-                /* Fragment */
-                tx_ip_hdr->ip_off = rx_ip_hdr->ip_off;
-
-                /* TTL */
-                tx_ip_hdr->ip_ttl = 64;
-
-                /* Protocol */
-                tx_ip_hdr->ip_p = rx_ip_hdr->ip_p;  // which is 1 = ICMP
-
-                /* Checksum */
-                tx_ip_hdr->ip_sum = 0;
-
-                /* Source IP address */
-                tx_ip_hdr->ip_src = rx_ip_hdr->ip_dst;
-
-                /* Destination IP address */
-                tx_ip_hdr->ip_dst = rx_ip_hdr->ip_src;
-
-                /* Re-Calculate checksum of the IP header */
-                tx_ip_hdr->ip_sum = calc_cksum(((uint8_t*)(tx_ip_hdr)), sizeof(ip));
-
-
-                /* Type */
-                tx_icmp_hdr->type = ICMP_ECHO_REPLY_TYPE;
-
-                /* Code */
-                tx_icmp_hdr->code = ICMP_ECHO_REPLY_CODE;
-
-                /* Checksum */
-                tx_icmp_hdr->cksum = 0;
-
-                /* Identification */
-                tx_icmp_hdr->id = rx_icmp_hdr->id;
-
-                /* Sequence Number */
-                tx_icmp_hdr->seq_n = rx_icmp_hdr->seq_n;
-
-
-                /***** Creating the transmitted packet *****/
-                tx_packet = ((uint8_t*)(malloc(sizeof(uint8_t) * len)));
-
-                memcpy(tx_packet, tx_e_hdr, sizeof(sr_ethernet_hdr));
-                memcpy(tx_packet + sizeof(sr_ethernet_hdr), tx_ip_hdr, sizeof(ip));
-                memcpy(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip), tx_icmp_hdr, sizeof(sr_icmphdr));
-                /* Copy the Data part */
-                for (unsigned int i = sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(sr_icmphdr); i < len; i++)
-                {
-                    tx_packet[i] = packet[i];
-                }
-
-
-                /* Re-Calculate checksum of the ICMP header */
-                /* Updating the new checksum in tx_packet */
-                ((sr_icmphdr*)(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip)))->cksum =
-                    calc_cksum(tx_packet + sizeof(sr_ethernet_hdr) + sizeof(ip), len - (sizeof(sr_ethernet_hdr) + sizeof(ip)));
-
-
-                /* Checking the ARP cache */
-                struct in_addr ip_address;
-                ip_address.s_addr = get_nex_hop_ip(sr, rx_if->name);
-                Debug("-> Searching the ARP Cache for [%s]\n", inet_ntoa(ip_address));
-                cache_item* item = cache_search(arp_cache, get_nex_hop_ip(sr, rx_if->name));
-                if (item == NULL)
-                {
-                    /* Push the packet in the queue */
-                    Debug("-> ARP Cache entry NOT found\n");
-
-                    Debug("-> Pushing the ICMP ECHO REPLY Packet in the queue, length = %d\n", len);
-                    queue_index = ((int)(rx_if->name[strlen(rx_if->name) - 1])) - 48;
-                    if (packet_queue[queue_index] == NULL)
-                    {
-                        packet_queue[queue_index] = queue_create_item(tx_packet, len, rx_if->name);
-                    }
-                    else
-                    {
-                        queue_push(packet_queue[queue_index], queue_create_item(tx_packet, len, rx_if->name));
-                    }
-                    send_arp_request(sr, rx_if, get_nex_hop_ip(sr, rx_if->name));
-                }
-                else
-                {
-                    ip_address.s_addr = item->ip;
-                    Debug("-> ARP Cache entry found, [%s, ", inet_ntoa(ip_address));
-                    DebugMAC(item->mac);
-                    Debug("]\n");
-
-                    Debug("-> Updating the ICMP ECHO REPLY Packet\n");    
-                    for (int i = 0; i < ETHER_ADDR_LEN; i++)
-                    {
-                        tx_packet[i] = item->mac[i];
-                    }
-
-                    Debug("-> Sending the ICMP ECHO REPLY Packet, length = %d\n", len);
-                    sr_send_packet(sr, tx_packet, len, rx_if->name);
-
-
-                    free(tx_packet);
-                }
-
-                
-                free(tx_icmp_hdr);
-                free(tx_ip_hdr);
-                free(tx_e_hdr);
+                Log(LOG_FWD, LOG_DEBUG, "The IP Packet is ICMP ECHO REQUEST");
+
+                /***** The reply is the request turned around, built in place:
+                 * swapping the addresses leaves the IP checksum as it is, the
+                 * TTL and the ICMP type are patched into both checksums *****/
+                Log(LOG_FWD, LOG_DEBUG, "Constructing ICMP ECHO REPLY Packet");
+                memcpy(rx_e_hdr->ether_dhost, rx_e_hdr->ether_shost, ETHER_ADDR_LEN);
+                memcpy(rx_e_hdr->ether_shost, rx_if->addr, ETHER_ADDR_LEN);
+
+                struct in_addr src_ip = rx_ip_hdr->ip_src;
+                rx_ip_hdr->ip_src = rx_ip_hdr->ip_dst;
+                rx_ip_hdr->ip_dst = src_ip;
+
+                uint16_t old_word = *((uint16_t*)(&rx_ip_hdr->ip_ttl));
+                rx_ip_hdr->ip_ttl = 64;
+                rx_ip_hdr->ip_sum = update_cksum(rx_ip_hdr->ip_sum, old_word, *((uint16_t*)(&rx_ip_hdr->ip_ttl)));
+
+                old_word = *((uint16_t*)(&rx_icmp_hdr->type));
+                rx_icmp_hdr->type = ICMP_ECHO_REPLY_TYPE;
+                rx_icmp_hdr->code = ICMP_ECHO_REPLY_CODE;
+                rx_icmp_hdr->cksum = update_cksum(rx_icmp_hdr->cksum, old_word, *((uint16_t*)(&rx_icmp_hdr->type)));
+
+                Log(LOG_FWD, LOG_DEBUG, "Sending the ICMP ECHO REPLY Packet, length = %d", len);
+                sr_send_packet(sr, packet, len, rx_if->name);
             }
             else if ((rx_icmp_hdr->type == ICMP_ECHO_REPLY_TYPE) & (rx_icmp_hdr->code == ICMP_ECHO_REPLY_CODE))
             {
-                Debug("-> The IP Packet is ICMP ECHO REPLY\n");
+                Log(LOG_FWD, LOG_DEBUG, "The IP Packet is ICMP ECHO REPLY");
             }
             break;
 
@@ -508,19 +367,19 @@ void handle_ip_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len,
         case IP_PROTO_UDP:
             if (rx_ip_hdr->ip_p == IP_PROTO_TCP)
             {
-                Debug("-> The IP Packet is TCP Packet\n");
+                Log(LOG_FWD, LOG_DEBUG, "The IP Packet is TCP Packet");
             }
             else
             {
-                Debug("-> The IP Packet is UDP Packet\n");
+                Log(LOG_FWD, LOG_DEBUG, "The IP Packet is UDP Packet");
             }
 
             /***** Seding an ICMP PORT UNREACHABLE packet *****/
-            send_icmp_error(sr, packet, len, rx_if, ICMP_DESTINATION_UNREACHABLE_TYPE, ICMP_PORT_UNREACHABLE_CODE);
+            send_icmp_error(sr, packet, len, rx_if, ICMP_DESTINATION_UNREACHABLE_TYPE, ICMP_PORT_UNREACHABLE_CODE, 0);
             break;
 
         case IP_PROTO_OSPFv2:
-            Debug("-> The IP Packet is PWOSPF Packet\n");
+            Log(LOG_FWD, LOG_DEBUG, "The IP Packet is PWOSPF Packet");
             handling_ospfv2_packets(sr, packet, len, rx_if);
             break;
     }
@@ -530,15 +389,27 @@ void handle_ip_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len,
 /*--------------------------------------------------------------------- 
  * Method: send_icmp_error
  *
+ * next_mtu is the MTU of the next hop for fragmentation needed, 0 for
+ * the other errors.
+ *
  *---------------------------------------------------------------------*/
-void send_icmp_error(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct sr_if* rx_if, uint8_t type, uint8_t code)
+void send_icmp_error(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct sr_if* rx_if, uint8_t type, uint8_t code, uint16_t next_mtu)
 {
+    /***** Rate limiting, a suppressed error is only counted *****/
+    if ((sr->icmp_limit != NULL) &&
+        !sr_icmp_limit_allow(sr->icmp_limit, type, code,
+            ((ip*)(packet + sizeof(sr_ethernet_hdr)))->ip_src.s_addr, sr_timer_now()))
+    {
+        Log(LOG_FWD, LOG_DEBUG, "ICMP error suppressed, type = %d, code = %d", type, code);
+        sr_stats_inc(sr, STATS_ICMP_LIMITED);
+        return;
+    }
+
     struct sr_ethernet_hdr* rx_e_hdr = (struct sr_ethernet_hdr*)packet;
     struct sr_ethernet_hdr* tx_e_hdr = ((sr_ethernet_hdr*)(malloc(sizeof(sr_ethernet_hdr))));
     struct sr_icmphdr* rx_icmp_hdr;
     struct sr_icmphdr* tx_icmp_hdr;
     uint8_t* tx_packet;
-    int queue_index;
 
     /***** Getting the IP header *****/
     ip* rx_ip_hdr = ((ip*)(packet + sizeof(sr_ethernet_hdr)));
@@ -548,16 +419,20 @@ void send_icmp_error(struct sr_instance* sr, uint8_t* packet, unsigned int len,
     {
         if (code == ICMP_HOST_UNREACHABLE_CODE)
         {
-            Debug("-> Constructing ICMP HOST UNREACHABLE Packet\n");
+            Log(LOG_FWD, LOG_DEBUG, "Constructing ICMP HOST UNREACHABLE Packet");
         }
         else if (code == ICMP_PORT_UNREACHABLE_CODE)
         {
-            Debug("-> Constructing ICMP PORT UNREACHABLE Packet\n");
+            Log(LOG_FWD, LOG_DEBUG, "Constructing ICMP PORT UNREACHABLE Packet");
+        }
+        else if (code == ICMP_FRAG_NEEDED_CODE)
+        {
+            Log(LOG_FWD, LOG_DEBUG, "Constructing ICMP FRAGMENTATION NEEDED Packet, mtu = %d", next_mtu);
         }
     }
     else if ((type == ICMP_TIME_EXCEEDED_TYPE) & (code == ICMP_TIME_EXCEEDED_CODE))
     {
-        Debug("-> Constructing ICMP TIME EXCEEDED Packet\n");
+        Log(LOG_FWD, LOG_DEBUG, "Constructing ICMP TIME EXCEEDED Packet");
     }
 
     /***** Getting the ICMP header *****/
@@ -606,7 +481,7 @@ void send_icmp_error(struct sr_instance* sr, uint8_t* packet, unsigned int len,
     tx_ip_hdr->ip_sum = 0;
 
     /* Source IP address */
-    if (type == 11)
+    if ((type == 11) || ((type == ICMP_DESTINATION_UNREACHABLE_TYPE) && (code == ICMP_FRAG_NEEDED_CODE)))
     {
         tx_ip_hdr->ip_src.s_addr = rx_if->ip;
     }
@@ -634,8 +509,8 @@ void send_icmp_error(struct sr_instance* sr, uint8_t* packet, unsigned int len,
     /* Identification */
     tx_icmp_hdr->id = 0;
 
-    /* Sequence Number */
-    tx_icmp_hdr->seq_n = 0;
+    /* Sequence Number, the next-hop MTU for fragmentation needed (RFC 1191) */
+    tx_icmp_hdr->seq_n = htons(next_mtu);
 
     /***** Creating the transmitted packet *****/
     tx_packet = ((uint8_t*)(malloc(sizeof(sr_ethernet_hdr) + (2 * sizeof(ip)) + sizeof(sr_icmphdr) + 8)));
@@ -659,50 +534,44 @@ void send_icmp_error(struct sr_instance* sr, uint8_t* packet, unsigned int len,
     /* Checking the ARP cache */
     struct in_addr ip_address;
     ip_address.s_addr = get_nex_hop_ip(sr, rx_if->name);
-    Debug("-> Searching the ARP Cache for [%s]\n", inet_ntoa(ip_address));
-    cache_item* item = cache_search(arp_cache, get_nex_hop_ip(sr, rx_if->name));
+    Log(LOG_ARP, LOG_DEBUG, "Searching the ARP Cache for [%I]", ip_address.s_addr);
+    cache_item* item = cache_search(sr->arp_cache, get_nex_hop_ip(sr, rx_if->name));
     if (item == NULL)
     {
         /* Push the packet in the queue */
-        Debug("-> ARP Cache entry NOT found\n");
+        Log(LOG_ARP, LOG_DEBUG, "ARP Cache entry NOT found");
+        sr_stats_inc(sr, STATS_ARP_MISS);
 
         /* Push the packet in the queue */
-        Debug("-> Pushing the ICMP ERROR MESSAGE Packet in the queue, length = %d\n",
+        Log(LOG_FWD, LOG_DEBUG, "Pushing the ICMP ERROR MESSAGE Packet in the queue, length = %zu",
             sizeof(uint8_t) * (sizeof(sr_ethernet_hdr) + (2 * sizeof(ip)) + sizeof(sr_icmphdr) + 8));
-        queue_index = ((int)(rx_if->name[strlen(rx_if->name) - 1])) - 48;
-        if (packet_queue[queue_index] == NULL)
+        if (queue_packet(sr, tx_packet, sizeof(sr_ethernet_hdr) + (2 * sizeof(ip)) + sizeof(sr_icmphdr) + 8, rx_if))
         {
-            packet_queue[queue_index] = queue_create_item(tx_packet, sizeof(sr_ethernet_hdr) + (2 * sizeof(ip)) + sizeof(sr_icmphdr) + 8, rx_if->name);
-        }
-        else
-        {
-            queue_push(packet_queue[queue_index], queue_create_item(tx_packet, sizeof(sr_ethernet_hdr) + (2 * sizeof(ip)) + sizeof(sr_icmphdr) + 8,
-                rx_if->name));
+            send_arp_request(sr, rx_if, get_nex_hop_ip(sr, rx_if->name));
         }
 
-        send_arp_request(sr, rx_if, get_nex_hop_ip(sr, rx_if->name));
+        free(tx_packet);
     }
     else
     {
+        sr_stats_inc(sr, STATS_ARP_HIT);
         ip_address.s_addr = item->ip;
-        Debug("-> ARP Cache entry found, [%s, ", inet_ntoa(ip_address));
-        DebugMAC(item->mac);
-        Debug("]\n");
+        Log(LOG_ARP, LOG_DEBUG, "ARP Cache entry found, [%I, %M]", ip_address.s_addr, item->mac);
 
         if (type == ICMP_DESTINATION_UNREACHABLE_TYPE)
         {
             if (code == ICMP_HOST_UNREACHABLE_CODE)
             {
-                Debug("-> Updating the ICMP HOST UNREACHABLE Packet\n");
+                Log(LOG_FWD, LOG_DEBUG, "Updating the ICMP HOST UNREACHABLE Packet");
             }
             else if (code == ICMP_PORT_UNREACHABLE_CODE)
             {
-                Debug("-> Updating the ICMP PORT UNREACHABLE Packet\n");
+                Log(LOG_FWD, LOG_DEBUG, "Updating the ICMP PORT UNREACHABLE Packet");
             }
         }
         else if ((type == ICMP_TIME_EXCEEDED_TYPE) & (code == ICMP_TIME_EXCEEDED_CODE))
         {
-            Debug("-> Updating the ICMP TIME EXCEEDED Packet\n");
+            Log(LOG_FWD, LOG_DEBUG, "Updating the ICMP TIME EXCEEDED Packet");
         }
         for (int i = 0; i < ETHER_ADDR_LEN; i++)
         {
@@ -713,16 +582,16 @@ void send_icmp_error(struct sr_instance* sr, uint8_t* packet, unsigned int len,
         {
             if (code == ICMP_HOST_UNREACHABLE_CODE)
             {
-                Debug("-> Sending the ICMP HOST UNREACHABLE Packet, length = %d\n", len);
+                Log(LOG_FWD, LOG_DEBUG, "Sending the ICMP HOST UNREACHABLE Packet, length = %d", len);
             }
             else if (code == ICMP_PORT_UNREACHABLE_CODE)
             {
-                Debug("-> Sending the ICMP PORT UNREACHABLE Packet, length = %d\n", len);
+                Log(LOG_FWD, LOG_DEBUG, "Sending the ICMP PORT UNREACHABLE Packet, length = %d", len);
             }
         }
         else if ((type == ICMP_TIME_EXCEEDED_TYPE) & (code == ICMP_TIME_EXCEEDED_CODE))
         {
-            Debug("-> Sending the ICMP TIME EXCEEDED Packet, length = %d\n", len);
+            Log(LOG_FWD, LOG_DEBUG, "Sending the ICMP TIME EXCEEDED Packet, length = %d", len);
         }
         sr_send_packet(sr, tx_packet, sizeof(sr_ethernet_hdr) + (2 * sizeof(ip)) + sizeof(sr_icmphdr) + 8, rx_if->name);
 
@@ -744,7 +613,7 @@ void send_icmp_error(struct sr_instance* sr, uint8_t* packet, unsigned int len,
 
 void send_arp_request(struct sr_instance* sr, struct sr_if* rx_if, uint32_t target_ip)
 {
-    Debug("-> Constructing ARP REQUEST Packet\n");
+    Log(LOG_ARP, LOG_DEBUG, "Constructing ARP REQUEST Packet");
     struct sr_ethernet_hdr* tx_e_hdr = ((sr_ethernet_hdr*)(malloc(sizeof(sr_ethernet_hdr))));
     struct sr_arphdr* tx_arp_hdr = ((sr_arphdr*)(malloc(sizeof(sr_arphdr))));
 
@@ -805,8 +674,8 @@ void send_arp_request(struct sr_instance* sr, struct sr_if* rx_if, uint32_t targ
     memcpy(tx_packet + sizeof(sr_ethernet_hdr), tx_arp_hdr, sizeof(sr_arphdr));
 
 
-    struct sr_arp_thread_param* arp_param = ((sr_arp_thread_param*)(malloc(sizeof(sr_arp_thread_param))));
-    arp_param->sr = sr;
+    struct sr_arp_request* arp_param = ((sr_arp_request*)(malloc(sizeof(sr_arp_request))));
+    sr_timer_init(&arp_param->timer, sending_arp_request, arp_param);
     arp_param->counter = ARP_REQUESTS_NUM;
     for (int i = 0; i < ARP_REQUEST_PKT_LEN;i++)
     {
@@ -818,10 +687,14 @@ void send_arp_request(struct sr_instance* sr, struct sr_if* rx_if, uint32_t targ
     }
     arp_param->target_ip = target_ip;
     
-    Debug("-> Running the ARP REQUESTs thread for %d attempt(s)\n", ARP_REQUESTS_NUM);
-    int queue_index = ((int)(rx_if->name[strlen(rx_if->name) - 1])) - 48;
-    stop_arp_thread[queue_index] = 0;
-    pthread_create(&arp_thread[queue_index], NULL, sending_arp_request, arp_param);
+    Log(LOG_ARP, LOG_DEBUG, "Sending the ARP REQUESTs for %d attempt(s)", ARP_REQUESTS_NUM);
+    arp_param->next = rx_if->arp_requests;
+    rx_if->arp_requests = arp_param;
+    if (rx_if->arp_request_time == 0)
+    {
+        rx_if->arp_request_time = sr_stats_now();
+    }
+    sending_arp_request(sr, arp_param);
 
 
     free(tx_packet);
@@ -833,85 +706,197 @@ void send_arp_request(struct sr_instance* sr, struct sr_if* rx_if, uint32_t targ
 /*--------------------------------------------------------------------- 
  * Method: sending_arp_request
  *
+ * Timer of an ARP REQUEST: sends it every ARP_REQUEST_INTERVAL ms, after
+ * ARP_REQUESTS_NUM attempts gives up on one queued packet
+ *
  *---------------------------------------------------------------------*/
 
-void* sending_arp_request(void* args)
+void sending_arp_request(struct sr_instance* sr, void* args)
 {
-    struct sr_arp_thread_param* arp_param = ((sr_arp_thread_param*)(args));
-    int queue_index = ((int)(arp_param->interface[strlen(arp_param->interface) - 1])) - 48;
+    struct sr_arp_request* arp_param = ((sr_arp_request*)(args));
+    struct sr_if* tx_if = sr_get_interface(sr, arp_param->interface);
 
-    while((arp_param->counter > 0) & (stop_arp_thread[queue_index] == 0))
+    if (arp_param->counter > 0)
     {
         struct in_addr target_addr;
         target_addr.s_addr = arp_param->target_ip;
-        Debug("\n\n**** Sending ARP REQUEST Packet to [%s], length = %d [Attempt %d] ****\n\n", inet_ntoa(target_addr), sizeof(sr_ethernet_hdr) +
-            sizeof(sr_arphdr), ARP_REQUESTS_NUM - arp_param->counter + 1);
-        sr_send_packet(arp_param->sr, ((uint8_t*)(arp_param->packet)), ARP_REQUEST_PKT_LEN, arp_param->interface);
+        Log(LOG_ARP, LOG_DEBUG, "**** Sending ARP REQUEST Packet to [%I], length = %zu [Attempt %d] ****",
+            target_addr.s_addr, sizeof(sr_ethernet_hdr) + sizeof(sr_arphdr), ARP_REQUESTS_NUM - arp_param->counter + 1);
+        sr_send_packet(sr, ((uint8_t*)(arp_param->packet)), ARP_REQUEST_PKT_LEN, arp_param->interface);
+        TraceInstant("arp request", "arp", arp_param->interface, arp_param->target_ip);
 
         arp_param->counter--;
 
-        usleep(5000000);
+        sr_timer_add(sr, &arp_param->timer, ARP_REQUEST_INTERVAL);
+        return;
     }
 
-    if (queue_is_empty(packet_queue[queue_index]) == 0)
+    /* -- unanswered, not a resolution time -- */
+    tx_if->arp_request_time = 0;
+    TraceInstant("arp timeout", "arp", arp_param->interface, arp_param->target_ip);
+
+    if (queue_is_empty(tx_if->packet_queue) == 0)
     {
-        struct queue_item* q_item = queue_pop(packet_queue[queue_index]);
-        send_icmp_error(arp_param->sr, q_item->packet, q_item->length, sr_get_interface(arp_param->sr, q_item->interface),
-            ICMP_DESTINATION_UNREACHABLE_TYPE, ICMP_HOST_UNREACHABLE_CODE);
+        struct queue_item* q_item = queue_pop(tx_if->packet_queue);
+        sr_stats_inc(sr, STATS_DROP_ARP_TIMEOUT);
+        sr_stats_record_since(sr, HIST_ARP_QUEUE, q_item->queued_at);
+        send_icmp_error(sr, q_item->packet, q_item->length, sr_get_interface(sr, q_item->interface),
+            ICMP_DESTINATION_UNREACHABLE_TYPE, ICMP_HOST_UNREACHABLE_CODE, 0);
     }
 
-    return NULL;
+    struct sr_arp_request** ptr = &tx_if->arp_requests;
+    while (*ptr != NULL)
+    {
+        if (*ptr == arp_param)
+        {
+            *ptr = arp_param->next;
+            break;
+        }
+        ptr = &(*ptr)->next;
+    }
+    free(arp_param);
 }/* end sending_arp_request */
 
 
 /*--------------------------------------------------------------------- 
- * Method: forward_packet
+ * Method: transmit_packet
+ *
+ * Sends a packet out of tx_if to next_hop, or queues it behind an ARP
+ * request if next_hop is not in the cache.
  *
  *---------------------------------------------------------------------*/
 
-void forward_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len)
+static
+void transmit_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct sr_if* tx_interface, struct in_addr ip_address)
 {
-    /***** Reducing the TTL and Recalculating the Checksum *****/
-    ((ip*)(packet + sizeof(sr_ethernet_hdr)))->ip_ttl--;
-    ((ip*)(packet + sizeof(sr_ethernet_hdr)))->ip_sum = 0;
-    ((ip*)(packet + sizeof(sr_ethernet_hdr)))->ip_sum =
-        calc_cksum(packet + sizeof(sr_ethernet_hdr), sizeof(ip));
+    for (int i = 0; i < ETHER_ADDR_LEN; i++)
+    {
+        packet[i + 6] = tx_interface->addr[i];
+    }
+
+
+    /* Checking the ARP cache */
+    Log(LOG_ARP, LOG_DEBUG, "Searching the ARP Cache for [%I]", ip_address.s_addr);
+    cache_item* item = cache_search(sr->arp_cache, ip_address.s_addr);
+    if (item == NULL)
+    {
+        Log(LOG_ARP, LOG_DEBUG, "ARP Cache entry NOT found");
+        sr_stats_inc(sr, STATS_ARP_MISS);
+
+        /* Push the packet in the queue */
+        Log(LOG_FWD, LOG_DEBUG, "Pushing forwarded packet in the queue, length = %d", len);
+        if (queue_packet(sr, packet, len, tx_interface))
+        {
+            send_arp_request(sr, tx_interface, ip_address.s_addr);
+        }
+    }
+    else
+    {
+        sr_stats_inc(sr, STATS_ARP_HIT);
+        ip_address.s_addr = item->ip;
+        Log(LOG_ARP, LOG_DEBUG, "ARP Cache entry found, [%I, %M]", ip_address.s_addr, item->mac);
+
+        Log(LOG_FWD, LOG_DEBUG, "Updating the forworded packet");    
+        for (int i = 0; i < ETHER_ADDR_LEN; i++)
+        {
+            packet[i] = item->mac[i];
+        }
+
+        Log(LOG_FWD, LOG_DEBUG, "Sending the forworded packet, length = %d", len);
+        sr_send_packet(sr, packet, len, tx_interface->name);
+    }
+}/* transmit_packet */
 
 
+/*--------------------------------------------------------------------- 
+ * Method: fragment_packet
+ *
+ * Splits a packet larger than the MTU of tx_if into fragments that fit
+ * (RFC 791), each one built in a frame of its own and transmitted. The
+ * fragments keep the MF flag of a packet that was itself a fragment.
+ *
+ *---------------------------------------------------------------------*/
+
+static
+void fragment_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct sr_if* tx_interface, struct in_addr ip_address)
+{
     ip* rx_ip_hdr = ((ip*)(packet + sizeof(sr_ethernet_hdr)));
-    int queue_index;
+    unsigned int hdr_len = rx_ip_hdr->ip_hl * 4;
+    unsigned int ip_len = ntohs(rx_ip_hdr->ip_len);
+    uint16_t off = ntohs(rx_ip_hdr->ip_off);
+    uint8_t frame[sizeof(sr_ethernet_hdr) + sr_IFACE_MAX_MTU];
 
-    struct sr_rt* temp = sr->routing_table;
-    struct sr_rt* default_route = NULL;
-    struct sr_rt* route = NULL;
-    while(temp != NULL)
+    if ((ip_len > len - sizeof(sr_ethernet_hdr)) || (hdr_len < sizeof(ip)) || (hdr_len >= ip_len))
     {
-        if (temp->dest.s_addr == 0)
+        return;
+    }
+
+    /* -- fragment data is a multiple of 8 bytes, but for the last one -- */
+    unsigned int chunk = (tx_interface->mtu - hdr_len) & ~7u;
+    Log(LOG_FWD, LOG_DEBUG, "Fragmenting packet, length = %d, mtu = %d", ip_len, tx_interface->mtu);
+
+    for (unsigned int pos = 0; pos < ip_len - hdr_len; pos += chunk)
+    {
+        unsigned int data_len = ip_len - hdr_len - pos;
+        uint16_t frag_off = (off & IP_OFFMASK) + (pos / 8);
+        if (data_len > chunk)
         {
-            default_route = temp;
+            data_len = chunk;
+            frag_off |= IP_MF;
         }
         else
         {
-            if (route == NULL)
-            {
-                if ((temp->dest.s_addr & htonl(0xfffffffe)/*temp->mask.s_addr*/) == (rx_ip_hdr->ip_dst.s_addr & htonl(0xfffffffe)/*temp->mask.s_addr*/))
-                {
-                    route = temp;
-                }
-            }
+            frag_off |= (off & IP_MF);
         }
 
-        temp = temp->next;
+        memcpy(frame, packet, sizeof(sr_ethernet_hdr) + hdr_len);
+        memcpy(frame + sizeof(sr_ethernet_hdr) + hdr_len, packet + sizeof(sr_ethernet_hdr) + hdr_len + pos, data_len);
+
+        ip* tx_ip_hdr = ((ip*)(frame + sizeof(sr_ethernet_hdr)));
+        tx_ip_hdr->ip_len = htons(hdr_len + data_len);
+        tx_ip_hdr->ip_off = htons(frag_off);
+        tx_ip_hdr->ip_sum = 0;
+        tx_ip_hdr->ip_sum = calc_cksum(((uint8_t*)(tx_ip_hdr)), hdr_len);
+
+        sr_stats_inc(sr, STATS_IP_FRAGMENTS);
+        transmit_packet(sr, frame, sizeof(sr_ethernet_hdr) + hdr_len + data_len, tx_interface, ip_address);
     }
+}/* fragment_packet */
 
-    struct sr_if* tx_interface;
+
+/*--------------------------------------------------------------------- 
+ * Method: forward_packet
+ *
+ *---------------------------------------------------------------------*/
+
+void forward_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct sr_if* rx_if)
+{
+    /***** Reducing the TTL and Recalculating the Checksum *****/
+    ((ip*)(packet + sizeof(sr_ethernet_hdr)))->ip_ttl--;
+    ((ip*)(packet + sizeof(sr_ethernet_hdr)))->ip_sum = 0;
+    ((ip*)(packet + sizeof(sr_ethernet_hdr)))->ip_sum =
+        calc_cksum(packet + sizeof(sr_ethernet_hdr), sizeof(ip));
+
+
+    ip* rx_ip_hdr = ((ip*)(packet + sizeof(sr_ethernet_hdr)));
+
+    struct sr_rt* route = sr_lookup_rt(sr, rx_ip_hdr->ip_dst);
+
+    struct sr_if* tx_interface = NULL;
     struct in_addr ip_address;
-    if (route != NULL)
+    if ((route != NULL) && (route->dest.s_addr != 0))
     {
-        tx_interface = sr_get_interface(sr, route->interface);
-        if (route->gw.s_addr != 0)
+        /* Keeping each flow on one of the equal-cost next hops */
+        struct sr_rt_nexthop* nexthop = &route->nexthop[0];
+        if (route->nexthop_num > 1)
         {
-            ip_address = route->gw;
+            nexthop = &route->nexthop[calc_flow_hash(rx_ip_hdr, len - sizeof(sr_ethernet_hdr)) % route->nexthop_num];
+        }
+
+        tx_interface = sr_get_interface(sr, nexthop->interface);
+        if (nexthop->gw.s_addr != 0)
+        {
+            ip_address = nexthop->gw;
         }
         else if (tx_interface->neighbor_ip != 0)
         {
@@ -922,71 +907,101 @@ void forward_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len)
             ip_address.s_addr = ((ip*)(packet + sizeof(sr_ethernet_hdr)))->ip_dst.s_addr;
         }
     }
-    else if (default_route != NULL)
+    else if (route != NULL)
     {
-        tx_interface = sr_get_interface(sr, default_route->interface);
-        ip_address = default_route->gw;
+        /* Default route */
+        tx_interface = sr_get_interface(sr, route->interface);
+        ip_address = route->gw;
     }
 
-    if (tx_interface != NULL)
+    if (tx_interface == NULL)
     {
-        for (int i = 0; i < ETHER_ADDR_LEN; i++)
+        Log(LOG_FWD, LOG_DEBUG, "**** ERROR: no route the destenation ****");
+        sr_stats_inc(sr, STATS_DROP_NO_ROUTE);
+    }
+    else if (sr_acl_check(sr, ACL_OUT, tx_interface, rx_ip_hdr, len - sizeof(sr_ethernet_hdr)) == ACL_DENY)
+    {
+        Log(LOG_FWD, LOG_DEBUG, "Packet dropped: denied out on %s", tx_interface->name);
+        sr_stats_inc(sr, STATS_DROP_ACL);
+    }
+    else
+    {
+        sr_flow_update(sr, rx_if, tx_interface, rx_ip_hdr, len - sizeof(sr_ethernet_hdr));
+
+        if (ntohs(rx_ip_hdr->ip_len) <= tx_interface->mtu)
         {
-            packet[i + 6] = tx_interface->addr[i];
+            transmit_packet(sr, packet, len, tx_interface, ip_address);
         }
-
-
-        /* Checking the ARP cache */
-        Debug("-> Searching the ARP Cache for [%s]\n", inet_ntoa(ip_address));
-        cache_item* item = cache_search(arp_cache, ip_address.s_addr);
-        if (item == NULL)
+        else if (ntohs(rx_ip_hdr->ip_off) & IP_DF)
         {
-            Debug("-> ARP Cache entry NOT found\n");
-
-            /* Push the packet in the queue */
-            Debug("-> Pushing forwarded packet in the queue, length = %d\n", len);
-            queue_index = ((int)(tx_interface->name[strlen(tx_interface->name) - 1])) - 48;
-            if (packet_queue[queue_index] == NULL)
-            {
-                packet_queue[queue_index] = queue_create_item(packet, len, tx_interface->name);
-            }
-            else
-            {
-                queue_push(packet_queue[queue_index], queue_create_item(packet, len, tx_interface->name));
-            }
-        
-            //if (route != NULL)
-            //{
-                send_arp_request(sr, tx_interface, ip_address.s_addr/*route->gw.s_addr*/);
-            //}
-            //else if (default_route != NULL)
-            //{
-            //    send_arp_request(sr, tx_interface, default_route->gw.s_addr);
-            //}
+            Log(LOG_FWD, LOG_DEBUG, "Packet dropped: larger than the MTU of %s with DF set", tx_interface->name);
+            sr_stats_inc(sr, STATS_DROP_FRAG_NEEDED);
+            send_icmp_error(sr, packet, len, rx_if, ICMP_DESTINATION_UNREACHABLE_TYPE, ICMP_FRAG_NEEDED_CODE,
+                tx_interface->mtu);
         }
         else
         {
-            ip_address.s_addr = item->ip;
-            Debug("-> ARP Cache entry found, [%s, ", inet_ntoa(ip_address));
-            DebugMAC(item->mac);
-            Debug("]\n");
+            fragment_packet(sr, packet, len, tx_interface, ip_address);
+        }
+    }
+    
+}/* forward_packet */
 
-            Debug("-> Updating the forworded packet\n");    
-            for (int i = 0; i < ETHER_ADDR_LEN; i++)
-            {
-                packet[i] = item->mac[i];
-            }
 
-            Debug("-> Sending the forworded packet, length = %d\n", len);
-            sr_send_packet(sr, packet, len, tx_interface->name);
-        }
+/*--------------------------------------------------------------------- 
+ * Method: queue_packet
+ *
+ * Holds a copy of the packet until the ARP reply for its next hop comes
+ * back. Returns 0 if the queue of the interface is full and the packet
+ * was dropped.
+ *
+ *---------------------------------------------------------------------*/
+
+uint8_t queue_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct sr_if* tx_if)
+{
+    if (queue_length(tx_if->packet_queue) >= PACKET_QUEUE_MAX_LEN)
+    {
+        Log(LOG_FWD, LOG_DEBUG, "Packet dropped: queue full");
+        sr_stats_inc(sr, STATS_DROP_QUEUE_FULL);
+        return 0;
     }
-    else
+
+    struct queue_item* item = queue_create_item(packet, len, tx_if->name);
+    item->queued_at = sr_stats_now();
+    queue_push(tx_if->packet_queue, item);
+    return 1;
+}/* end queue_packet */
+
+
+/*--------------------------------------------------------------------- 
+ * Method: calc_flow_hash
+ *
+ * Hash the 5-tuple of an IP packet, fragments only hash the addresses
+ * and the protocol since the ports are in the first fragment only.
+ *
+ *---------------------------------------------------------------------*/
+
+uint32_t calc_flow_hash(struct ip* ip_hdr, unsigned int len)
+{
+    uint32_t hash = ip_hdr->ip_src.s_addr ^ (ip_hdr->ip_dst.s_addr * 0x9e3779b1) ^ ip_hdr->ip_p;
+
+    if (((ip_hdr->ip_p == IP_PROTO_TCP) || (ip_hdr->ip_p == IP_PROTO_UDP)) &&
+        ((ntohs(ip_hdr->ip_off) & (IP_MF | IP_OFFMASK)) == 0) &&
+        (len >= (unsigned int)(ip_hdr->ip_hl * 4) + 4))
     {
-        Debug("**** ERROR: no route the destenation ****\n");
+        uint32_t ports;
+        memcpy(&ports, ((uint8_t*)(ip_hdr)) + (ip_hdr->ip_hl * 4), sizeof(ports));
+        hash ^= ports * 0x85ebca6b;
     }
-    
-}/* forward_packet */
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+
+    return hash;
+}/* end calc_flow_hash */
 
 
 /*--------------------------------------------------------------------- 
@@ -1100,3 +1115,24 @@ uint16_t calc_cksum(uint8_t* hdr, int len)
 
     return ~sum;
 }/* end calc_cksum */
+
+
+/*--------------------------------------------------------------------- 
+ * Method: update_cksum
+ *
+ * The checksum of a header after one of its 16 bit words changed from
+ * old_word to new_word (RFC 1624), both as stored in the header.
+ *
+ *---------------------------------------------------------------------*/
+
+uint16_t update_cksum(uint16_t cksum, uint16_t old_word, uint16_t new_word)
+{
+    uint32_t sum = ((uint16_t)(~cksum)) + ((uint16_t)(~old_word)) + new_word;
+
+    while(sum>>16)
+    {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    return ~sum;
+}/* end update_cksum */
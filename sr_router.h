@@ -12,8 +12,10 @@
 #include <netinet/in.h>
 #include <sys/time.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "sr_protocol.h"
+#include "sr_event.h"
 
 /* we dont like this debug , but what to do for varargs ? */
 #ifdef _DEBUG_
@@ -28,12 +30,27 @@
 
 #define INIT_TTL 255
 #define PACKET_DUMP_SIZE 1024
+#define DEFAULT_ECMP_WIDTH 4
+#define PACKET_QUEUE_MAX_LEN 256 /* packets waiting for ARP, per interface */
 
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct queue_item;
+struct cache_item;
+struct sr_arp_request;
 
 struct pwospf_subsys;
+struct sr_stats;
+struct sr_dump;
+struct sr_afpacket;
+struct sr_uring;
+struct sr_txbuf;
+struct sr_shm;
+struct sr_icmp_limit;
+struct sr_copp;
+struct sr_snapshot;
+struct sr_flow_table;
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -45,6 +62,7 @@ struct pwospf_subsys;
 struct sr_instance
 {
     int  sockfd;   /* socket to server */
+    pthread_mutex_t sock_lock; /* serialises writes on sockfd */
     char user[32]; /* user name */
     char host[32]; /* host name */
     char sr_template[30]; /* template name if any */
@@ -52,7 +70,7 @@ struct sr_instance
     struct sockaddr_in sr_addr; /* address to server */
     struct sr_if* if_list; /* list of interfaces */
     struct sr_rt* routing_table; /* routing table */
-    FILE* logfile;
+    struct sr_dump* logfile; /* packet capture, see sr_dumper.h */
     volatile uint8_t  hw_init; /* bool : hardware has been initialized */
 
     /* -- pwospf subsystem -- */
@@ -60,6 +78,70 @@ struct sr_instance
 
     char f_interface[sr_IFACE_NAMELEN];
     int number_of_lsus;
+    uint8_t ecmp_width; /* max equal-cost next hops installed per route */
+    const char* mtu_spec; /* iface=mtu,... (-m) over the MTUs of the hardware, or NULL */
+    const char* sched_spec; /* iface=Mbit/s,... (-Q) of the shaped interfaces, or NULL */
+
+    /* -- access control lists (-A), see sr_acl.h -- */
+    const char* acl_path; /* rule file, NULL for none */
+    struct sr_acl* acl; /* in use, swapped only by the event loop */
+    struct sr_acl* acl_pending; /* loaded, waiting for the event loop */
+    pthread_mutex_t acl_lock; /* acl and acl_pending against the stats thread */
+
+    /* -- token buckets of the ICMP errors (-E), NULL for no limit -- */
+    struct sr_icmp_limit* icmp_limit;
+
+    /* -- token buckets of the packets punted to the router (-P), NULL for no limit -- */
+    struct sr_copp* copp;
+
+    /* -- warm restart snapshot (-W), NULL for none, see sr_snapshot.h -- */
+    struct sr_snapshot* snapshot;
+
+    /* -- flow table and its export (-x), see sr_flow.h -- */
+    struct sr_flow_table* flows;
+
+    /* -- counters, see sr_stats.h -- */
+    struct sr_stats* stats;
+
+    /* -- AF_PACKET data plane, NULL when connected to VNS -- */
+    struct sr_afpacket* afpacket;
+
+    /* -- io_uring on sockfd, NULL for plain reads and writes -- */
+    struct sr_uring* uring;
+
+    /* -- coalesced writes on sockfd (-b), NULL for a write per frame -- */
+    struct sr_txbuf* txbuf;
+    unsigned int tx_deadline; /* ms a frame may wait for others */
+    struct sr_timer tx_timer;
+    uint8_t tx_in_batch; /* handling received commands, flushed after them */
+
+    /* -- rings shared with a server on this machine, NULL over the socket alone -- */
+    struct sr_shm* shm;
+
+    /* -- the event loop, see sr_event.h, shared by the routers of the process -- */
+    struct sr_event_loop* loop;
+
+    /* -- ARP, see sr_router.c -- */
+    struct cache_item* arp_cache;
+    struct sr_timer arp_cache_timer; /* the packets waiting for ARP are in sr_if */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_arp_request
+ *
+ * An unanswered ARP REQUEST, sent again by its timer until the reply or
+ * ARP_REQUESTS_NUM attempts.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_arp_request
+{
+    struct sr_timer timer;
+    uint8_t   counter;
+    uint8_t   packet[ARP_REQUEST_PKT_LEN];
+    char interface[sr_IFACE_NAMELEN];
+    uint32_t target_ip;
+    struct sr_arp_request* next;
 };
 
 /* -- sr_main.c -- */
@@ -67,25 +149,34 @@ int sr_verify_routing_table(struct sr_instance* sr);
 
 /* -- sr_vns_comm.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+int sr_send_frame(struct sr_instance* , uint8_t* , unsigned int , const char*);
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
+int sr_read_from_server_ready(struct sr_instance* , void* );
+int sr_handle_command(struct sr_instance* , uint8_t* , int );
+int sr_coalesce_tx(struct sr_instance* , unsigned int );
+int sr_flush_tx(struct sr_instance* );
+void sr_log_packet(struct sr_instance* , uint8_t* , int );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
 void sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
 
 
-void* check_cache(void*);
+void arp_cache_expired(struct sr_instance*, void*);
 void handle_arp_packet(struct sr_instance*, uint8_t*, unsigned int, struct sr_if*, struct sr_ethernet_hdr*);
 void handle_ip_packet(struct sr_instance*, uint8_t*, unsigned int, struct sr_if*, struct sr_ethernet_hdr*);
-void send_icmp_error(struct sr_instance*, uint8_t*, unsigned int, struct sr_if*, uint8_t, uint8_t);
+void send_icmp_error(struct sr_instance*, uint8_t*, unsigned int, struct sr_if*, uint8_t, uint8_t, uint16_t);
 void send_arp_request(struct sr_instance*, struct sr_if* rx_if, uint32_t target_ip);
-void* sending_arp_request(void*);
-void forward_packet(struct sr_instance*, uint8_t*, unsigned int);
+void sending_arp_request(struct sr_instance*, void*);
+void forward_packet(struct sr_instance*, uint8_t*, unsigned int, struct sr_if*);
+uint8_t queue_packet(struct sr_instance*, uint8_t*, unsigned int, struct sr_if*);
+uint32_t calc_flow_hash(struct ip*, unsigned int);
 short chk_ether_addr(struct sr_ethernet_hdr* rx_e_hdr, struct sr_if* rx_if);
 uint32_t get_nex_hop_ip(struct sr_instance*, char*);
 short chk_ip_addr(struct ip*, struct sr_instance*);
 uint16_t calc_cksum(uint8_t*, int);
+uint16_t update_cksum(uint16_t, uint16_t, uint16_t);
 
 
 /* -- sr_if.c -- */
@@ -89,7 +89,7 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
  *
  *---------------------------------------------------------------------*/
 
-void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
+struct sr_rt* sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
         struct in_addr gw, struct in_addr mask,char* if_name,uint8_t admin_dst)
 {
     struct sr_rt* rt_walker = 0;
@@ -109,8 +109,11 @@ void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
         sr->routing_table->mask = mask;
         strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
         sr->routing_table->admin_dst = admin_dst;
+        sr->routing_table->nexthop_num = 1;
+        sr->routing_table->nexthop[0].gw = gw;
+        strncpy(sr->routing_table->nexthop[0].interface,if_name,sr_IFACE_NAMELEN);
 
-        return;
+        return sr->routing_table;
     }
 
     /* -- find the end of the list -- */
@@ -128,9 +131,45 @@ void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
     rt_walker->mask = mask;
     strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
     rt_walker->admin_dst = admin_dst;
+    rt_walker->nexthop_num = 1;
+    rt_walker->nexthop[0].gw = gw;
+    strncpy(rt_walker->nexthop[0].interface,if_name,sr_IFACE_NAMELEN);
 
+    return rt_walker;
 } /* -- sr_add_entry -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_add_rt_nexthop
+ *
+ * Add an equal-cost next hop to a route, duplicates are ignored
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_add_rt_nexthop(struct sr_rt* entry, struct in_addr gw, char* if_name)
+{
+    /* -- REQUIRES -- */
+    assert(entry);
+    assert(if_name);
+
+    for (int i = 0; i < entry->nexthop_num; i++)
+    {
+        if ((entry->nexthop[i].gw.s_addr == gw.s_addr) &&
+            (strncmp(entry->nexthop[i].interface, if_name, sr_IFACE_NAMELEN) == 0))
+        {
+            return;
+        }
+    }
+
+    if (entry->nexthop_num >= SR_RT_MAX_NEXTHOPS)
+    {
+        return;
+    }
+
+    entry->nexthop[entry->nexthop_num].gw = gw;
+    strncpy(entry->nexthop[entry->nexthop_num].interface, if_name, sr_IFACE_NAMELEN);
+    entry->nexthop_num++;
+} /* -- sr_add_rt_nexthop -- */
+
 /*--------------------------------------------------------------------- 
  * Method:
  *
@@ -178,6 +217,14 @@ void sr_print_routing_entry(struct sr_rt* entry)
     printf("%-8s",entry->interface);
     printf("%d\n",entry->admin_dst);
 
+    for (int i = 1; i < entry->nexthop_num; i++)
+    {
+        printf("%-18s","");
+        printf("%-18s",inet_ntoa(entry->nexthop[i].gw));
+        printf("%-18s","");
+        printf("%-8s\n",entry->nexthop[i].interface);
+    }
+
 } /* -- sr_print_routing_entry -- */
 
 
@@ -306,3 +353,32 @@ uint8_t check_route(struct sr_instance* sr, struct in_addr route)
 
     return 0;
 } /* -- check_route -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lookup_rt
+ *
+ * Find the route of a destination, the first matching network or else
+ * the default route. Returns NULL if there is neither.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_lookup_rt(struct sr_instance* sr, struct in_addr dst)
+{
+    struct sr_rt* entry = sr->routing_table;
+    struct sr_rt* default_route = NULL;
+    while(entry != NULL)
+    {
+        if (entry->dest.s_addr == 0)
+        {
+            default_route = entry;
+        }
+        else if ((entry->dest.s_addr & htonl(0xfffffffe)/*entry->mask.s_addr*/) == (dst.s_addr & htonl(0xfffffffe)/*entry->mask.s_addr*/))
+        {
+            return entry;
+        }
+
+        entry = entry->next;
+    }
+
+    return default_route;
+} /* -- sr_lookup_rt -- */
@@ -20,6 +20,21 @@
 
 #include "sr_if.h"
 
+#define SR_RT_MAX_NEXTHOPS 8
+
+/* ----------------------------------------------------------------------------
+ * struct sr_rt_nexthop
+ *
+ * One of the equal-cost next hops of a route
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_rt_nexthop
+{
+    struct in_addr gw;
+    char   interface[sr_IFACE_NAMELEN];
+};
+
 /* ----------------------------------------------------------------------------
  * struct sr_rt
  *
@@ -38,12 +53,17 @@ struct sr_rt
     /* New Field */
     uint8_t admin_dst;
     /*************/
+
+    /* Equal-cost next hops, nexthop[0] is always gw/interface */
+    uint8_t nexthop_num;
+    struct sr_rt_nexthop nexthop[SR_RT_MAX_NEXTHOPS];
 };
 
 
 int sr_load_rt(struct sr_instance*,const char*);
-void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
+struct sr_rt* sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
                   struct in_addr,char*,uint8_t);
+void sr_add_rt_nexthop(struct sr_rt*, struct in_addr, char*);
 void sr_print_routing_table(struct sr_instance* sr);
 void sr_print_routing_entry(struct sr_rt* entry);
 
@@ -52,5 +72,6 @@ int count_routes(struct sr_instance*, uint8_t);
 void clear_routes(struct sr_instance*);
 void sr_del_rt_entry(struct sr_rt*);
 uint8_t check_route(struct sr_instance*, struct in_addr);
+struct sr_rt* sr_lookup_rt(struct sr_instance*, struct in_addr);
 
 #endif  /* --  sr_RT_H -- */
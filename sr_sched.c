@@ -0,0 +1,411 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_sched.c
+ *
+ * Description:
+ *
+ * Priority and deficit round robin output queues, see sr_sched.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <netinet/in.h>
+
+#include "sr_sched.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_stats.h"
+#include "sr_if.h"
+
+static void sched_expired(struct sr_instance* sr, void* arg);
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_sched_config
+ *
+ * Shapes the interfaces of a comma separated list of iface=Mbit/s (-Q).
+ * With sr NULL only checks the list. Returns 0, or -1 if the list does
+ * not parse.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_sched_config(struct sr_instance* sr, const char* spec)
+{
+    const char* item = spec;
+    while (*item != '\0')
+    {
+        unsigned int len = strcspn(item, ",");
+        const char* equal = ((const char*)(memchr(item, '=', len)));
+        if ((equal == NULL) || (equal == item) || (equal - item >= sr_IFACE_NAMELEN))
+        {
+            return -1;
+        }
+
+        char* end;
+        double mbits = strtod(equal + 1, &end);
+        if ((end != item + len) || (mbits < 0.064) || (mbits > 100000))
+        {
+            return -1;
+        }
+
+        if (sr != NULL)
+        {
+            char name[sr_IFACE_NAMELEN];
+            memcpy(name, item, equal - item);
+            name[equal - item] = '\0';
+
+            struct sr_if* iface = sr_get_interface(sr, name);
+            if (iface == NULL)
+            {
+                fprintf(stderr, "*warning* no interface %s to shape\n", name);
+            }
+            else if (iface->sched == NULL)
+            {
+                struct sr_sched* sched = ((struct sr_sched*)(calloc(1, sizeof(struct sr_sched))));
+                pthread_mutex_init(&sched->lock, NULL);
+                sched->sr = sr;
+                sched->iface = iface;
+                sched->rate = ((uint64_t)(mbits * 125000));
+                /* -- at least two frames of the largest MTU -- */
+                sched->burst = (sched->rate * SCHED_BURST_MS) / 1000;
+                if (sched->burst < ((int64_t)(2 * (sr_IFACE_MAX_MTU + sizeof(sr_ethernet_hdr)))))
+                {
+                    sched->burst = 2 * (sr_IFACE_MAX_MTU + sizeof(sr_ethernet_hdr));
+                }
+                sched->tokens = sched->burst;
+                sched->last = sr_stats_now();
+                for (int i = 1; i < SCHED_QUEUE_NUM; i++)
+                {
+                    sched->queues[i].quantum = i * SCHED_QUANTUM;
+                }
+                sr_timer_init(&sched->timer, sched_expired, sched);
+                iface->sched = sched;
+            }
+        }
+
+        item += len;
+        if (*item == ',')
+        {
+            item++;
+        }
+    }
+    return 0;
+} /* -- sr_sched_config -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sched_classify
+ *
+ * The queue of a frame: ARP and OSPF to the control queue, IP by its
+ * precedence to a data queue.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+unsigned int sched_classify(uint8_t* buf, unsigned int len)
+{
+    struct sr_ethernet_hdr* e_hdr = ((sr_ethernet_hdr*)(buf));
+    if (ntohs(e_hdr->ether_type) == ETHERTYPE_ARP)
+    {
+        return SCHED_CONTROL;
+    }
+    if ((ntohs(e_hdr->ether_type) != ETHERTYPE_IP) || (len < sizeof(sr_ethernet_hdr) + sizeof(ip)))
+    {
+        return 1;
+    }
+
+    struct ip* ip_hdr = ((ip*)(buf + sizeof(sr_ethernet_hdr)));
+    if (ip_hdr->ip_p == IP_PROTO_OSPFv2)
+    {
+        return SCHED_CONTROL;
+    }
+    return 1 + (ip_hdr->ip_tos >> 6);
+} /* -- sched_classify -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sched_pop
+ *
+ * Takes the head frame off a queue that has one
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+struct sr_sched_frame* sched_pop(struct sr_sched_queue* queue)
+{
+    struct sr_sched_frame* frame = queue->head;
+    queue->head = frame->next;
+    if (queue->head == NULL)
+    {
+        queue->tail = NULL;
+    }
+    queue->len--;
+    queue->bytes -= frame->len;
+    queue->sent++;
+    return frame;
+} /* -- sched_pop -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sched_dequeue
+ *
+ * The next frame to send: the control queue first, then the data queues
+ * in turn, each sending while its deficit covers its head frame.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+struct sr_sched_frame* sched_dequeue(struct sr_sched* sched)
+{
+    if (sched->queues[SCHED_CONTROL].head != NULL)
+    {
+        return sched_pop(&sched->queues[SCHED_CONTROL]);
+    }
+    if (sched->data_len == 0)
+    {
+        return NULL;
+    }
+
+    while (1)
+    {
+        struct sr_sched_queue* queue = &sched->queues[1 + sched->drr_next];
+        if ((queue->head != NULL) && (queue->deficit >= ((int)(queue->head->len))))
+        {
+            struct sr_sched_frame* frame = sched_pop(queue);
+            queue->deficit -= frame->len;
+            if (queue->head == NULL)
+            {
+                /* -- an empty queue keeps no credit for later -- */
+                queue->deficit = 0;
+            }
+            sched->data_len--;
+            return frame;
+        }
+
+        /* -- this turn is over, the next queue with frames gets its quantum -- */
+        sched->drr_next = (sched->drr_next + 1) % SCHED_DATA_QUEUES;
+        queue = &sched->queues[1 + sched->drr_next];
+        if (queue->head != NULL)
+        {
+            queue->deficit += queue->quantum;
+        }
+    }
+} /* -- sched_dequeue -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sched_refill
+ *
+ * Adds the bytes earned since the last refill to the bucket, up to the
+ * burst. Called with the lock held.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void sched_refill(struct sr_sched* sched, uint64_t now)
+{
+    uint64_t elapsed = now - sched->last;
+    if (elapsed > 1000000000ULL)
+    {
+        elapsed = 1000000000ULL;
+    }
+    sched->tokens += (elapsed * sched->rate) / 1000000000ULL;
+    if (sched->tokens > sched->burst)
+    {
+        sched->tokens = sched->burst;
+    }
+    sched->last = now;
+} /* -- sched_refill -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sched_run
+ *
+ * Refills the bucket and sends the frames it covers, the last one may
+ * take it below zero. With frames left, the timer is armed for when the
+ * bucket is positive again. Called with the lock held.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void sched_run(struct sr_sched* sched, uint64_t now)
+{
+    struct sr_instance* sr = sched->sr;
+    struct sr_sched_frame* frame;
+
+    sched_refill(sched, now);
+    while ((sched->tokens > 0) && ((frame = sched_dequeue(sched)) != NULL))
+    {
+        sched->tokens -= frame->len;
+        sr_stats_record(sr, HIST_SCHED_QUEUE, now - frame->queued_at);
+        sr_send_frame(sr, frame->packet, frame->len, sched->iface->name);
+        free(frame);
+    }
+
+    if (((sched->queues[SCHED_CONTROL].head != NULL) || (sched->data_len > 0)) && !sr_timer_armed(&sched->timer))
+    {
+        uint64_t ms = (sched->tokens < 0) ? ((((uint64_t)(-sched->tokens)) * 1000) / sched->rate) : 0;
+        sr_timer_add(sr, &sched->timer, ms + 1);
+    }
+} /* -- sched_run -- */
+
+static
+void sched_expired(struct sr_instance* sr, void* arg)
+{
+    struct sr_sched* sched = ((struct sr_sched*)(arg));
+    pthread_mutex_lock(&sched->lock);
+    sched_run(sched, sr_stats_now());
+    pthread_mutex_unlock(&sched->lock);
+} /* -- sched_expired -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_sched_send
+ *
+ * Sends the frame out of the shaped interface, right away if nothing is
+ * waiting and the bucket allows, else once its turn comes. Returns 0, or
+ * -1 if its queue is full and the frame dropped.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_sched_send(struct sr_instance* sr, struct sr_if* iface, uint8_t* buf, unsigned int len)
+{
+    struct sr_sched* sched = iface->sched;
+    uint64_t now = sr_stats_now();
+    unsigned int index = sched_classify(buf, len);
+    struct sr_sched_queue* queue = &sched->queues[index];
+
+    pthread_mutex_lock(&sched->lock);
+
+    if ((sched->queues[SCHED_CONTROL].head == NULL) && (sched->data_len == 0))
+    {
+        sched_refill(sched, now);
+        if (sched->tokens > 0)
+        {
+            sched->tokens -= len;
+            queue->sent++;
+            int ret = sr_send_frame(sr, buf, len, iface->name);
+            pthread_mutex_unlock(&sched->lock);
+            return ret;
+        }
+    }
+
+    if (queue->len >= SCHED_QUEUE_LEN)
+    {
+        queue->drops++;
+        pthread_mutex_unlock(&sched->lock);
+        sr_stats_inc(sr, STATS_DROP_SCHED);
+        return -1;
+    }
+
+    struct sr_sched_frame* frame = ((struct sr_sched_frame*)(malloc(sizeof(struct sr_sched_frame) + len)));
+    frame->next = NULL;
+    frame->queued_at = now;
+    frame->len = len;
+    memcpy(frame->packet, buf, len);
+    if (queue->tail == NULL)
+    {
+        queue->head = frame;
+    }
+    else
+    {
+        queue->tail->next = frame;
+    }
+    queue->tail = frame;
+    queue->len++;
+    queue->bytes += len;
+    if (queue->len > queue->max_len)
+    {
+        queue->max_len = queue->len;
+    }
+    if (index != SCHED_CONTROL)
+    {
+        sched->data_len++;
+    }
+
+    sched_run(sched, now);
+    pthread_mutex_unlock(&sched->lock);
+    return 0;
+} /* -- sr_sched_send -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_sched_format
+ *
+ * The queues of the shaped interfaces, for the stats socket.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_sched_format(struct sr_instance* sr, struct stats_buf* buf)
+{
+    int shaped = 0;
+    for (struct sr_if* iface = sr->if_list; iface != NULL; iface = iface->next)
+    {
+        struct sr_sched* sched = iface->sched;
+        if (sched == NULL)
+        {
+            continue;
+        }
+        shaped = 1;
+
+        pthread_mutex_lock(&sched->lock);
+        stats_printf(buf, "%s %.3f Mbit/s, %lld bytes of tokens\n", iface->name, sched->rate / 125000.0,
+            ((long long)(sched->tokens)));
+        stats_printf(buf, "  %-9s %6s %8s %6s %12s %10s\n", "queue", "frames", "bytes", "max", "sent", "drops");
+        for (int i = 0; i < SCHED_QUEUE_NUM; i++)
+        {
+            struct sr_sched_queue* queue = &sched->queues[i];
+            char name[16];
+            if (i == SCHED_CONTROL)
+            {
+                strcpy(name, "control");
+            }
+            else
+            {
+                snprintf(name, sizeof(name), "data %d", i - 1);
+            }
+            stats_printf(buf, "  %-9s %6u %8u %6u %12llu %10llu\n", name, queue->len, queue->bytes, queue->max_len,
+                ((unsigned long long)(queue->sent)), ((unsigned long long)(queue->drops)));
+        }
+        pthread_mutex_unlock(&sched->lock);
+    }
+
+    if (!shaped)
+    {
+        stats_printf(buf, "no shaped interface\n");
+    }
+} /* -- sr_sched_format -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_sched_destroy
+ *
+ * Drops what is still queued, once nothing sends any more.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_sched_destroy(struct sr_instance* sr)
+{
+    for (struct sr_if* iface = sr->if_list; iface != NULL; iface = iface->next)
+    {
+        struct sr_sched* sched = iface->sched;
+        if (sched == NULL)
+        {
+            continue;
+        }
+
+        sr_timer_cancel(sr, &sched->timer);
+        for (int i = 0; i < SCHED_QUEUE_NUM; i++)
+        {
+            while (sched->queues[i].head != NULL)
+            {
+                free(sched_pop(&sched->queues[i]));
+            }
+        }
+        pthread_mutex_destroy(&sched->lock);
+        free(sched);
+        iface->sched = NULL;
+    }
+} /* -- sr_sched_destroy -- */
@@ -0,0 +1,93 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_sched.h
+ *
+ * Description:
+ *
+ * Output scheduling of an interface shaped to the rate of its link (-Q).
+ * A router sending faster than its link lets the link drop at random,
+ * hellos and LSUs as well as data, and the adjacencies time out when the
+ * network is busiest. Shaped, the queue builds here instead, where the
+ * frames can be told apart.
+ *
+ * ARP and OSPF go to the control queue, served first. The data queues
+ * share what is left by deficit round robin, by the precedence bits of
+ * ip_tos (tos >> 6): queue c gets (c + 1) quanta of SCHED_QUANTUM bytes a
+ * round, so under load queue 3 gets four times the share of queue 0.
+ * A full queue drops the frame arriving (drop_sched).
+ *
+ * The shaper is a token bucket of SCHED_BURST_MS of the rate, refilled
+ * when a frame is queued and by a timer of the event loop while frames
+ * wait. "sched" on the stats socket lists the queues of every interface.
+ *
+ *   -Q eth0=10,eth1=100      (Mbit/s)
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SCHED_H
+#define SR_SCHED_H
+
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include "sr_event.h"
+
+#define SCHED_CONTROL 0
+#define SCHED_DATA_QUEUES 4
+#define SCHED_QUEUE_NUM (1 + SCHED_DATA_QUEUES)
+
+#define SCHED_QUANTUM 1514          /* bytes, times the weight of the queue */
+#define SCHED_QUEUE_LEN 128         /* frames a queue holds */
+#define SCHED_BURST_MS 5
+
+struct sr_instance;
+struct sr_if;
+struct stats_buf;
+
+struct sr_sched_frame
+{
+    struct sr_sched_frame* next;
+    uint64_t queued_at;             /* ns, see sr_stats_now() */
+    unsigned int len;
+    uint8_t packet[1];
+};
+
+struct sr_sched_queue
+{
+    struct sr_sched_frame* head;
+    struct sr_sched_frame* tail;
+    unsigned int len;               /* frames */
+    unsigned int bytes;
+    unsigned int max_len;           /* deepest since started */
+    unsigned int quantum;
+    int deficit;
+    uint64_t sent;
+    uint64_t drops;
+};
+
+struct sr_sched
+{
+    pthread_mutex_t lock;           /* frames are sent from several threads */
+    struct sr_instance* sr;
+    struct sr_if* iface;
+
+    uint64_t rate;                  /* bytes per second */
+    int64_t tokens;                 /* bytes, negative after a frame larger than what was left */
+    int64_t burst;
+    uint64_t last;                  /* ns of the last refill */
+
+    struct sr_sched_queue queues[SCHED_QUEUE_NUM];
+    unsigned int data_len;          /* frames in the data queues */
+    unsigned int drr_next;          /* data queue whose turn it is */
+
+    struct sr_timer timer;
+};
+
+int sr_sched_config(struct sr_instance*, const char*);
+int sr_sched_send(struct sr_instance*, struct sr_if*, uint8_t*, unsigned int);
+void sr_sched_format(struct sr_instance*, struct stats_buf*);
+void sr_sched_destroy(struct sr_instance*);
+
+#endif /* -- SR_SCHED_H -- */
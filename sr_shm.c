@@ -0,0 +1,259 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm.c
+ *
+ * Description:
+ *
+ * Shared memory transport to a server on the same machine, see sr_shm.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+
+#include "sr_shm.h"
+#include "sr_router.h"
+#include "sr_event.h"
+#include "sr_stats.h"
+#include "vnscommand.h"
+
+static int shm_read(struct sr_instance* sr, void* arg);
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_offer
+ *
+ * Maps the rings and passes them with their eventfds to the server in a
+ * VNS_SHM command. Nothing goes through them until the server answers,
+ * see sr_shm_start(). Returns 0, or -1 and the session stays on the
+ * socket alone.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_shm_offer(struct sr_instance* sr)
+{
+    struct sr_shm* shm = ((struct sr_shm*)(calloc(1, sizeof(struct sr_shm))));
+    shm->memfd = shm->rx.efd = shm->tx.efd = -1;
+
+    shm->memfd = memfd_create("sr_shm", MFD_CLOEXEC);
+    if ((shm->memfd < 0) || (ftruncate(shm->memfd, sizeof(struct sr_shm_region)) < 0))
+    {
+        perror("memfd_create(..):sr_shm.c::sr_shm_offer");
+        goto error;
+    }
+
+    shm->region = ((struct sr_shm_region*)(mmap(NULL, sizeof(struct sr_shm_region),
+                    PROT_READ | PROT_WRITE, MAP_SHARED, shm->memfd, 0)));
+    if (shm->region == MAP_FAILED)
+    {
+        shm->region = NULL;
+        perror("mmap(..):sr_shm.c::sr_shm_offer");
+        goto error;
+    }
+    shm->region->magic = SHM_MAGIC;
+    shm->region->slot_num = SHM_SLOT_NUM;
+    shm->region->slot_size = SHM_SLOT_SIZE;
+
+    shm->rx.ring = &shm->region->to_router;
+    shm->tx.ring = &shm->region->from_router;
+    shm->rx.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shm->tx.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((shm->rx.efd < 0) || (shm->tx.efd < 0))
+    {
+        perror("eventfd(..):sr_shm.c::sr_shm_offer");
+        goto error;
+    }
+
+    {
+        c_shm command;
+        memset(&command, 0, sizeof(command));
+        command.mLen = htonl(sizeof(c_shm));
+        command.mType = htonl(VNS_SHM);
+        command.mSlotNum = htonl(SHM_SLOT_NUM);
+        command.mSlotSize = htonl(SHM_SLOT_SIZE);
+
+        /* -- memfd, then the eventfds of the to_router and from_router rings -- */
+        int fds[3] = { shm->memfd, shm->rx.efd, shm->tx.efd };
+        union
+        {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(fds))];
+        } control;
+        memset(&control, 0, sizeof(control));
+
+        struct iovec iov;
+        iov.iov_base = &command;
+        iov.iov_len = sizeof(command);
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        if (sendmsg(sr->sockfd, &msg, 0) != sizeof(command))
+        {
+            perror("sendmsg(..):sr_shm.c::sr_shm_offer");
+            goto error;
+        }
+    }
+
+    sr->shm = shm;
+    return 0;
+
+error:
+    sr->shm = shm;
+    sr_shm_close(sr);
+    return -1;
+} /* -- sr_shm_offer -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_start
+ *
+ * Called on the VNS_SHM answer of the server, packets use the rings from
+ * now on. Returns 0 or -1.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_shm_start(struct sr_instance* sr, uint8_t* buf, unsigned int len)
+{
+    c_shm* command = ((c_shm*)(buf));
+
+    if ((sr->shm == NULL) || sr->shm->active || (len < sizeof(c_shm)) ||
+        (ntohl(command->mSlotNum) != SHM_SLOT_NUM) || (ntohl(command->mSlotSize) != SHM_SLOT_SIZE))
+    {
+        fprintf(stderr, "Ignoring unexpected VNS_SHM from the server\n");
+        return -1;
+    }
+
+    if (sr_event_add_fd(sr, sr->shm->rx.efd, shm_read, NULL) != 0)
+    {
+        return -1;
+    }
+    sr->shm->active = 1;
+    printf("Packets go through shared memory rings of %d slots\n", SHM_SLOT_NUM);
+    return 0;
+} /* -- sr_shm_start -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: shm_read
+ *
+ * The to_router eventfd is readable: handles the VNSPACKET commands of the
+ * ring in place, at most SHM_READ_BATCH of them before giving the other
+ * descriptors a turn.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int shm_read(struct sr_instance* sr, void* arg)
+{
+    struct sr_shm* shm = sr->shm;
+    uint64_t count;
+    uint8_t* slot;
+    int handled = 0;
+
+    if (read(shm->rx.efd, &count, sizeof(count)) < 0)
+    {
+        /* -- EAGAIN, a wakeup already consumed by the last drain -- */
+    }
+    sr_stats_inc(sr, STATS_IO_SYSCALLS);
+
+    while ((handled < SHM_READ_BATCH) && ((slot = sr_shm_peek(&shm->rx)) != NULL))
+    {
+        uint32_t len = ntohl(*((uint32_t*)(slot)));
+        if ((len >= sizeof(c_packet_header)) && (len <= SHM_SLOT_SIZE))
+        {
+            sr_handle_command(sr, slot, len);
+        }
+        sr_shm_pop(&shm->rx);
+        handled++;
+    }
+
+    /* -- left some behind, the producer will not wake us for them -- */
+    if (handled == SHM_READ_BATCH)
+    {
+        count = 1;
+        if (write(shm->rx.efd, &count, sizeof(count)) < 0)
+        {
+            /* -- the counter is not empty, we run again anyway -- */
+        }
+        sr_stats_inc(sr, STATS_IO_SYSCALLS);
+    }
+    return 1;
+} /* -- shm_read -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_send
+ *
+ * Frames the packet as a VNSPACKET command in the from_router ring. The
+ * ring has one producer: hellos, LSUs and forwarded packets come from
+ * different threads, so they take sock_lock as for a write on the socket.
+ * Returns 0, or -1 if the ring is full and the packet dropped.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_shm_send(struct sr_instance* sr, uint8_t* buf, unsigned int len, const char* iface)
+{
+    c_packet_header hdr;
+    hdr.mLen = htonl(len + sizeof(c_packet_header));
+    hdr.mType = htonl(VNSPACKET);
+    memset(hdr.mInterfaceName, 0, sizeof(hdr.mInterfaceName));
+    memcpy(hdr.mInterfaceName, iface, strnlen(iface, sizeof(hdr.mInterfaceName)));
+
+    pthread_mutex_lock(&sr->sock_lock);
+    int ret = sr_shm_push(&sr->shm->tx, &hdr, sizeof(hdr), buf, len);
+    pthread_mutex_unlock(&sr->sock_lock);
+
+    if (ret == 1)
+    {
+        sr_stats_inc(sr, STATS_IO_SYSCALLS);
+    }
+    else if (ret == -1)
+    {
+        sr_stats_inc(sr, STATS_SHM_FULL);
+        return -1;
+    }
+    return 0;
+} /* -- sr_shm_send -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_close
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_shm_close(struct sr_instance* sr)
+{
+    struct sr_shm* shm = sr->shm;
+
+    if (shm->region != NULL)
+    {
+        munmap(shm->region, sizeof(struct sr_shm_region));
+    }
+    if (shm->memfd >= 0)
+    { close(shm->memfd); }
+    if (shm->rx.efd >= 0)
+    { close(shm->rx.efd); }
+    if (shm->tx.efd >= 0)
+    { close(shm->tx.efd); }
+
+    free(shm);
+    sr->shm = NULL;
+} /* -- sr_shm_close -- */
@@ -0,0 +1,146 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm.h
+ *
+ * Description:
+ *
+ * Shared memory transport between sr and a VNS stand-in on the same
+ * machine (vns_emu). When sr reaches the server on a Unix socket (-s
+ * with a path), it follows VNSOPEN with a VNS_SHM command carrying,
+ * as SCM_RIGHTS, a memfd and two eventfds. The memfd holds two rings of
+ * packet slots, one per direction, each with a single producer and a
+ * single consumer. Once the server answers with its own VNS_SHM, the
+ * VNSPACKET commands of both sides go through the rings instead of the
+ * socket, which is left with the other commands.
+ *
+ * A slot holds a whole VNSPACKET command, so the consumer handles it as
+ * if read from the socket, in place. The producer writes the eventfd of
+ * the ring only when it found the ring empty, the consumer drains the
+ * ring until it finds it empty: a burst costs one wakeup.
+ *
+ * This header is shared by sr (sr_shm.c) and vns_emu.c.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SHM_H
+#define SR_SHM_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include <string.h>
+#include <unistd.h>
+
+#define SHM_MAGIC 0x73686d31            /* "shm1" */
+#define SHM_SLOT_NUM 1024               /* per ring, a power of two */
+#define SHM_SLOT_SIZE 9216              /* a VNSPACKET command of a 9014 byte jumbo frame fits */
+#define SHM_CACHE_LINE 64
+
+struct sr_shm_ring
+{
+    uint64_t head __attribute__ ((aligned (SHM_CACHE_LINE)));  /* written by the producer */
+    uint64_t tail __attribute__ ((aligned (SHM_CACHE_LINE)));  /* written by the consumer */
+    uint8_t slots[SHM_SLOT_NUM][SHM_SLOT_SIZE] __attribute__ ((aligned (SHM_CACHE_LINE)));
+};
+
+struct sr_shm_region
+{
+    uint32_t magic;
+    uint32_t slot_num;
+    uint32_t slot_size;
+    struct sr_shm_ring to_router __attribute__ ((aligned (SHM_CACHE_LINE)));
+    struct sr_shm_ring from_router;
+};
+
+/* -- a ring seen from one side, with the eventfd of its consumer -- */
+struct sr_shm_queue
+{
+    struct sr_shm_ring* ring;
+    int efd;
+};
+
+/*---------------------------------------------------------------------
+ * Producer: sr_shm_push() copies a command (its length first, in
+ * network order) into the next slot. Returns 0 if it fit, 1 if it also
+ * had to wake the consumer, -1 if the ring is full or the command too
+ * long.
+ *---------------------------------------------------------------------*/
+
+static inline
+int sr_shm_push(struct sr_shm_queue* queue, const void* hdr, unsigned int hdr_len, const void* data, unsigned int len)
+{
+    struct sr_shm_ring* ring = queue->ring;
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if ((head - tail >= SHM_SLOT_NUM) || (hdr_len + len > SHM_SLOT_SIZE))
+    {
+        return -1;
+    }
+
+    uint8_t* slot = ring->slots[head & (SHM_SLOT_NUM - 1)];
+    memcpy(slot, hdr, hdr_len);
+    memcpy(slot + hdr_len, data, len);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    /* -- the consumer may have found it empty and gone to sleep -- */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head)
+    {
+        uint64_t one = 1;
+        if (write(queue->efd, &one, sizeof(one)) < 0)
+        {
+            /* -- only if the counter is full, the consumer is awake -- */
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Consumer: slot = sr_shm_peek(queue); handle it; sr_shm_pop(queue);
+ * sr_shm_peek() returns NULL once the ring is empty.
+ *---------------------------------------------------------------------*/
+
+static inline
+uint8_t* sr_shm_peek(struct sr_shm_queue* queue)
+{
+    struct sr_shm_ring* ring = queue->ring;
+    uint64_t tail = ring->tail;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+    {
+        return NULL;
+    }
+    return ring->slots[tail & (SHM_SLOT_NUM - 1)];
+}
+
+static inline
+void sr_shm_pop(struct sr_shm_queue* queue)
+{
+    __atomic_store_n(&queue->ring->tail, queue->ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+
+/* -- sr side, sr_shm.c -- */
+
+#define SHM_READ_BATCH 256 /* commands handled per wakeup of the event loop */
+
+struct sr_instance;
+
+struct sr_shm
+{
+    int memfd;
+    struct sr_shm_region* region;
+    struct sr_shm_queue rx;     /* to_router, its eventfd wakes the event loop */
+    struct sr_shm_queue tx;     /* from_router, its eventfd wakes the server */
+    int active;                 /* the server accepted, packets go through the rings */
+};
+
+int sr_shm_offer(struct sr_instance*);
+int sr_shm_start(struct sr_instance*, uint8_t*, unsigned int);
+int sr_shm_send(struct sr_instance*, uint8_t*, unsigned int, const char*);
+void sr_shm_close(struct sr_instance*);
+
+#endif /* -- SR_SHM_H -- */
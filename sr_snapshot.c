@@ -0,0 +1,485 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_snapshot.c
+ *
+ * Description:
+ *
+ * Snapshots of the LSDB, the routes and the ARP cache for a warm restart,
+ * see sr_snapshot.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "sr_snapshot.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "pwospf_protocol.h"
+#include "pwospf_neighbors.h"
+#include "pwospf_topology.h"
+#include "sr_pwospf.h"
+#include "sr_if.h"
+#include "sr_log.h"
+#include "cache.h"
+
+static void snapshot_expired(struct sr_instance* sr, void* arg);
+
+
+/*-----------------------------------------------------------------------------
+ * Method: snapshot_wall_ms
+ *
+ * Wall clock ms, the only clock that goes on across a restart
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+uint64_t snapshot_wall_ms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (((uint64_t)(tv.tv_sec)) * 1000) + (tv.tv_usec / 1000);
+} /* -- snapshot_wall_ms -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_snapshot_create
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_snapshot* sr_snapshot_create(const char* path)
+{
+    struct sr_snapshot* snapshot = ((struct sr_snapshot*)(calloc(1, sizeof(struct sr_snapshot))));
+    strncpy(snapshot->path, path, sizeof(snapshot->path) - 1);
+    sr_timer_init(&snapshot->timer, snapshot_expired, snapshot);
+    return snapshot;
+} /* -- sr_snapshot_create -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_snapshot_save
+ *
+ * Writes the state of the router to the snapshot file. Returns 0, or -1
+ * if it could not be written, the previous one is then left as it was.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_snapshot_save(struct sr_instance* sr)
+{
+    struct sr_snapshot* snapshot = sr->snapshot;
+    struct pwospf_subsys* subsys = sr->ospf_subsys;
+    uint64_t now = sr_timer_now();
+
+    struct sr_snapshot_hdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SNAPSHOT_MAGIC;
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.hdr_len = sizeof(struct sr_snapshot_hdr);
+
+    pwospf_lock(subsys);
+
+    for (struct sr_if* iface = sr->if_list; iface != NULL; iface = iface->next)
+    {
+        hdr.iface_num++;
+    }
+    for (struct ospfv2_topology_entry* entry = subsys->first_topology_entry->next; entry != NULL; entry = entry->next)
+    {
+        hdr.topo_num++;
+    }
+    for (struct sr_rt* route = sr->routing_table; route != NULL; route = route->next)
+    {
+        hdr.route_num += (route->admin_dst > 1);
+    }
+    for (struct cache_item* item = (sr->arp_cache != NULL) ? sr->arp_cache->next_item : NULL; item != NULL; item = item->next_item)
+    {
+        hdr.arp_num += (item->expires > now);
+    }
+
+    unsigned int len = (hdr.iface_num * sizeof(struct sr_snapshot_iface)) + (hdr.topo_num * sizeof(struct sr_snapshot_topo)) +
+        (hdr.route_num * sizeof(struct sr_snapshot_route)) + (hdr.arp_num * sizeof(struct sr_snapshot_arp));
+    uint8_t* buf = ((uint8_t*)(calloc(1, sizeof(hdr) + len)));
+    uint8_t* ptr = buf + sizeof(hdr);
+
+    /* -- interfaces, with the adjacency and the time it has left -- */
+    for (struct sr_if* iface = sr->if_list; iface != NULL; iface = iface->next)
+    {
+        struct sr_snapshot_iface* rec = ((struct sr_snapshot_iface*)(ptr));
+        strncpy(rec->name, iface->name, sr_IFACE_NAMELEN);
+        rec->ip = iface->ip;
+        for (struct ospfv2_neighbor* nbr = subsys->first_neighbor->next; nbr != NULL; nbr = nbr->next)
+        {
+            if ((iface->neighbor_id != 0) && (nbr->neighbor_id.s_addr == iface->neighbor_id) &&
+                (nbr->neighbor_ip.s_addr == iface->neighbor_ip) && (nbr->expires > now))
+            {
+                rec->neighbor_id = iface->neighbor_id;
+                rec->neighbor_ip = iface->neighbor_ip;
+                rec->neighbor_left = nbr->expires - now;
+            }
+        }
+        ptr += sizeof(struct sr_snapshot_iface);
+    }
+
+    for (struct ospfv2_topology_entry* entry = subsys->first_topology_entry->next; entry != NULL; entry = entry->next)
+    {
+        struct sr_snapshot_topo* rec = ((struct sr_snapshot_topo*)(ptr));
+        rec->router_id = entry->router_id.s_addr;
+        rec->net_num = entry->net_num.s_addr;
+        rec->net_mask = entry->net_mask.s_addr;
+        rec->neighbor_id = entry->neighbor_id.s_addr;
+        rec->next_hop = entry->next_hop.s_addr;
+        rec->age = (now > entry->refreshed) ? (now - entry->refreshed) : 0;
+        rec->sequence_num = entry->sequence_num;
+        ptr += sizeof(struct sr_snapshot_topo);
+    }
+    hdr.sequence_num = subsys->sequence_num;
+
+    pwospf_unlock(subsys);
+
+    /* -- the routes computed from the LSDB, next hops by interface index -- */
+    for (struct sr_rt* route = sr->routing_table; route != NULL; route = route->next)
+    {
+        if (route->admin_dst <= 1)
+        {
+            continue;
+        }
+
+        struct sr_snapshot_route* rec = ((struct sr_snapshot_route*)(ptr));
+        rec->dest = route->dest.s_addr;
+        rec->mask = route->mask.s_addr;
+        rec->admin_dst = route->admin_dst;
+        for (int i = 0; i < route->nexthop_num; i++)
+        {
+            uint32_t index = 0;
+            struct sr_if* iface = sr->if_list;
+            while ((iface != NULL) && (strncmp(iface->name, route->nexthop[i].interface, sr_IFACE_NAMELEN) != 0))
+            {
+                iface = iface->next;
+                index++;
+            }
+            if (iface != NULL)
+            {
+                rec->nexthop[rec->nexthop_num].gw = route->nexthop[i].gw.s_addr;
+                rec->nexthop[rec->nexthop_num].iface = index;
+                rec->nexthop_num++;
+            }
+        }
+        ptr += sizeof(struct sr_snapshot_route);
+    }
+
+    for (struct cache_item* item = (sr->arp_cache != NULL) ? sr->arp_cache->next_item : NULL; item != NULL; item = item->next_item)
+    {
+        if (item->expires <= now)
+        {
+            continue;
+        }
+
+        struct sr_snapshot_arp* rec = ((struct sr_snapshot_arp*)(ptr));
+        rec->ip = item->ip;
+        rec->left = item->expires - now;
+        memcpy(rec->mac, item->mac, ETHER_ADDR_LEN);
+        ptr += sizeof(struct sr_snapshot_arp);
+    }
+
+    hdr.saved = snapshot_wall_ms();
+    hdr.sum = calc_cksum(buf + sizeof(hdr), len);
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    char tmp[sizeof(snapshot->path) + 4];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", snapshot->path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int ret = -1;
+    if (fd >= 0)
+    {
+        if (write(fd, buf, sizeof(hdr) + len) == ((ssize_t)(sizeof(hdr) + len)))
+        {
+            ret = rename(tmp, snapshot->path);
+        }
+        close(fd);
+    }
+    free(buf);
+
+    if (ret != 0)
+    {
+        Log(LOG_OSPF, LOG_WARN, "Snapshot %s not written", snapshot->path);
+        unlink(tmp);
+        return -1;
+    }
+    snapshot->saves++;
+    return 0;
+} /* -- sr_snapshot_save -- */
+
+static
+void snapshot_expired(struct sr_instance* sr, void* arg)
+{
+    struct sr_snapshot* snapshot = ((struct sr_snapshot*)(arg));
+    sr_snapshot_save(sr);
+    sr_timer_add(sr, &snapshot->timer, SNAPSHOT_INTERVAL_MS);
+} /* -- snapshot_expired -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: snapshot_map
+ *
+ * Maps the snapshot file and checks it is whole. Returns the header, or
+ * NULL if there is no usable snapshot. *size is what to unmap.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+struct sr_snapshot_hdr* snapshot_map(const char* path, size_t* size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if ((fstat(fd, &st) == 0) && (st.st_size >= ((off_t)(sizeof(struct sr_snapshot_hdr)))))
+    {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    struct sr_snapshot_hdr* hdr = ((struct sr_snapshot_hdr*)(map));
+    uint64_t len = (((uint64_t)(hdr->iface_num)) * sizeof(struct sr_snapshot_iface)) +
+        (((uint64_t)(hdr->topo_num)) * sizeof(struct sr_snapshot_topo)) +
+        (((uint64_t)(hdr->route_num)) * sizeof(struct sr_snapshot_route)) +
+        (((uint64_t)(hdr->arp_num)) * sizeof(struct sr_snapshot_arp));
+    if ((hdr->magic != SNAPSHOT_MAGIC) || (hdr->version != SNAPSHOT_VERSION) ||
+        (hdr->hdr_len != sizeof(struct sr_snapshot_hdr)) || (sizeof(struct sr_snapshot_hdr) + len != ((uint64_t)(st.st_size))) ||
+        (calc_cksum(((uint8_t*)(map)) + sizeof(struct sr_snapshot_hdr), len) != hdr->sum))
+    {
+        Log(LOG_OSPF, LOG_WARN, "Snapshot %s damaged, starting cold", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return hdr;
+} /* -- snapshot_map -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: snapshot_restore
+ *
+ * Takes what has not expired since the snapshot was written into the
+ * router, still empty of dynamic state. Returns 0, or -1 if the snapshot
+ * is too old or of other interfaces.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int snapshot_restore(struct sr_instance* sr, struct sr_snapshot_hdr* hdr)
+{
+    struct pwospf_subsys* subsys = sr->ospf_subsys;
+    uint64_t now = sr_timer_now();
+    uint64_t wall = snapshot_wall_ms();
+    uint64_t elapsed = (wall > hdr->saved) ? (wall - hdr->saved) : 0;
+
+    if (elapsed >= ((uint64_t)(OSPF_TOPO_ENTRY_TIMEOUT)) * 1000)
+    {
+        Log(LOG_OSPF, LOG_INFO, "Snapshot %s is %d s old, starting cold", sr->snapshot->path, ((int)(elapsed / 1000)));
+        return -1;
+    }
+
+    struct sr_snapshot_iface* ifaces = ((struct sr_snapshot_iface*)(hdr + 1));
+    struct sr_snapshot_topo* topo = ((struct sr_snapshot_topo*)(ifaces + hdr->iface_num));
+    struct sr_snapshot_route* routes = ((struct sr_snapshot_route*)(topo + hdr->topo_num));
+    struct sr_snapshot_arp* arp = ((struct sr_snapshot_arp*)(routes + hdr->route_num));
+
+    /* -- the interfaces must be the ones the snapshot was taken of -- */
+    struct sr_if** iface_map = ((struct sr_if**)(calloc(hdr->iface_num + 1, sizeof(struct sr_if*))));
+    for (unsigned int i = 0; i < hdr->iface_num; i++)
+    {
+        char name[sr_IFACE_NAMELEN + 1];
+        memcpy(name, ifaces[i].name, sr_IFACE_NAMELEN);
+        name[sr_IFACE_NAMELEN] = '\0';
+        iface_map[i] = sr_get_interface(sr, name);
+        if ((iface_map[i] == NULL) || (iface_map[i]->ip != ifaces[i].ip))
+        {
+            Log(LOG_OSPF, LOG_WARN, "Snapshot %s is of other interfaces, starting cold", sr->snapshot->path);
+            free(iface_map);
+            return -1;
+        }
+    }
+
+    unsigned int neighbors = 0;
+    unsigned int entries = 0;
+    unsigned int route_num = 0;
+    unsigned int arp_num = 0;
+
+    pwospf_lock(subsys);
+
+    /* -- adjacencies, a route only keeps the next hops over these -- */
+    for (unsigned int i = 0; i < hdr->iface_num; i++)
+    {
+        if ((ifaces[i].neighbor_id == 0) || (ifaces[i].neighbor_left <= elapsed))
+        {
+            continue;
+        }
+
+        struct in_addr neighbor_id;
+        neighbor_id.s_addr = ifaces[i].neighbor_id;
+        struct in_addr neighbor_ip;
+        neighbor_ip.s_addr = ifaces[i].neighbor_ip;
+        struct ospfv2_neighbor* nbr = create_ospfv2_neighbor(neighbor_id, neighbor_ip);
+        nbr->expires = now + ifaces[i].neighbor_left - elapsed;
+        add_neighbor(subsys->first_neighbor, nbr);
+        iface_map[i]->neighbor_id = ifaces[i].neighbor_id;
+        iface_map[i]->neighbor_ip = ifaces[i].neighbor_ip;
+        neighbors++;
+    }
+
+    /* -- entries are added at the head, from the last to keep the order -- */
+    for (unsigned int i = hdr->topo_num; i > 0; i--)
+    {
+        struct sr_snapshot_topo* rec = &topo[i - 1];
+        uint64_t age = rec->age + elapsed;
+        if (age >= ((uint64_t)(OSPF_TOPO_ENTRY_TIMEOUT)) * 1000)
+        {
+            continue;
+        }
+
+        struct in_addr router_id;     router_id.s_addr = rec->router_id;
+        struct in_addr net_num;       net_num.s_addr = rec->net_num;
+        struct in_addr net_mask;      net_mask.s_addr = rec->net_mask;
+        struct in_addr neighbor_id;   neighbor_id.s_addr = rec->neighbor_id;
+        struct in_addr next_hop;      next_hop.s_addr = rec->next_hop;
+        struct ospfv2_topology_entry* entry = create_ospfv2_topology_entry(router_id, net_num, net_mask, neighbor_id, next_hop,
+            rec->sequence_num);
+        entry->refreshed = (now > age) ? (now - age) : 0;
+        add_topology_entry(subsys->first_topology_entry, entry);
+        entries++;
+    }
+
+    /* -- our next LSU must not look like one the others already have: we
+     *    may have originated once every OSPF_MIN_LSU_INTERVAL since the
+     *    snapshot was written -- */
+    subsys->sequence_num = hdr->sequence_num + (elapsed / (OSPF_MIN_LSU_INTERVAL * 1000)) + 1;
+
+    pwospf_unlock(subsys);
+
+    for (unsigned int i = 0; i < hdr->route_num; i++)
+    {
+        struct sr_snapshot_route* rec = &routes[i];
+        struct in_addr dest;    dest.s_addr = rec->dest;
+        struct in_addr mask;    mask.s_addr = rec->mask;
+        if (check_route(sr, dest) != 0)
+        {
+            continue;
+        }
+
+        struct sr_rt* route = NULL;
+        for (int n = 0; (n < rec->nexthop_num) && (n < SR_RT_MAX_NEXTHOPS); n++)
+        {
+            if (rec->nexthop[n].iface >= hdr->iface_num)
+            {
+                continue;
+            }
+            struct sr_if* iface = iface_map[rec->nexthop[n].iface];
+            if ((iface->neighbor_id == 0) || (iface->neighbor_ip != rec->nexthop[n].gw))
+            {
+                continue;
+            }
+
+            struct in_addr gw;
+            gw.s_addr = rec->nexthop[n].gw;
+            if (route == NULL)
+            {
+                route = sr_add_rt_entry(sr, dest, gw, mask, iface->name, rec->admin_dst);
+                route_num++;
+            }
+            else
+            {
+                sr_add_rt_nexthop(route, gw, iface->name);
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < hdr->arp_num; i++)
+    {
+        if (arp[i].left <= elapsed)
+        {
+            continue;
+        }
+        unsigned char mac[ETHER_ADDR_LEN];
+        memcpy(mac, arp[i].mac, ETHER_ADDR_LEN);
+        cache_push(sr->arp_cache, cache_create_item(arp[i].ip, mac, now + arp[i].left - elapsed));
+        arp_num++;
+    }
+    free(iface_map);
+
+    /* -- the timers find out when what was restored expires -- */
+    sr_timer_add(sr, &subsys->neighbor_timer, 0);
+    sr_timer_add(sr, &subsys->topology_timer, 0);
+    sr_timer_add(sr, &sr->arp_cache_timer, 0);
+
+    Log(LOG_OSPF, LOG_INFO, "Warm restart from %s, %d ms old: %u adjacencies, %u LSDB entries, %u routes, %u ARP entries",
+        sr->snapshot->path, ((int)(elapsed)), neighbors, entries, route_num, arp_num);
+    return 0;
+} /* -- snapshot_restore -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_snapshot_start
+ *
+ * Restores the snapshot if there is a usable one, then starts taking
+ * them. Called from sr_init() and once the hardware information is in,
+ * does nothing until both are done.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_snapshot_start(struct sr_instance* sr)
+{
+    struct sr_snapshot* snapshot = sr->snapshot;
+    if (!sr->hw_init || (sr->ospf_subsys == NULL) || snapshot->started)
+    {
+        return;
+    }
+    snapshot->started = 1;
+
+    size_t size;
+    struct sr_snapshot_hdr* hdr = snapshot_map(snapshot->path, &size);
+    if (hdr != NULL)
+    {
+        if (snapshot_restore(sr, hdr) == 0)
+        {
+            /* -- the interfaces are up, no need to wait for them -- */
+            sr_timer_add(sr, &sr->ospf_subsys->start_timer, 0);
+        }
+        munmap(hdr, size);
+    }
+
+    sr_timer_add(sr, &snapshot->timer, SNAPSHOT_INTERVAL_MS);
+} /* -- sr_snapshot_start -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_snapshot_destroy
+ *
+ * Takes a last snapshot, once the event loop is done.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_snapshot_destroy(struct sr_instance* sr)
+{
+    struct sr_snapshot* snapshot = sr->snapshot;
+    sr_timer_cancel(sr, &snapshot->timer);
+    if (sr->ospf_subsys != NULL)
+    {
+        sr_snapshot_save(sr);
+    }
+    free(snapshot);
+    sr->snapshot = NULL;
+} /* -- sr_snapshot_destroy -- */
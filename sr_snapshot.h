@@ -0,0 +1,119 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_snapshot.h
+ *
+ * Description:
+ *
+ * Warm restart of a router from a snapshot of its state (-W file). A
+ * router started cold waits OSPF_START_DELAY for its first hello, then
+ * for the LSUs of the others before it has routes, and the first packet
+ * to every next hop waits on ARP. Every SNAPSHOT_INTERVAL_MS, and once
+ * more when the router shuts down, the event loop writes the adjacencies,
+ * the LSDB, the routes computed from it and the ARP cache to the file.
+ *
+ * Once the router is initialized and knows its interfaces (sr_init() and
+ * the hardware information, in either order) the file is mapped and taken
+ * as provisional state, aged by the time since it was written: what would
+ * have expired in between is left out, the rest expires when it would have
+ * and is refreshed or withdrawn by the hellos and LSUs as usual. A route
+ * keeps only the next hops whose adjacency was restored. The sequence
+ * number of our LSUs moves past the ones we may have sent after the
+ * snapshot. OSPF then starts right away instead of after
+ * OSPF_START_DELAY. A snapshot of other interfaces, older than
+ * OSPF_TOPO_ENTRY_TIMEOUT or damaged is ignored.
+ *
+ * The file is a header followed by arrays of fixed size records, in this
+ * order: interfaces, LSDB entries, routes and ARP entries. Integers are in
+ * host order, addresses in network order. It is written to file.tmp and
+ * renamed, so a crash leaves the previous snapshot whole.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SNAPSHOT_H
+#define SR_SNAPSHOT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include "sr_protocol.h"
+#include "sr_event.h"
+#include "sr_rt.h"
+
+#define SNAPSHOT_MAGIC 0x53525753       /* "SRWS" */
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_INTERVAL_MS 5000
+
+struct sr_instance;
+
+struct sr_snapshot_hdr
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t hdr_len;
+    uint64_t saved;             /* wall clock ms, records age from it */
+    uint32_t iface_num;
+    uint32_t topo_num;
+    uint32_t route_num;
+    uint32_t arp_num;
+    uint16_t sequence_num;      /* of the last LSU we originated */
+    uint16_t sum;               /* calc_cksum() of the records */
+    uint32_t pad;
+}__attribute__ ((packed));
+
+struct sr_snapshot_iface
+{
+    char name[sr_IFACE_NAMELEN];
+    uint32_t ip;
+    uint32_t neighbor_id;       /* 0 for no adjacency */
+    uint32_t neighbor_ip;
+    uint32_t neighbor_left;     /* ms until the neighbor would have been dead */
+}__attribute__ ((packed));
+
+struct sr_snapshot_topo
+{
+    uint32_t router_id;
+    uint32_t net_num;
+    uint32_t net_mask;
+    uint32_t neighbor_id;
+    uint32_t next_hop;
+    uint32_t age;               /* ms since the last LSU */
+    uint16_t sequence_num;
+    uint16_t pad;
+}__attribute__ ((packed));
+
+struct sr_snapshot_route
+{
+    uint32_t dest;
+    uint32_t mask;
+    uint8_t admin_dst;
+    uint8_t nexthop_num;
+    uint16_t pad;
+    struct
+    {
+        uint32_t gw;
+        uint32_t iface;         /* index in the interface records */
+    } nexthop[SR_RT_MAX_NEXTHOPS];
+}__attribute__ ((packed));
+
+struct sr_snapshot_arp
+{
+    uint32_t ip;
+    uint32_t left;              /* ms until the entry would have expired */
+    uint8_t mac[ETHER_ADDR_LEN];
+    uint16_t pad;
+}__attribute__ ((packed));
+
+struct sr_snapshot
+{
+    char path[256];
+    struct sr_timer timer;
+    uint8_t started;
+    uint64_t saves;             /* snapshots written */
+};
+
+struct sr_snapshot* sr_snapshot_create(const char*);
+void sr_snapshot_start(struct sr_instance*);
+int sr_snapshot_save(struct sr_instance*);
+void sr_snapshot_destroy(struct sr_instance*);
+
+#endif /* -- SR_SNAPSHOT_H -- */
@@ -0,0 +1,466 @@
+/**********************************************************************
+ * file:  sr_spf_bench.c
+ *
+ * Description:
+ *
+ * Control plane scale benchmark. Generates synthetic topologies of N
+ * routers (ring, grid, random graph, leaf-spine Clos), feeds the LSAs
+ * of every router but ours through refresh_topology_entry() as the
+ * LSU handler does, then runs run_dijkstra() once from router 0 (the
+ * first leaf for Clos). Reports the time to fill the topology table,
+ * the SPF wall time, its allocations, the LSDB and routing table sizes
+ * and the peak RSS of the case: each one runs in a process of its own,
+ * forked before anything of it is allocated.
+ *
+ * A topology stops growing once one of its cases takes more than the
+ * time budget, the following N would only take longer.
+ *
+ * Usage: sr_spf_bench [budget seconds] [N ...]
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_pwospf.h"
+#include "pwospf_topology.h"
+
+#define SPF_BENCH_MAX_SIZES 32
+
+/* -- sr_pwospf.c -- */
+
+static unsigned long malloc_calls = 0;
+static unsigned long long malloc_bytes = 0;
+
+
+/*---------------------------------------------------------------------
+ * Link time wrapper of malloc (-Wl,--wrap=malloc), counts the
+ * allocations and the requested bytes.
+ *---------------------------------------------------------------------*/
+
+extern "C" void* __real_malloc(size_t);
+
+extern "C" void* __wrap_malloc(size_t size)
+{
+    malloc_calls++;
+    malloc_bytes += size;
+    return __real_malloc(size);
+}
+
+
+/*---------------------------------------------------------------------
+ * Stub of the VNS connection, nothing is sent during the benchmark
+ *---------------------------------------------------------------------*/
+
+int sr_send_packet(struct sr_instance* sr, uint8_t* buf, unsigned int len, const char* iface)
+{
+    return 0;
+}
+
+int sr_send_frame(struct sr_instance* sr, uint8_t* buf, unsigned int len, const char* iface)
+{
+    return 0;
+}
+
+
+static
+double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+
+/*---------------------------------------------------------------------
+ * Synthetic topology: point to point links, link k is the /31
+ * 10.0.0.0 + 2k with router a on the even address and router b on the
+ * odd one. Every router also has a stub network 11.0.0.0 + 2i.
+ *---------------------------------------------------------------------*/
+
+struct spf_link
+{
+    int a;
+    int b;
+};
+
+struct spf_topology
+{
+    int router_num;
+    int local;                  /* the router running the SPF */
+    int link_num;
+    int link_max;
+    struct spf_link* links;
+};
+
+static
+void add_link(struct spf_topology* topo, int a, int b)
+{
+    if (topo->link_num == topo->link_max)
+    {
+        topo->link_max = (topo->link_max == 0) ? 64 : topo->link_max * 2;
+        topo->links = ((spf_link*)(realloc(topo->links, sizeof(spf_link) * topo->link_max)));
+    }
+    topo->links[topo->link_num].a = a;
+    topo->links[topo->link_num].b = b;
+    topo->link_num++;
+}
+
+static
+uint32_t rid_of(int router)
+{
+    return htonl(0x01000001 + router);
+}
+
+static
+uint32_t link_ip(int link, int side)
+{
+    return htonl(0x0a000000 + (link << 1) + side);
+}
+
+
+static
+void gen_ring(struct spf_topology* topo, int n)
+{
+    topo->router_num = n;
+    for (int i = 0; i < n; i++)
+    {
+        add_link(topo, i, (i + 1) % n);
+    }
+}
+
+static
+void gen_grid(struct spf_topology* topo, int n)
+{
+    int side = ((int)(ceil(sqrt((double)(n)))));
+    topo->router_num = n;
+    for (int i = 0; i < n; i++)
+    {
+        if (((i % side) + 1 < side) && (i + 1 < n))
+        {
+            add_link(topo, i, i + 1);
+        }
+        if (i + side < n)
+        {
+            add_link(topo, i, i + side);
+        }
+    }
+}
+
+/* A random spanning tree plus as many random links, average degree 4 */
+static
+void gen_random(struct spf_topology* topo, int n)
+{
+    srand(n);
+    topo->router_num = n;
+    for (int i = 1; i < n; i++)
+    {
+        add_link(topo, i, rand() % i);
+    }
+    for (int i = 0; (i < n) && (n > 2); i++)
+    {
+        int a = rand() % n;
+        int b = rand() % n;
+        if (a != b)
+        {
+            add_link(topo, a, b);
+        }
+    }
+}
+
+/* Two tier leaf-spine, every leaf is linked to every spine */
+static
+void gen_clos(struct spf_topology* topo, int n)
+{
+    int spines = n / 16;
+    if (spines < 2)
+    {
+        spines = 2;
+    }
+    if (spines > 8)
+    {
+        spines = 8;
+    }
+
+    topo->router_num = n;
+    topo->local = spines;
+    for (int leaf = spines; leaf < n; leaf++)
+    {
+        for (int spine = 0; spine < spines; spine++)
+        {
+            add_link(topo, leaf, spine);
+        }
+    }
+}
+
+
+/*---------------------------------------------------------------------
+ * Method: build_router
+ *
+ * The local router gets one interface per link, with the neighbor
+ * already up, and its connected routes.
+ *
+ *---------------------------------------------------------------------*/
+
+static
+void build_router(struct sr_instance* sr, struct spf_topology* topo)
+{
+    memset(sr, 0, sizeof(struct sr_instance));
+    strcpy(sr->f_interface, "no");
+    sr->ecmp_width = DEFAULT_ECMP_WIDTH;
+    sr->ospf_subsys = ((pwospf_subsys*)(calloc(1, sizeof(pwospf_subsys))));
+    pthread_mutex_init(&(sr->ospf_subsys->lock), 0);
+
+    sr->ospf_subsys->router_id.s_addr = rid_of(topo->local);
+
+    struct in_addr dest, gw, mask;
+    mask.s_addr = htonl(0xfffffffe);
+    gw.s_addr = 0;
+    int if_num = 0;
+    for (int k = 0; k < topo->link_num; k++)
+    {
+        if ((topo->links[k].a != topo->local) && (topo->links[k].b != topo->local))
+        {
+            continue;
+        }
+
+        int side = (topo->links[k].a == topo->local) ? 0 : 1;
+        int other = (side == 0) ? topo->links[k].b : topo->links[k].a;
+        char name[sr_IFACE_NAMELEN];
+        snprintf(name, sizeof(name), "eth%d", if_num++);
+
+        sr_add_interface(sr, name);
+        sr_set_ether_ip(sr, link_ip(k, side));
+        sr_set_ether_mask(sr, mask.s_addr);
+        struct sr_if* iface = sr_get_interface(sr, name);
+        iface->neighbor_id = rid_of(other);
+        iface->neighbor_ip = link_ip(k, 1 - side);
+
+        dest.s_addr = link_ip(k, 0);
+        sr_add_rt_entry(sr, dest, gw, mask, name, 1);
+    }
+} /* -- build_router -- */
+
+static
+void free_router(struct sr_instance* sr)
+{
+    while (sr->routing_table != NULL)
+    {
+        struct sr_rt* entry = sr->routing_table;
+        sr->routing_table = entry->next;
+        free(entry);
+    }
+    while (sr->if_list != NULL)
+    {
+        struct sr_if* iface = sr->if_list;
+        sr->if_list = iface->next;
+        free(iface->packet_queue);
+        free(iface);
+    }
+    while (sr->ospf_subsys->first_topology_entry != NULL)
+    {
+        struct ospfv2_topology_entry* entry = sr->ospf_subsys->first_topology_entry;
+        sr->ospf_subsys->first_topology_entry = entry->next;
+        free(entry);
+    }
+
+    pthread_mutex_destroy(&(sr->ospf_subsys->lock));
+    free(sr->ospf_subsys);
+} /* -- free_router -- */
+
+
+/*---------------------------------------------------------------------
+ * Method: feed_lsdb
+ *
+ * The LSAs every other router would send in its LSU: its links with
+ * the neighbor on the other end, and its stub network.
+ *
+ *---------------------------------------------------------------------*/
+
+static
+void feed_lsdb(struct sr_instance* sr, struct spf_topology* topo)
+{
+    struct in_addr zero;
+    zero.s_addr = 0;
+    sr->ospf_subsys->first_topology_entry = create_ospfv2_topology_entry(zero, zero, zero, zero, zero, 0);
+
+    struct in_addr rid, net, mask, neighbor, next_hop;
+    mask.s_addr = htonl(0xfffffffe);
+    for (int k = 0; k < topo->link_num; k++)
+    {
+        for (int side = 0; side < 2; side++)
+        {
+            int router = (side == 0) ? topo->links[k].a : topo->links[k].b;
+            int other = (side == 0) ? topo->links[k].b : topo->links[k].a;
+            if (router == topo->local)
+            {
+                continue;
+            }
+
+            rid.s_addr = rid_of(router);
+            net.s_addr = link_ip(k, 0);
+            neighbor.s_addr = rid_of(other);
+            next_hop.s_addr = link_ip(k, side);
+            refresh_topology_entry(sr->ospf_subsys->first_topology_entry, rid, net, mask, neighbor, next_hop, 1);
+        }
+    }
+    for (int i = 0; i < topo->router_num; i++)
+    {
+        if (i != topo->local)
+        {
+            rid.s_addr = rid_of(i);
+            net.s_addr = htonl(0x0b000000 + (i << 1));
+            refresh_topology_entry(sr->ospf_subsys->first_topology_entry, rid, net, mask, zero, zero, 1);
+        }
+    }
+} /* -- feed_lsdb -- */
+
+
+/*---------------------------------------------------------------------
+ * Method: bench_topology
+ *
+ * Returns the seconds spent, filling the topology table included.
+ *
+ *---------------------------------------------------------------------*/
+
+static
+double bench_topology(const char* name, void (*generate)(struct spf_topology*, int), int n)
+{
+    struct spf_topology topo;
+    memset(&topo, 0, sizeof(topo));
+    generate(&topo, n);
+
+    struct sr_instance sr;
+    build_router(&sr, &topo);
+
+    double start = now_sec();
+    feed_lsdb(&sr, &topo);
+    double feed = now_sec() - start;
+
+    unsigned long lsdb_num = 0;
+    for (struct ospfv2_topology_entry* entry = sr.ospf_subsys->first_topology_entry->next; entry != NULL; entry = entry->next)
+    {
+        lsdb_num++;
+    }
+
+    struct dijkstra_param dij_param;
+    dij_param.sr = &sr;
+    dij_param.first_topology_entry = sr.ospf_subsys->first_topology_entry;
+    unsigned long mallocs = malloc_calls;
+    unsigned long long bytes = malloc_bytes;
+    double spf_start = now_sec();
+    run_dijkstra(&dij_param);
+    double spf = now_sec() - spf_start;
+    mallocs = malloc_calls - mallocs;
+    bytes = malloc_bytes - bytes;
+
+    unsigned long route_num = 0;
+    unsigned long ecmp_num = 0;
+    for (struct sr_rt* entry = sr.routing_table; entry != NULL; entry = entry->next)
+    {
+        route_num++;
+        ecmp_num += (entry->nexthop_num > 1);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%-7s %6d %7d %8lu %9.1f %10.3f %9.3f %10lu %9.1f %7lu %6lu %8ld\n", name, n, topo.link_num, lsdb_num,
+        lsdb_num * sizeof(ospfv2_topology_entry) / 1024.0, feed, spf, mallocs, bytes / 1048576.0, route_num, ecmp_num,
+        usage.ru_maxrss / 1024);
+    fflush(stdout);
+
+    free_router(&sr);
+    free(topo.links);
+
+    return now_sec() - start;
+} /* -- bench_topology -- */
+
+
+/*---------------------------------------------------------------------
+ * Method: bench_case
+ *
+ * Runs bench_topology() in a child process, so the peak RSS it reports
+ * is that of the case and not of the largest case run so far. Returns
+ * 1 if the case took more than the budget, or failed.
+ *
+ *---------------------------------------------------------------------*/
+
+static
+int bench_case(const char* name, void (*generate)(struct spf_topology*, int), int n, double budget)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0)
+    {
+        _exit((bench_topology(name, generate, n) > budget) ? 1 : 0);
+    }
+
+    int status;
+    if ((waitpid(pid, &status, 0) != pid) || !WIFEXITED(status))
+    {
+        printf("%-7s %6d failed\n", name, n);
+        return 1;
+    }
+    return WEXITSTATUS(status);
+} /* -- bench_case -- */
+
+
+int main(int argc, char** argv)
+{
+    double budget = 30.0;
+    int sizes[SPF_BENCH_MAX_SIZES] = {10, 50, 100, 200, 500, 1000, 2000, 5000};
+    int sizes_num = 8;
+
+    if (argc > 1)
+    {
+        budget = atof(argv[1]);
+    }
+    if (argc > 2)
+    {
+        sizes_num = 0;
+        for (int i = 2; (i < argc) && (sizes_num < SPF_BENCH_MAX_SIZES); i++)
+        {
+            sizes[sizes_num++] = atoi(argv[i]);
+        }
+    }
+
+    const char* names[] = {"ring", "grid", "random", "clos"};
+    void (*generators[])(struct spf_topology*, int) = {gen_ring, gen_grid, gen_random, gen_clos};
+
+    printf("%-7s %6s %7s %8s %9s %10s %9s %10s %9s %7s %6s %8s\n", "topo", "N", "links", "lsdb", "lsdb KiB",
+        "feed s", "spf s", "spf allocs", "spf MiB", "routes", "ecmp", "rss MiB");
+    for (int t = 0; t < 4; t++)
+    {
+        for (int i = 0; i < sizes_num; i++)
+        {
+            if (bench_case(names[t], generators[t], sizes[i], budget) != 0)
+            {
+                if (i + 1 < sizes_num)
+                {
+                    printf("%-7s stopping, over the %.0f s budget\n", names[t], budget);
+                }
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
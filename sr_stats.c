@@ -0,0 +1,490 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.c
+ *
+ * Description:
+ *
+ * Counters and the local stats socket. A client connects to the Unix
+ * domain socket given with -S, optionally writes "json" or "text", and
+ * reads the counters back. Adding "reset" to the request clears the
+ * histograms once they are written, so each read covers one interval:
+ *
+ *   echo json | nc -U /tmp/sr.stats
+ *   echo text reset | nc -U /tmp/sr.stats
+ *
+ * "log <spec>" changes the log levels instead (see sr_log.c) and writes
+ * them back, "log" alone only writes them:
+ *
+ *   echo log fwd=debug | nc -U /tmp/sr.stats
+ *
+ * "trace on" and "trace off" pause and resume the -J trace. "acl" lists the
+ * -A rules with their hits, "acl reload" reads the rule file again.
+ * "sched" lists the output queues of the interfaces shaped with -Q.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+#include "sr_stats.h"
+#include "sr_log.h"
+#include "sr_trace.h"
+#include "sr_acl.h"
+#include "sr_sched.h"
+
+__thread int stats_shard_index = -1;
+
+static const char* stats_counter_names[STATS_COUNTER_NUM] =
+{
+    "drop_bad_cksum",
+    "drop_ttl_expired",
+    "drop_no_route",
+    "drop_arp_timeout",
+    "drop_queue_full",
+    "drop_not_for_us",
+    "drop_frag_needed",
+    "drop_acl",
+    "drop_sched",
+    "drop_copp_arp",
+    "drop_copp_icmp",
+    "drop_copp_hello",
+    "drop_copp_lsu",
+    "drop_copp_local",
+    "ospf_hello_rx",
+    "ospf_hello_tx",
+    "ospf_lsu_rx",
+    "ospf_lsu_tx",
+    "spf_runs",
+    "arp_hit",
+    "arp_miss",
+    "capture_drops",
+    "io_syscalls",
+    "shm_full",
+    "icmp_limited",
+    "ip_fragments",
+    "timer_wakeups",
+    "flows_created",
+    "flows_evicted",
+    "flows_exported",
+    "flow_export_drops"
+};
+
+static const char* stats_if_counter_names[STATS_IF_COUNTER_NUM] =
+{
+    "rx_packets",
+    "rx_bytes",
+    "tx_packets",
+    "tx_bytes"
+};
+
+static const char* stats_hist_names[HIST_NUM] =
+{
+    "spf_run",
+    "lsu_to_fib",
+    "arp_resolve",
+    "arp_queue",
+    "sched_queue"
+};
+
+static const double stats_percentiles[] = {50, 90, 99, 99.9};
+#define STATS_PERCENTILE_NUM 4
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_stats_init
+ *
+ * Allocates the counters, and serves them on a Unix domain socket at
+ * path unless path is NULL. Returns 0 on success.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_stats_init(struct sr_instance* sr, const char* path)
+{
+    assert(sr);
+
+    void* mem;
+    if (posix_memalign(&mem, STATS_CACHE_LINE, sizeof(struct sr_stats)) != 0)
+    {
+        return -1;
+    }
+    sr->stats = ((struct sr_stats*)(mem));
+    memset(sr->stats, 0, sizeof(struct sr_stats));
+    sr->stats->sockfd = -1;
+
+    if (path == NULL)
+    {
+        return 0;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    strncpy(sr->stats->path, path, sizeof(sr->stats->path) - 1);
+
+    sr->stats->sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if ((sr->stats->sockfd < 0) ||
+        (bind(sr->stats->sockfd, ((struct sockaddr*)(&addr)), sizeof(addr)) < 0) ||
+        (listen(sr->stats->sockfd, 4) < 0))
+    {
+        perror("stats socket");
+        return -1;
+    }
+
+    pthread_create(&sr->stats->thread, NULL, sr_stats_thread, sr);
+
+    return 0;
+} /* -- sr_stats_init -- */
+
+/* Closes the stats socket. The counters stay allocated, the other
+ * threads may still be counting while the process exits. */
+void sr_stats_destroy(struct sr_instance* sr)
+{
+    if ((sr->stats != NULL) && (sr->stats->sockfd >= 0))
+    {
+        shutdown(sr->stats->sockfd, SHUT_RDWR);
+        close(sr->stats->sockfd);
+        unlink(sr->stats->path);
+        sr->stats->sockfd = -1;
+    }
+} /* -- sr_stats_destroy -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_stats_get
+ *
+ * Sums a counter over all the shards
+ *
+ *---------------------------------------------------------------------------*/
+
+uint64_t sr_stats_get(struct sr_instance* sr, enum sr_stats_counter counter)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < STATS_SHARDS; i++)
+    {
+        total += __atomic_load_n(&sr->stats->shards[i].counters[counter], __ATOMIC_RELAXED);
+    }
+    return total;
+} /* -- sr_stats_get -- */
+
+uint64_t sr_stats_if_get(struct sr_instance* sr, struct sr_if* iface, enum sr_stats_if_counter counter)
+{
+    uint64_t total = 0;
+    if (iface->index >= STATS_MAX_IFACES)
+    {
+        return 0;
+    }
+    for (int i = 0; i < STATS_SHARDS; i++)
+    {
+        total += __atomic_load_n(&sr->stats->shards[i].if_counters[iface->index][counter], __ATOMIC_RELAXED);
+    }
+    return total;
+} /* -- sr_stats_if_get -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_stats_hist_count
+ *
+ * Returns the number of values recorded in the histogram
+ *
+ *---------------------------------------------------------------------------*/
+
+uint64_t sr_stats_hist_count(struct sr_stats_histogram* hist)
+{
+    uint64_t count = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        count += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+    }
+    return count;
+} /* -- sr_stats_hist_count -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_stats_hist_percentile
+ *
+ * Returns the highest value of the bucket holding the percentile, in ns
+ *
+ *---------------------------------------------------------------------------*/
+
+uint64_t sr_stats_hist_percentile(struct sr_stats_histogram* hist, double percentile)
+{
+    uint64_t count = sr_stats_hist_count(hist);
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = ((uint64_t)((percentile / 100.0) * count + 0.5));
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= rank)
+        {
+            if (i < HIST_SUB_BUCKETS)
+            {
+                return i;
+            }
+            unsigned int exp = (i / HIST_SUB_BUCKETS) + HIST_SUB_BITS - 1;
+            uint64_t low = ((uint64_t)(HIST_SUB_BUCKETS + (i % HIST_SUB_BUCKETS))) << (exp - HIST_SUB_BITS);
+            uint64_t high = low + (1ULL << (exp - HIST_SUB_BITS)) - 1;
+            uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+            return (high < max) ? high : max;
+        }
+    }
+    return __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+} /* -- sr_stats_hist_percentile -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_stats_hist_reset
+ *
+ * Starts a new interval. Values recorded while the buckets are being
+ * cleared may be lost.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_stats_hist_reset(struct sr_instance* sr)
+{
+    for (int h = 0; h < HIST_NUM; h++)
+    {
+        struct sr_stats_histogram* hist = &sr->stats->hists[h];
+        for (int i = 0; i < HIST_BUCKETS; i++)
+        {
+            __atomic_store_n(&hist->buckets[i], 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&hist->sum, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&hist->max, 0, __ATOMIC_RELAXED);
+    }
+} /* -- sr_stats_hist_reset -- */
+
+
+void stats_printf(struct stats_buf* buf, const char* format, ...)
+{
+    va_list args;
+    while (1)
+    {
+        va_start(args, format);
+        int n = vsnprintf(buf->data + buf->len, buf->size - buf->len, format, args);
+        va_end(args);
+        if ((n >= 0) && (buf->len + n < buf->size))
+        {
+            buf->len += n;
+            return;
+        }
+        buf->size *= 2;
+        buf->data = ((char*)(realloc(buf->data, buf->size)));
+    }
+}
+
+static
+void stats_format(struct sr_instance* sr, struct stats_buf* buf, uint8_t json)
+{
+    if (json)
+    {
+        stats_printf(buf, "{\"router\": \"%s\", \"interfaces\": {", sr->host);
+    }
+
+    for (struct sr_if* iface = sr->if_list; iface != NULL; iface = iface->next)
+    {
+        if (json)
+        {
+            stats_printf(buf, "%s\"%s\": {", (iface == sr->if_list) ? "" : ", ", iface->name);
+        }
+        for (int i = 0; i < STATS_IF_COUNTER_NUM; i++)
+        {
+            uint64_t value = sr_stats_if_get(sr, iface, ((enum sr_stats_if_counter)(i)));
+            if (json)
+            {
+                stats_printf(buf, "%s\"%s\": %llu", (i == 0) ? "" : ", ", stats_if_counter_names[i],
+                    ((unsigned long long)(value)));
+            }
+            else
+            {
+                stats_printf(buf, "%s.%s %llu\n", iface->name, stats_if_counter_names[i], ((unsigned long long)(value)));
+            }
+        }
+        if (json)
+        {
+            stats_printf(buf, "}");
+        }
+    }
+
+    if (json)
+    {
+        stats_printf(buf, "}, \"counters\": {");
+    }
+    for (int i = 0; i < STATS_COUNTER_NUM; i++)
+    {
+        uint64_t value = sr_stats_get(sr, ((enum sr_stats_counter)(i)));
+        if (json)
+        {
+            stats_printf(buf, "%s\"%s\": %llu", (i == 0) ? "" : ", ", stats_counter_names[i],
+                ((unsigned long long)(value)));
+        }
+        else
+        {
+            stats_printf(buf, "%s %llu\n", stats_counter_names[i], ((unsigned long long)(value)));
+        }
+    }
+
+    /* -- histograms, in us -- */
+    if (json)
+    {
+        stats_printf(buf, "}, \"histograms\": {");
+    }
+    for (int h = 0; h < HIST_NUM; h++)
+    {
+        struct sr_stats_histogram* hist = &sr->stats->hists[h];
+        uint64_t count = sr_stats_hist_count(hist);
+        double mean = (count > 0) ? __atomic_load_n(&hist->sum, __ATOMIC_RELAXED) / 1000.0 / count : 0;
+        double max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED) / 1000.0;
+
+        if (json)
+        {
+            stats_printf(buf, "%s\"%s\": {\"count\": %llu, \"mean_us\": %.3f", (h == 0) ? "" : ", ", stats_hist_names[h],
+                ((unsigned long long)(count)), mean);
+        }
+        else
+        {
+            stats_printf(buf, "%s_us count %llu mean %.3f", stats_hist_names[h], ((unsigned long long)(count)), mean);
+        }
+        for (int i = 0; i < STATS_PERCENTILE_NUM; i++)
+        {
+            double value = sr_stats_hist_percentile(hist, stats_percentiles[i]) / 1000.0;
+            if (json)
+            {
+                stats_printf(buf, ", \"p%g_us\": %.3f", stats_percentiles[i], value);
+            }
+            else
+            {
+                stats_printf(buf, " p%g %.3f", stats_percentiles[i], value);
+            }
+        }
+        if (json)
+        {
+            stats_printf(buf, ", \"max_us\": %.3f}", max);
+        }
+        else
+        {
+            stats_printf(buf, " max %.3f\n", max);
+        }
+    }
+    if (json)
+    {
+        stats_printf(buf, "}}\n");
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_stats_thread
+ *
+ * Serves one client at a time, the request is optional so a plain
+ * connect-and-read gets the text format.
+ *
+ *---------------------------------------------------------------------------*/
+
+void* sr_stats_thread(void* arg)
+{
+    struct sr_instance* sr = ((struct sr_instance*)(arg));
+    struct stats_buf buf;
+    buf.size = 4096;
+    buf.data = ((char*)(malloc(buf.size)));
+
+    while (1)
+    {
+        int fd = accept(sr->stats->sockfd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        struct timeval timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 200000;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        char request[64];
+        ssize_t n = read(fd, request, sizeof(request) - 1);
+        request[(n > 0) ? n : 0] = '\0';
+
+        buf.len = 0;
+        if (strncmp(request, "log", 3) == 0)
+        {
+            char* spec = request + 3;
+            spec += strspn(spec, " ");
+            spec[strcspn(spec, "\r\n")] = '\0';
+            if ((*spec != '\0') && (sr_log_set(spec) != 0))
+            {
+                stats_printf(&buf, "bad log spec: %s\n", spec);
+            }
+            char levels[128];
+            sr_log_get(levels, sizeof(levels));
+            stats_printf(&buf, "%s\n", levels);
+        }
+        else if (strncmp(request, "trace", 5) == 0)
+        {
+            sr_trace_set(strstr(request, "on") != NULL);
+            stats_printf(&buf, "trace %s\n", sr_trace_on ? "on" : "off");
+        }
+        else if (strncmp(request, "acl", 3) == 0)
+        {
+            if ((strstr(request, "reload") != NULL) && (sr_acl_reload(sr) != 0))
+            {
+                stats_printf(&buf, "cannot load %s, rules unchanged\n", (sr->acl_path != NULL) ? sr->acl_path : "(no -A)");
+            }
+            sr_acl_format(sr, &buf);
+        }
+        else if (strncmp(request, "sched", 5) == 0)
+        {
+            sr_sched_format(sr, &buf);
+        }
+        else
+        {
+            stats_format(sr, &buf, strncmp(request, "json", 4) == 0);
+            if (strstr(request, "reset") != NULL)
+            {
+                sr_stats_hist_reset(sr);
+            }
+        }
+
+        /* -- a client that hung up gets EPIPE, not a SIGPIPE ending the router -- */
+        unsigned int sent = 0;
+        while (sent < buf.len)
+        {
+            n = send(fd, buf.data + sent, buf.len - sent, MSG_NOSIGNAL);
+            if ((n < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                break;                  /* -- EPIPE or ECONNRESET, the client is gone -- */
+            }
+            sent += n;
+        }
+        close(fd);
+    }
+
+    free(buf.data);
+    return NULL;
+} /* -- sr_stats_thread -- */
@@ -0,0 +1,227 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.h
+ *
+ * Description:
+ *
+ * Packet and protocol counters. Every thread increments its own cache
+ * line padded shard with relaxed atomics, the shards are only summed up
+ * when somebody asks for them on the stats socket.
+ *
+ * Latency histograms for the control plane, log bucketed like HDR
+ * histograms: 16 linear sub-buckets per power of two, so a recorded
+ * value is off by at most 1/16 and recording is a couple of shifts and
+ * relaxed atomic adds.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_STATS_H
+#define SR_STATS_H
+
+#include <pthread.h>
+#include <time.h>
+
+#include "sr_if.h"
+#include "sr_router.h"
+
+#define STATS_SHARDS 16
+#define STATS_MAX_IFACES 16
+#define STATS_CACHE_LINE 64
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP 47    /* ~39 hours in ns */
+#define HIST_BUCKETS ((HIST_MAX_EXP - HIST_SUB_BITS + 2) * HIST_SUB_BUCKETS)
+
+enum sr_stats_counter
+{
+    STATS_DROP_BAD_CKSUM,
+    STATS_DROP_TTL_EXPIRED,
+    STATS_DROP_NO_ROUTE,
+    STATS_DROP_ARP_TIMEOUT,
+    STATS_DROP_QUEUE_FULL,
+    STATS_DROP_NOT_FOR_US,
+    STATS_DROP_FRAG_NEEDED, /* larger than the MTU out with DF set, ICMP fragmentation needed */
+    STATS_DROP_ACL,         /* denied by a -A rule, in or out */
+    STATS_DROP_SCHED,       /* output queue of a shaped interface full */
+    STATS_DROP_COPP_ARP,    /* punted to the router over the -P limits, in sr_copp_kind order */
+    STATS_DROP_COPP_ICMP,
+    STATS_DROP_COPP_HELLO,
+    STATS_DROP_COPP_LSU,
+    STATS_DROP_COPP_LOCAL,
+    STATS_OSPF_HELLO_RX,
+    STATS_OSPF_HELLO_TX,
+    STATS_OSPF_LSU_RX,
+    STATS_OSPF_LSU_TX,
+    STATS_SPF_RUNS,
+    STATS_ARP_HIT,
+    STATS_ARP_MISS,
+    STATS_CAPTURE_DROPS,    /* packets not written to the -l capture, ring full */
+    STATS_IO_SYSCALLS,      /* system calls on the server connection */
+    STATS_SHM_FULL,         /* packets to the server dropped, shared memory ring full */
+    STATS_ICMP_LIMITED,     /* ICMP errors suppressed by the -E limits */
+    STATS_IP_FRAGMENTS,     /* fragments sent of packets larger than the MTU out */
+    STATS_TIMER_WAKEUPS,    /* timerfd expirations of the event loop */
+    STATS_FLOWS_CREATED,    /* flows added to the -x flow table */
+    STATS_FLOWS_EVICTED,    /* flows exported early to make room for a new one */
+    STATS_FLOWS_EXPORTED,   /* flow records written or sent */
+    STATS_FLOW_EXPORT_DROPS, /* flow records lost, ring full or write failed */
+    STATS_COUNTER_NUM
+};
+
+enum sr_stats_if_counter
+{
+    STATS_IF_RX_PACKETS,
+    STATS_IF_RX_BYTES,
+    STATS_IF_TX_PACKETS,
+    STATS_IF_TX_BYTES,
+    STATS_IF_COUNTER_NUM
+};
+
+enum sr_stats_hist
+{
+    HIST_SPF_RUN,         /* run_dijkstra, topology to routing table */
+    HIST_LSU_TO_FIB,      /* LSU received to its routes installed */
+    HIST_ARP_RESOLVE,     /* ARP request sent to reply received */
+    HIST_ARP_QUEUE,       /* packet queued until sent or dropped */
+    HIST_SCHED_QUEUE,     /* frame held by the output queues of a shaped interface */
+    HIST_NUM
+};
+
+struct sr_stats_histogram
+{
+    uint64_t buckets[HIST_BUCKETS];
+    uint64_t sum;
+    uint64_t max;
+} __attribute__ ((aligned (STATS_CACHE_LINE)));
+
+struct sr_stats_shard
+{
+    uint64_t counters[STATS_COUNTER_NUM];
+    uint64_t if_counters[STATS_MAX_IFACES][STATS_IF_COUNTER_NUM];
+} __attribute__ ((aligned (STATS_CACHE_LINE)));
+
+struct sr_stats
+{
+    struct sr_stats_shard shards[STATS_SHARDS];
+    unsigned int next_shard;
+
+    /* -- in ns, shared by all threads -- */
+    struct sr_stats_histogram hists[HIST_NUM];
+
+    /* -- stats socket -- */
+    int sockfd;
+    char path[108];
+    pthread_t thread;
+};
+
+/* -- the shard of the calling thread, -1 until its first increment -- */
+extern __thread int stats_shard_index;
+
+static inline
+struct sr_stats_shard* sr_stats_shard(struct sr_stats* stats)
+{
+    if (stats_shard_index < 0)
+    {
+        stats_shard_index = __atomic_fetch_add(&stats->next_shard, 1, __ATOMIC_RELAXED) % STATS_SHARDS;
+    }
+    return &stats->shards[stats_shard_index];
+}
+
+static inline
+void sr_stats_inc(struct sr_instance* sr, enum sr_stats_counter counter)
+{
+    if (sr->stats != NULL)
+    {
+        __atomic_fetch_add(&sr_stats_shard(sr->stats)->counters[counter], 1, __ATOMIC_RELAXED);
+    }
+}
+
+static inline
+void sr_stats_add(struct sr_instance* sr, enum sr_stats_counter counter, uint64_t value)
+{
+    if ((sr->stats != NULL) && (value != 0))
+    {
+        __atomic_fetch_add(&sr_stats_shard(sr->stats)->counters[counter], value, __ATOMIC_RELAXED);
+    }
+}
+
+static inline
+void sr_stats_if_add(struct sr_instance* sr, struct sr_if* iface, enum sr_stats_if_counter packets, unsigned int len)
+{
+    if ((sr->stats != NULL) && (iface != NULL) && (iface->index < STATS_MAX_IFACES))
+    {
+        struct sr_stats_shard* shard = sr_stats_shard(sr->stats);
+        __atomic_fetch_add(&shard->if_counters[iface->index][packets], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&shard->if_counters[iface->index][packets + 1], len, __ATOMIC_RELAXED);
+    }
+}
+
+/* -- monotonic time in ns, for the histograms -- */
+static inline
+uint64_t sr_stats_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t)(ts.tv_sec)) * 1000000000ULL) + ts.tv_nsec;
+}
+
+static inline
+unsigned int sr_stats_hist_bucket(uint64_t value)
+{
+    if (value < HIST_SUB_BUCKETS)
+    {
+        return value;
+    }
+    unsigned int exp = 63 - __builtin_clzll(value);
+    if (exp > HIST_MAX_EXP)
+    {
+        return HIST_BUCKETS - 1;
+    }
+    return ((exp - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS) + ((value >> (exp - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+}
+
+static inline
+void sr_stats_record(struct sr_instance* sr, enum sr_stats_hist hist, uint64_t value)
+{
+    if (sr->stats == NULL)
+    {
+        return;
+    }
+    struct sr_stats_histogram* h = &sr->stats->hists[hist];
+    __atomic_fetch_add(&h->buckets[sr_stats_hist_bucket(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while ((value > max) && !__atomic_compare_exchange_n(&h->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* Records the time elapsed since start, a start of 0 means nothing to record */
+static inline
+void sr_stats_record_since(struct sr_instance* sr, enum sr_stats_hist hist, uint64_t start)
+{
+    if (start != 0)
+    {
+        sr_stats_record(sr, hist, sr_stats_now() - start);
+    }
+}
+
+/* -- reply being built for a stats client -- */
+struct stats_buf
+{
+    char* data;
+    unsigned int len;
+    unsigned int size;
+};
+
+void stats_printf(struct stats_buf*, const char*, ...);
+
+int sr_stats_init(struct sr_instance*, const char*);
+void sr_stats_destroy(struct sr_instance*);
+uint64_t sr_stats_get(struct sr_instance*, enum sr_stats_counter);
+uint64_t sr_stats_if_get(struct sr_instance*, struct sr_if*, enum sr_stats_if_counter);
+uint64_t sr_stats_hist_count(struct sr_stats_histogram*);
+uint64_t sr_stats_hist_percentile(struct sr_stats_histogram*, double);
+void sr_stats_hist_reset(struct sr_instance*);
+void* sr_stats_thread(void*);
+
+#endif /* -- SR_STATS_H -- */
@@ -0,0 +1,244 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_trace.c
+ *
+ * Description:
+ *
+ * Chrome trace event writer, see sr_trace.h. The file is a JSON array of
+ * events, closed by sr_trace_stop(); the trace viewers also load it when
+ * the router was killed before.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+
+#include "sr_trace.h"
+#include "sr_ring.h"
+#include "sr_log.h"
+
+#define TRACE_MAX_HOSTS 64
+
+volatile uint8_t sr_trace_on = 0;
+
+struct sr_trace_record
+{
+    uint64_t time;              /* ns, CLOCK_MONOTONIC */
+    const char* name;
+    const char* category;
+    const char* host;           /* sr_log_host, NULL for none */
+    uint32_t tid;
+    uint32_t id;
+    char phase;
+    char iface[TRACE_IFACE_LEN];
+};
+
+static struct sr_ring* trace_ring = NULL;
+static FILE* trace_file = NULL;
+static pthread_t trace_thread;
+static volatile uint8_t trace_stop = 0;
+static int trace_pid;
+static const char* trace_hosts[TRACE_MAX_HOSTS];   /* writer thread, tid is the index + 1 */
+static unsigned int trace_host_num = 0;
+
+static __thread uint32_t trace_tid = 0;
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_trace_init
+ *
+ * Opens the trace file, names the process after the router and turns
+ * tracing on. Returns 0 on success.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_trace_init(const char* path, const char* process_name)
+{
+    trace_file = fopen(path, "w");
+    if (trace_file == NULL)
+    {
+        return -1;
+    }
+    trace_ring = sr_ring_create(TRACE_RING_SLOTS, sizeof(struct sr_trace_record));
+    if (trace_ring == NULL)
+    {
+        fclose(trace_file);
+        return -1;
+    }
+    setvbuf(trace_file, NULL, _IOFBF, 65536);
+
+    trace_pid = getpid();
+    fprintf(trace_file, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"%s\"}}",
+        trace_pid, process_name);
+
+    pthread_create(&trace_thread, NULL, sr_trace_thread, NULL);
+    sr_trace_on = 1;
+
+    return 0;
+} /* -- sr_trace_init -- */
+
+/* Pauses or resumes the tracing started with sr_trace_init() */
+void sr_trace_set(uint8_t on)
+{
+    sr_trace_on = (on && (trace_ring != NULL) && !trace_stop);
+} /* -- sr_trace_set -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_trace_event
+ *
+ * Called through the Trace macros, only while tracing is on. Events are
+ * lost if the ring is full.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_trace_event(const char* name, const char* category, char phase, const char* iface, uint32_t id)
+{
+    struct sr_trace_record* record = ((struct sr_trace_record*)(sr_ring_reserve(trace_ring)));
+    if (record == NULL)
+    {
+        return;
+    }
+
+    if (trace_tid == 0)
+    {
+        trace_tid = syscall(SYS_gettid);
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    record->time = (((uint64_t)(ts.tv_sec)) * 1000000000ULL) + ts.tv_nsec;
+    record->name = name;
+    record->category = category;
+    record->host = sr_log_host;
+    record->tid = trace_tid;
+    record->id = id;
+    record->phase = phase;
+    record->iface[0] = '\0';
+    if (iface != NULL)
+    {
+        strncpy(record->iface, iface, TRACE_IFACE_LEN - 1);
+        record->iface[TRACE_IFACE_LEN - 1] = '\0';
+    }
+
+    sr_ring_commit(trace_ring, record);
+} /* -- sr_trace_event -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_trace_thread
+ *
+ * Writes the events out as JSON objects
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+uint32_t trace_host_tid(struct sr_trace_record* record)
+{
+    unsigned int i = 0;
+    while ((i < trace_host_num) && (trace_hosts[i] != record->host))
+    {
+        i++;
+    }
+    if (i == trace_host_num)
+    {
+        if (trace_host_num == TRACE_MAX_HOSTS)
+        {
+            return record->tid;
+        }
+        trace_hosts[trace_host_num++] = record->host;
+        fprintf(trace_file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            trace_pid, i + 1, record->host);
+    }
+    return i + 1;
+}
+
+static
+void trace_write(struct sr_trace_record* record)
+{
+    uint32_t tid = (record->host != NULL) ? trace_host_tid(record) : record->tid;
+    fprintf(trace_file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%u",
+        record->name, record->category, record->phase, ((unsigned long long)(record->time / 1000)),
+        ((unsigned int)(record->time % 1000)), trace_pid, tid);
+    if (record->phase == 'i')
+    {
+        fprintf(trace_file, ",\"s\":\"t\"");
+    }
+
+    if ((record->iface[0] != '\0') || (record->id != 0))
+    {
+        fprintf(trace_file, ",\"args\":{");
+        if (record->iface[0] != '\0')
+        {
+            fprintf(trace_file, "\"iface\":\"%s\"%s", record->iface, (record->id != 0) ? "," : "");
+        }
+        if (record->id != 0)
+        {
+            struct in_addr addr;
+            addr.s_addr = record->id;
+            fprintf(trace_file, "\"id\":\"%s\"", inet_ntoa(addr));
+        }
+        fprintf(trace_file, "}");
+    }
+    fprintf(trace_file, "}");
+}
+
+void* sr_trace_thread(void* arg)
+{
+    uint64_t drops = 0;
+
+    while (1)
+    {
+        struct sr_trace_record* record = ((struct sr_trace_record*)(sr_ring_peek(trace_ring)));
+        if (record != NULL)
+        {
+            trace_write(record);
+            sr_ring_release(trace_ring, record);
+            continue;
+        }
+
+        uint64_t ring_drops = __atomic_load_n(&trace_ring->drops, __ATOMIC_RELAXED);
+        if (ring_drops != drops)
+        {
+            fprintf(stderr, "sr_trace: %llu events dropped, ring full\n", ((unsigned long long)(ring_drops - drops)));
+            drops = ring_drops;
+        }
+        fflush(trace_file);
+        if (trace_stop)
+        {
+            break;
+        }
+        usleep(1000);
+    }
+
+    return NULL;
+} /* -- sr_trace_thread -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_trace_stop
+ *
+ * Writes the events left and closes the JSON array
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_trace_stop()
+{
+    if ((trace_ring == NULL) || trace_stop)
+    {
+        return;
+    }
+
+    /* -- the ring is left allocated, a thread may still be in an event -- */
+    sr_trace_on = 0;
+    trace_stop = 1;
+    pthread_join(trace_thread, NULL);
+
+    fprintf(trace_file, "\n]\n");
+    fclose(trace_file);
+} /* -- sr_trace_stop -- */
@@ -0,0 +1,58 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_trace.h
+ *
+ * Description:
+ *
+ * Timeline of the control plane events, written in the Chrome trace event
+ * format so a convergence episode can be opened in chrome://tracing or
+ * Perfetto. Started with -J file; every event goes through a lock-free
+ * ring to a writer thread, and while tracing is off an event costs one
+ * branch.
+ *
+ * The timestamps are CLOCK_MONOTONIC and the pid that of the router, so
+ * the traces of all the routers of a topology can be merged:
+ *
+ *   jq -s add vhost1.json vhost2.json vhost3.json > all.json
+ *
+ * A process running several routers (-v host1,host2,..) is one pid, the
+ * events of each router are then on a thread of their own named after
+ * it (sr_log_host).
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_TRACE_H
+#define SR_TRACE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _SOLARIS_
+#include </usr/include/sys/int_types.h>
+#endif /* SOLARIS */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif
+
+#define TRACE_RING_SLOTS 4096
+#define TRACE_IFACE_LEN 16
+
+extern volatile uint8_t sr_trace_on;
+
+/* -- name and category must be string literals, id an IPv4 address in
+ *    network byte order or 0, iface NULL for none -- */
+#define TraceBegin(name, category) \
+  do { if (sr_trace_on) sr_trace_event(name, category, 'B', NULL, 0); } while (0)
+#define TraceEnd(name, category) \
+  do { if (sr_trace_on) sr_trace_event(name, category, 'E', NULL, 0); } while (0)
+#define TraceInstant(name, category, iface, id) \
+  do { if (sr_trace_on) sr_trace_event(name, category, 'i', iface, id); } while (0)
+
+int sr_trace_init(const char*, const char*);
+void sr_trace_set(uint8_t);
+void sr_trace_event(const char*, const char*, char, const char*, uint32_t);
+void sr_trace_stop();
+void* sr_trace_thread(void*);
+
+#endif /* -- SR_TRACE_H -- */
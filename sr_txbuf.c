@@ -0,0 +1,173 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_txbuf.c
+ *
+ * Description:
+ *
+ * Coalesced writes of VNSPACKET commands, see sr_txbuf.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <netinet/in.h>
+
+#include "sr_txbuf.h"
+#include "vnscommand.h"
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txbuf_create
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_txbuf* sr_txbuf_create(int fd, unsigned int size)
+{
+    struct sr_txbuf* txbuf = ((struct sr_txbuf*)(calloc(1, sizeof(struct sr_txbuf))));
+    txbuf->buf = ((uint8_t*)(malloc(size)));
+    if (txbuf->buf == NULL)
+    {
+        free(txbuf);
+        return NULL;
+    }
+    txbuf->fd = fd;
+    txbuf->size = size;
+    pthread_mutex_init(&txbuf->lock, NULL);
+    return txbuf;
+} /* -- sr_txbuf_create -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: txbuf_write
+ *
+ * Writes len bytes whatever the short writes, counts the system calls in
+ * syscalls. Returns 0 or -1.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int txbuf_write(int fd, uint8_t* buf, unsigned int len, unsigned int* syscalls)
+{
+    unsigned int written = 0;
+    while (written < len)
+    {
+        int ret = write(fd, buf + written, len - written);
+        (*syscalls)++;
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+            { continue; }
+            return -1;
+        }
+        written += ret;
+    }
+    return 0;
+} /* -- txbuf_write -- */
+
+static
+void txbuf_header(c_packet_header* hdr, unsigned int total_len, const char* iface)
+{
+    hdr->mLen = htonl(total_len);
+    hdr->mType = htonl(VNSPACKET);
+    memset(hdr->mInterfaceName, 0, sizeof(hdr->mInterfaceName));
+    memcpy(hdr->mInterfaceName, iface, strnlen(iface, sizeof(hdr->mInterfaceName)));
+} /* -- txbuf_header -- */
+
+static
+int txbuf_flush_locked(struct sr_txbuf* txbuf, unsigned int* syscalls)
+{
+    if (txbuf->len == 0)
+    {
+        return 0;
+    }
+
+    int ret = txbuf_write(txbuf->fd, txbuf->buf, txbuf->len, syscalls);
+    txbuf->len = 0;
+    txbuf->frames = 0;
+    return ret;
+} /* -- txbuf_flush_locked -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txbuf_append
+ *
+ * Frames the packet as a VNSPACKET command behind the ones waiting,
+ * writing them first if it does not fit. Returns 1 if the buffer was
+ * empty, so the caller can start the deadline, 0 if not, -1 if a write
+ * failed.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_txbuf_append(struct sr_txbuf* txbuf, uint8_t* buf, unsigned int len, const char* iface, unsigned int* syscalls)
+{
+    unsigned int total_len = len + sizeof(c_packet_header);
+    int ret = 0;
+
+    pthread_mutex_lock(&txbuf->lock);
+
+    if (txbuf->len + total_len > txbuf->size)
+    {
+        ret = txbuf_flush_locked(txbuf, syscalls);
+    }
+
+    if (total_len > txbuf->size)
+    {
+        /* -- never the case with TXBUF_SIZE, the frame goes out alone -- */
+        c_packet_header hdr;
+        txbuf_header(&hdr, total_len, iface);
+        if ((ret == 0) && (txbuf_write(txbuf->fd, ((uint8_t*)(&hdr)), sizeof(hdr), syscalls) != 0))
+        {
+            ret = -1;
+        }
+        if ((ret == 0) && (txbuf_write(txbuf->fd, buf, len, syscalls) != 0))
+        {
+            ret = -1;
+        }
+        pthread_mutex_unlock(&txbuf->lock);
+        return ret;
+    }
+
+    txbuf_header(((c_packet_header*)(txbuf->buf + txbuf->len)), total_len, iface);
+    memcpy(txbuf->buf + txbuf->len + sizeof(c_packet_header), buf, len);
+
+    if ((ret == 0) && (txbuf->len == 0))
+    {
+        ret = 1;
+    }
+    txbuf->len += total_len;
+    txbuf->frames++;
+
+    pthread_mutex_unlock(&txbuf->lock);
+    return ret;
+} /* -- sr_txbuf_append -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txbuf_flush
+ *
+ * Writes the frames waiting, if any. Returns 0 or -1.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_txbuf_flush(struct sr_txbuf* txbuf, unsigned int* syscalls)
+{
+    pthread_mutex_lock(&txbuf->lock);
+    int ret = txbuf_flush_locked(txbuf, syscalls);
+    pthread_mutex_unlock(&txbuf->lock);
+    return ret;
+} /* -- sr_txbuf_flush -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txbuf_destroy
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_txbuf_destroy(struct sr_txbuf* txbuf)
+{
+    pthread_mutex_destroy(&txbuf->lock);
+    free(txbuf->buf);
+    free(txbuf);
+} /* -- sr_txbuf_destroy -- */
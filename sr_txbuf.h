@@ -0,0 +1,40 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_txbuf.h
+ *
+ * Description:
+ *
+ * Transmit coalescing on the connection to the VNS server (-b). Outgoing
+ * VNSPACKET commands are framed straight into one buffer per connection
+ * and go out together in a single write() when the buffer fills or is
+ * flushed. sr_vns_comm.c flushes it at the end of each batch of received
+ * commands, or once the oldest frame waited the deadline given with -b.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_TXBUF_H
+#define SR_TXBUF_H
+
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#define TXBUF_SIZE (64 * 1024)
+
+struct sr_txbuf
+{
+    int fd;
+    pthread_mutex_t lock;
+    uint8_t* buf;
+    unsigned int size;
+    unsigned int len;           /* bytes waiting */
+    unsigned int frames;        /* frames waiting */
+};
+
+struct sr_txbuf* sr_txbuf_create(int, unsigned int);
+int sr_txbuf_append(struct sr_txbuf*, uint8_t*, unsigned int, const char*, unsigned int*);
+int sr_txbuf_flush(struct sr_txbuf*, unsigned int*);
+void sr_txbuf_destroy(struct sr_txbuf*);
+
+#endif /* -- SR_TXBUF_H -- */
@@ -0,0 +1,625 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_uring.c
+ *
+ * Description:
+ *
+ * io_uring I/O on the connection to the VNS server, see sr_uring.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#include "sr_uring.h"
+#include "sr_router.h"
+#include "sr_stats.h"
+
+#include "vnscommand.h"
+
+#define URING_TAG_RECV 1
+#define URING_TAG_SEND 2
+#define URING_TAG_PROVIDE 3
+#define URING_TAG_EVENT 4
+
+static
+int uring_setup(unsigned entries, struct io_uring_params* p)
+{
+    return ((int)(syscall(__NR_io_uring_setup, entries, p)));
+}
+
+static
+int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return ((int)(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0)));
+}
+
+static
+int uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args)
+{
+    return ((int)(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args)));
+}
+
+
+/*-----------------------------------------------------------------------------
+ * Method: uring_get_sqe
+ *
+ * Next free submission entry, zeroed. Called with tx_lock held, the
+ * queue is never full: one recv, one write and the receive buffers are
+ * all there is to submit.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+struct io_uring_sqe* uring_get_sqe(struct sr_uring* ur)
+{
+    unsigned tail = *ur->sq_tail;
+    unsigned index = tail & *ur->sq_mask;
+    struct io_uring_sqe* sqe = &ur->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ur->sq_array[index] = index;
+    __atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ur->sq_pending++;
+
+    return sqe;
+} /* -- uring_get_sqe -- */
+
+static
+void uring_arm_recv(struct sr_uring* ur)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe(ur);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = 0;                            /* registered socket */
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = URING_RX_BGID;
+    sqe->user_data = URING_TAG_RECV;
+    ur->rx_armed = 1;
+} /* -- uring_arm_recv -- */
+
+static
+void uring_arm_event(struct sr_uring* ur, int epfd)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe(ur);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = epfd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = URING_TAG_EVENT;
+    ur->ev_armed = 1;
+} /* -- uring_arm_event -- */
+
+static
+void uring_provide(struct sr_uring* ur, uint16_t bid, unsigned int num)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe(ur);
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = num;
+    sqe->addr = ((uint64_t)(uintptr_t)(ur->rx_bufs + (bid * URING_RX_BUF_SIZE)));
+    sqe->len = URING_RX_BUF_SIZE;
+    sqe->off = bid;
+    sqe->buf_group = URING_RX_BGID;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = URING_TAG_PROVIDE;
+} /* -- uring_provide -- */
+
+static
+void uring_write(struct sr_uring* ur, unsigned int buf)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe(ur);
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = 0;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = ((uint64_t)(uintptr_t)(ur->tx_bufs[buf] + ur->tx_off));
+    sqe->len = ur->tx_len[buf] - ur->tx_off;
+    sqe->buf_index = buf;
+    sqe->user_data = URING_TAG_SEND;
+} /* -- uring_write -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: uring_tx_flush
+ *
+ * Puts the filled batch in flight if nothing is. Called with tx_lock
+ * held, the write still has to be submitted.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void uring_tx_flush(struct sr_uring* ur)
+{
+    if (ur->tx_busy || (ur->tx_len[ur->tx_fill] == 0))
+    {
+        return;
+    }
+
+    unsigned int buf = ur->tx_fill;
+    ur->tx_fill = 1 - buf;
+    ur->tx_off = 0;
+    ur->tx_busy = 1;
+    uring_write(ur, buf);
+} /* -- uring_tx_flush -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: uring_reap
+ *
+ * Empties the completion queue. Write completions are handled here, with
+ * tx_lock held; receive completions are set aside for the main loop,
+ * their commands may send packets.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void uring_reap(struct sr_uring* ur)
+{
+    unsigned head = *ur->cq_head;
+    unsigned tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+        struct io_uring_cqe* cqe = &ur->cqes[head & *ur->cq_mask];
+
+        if (cqe->user_data == URING_TAG_RECV)
+        {
+            if (ur->rx_cqe_tail - ur->rx_cqe_head >= (sizeof(ur->rx_cqes) / sizeof(ur->rx_cqes[0])))
+            {
+                break;
+            }
+            ur->rx_cqes[ur->rx_cqe_tail % (sizeof(ur->rx_cqes) / sizeof(ur->rx_cqes[0]))] = *cqe;
+            ur->rx_cqe_tail++;
+        }
+        else if (cqe->user_data == URING_TAG_EVENT)
+        {
+            ur->ev_armed = 0;
+            ur->ev_ready = 1;
+        }
+        else if (cqe->user_data == URING_TAG_PROVIDE)
+        {
+            fprintf(stderr, "Error providing receive buffers: %s\n", strerror(-cqe->res));
+        }
+        else if (cqe->user_data == URING_TAG_SEND)
+        {
+            unsigned int buf = 1 - ur->tx_fill;
+            if ((cqe->res == -EINTR) || (cqe->res == -EAGAIN))
+            {
+                uring_write(ur, buf);
+            }
+            else if (cqe->res <= 0)
+            {
+                fprintf(stderr, "Error writing packet: %s\n", strerror(-cqe->res));
+                ur->tx_error = 1;
+                ur->tx_busy = 0;
+                pthread_cond_broadcast(&ur->tx_done);
+            }
+            else if (ur->tx_off + cqe->res < ur->tx_len[buf])
+            {
+                /* -- short write, the rest goes out before anything else -- */
+                ur->tx_off += cqe->res;
+                uring_write(ur, buf);
+            }
+            else
+            {
+                ur->tx_len[buf] = 0;
+                ur->tx_busy = 0;
+                uring_tx_flush(ur);
+                pthread_cond_broadcast(&ur->tx_done);
+            }
+        }
+
+        head++;
+    }
+
+    __atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+} /* -- uring_reap -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: uring_submit
+ *
+ * Submits what is pending, optionally waiting for a completion. Called
+ * with tx_lock held, which is released for the wait.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int uring_submit(struct sr_instance* sr, int wait)
+{
+    struct sr_uring* ur = sr->uring;
+    unsigned int to_submit = ur->sq_pending;
+
+    if ((to_submit == 0) && (!wait))
+    {
+        return 0;
+    }
+    ur->sq_pending = 0;
+
+    if (wait)
+    {
+        pthread_mutex_unlock(&ur->tx_lock);
+    }
+    int ret = uring_enter(ur->fd, to_submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+    sr_stats_inc(sr, STATS_IO_SYSCALLS);
+    if (wait)
+    {
+        pthread_mutex_lock(&ur->tx_lock);
+    }
+
+    if ((ret < 0) && (errno != EINTR))
+    {
+        perror("io_uring_enter(..):sr_uring.c::uring_submit");
+        return -1;
+    }
+    return 0;
+} /* -- uring_submit -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_open
+ *
+ * Sets up the ring on sr->sockfd, once connected to the server
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_uring_open(struct sr_instance* sr)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    int fd = uring_setup(URING_ENTRIES, &p);
+    if (fd < 0)
+    {
+        perror("io_uring_setup(..):sr_uring.c::sr_uring_open");
+        return -1;
+    }
+
+    struct sr_uring* ur = ((struct sr_uring*)(calloc(1, sizeof(struct sr_uring))));
+    ur->fd = fd;
+    pthread_mutex_init(&ur->tx_lock, NULL);
+    pthread_cond_init(&ur->tx_done, NULL);
+    ur->loop_thread = pthread_self();
+    sr->uring = ur;
+
+    /* -- map the queues -- */
+    ur->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ur->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ur->cq_size > ur->sq_size)
+        {
+            ur->sq_size = ur->cq_size;
+        }
+        ur->cq_size = ur->sq_size;
+    }
+    ur->sq_ptr = mmap(NULL, ur->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ur->sq_ptr == MAP_FAILED)
+    {
+        perror("mmap(..):sr_uring.c::sr_uring_open");
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ur->cq_ptr = ur->sq_ptr;
+    }
+    else
+    {
+        ur->cq_ptr = mmap(NULL, ur->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ur->cq_ptr == MAP_FAILED)
+        {
+            perror("mmap(..):sr_uring.c::sr_uring_open");
+            return -1;
+        }
+    }
+    ur->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ur->sqes = ((struct io_uring_sqe*)(mmap(NULL, ur->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES)));
+    if (ur->sqes == MAP_FAILED)
+    {
+        perror("mmap(..):sr_uring.c::sr_uring_open");
+        return -1;
+    }
+
+    uint8_t* sq = ((uint8_t*)(ur->sq_ptr));
+    uint8_t* cq = ((uint8_t*)(ur->cq_ptr));
+    ur->sq_tail = ((unsigned*)(sq + p.sq_off.tail));
+    ur->sq_mask = ((unsigned*)(sq + p.sq_off.ring_mask));
+    ur->sq_array = ((unsigned*)(sq + p.sq_off.array));
+    ur->cq_head = ((unsigned*)(cq + p.cq_off.head));
+    ur->cq_tail = ((unsigned*)(cq + p.cq_off.tail));
+    ur->cq_mask = ((unsigned*)(cq + p.cq_off.ring_mask));
+    ur->cqes = ((struct io_uring_cqe*)(cq + p.cq_off.cqes));
+
+    /* -- the socket and the two batch buffers are registered once -- */
+    if (uring_register(fd, IORING_REGISTER_FILES, &sr->sockfd, 1) < 0)
+    {
+        perror("io_uring_register(FILES):sr_uring.c::sr_uring_open");
+        return -1;
+    }
+
+    struct iovec iov[2];
+    for (int i = 0; i < 2; i++)
+    {
+        void* mem;
+        if (posix_memalign(&mem, 4096, URING_TX_BATCH_SIZE) != 0)
+        {
+            return -1;
+        }
+        ur->tx_bufs[i] = ((uint8_t*)(mem));
+        iov[i].iov_base = mem;
+        iov[i].iov_len = URING_TX_BATCH_SIZE;
+    }
+    if (uring_register(fd, IORING_REGISTER_BUFFERS, iov, 2) < 0)
+    {
+        perror("io_uring_register(BUFFERS):sr_uring.c::sr_uring_open");
+        return -1;
+    }
+
+    /* -- receive buffers, provided with the first submission -- */
+    if (posix_memalign(((void**)(&ur->rx_bufs)), 4096, URING_RX_BUF_NUM * URING_RX_BUF_SIZE) != 0)
+    {
+        return -1;
+    }
+    uring_provide(ur, 0, URING_RX_BUF_NUM);
+
+    return 0;
+} /* -- sr_uring_open -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: uring_rx_stream
+ *
+ * Splits the bytes of one receive into commands. A command entirely in
+ * the buffer is handled in place, the bytes of one that continues in the
+ * next receive are kept in rx_partial.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int uring_rx_stream(struct sr_instance* sr, uint8_t* data, unsigned int n)
+{
+    struct sr_uring* ur = sr->uring;
+
+    while (n > 0)
+    {
+        uint8_t* cmd;
+        unsigned int len;
+
+        if ((ur->rx_partial_len == 0) && (n >= 4))
+        {
+            len = ntohl(*((uint32_t*)(data)));
+            if ((len > URING_RX_CMD_MAX) || (len < 8))
+            {
+                fprintf(stderr,"Error: command length to large %d\n",len);
+                return -1;
+            }
+            if (len > n)
+            {
+                memcpy(ur->rx_partial, data, n);
+                ur->rx_partial_len = n;
+                return 1;
+            }
+            cmd = data;
+            data += len;
+            n -= len;
+        }
+        else
+        {
+            /* -- the length first, then the rest of the command -- */
+            unsigned int take;
+            if (ur->rx_partial_len < 4)
+            {
+                take = (4 - ur->rx_partial_len < n) ? 4 - ur->rx_partial_len : n;
+                memcpy(ur->rx_partial + ur->rx_partial_len, data, take);
+                ur->rx_partial_len += take;
+                data += take;
+                n -= take;
+                if (ur->rx_partial_len < 4)
+                {
+                    return 1;
+                }
+            }
+            len = ntohl(*((uint32_t*)(ur->rx_partial)));
+            if ((len > URING_RX_CMD_MAX) || (len < 8))
+            {
+                fprintf(stderr,"Error: command length to large %d\n",len);
+                return -1;
+            }
+            take = (len - ur->rx_partial_len < n) ? len - ur->rx_partial_len : n;
+            memcpy(ur->rx_partial + ur->rx_partial_len, data, take);
+            ur->rx_partial_len += take;
+            data += take;
+            n -= take;
+            if (ur->rx_partial_len < len)
+            {
+                return 1;
+            }
+            cmd = ur->rx_partial;
+            ur->rx_partial_len = 0;
+        }
+
+        if (sr_handle_command(sr, cmd, len) == 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+} /* -- uring_rx_stream -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_read
+ *
+ * One turn of the main loop: submits the pending write (and the receive
+ * and event loop poll if they have to be armed again), waits for
+ * completions, runs the event loop if it is ready and handles the
+ * received commands. Returns as sr_read_from_server().
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_uring_read(struct sr_instance* sr)
+{
+    struct sr_uring* ur = sr->uring;
+
+    pthread_mutex_lock(&ur->tx_lock);
+    uring_tx_flush(ur);
+    for (unsigned int i = 0; i < ur->rx_free_num; i++)
+    {
+        uring_provide(ur, ur->rx_free[i], 1);
+    }
+    ur->rx_free_num = 0;
+    if (!ur->rx_armed)
+    {
+        uring_arm_recv(ur);
+    }
+    if (!ur->ev_armed && !ur->ev_ready)
+    {
+        uring_arm_event(ur, sr->loop->epfd);
+    }
+    /* -- receives set aside while waiting in sr_uring_send come first -- */
+    if (uring_submit(sr, ((ur->rx_cqe_head == ur->rx_cqe_tail) && !ur->ev_ready)) != 0)
+    {
+        pthread_mutex_unlock(&ur->tx_lock);
+        return -1;
+    }
+    uring_reap(ur);
+    pthread_mutex_unlock(&ur->tx_lock);
+
+    /* -- timers due, nothing else is registered with the loop -- */
+    if (ur->ev_ready)
+    {
+        ur->ev_ready = 0;
+        int ret = sr_event_dispatch(sr, 0);
+        if (ret != 1)
+        {
+            return ret;
+        }
+    }
+
+    while (ur->rx_cqe_head != ur->rx_cqe_tail)
+    {
+        struct io_uring_cqe cqe = ur->rx_cqes[ur->rx_cqe_head % (sizeof(ur->rx_cqes) / sizeof(ur->rx_cqes[0]))];
+        ur->rx_cqe_head++;
+
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+        {
+            ur->rx_armed = 0;
+        }
+
+        if (cqe.res == -ENOBUFS)
+        {
+            continue;       /* -- every buffer in use, armed again on the next turn -- */
+        }
+        if (cqe.res < 0)
+        {
+            fprintf(stderr, "Error: recv(..):sr_uring.c::sr_uring_read: %s\n", strerror(-cqe.res));
+            return -1;
+        }
+        if (cqe.res == 0)
+        {
+            fprintf(stderr,"vns server closed the connection.\n");
+            return 0;
+        }
+
+        uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        int ret = uring_rx_stream(sr, ur->rx_bufs + (bid * URING_RX_BUF_SIZE), cqe.res);
+        ur->rx_free[ur->rx_free_num++] = bid;
+        if (ret != 1)
+        {
+            return ret;
+        }
+    }
+
+    return 1;
+} /* -- sr_uring_read -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_send
+ *
+ * Appends a VNS packet command to the batch being filled. Frames sent
+ * from the main loop go out when it next waits; other threads submit
+ * themselves when no write is in flight. When the batch is full the
+ * sender waits for the write in flight.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_uring_send(struct sr_instance* sr, uint8_t* buf, unsigned int len, const char* iface)
+{
+    struct sr_uring* ur = sr->uring;
+    unsigned int total_len = len + sizeof(c_packet_header);
+    int loop = pthread_equal(pthread_self(), ur->loop_thread);
+
+    pthread_mutex_lock(&ur->tx_lock);
+
+    while ((ur->tx_len[ur->tx_fill] + total_len > URING_TX_BATCH_SIZE) && (!ur->tx_error))
+    {
+        uring_tx_flush(ur);
+        if (loop)
+        {
+            /* -- nobody else reaps, wait in place and set receives aside -- */
+            if (uring_submit(sr, 1) != 0)
+            {
+                break;
+            }
+            uring_reap(ur);
+        }
+        else
+        {
+            uring_submit(sr, 0);
+            pthread_cond_wait(&ur->tx_done, &ur->tx_lock);
+        }
+    }
+    if (ur->tx_error)
+    {
+        pthread_mutex_unlock(&ur->tx_lock);
+        return -1;
+    }
+
+    c_packet_header* sr_pkt = ((c_packet_header*)(ur->tx_bufs[ur->tx_fill] + ur->tx_len[ur->tx_fill]));
+    sr_pkt->mLen  = htonl(total_len);
+    sr_pkt->mType = htonl(VNSPACKET);
+    strncpy(sr_pkt->mInterfaceName,iface,16);
+    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header), buf, len);
+    ur->tx_len[ur->tx_fill] += total_len;
+
+    if (!loop)
+    {
+        uring_tx_flush(ur);
+        uring_submit(sr, 0);
+    }
+
+    pthread_mutex_unlock(&ur->tx_lock);
+    return 0;
+} /* -- sr_uring_send -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_close
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_uring_close(struct sr_instance* sr)
+{
+    struct sr_uring* ur = sr->uring;
+
+    close(ur->fd);
+    munmap(ur->sqes, ur->sqes_size);
+    if (ur->cq_ptr != ur->sq_ptr)
+    {
+        munmap(ur->cq_ptr, ur->cq_size);
+    }
+    munmap(ur->sq_ptr, ur->sq_size);
+    free(ur->tx_bufs[0]);
+    free(ur->tx_bufs[1]);
+    free(ur->rx_bufs);
+    free(ur);
+    sr->uring = 0;
+} /* -- sr_uring_close -- */
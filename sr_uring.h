@@ -0,0 +1,98 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_uring.h
+ *
+ * Description:
+ *
+ * io_uring I/O on the connection to the VNS server (-U). Replaces the
+ * recv/read/write per frame of sr_read_from_server()/sr_send_packet():
+ *
+ *  - receive: one multishot recv fills buffers provided to the kernel.
+ *    Commands are handled in place in those buffers, only a command
+ *    split across two of them is copied. A buffer goes back to the
+ *    kernel with the next submission.
+ *  - send: frames are appended to one of two registered batch buffers.
+ *    A single write is in flight at a time, so the stream stays ordered
+ *    whatever the thread that sent the frame; the buffer filling up
+ *    behind it goes out when it completes.
+ *
+ * The main loop submits the pending write and waits for completions in
+ * the same io_uring_enter(), frames sent while handling a batch of
+ * received ones cost no system call of their own. The same wait polls
+ * the epoll descriptor of the event loop (sr_event.h), whose timers then
+ * run from this loop too. Other threads submit directly when no write
+ * is in flight.
+ *
+ * Raw system calls, liburing is not needed. Linux 6.0 or newer.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_URING_H
+#define SR_URING_H
+
+#include <pthread.h>
+#include <linux/io_uring.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#define URING_ENTRIES 128                   /* the recv, the write and every buffer to give back */
+#define URING_RX_BUF_NUM 64
+#define URING_RX_BUF_SIZE (16 * 1024)
+#define URING_RX_CMD_MAX 10000              /* VNS_MAX_COMMAND, as sr_read_from_server */
+#define URING_RX_BGID 0
+#define URING_TX_BATCH_SIZE (256 * 1024)
+
+struct sr_instance;
+
+struct sr_uring
+{
+    int fd;
+
+    /* -- submission and completion queues, shared with the kernel -- */
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned int sq_pending;            /* written, not submitted yet */
+
+    /* -- receive -- */
+    uint8_t* rx_bufs;
+    uint16_t rx_free[URING_RX_BUF_NUM]; /* handled, to provide again */
+    unsigned int rx_free_num;
+    int rx_armed;
+    int ev_armed;                       /* poll on the event loop in flight */
+    int ev_ready;
+    struct io_uring_cqe rx_cqes[URING_RX_BUF_NUM * 2];  /* reaped, not handled yet */
+    unsigned int rx_cqe_head;
+    unsigned int rx_cqe_tail;
+    uint8_t rx_partial[URING_RX_CMD_MAX];
+    unsigned int rx_partial_len;
+
+    /* -- send -- */
+    pthread_mutex_t tx_lock;            /* tx state and the submission queue */
+    pthread_cond_t tx_done;
+    pthread_t loop_thread;
+    uint8_t* tx_bufs[2];
+    unsigned int tx_len[2];
+    unsigned int tx_fill;               /* buffer being filled, the other one is in flight */
+    unsigned int tx_off;                /* bytes of the in-flight buffer written */
+    int tx_busy;
+    int tx_error;
+};
+
+int sr_uring_open(struct sr_instance*);
+int sr_uring_read(struct sr_instance*);
+int sr_uring_send(struct sr_instance*, uint8_t*, unsigned int, const char*);
+void sr_uring_close(struct sr_instance*);
+
+#endif /* -- SR_URING_H -- */
@@ -32,24 +32,73 @@
 #include <errno.h>
 
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
 
 #include "sr_dumper.h"
 #include "sr_router.h"
+#include "sr_acl.h"
+#include "sr_sched.h"
+#include "sr_snapshot.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_stats.h"
+#include "sr_afpacket.h"
+#include "sr_uring.h"
+#include "sr_txbuf.h"
+#include "sr_shm.h"
 
 #include "vnscommand.h"
 
+#define VNS_READ_BATCH 64 /* commands handled per wakeup of the event loop */
+#define VNS_READ_EMPTY 2  /* nothing to read, from vns_read_command(.., 1) */
 
-static void sr_log_packet(struct sr_instance* , uint8_t* , int );
+
+static int  vns_read_command(struct sr_instance* sr, int nowait);
+static void vns_tx_expired(struct sr_instance* sr, void* arg);
 static int  sr_arp_req_not_for_us(struct sr_instance* sr, 
                                   uint8_t * packet /* lent */,
                                   unsigned int len,
                                   char* interface  /* lent */);
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_connect_to_path()
+ * Scope: Local
+ *
+ * Connect to a server listening on the Unix socket at path
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_connect_to_path(struct sr_instance* sr, const char* path)
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Error: socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    if ((sr->sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket(..):sr_client.c::sr_connect_to_path(..)");
+        return -1;
+    }
+
+    if (connect(sr->sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect(..):sr_client.c::sr_connect_to_path(..)");
+        close(sr->sockfd);
+        return -1;
+    }
+    return 0;
+} /* -- sr_connect_to_path -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_connect_to_server()
  * Scope: Global 
@@ -76,6 +125,16 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
     /* purify UMR be gone ! */
     memset((void*)&command,0,sizeof(c_open));
 
+    /* -- a path is a server on this machine, see sr_shm.h -- */
+    if (server[0] == '/')
+    {
+        if (sr_connect_to_path(sr, server) != 0)
+        {
+            return -1;
+        }
+        goto send_open;
+    }
+
     /* zero out server address struct */
     memset(&(sr->sr_addr),0,sizeof(struct sockaddr_in));
 
@@ -108,6 +167,7 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
         return -1;
     }
 
+send_open:
     /* send sr_OPEN message to server */ 
     command.mLen   = htonl(sizeof(c_open));
     command.mType  = htonl(VNSOPEN);
@@ -183,16 +243,39 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
                 Debug("\n");
                 sr_set_ether_addr(sr,(unsigned char*)hwinfo->mHWInfo[i].value);
                 break;
+            case HWMTU:
+                Debug("MTU: %d\n",
+                        ntohl(*((uint32_t*)hwinfo->mHWInfo[i].value)));
+                sr_set_ether_mtu(sr,ntohl(*((uint32_t*)hwinfo->mHWInfo[i].value)));
+                break;
             default:
                 printf (" %d \n",ntohl(hwinfo->mHWInfo[i].mKey));
         } /* -- switch -- */
     } /* -- for -- */
 
+    if (sr->mtu_spec != NULL)
+    {
+        sr_set_mtus(sr, sr->mtu_spec);
+    }
+    if (sr->sched_spec != NULL)
+    {
+        sr_sched_config(sr, sr->sched_spec);
+    }
+    if ((sr->acl_path != NULL) && (sr_acl_reload(sr) != 0))
+    {
+        fprintf(stderr, "*warning* no access control lists\n");
+    }
     sr_print_if_list(sr);
 
     /* flag that hardware has been initialized */
     sr->hw_init = 1;
 
+    /* -- the state of the last run needs the interfaces -- */
+    if (sr->snapshot != NULL)
+    {
+        sr_snapshot_start(sr);
+    }
+
     return num_entries;
 } /* -- sr_handle_hwinfo -- */
 
@@ -206,9 +289,63 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
 
 int sr_read_from_server(struct sr_instance* sr /* borrowed */)
 {
-    int command, len;
+    return vns_read_command(sr, 0);
+}/* -- sr_read_from_server -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server_ready(..)
+ * Scope: global
+ *
+ * Event loop callback of the server connection. Handles the commands
+ * already received, up to VNS_READ_BATCH so that the timers are not
+ * held up: the reads that find nothing stand in for an epoll_wait()
+ * per command.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server_ready(struct sr_instance* sr /* borrowed */,
+                              void* arg)
+{
+    int ret = 1;
+
+    sr->tx_in_batch = 1;
+    for (int i = 0; i < VNS_READ_BATCH; i++)
+    {
+        ret = vns_read_command(sr, (i > 0));
+        if (ret == VNS_READ_EMPTY)
+        {
+            ret = 1;
+            break;
+        }
+        if (ret != 1)
+        {
+            break;
+        }
+    }
+    sr->tx_in_batch = 0;
+
+    /* -- what the batch sent goes out in one write, unless it may wait -- */
+    if ((sr->txbuf != NULL) && (sr->tx_deadline == 0))
+    {
+        sr_flush_tx(sr);
+    }
+
+    return ret;
+}/* -- sr_read_from_server_ready -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: vns_read_command(..)
+ * Scope: local
+ *
+ * Reads and handles one command. With nowait, returns VNS_READ_EMPTY
+ * if none has started arriving.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int vns_read_command(struct sr_instance* sr /* borrowed */, int nowait)
+{
+    int len;
     unsigned char *buf = 0;
-    c_packet_ethernet_header* sr_pkt = 0;
     int ret = 0, bytes_read = 0;
 
     /* REQUIRES */
@@ -226,15 +363,26 @@ int sr_read_from_server(struct sr_instance* sr /* borrowed */)
         do
         { /* -- just in case SIGALRM breaks recv -- */
             errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read, 
-                            4 - bytes_read, 0)) == -1)
+            ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read, 
+                            4 - bytes_read,
+                            (nowait && (bytes_read == 0)) ? MSG_DONTWAIT : 0);
+            sr_stats_inc(sr, STATS_IO_SYSCALLS);
+            if(ret == -1)
             {
                 if ( errno == EINTR )
                 { continue; }
 
+                if ( (errno == EAGAIN) && (bytes_read == 0) )
+                { return VNS_READ_EMPTY; }
+
                 perror("recv(..):sr_client.c::sr_read_from_server");
                 return -1;
             }
+            if(ret == 0)
+            {
+                fprintf(stderr,"vns server closed the connection.\n");
+                return 0;
+            }
             bytes_read += ret;
         } while ( errno == EINTR); /* be mindful of signals */
 
@@ -242,7 +390,7 @@ int sr_read_from_server(struct sr_instance* sr /* borrowed */)
 
     len = ntohl(len);
 
-    if ( len > 10000 || len < 0 )
+    if ( len > VNS_MAX_COMMAND || len < 0 )
     {
         fprintf(stderr,"Error: command length to large %d\n",len);
         close(sr->sockfd); 
@@ -266,8 +414,9 @@ int sr_read_from_server(struct sr_instance* sr /* borrowed */)
         do
         {/* -- just in case SIGALRM breaks recv -- */
             errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
+            ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read);
+            sr_stats_inc(sr, STATS_IO_SYSCALLS);
+            if (ret == -1)
             {
                 if ( errno == EINTR )
                 { continue; }
@@ -279,6 +428,30 @@ int sr_read_from_server(struct sr_instance* sr /* borrowed */)
         } while (errno == EINTR); /* be mindful of signals */
     } 
 
+    ret = sr_handle_command(sr, buf, len);
+
+    if(buf)
+    { free(buf); }
+    return ret;
+}/* -- vns_read_command -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_handle_command(..)
+ * Scope: global
+ *
+ * Handles one command read from the server, buf holds the whole command
+ * (length included) and may be modified. Returns 0 if the server closed
+ * the session, 1 otherwise.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_handle_command(struct sr_instance* sr /* borrowed */,
+                      uint8_t* buf /* borrowed */,
+                      int len)
+{
+    int command;
+    c_packet_ethernet_header* sr_pkt = 0;
+
     /* My entry for most unreadable line of code - guido */
     /* ... you win - mc                                  */
     command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
@@ -316,8 +489,6 @@ int sr_read_from_server(struct sr_instance* sr /* borrowed */)
         case VNSCLOSE:
             fprintf(stderr,"vns server closed session.\n");
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
-            if(buf)
-            { free(buf); }
             return 0;      
             break;
 
@@ -332,16 +503,20 @@ int sr_read_from_server(struct sr_instance* sr /* borrowed */)
             }
             break;
 
+            /* -------------     VNS_SHM       -------------------- */
+
+        case VNS_SHM:
+            sr_shm_start(sr, buf, len);
+            break;
+
         default:
             Debug("unknown command: %d\n", command);
             break;
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
     return 1;
-}/* -- sr_read_from_server -- */
+}/* -- sr_handle_command -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_ether_addrs_match_interface(..)
@@ -390,12 +565,73 @@ sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
 
 } /* -- sr_ether_addrs_match_interface -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_coalesce_tx(..)
+ * Scope: Global
+ *
+ * Frames sent from now on wait in a buffer and share a write, see
+ * sr_txbuf.h. With a deadline of 0 they are written at the end of the
+ * batch of received commands or of the timer that sent them, otherwise
+ * up to deadline ms after the first of them. Returns 0 or -1.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_coalesce_tx(struct sr_instance* sr, unsigned int deadline)
+{
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->loop);
+
+    if ((sr->txbuf = sr_txbuf_create(sr->sockfd, TXBUF_SIZE)) == NULL)
+    {
+        fprintf(stderr, "Error allocating the transmit buffer\n");
+        return -1;
+    }
+    sr->tx_deadline = deadline;
+    sr_timer_init(&sr->tx_timer, vns_tx_expired, NULL);
+
+    return 0;
+} /* -- sr_coalesce_tx -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flush_tx(..)
+ * Scope: Global
+ *
+ * Writes the frames waiting in the transmit buffer. Returns 0 or -1.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_flush_tx(struct sr_instance* sr)
+{
+    unsigned int syscalls = 0;
+
+    if (sr_timer_armed(&sr->tx_timer))
+    {
+        sr_timer_cancel(sr, &sr->tx_timer);
+    }
+
+    int ret = sr_txbuf_flush(sr->txbuf, &syscalls);
+    sr_stats_add(sr, STATS_IO_SYSCALLS, syscalls);
+    if (ret != 0)
+    {
+        fprintf(stderr, "Error writing packet\n");
+    }
+
+    return ret;
+} /* -- sr_flush_tx -- */
+
+static void vns_tx_expired(struct sr_instance* sr, void* arg)
+{
+    sr_flush_tx(sr);
+} /* -- vns_tx_expired -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_send_packet(..)
  * Scope: Global
  *
  * Send a packet (ethernet header included!) of length 'len' to the server
- * to be injected onto the wire.
+ * to be injected onto the wire, through the output queues of the
+ * interface if it is shaped (see sr_sched.h).
  *
  *---------------------------------------------------------------------------*/
 
@@ -403,6 +639,28 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
                          uint8_t* buf /* borrowed */ ,
                          unsigned int len, 
                          const char* iface /* borrowed */)
+{
+    struct sr_if* tx_if = sr_get_interface(sr, iface);
+
+    if ( tx_if && tx_if->sched && (len >= sizeof(struct sr_ethernet_hdr)) )
+    {
+        return sr_sched_send(sr, tx_if, buf, len);
+    }
+    return sr_send_frame(sr, buf, len, iface);
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_frame(..)
+ * Scope: Global
+ *
+ * sr_send_packet() without the output queues, the frame goes now.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_frame(struct sr_instance* sr /* borrowed */, 
+                         uint8_t* buf /* borrowed */ ,
+                         unsigned int len, 
+                         const char* iface /* borrowed */)
 {
     c_packet_header *sr_pkt;
     unsigned int total_len =  len + (sizeof(c_packet_header));
@@ -419,6 +677,70 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
         return -1;
     }
 
+    /* -- log packet -- */
+    sr_log_packet(sr,buf,len);
+
+    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) )
+    {
+        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
+        return -1; 
+    }
+
+    /* -- straight onto the interface's TX ring, no VNS framing -- */
+    if ( sr->afpacket )
+    {
+        if ( sr_afpacket_send(sr, buf, len, iface) != 0 )
+        {
+            return -1;
+        }
+        sr_stats_if_add(sr, sr_get_interface(sr, iface), STATS_IF_TX_PACKETS, len);
+        return 0;
+    }
+
+    /* -- into the ring shared with the server, see sr_shm.h -- */
+    if ( sr->shm && sr->shm->active )
+    {
+        if ( sr_shm_send(sr, buf, len, iface) != 0 )
+        {
+            return -1;
+        }
+        sr_stats_if_add(sr, sr_get_interface(sr, iface), STATS_IF_TX_PACKETS, len);
+        return 0;
+    }
+
+    /* -- batched on the io_uring, see sr_uring.h -- */
+    if ( sr->uring )
+    {
+        if ( sr_uring_send(sr, buf, len, iface) != 0 )
+        {
+            return -1;
+        }
+        sr_stats_if_add(sr, sr_get_interface(sr, iface), STATS_IF_TX_PACKETS, len);
+        return 0;
+    }
+
+    /* -- waits for the next flush, see sr_coalesce_tx() -- */
+    if ( sr->txbuf )
+    {
+        unsigned int syscalls = 0;
+        int ret = sr_txbuf_append(sr->txbuf, buf, len, iface, &syscalls);
+        sr_stats_add(sr, STATS_IO_SYSCALLS, syscalls);
+        if ( ret == -1 )
+        {
+            fprintf(stderr, "Error writing packet\n");
+            return -1;
+        }
+
+        /* -- the first frame waiting starts the deadline, a batch of
+         *    received commands ends with a flush anyway -- */
+        if ( (ret == 1) && ((sr->tx_deadline > 0) || !sr->tx_in_batch) )
+        {
+            sr_timer_add(sr, &sr->tx_timer, sr->tx_deadline);
+        }
+        sr_stats_if_add(sr, sr_get_interface(sr, iface), STATS_IF_TX_PACKETS, len);
+        return 0;
+    }
+
     /* Create packet */
     sr_pkt = (c_packet_header *)malloc(len +
             sizeof(c_packet_header));
@@ -429,53 +751,57 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
     memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
             buf,len);
 
-    /* -- log packet -- */
-    sr_log_packet(sr,buf,len);
-
-    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) )
+    /* -- hellos, LSUs and forwarded packets come from different threads,
+     *    one command must not be interleaved with another -- */
+    pthread_mutex_lock(&sr->sock_lock);
+    unsigned int written = 0;
+    while ( written < total_len )
     {
-        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
-        return -1; 
+        int ret = write(sr->sockfd, ((uint8_t*)sr_pkt) + written, total_len - written);
+        sr_stats_inc(sr, STATS_IO_SYSCALLS);
+        if ( ret == -1 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            break;
+        }
+        written += ret;
     }
+    pthread_mutex_unlock(&sr->sock_lock);
 
-    if( ((uint32_t)(write(sr->sockfd, sr_pkt, total_len))) < total_len ) 
+    if( written < total_len ) 
     {
         fprintf(stderr, "Error writing packet\n");
         free(sr_pkt);
         return -1;
     }
 
+    sr_stats_if_add(sr, sr_get_interface(sr, iface), STATS_IF_TX_PACKETS, len);
+
     free(sr_pkt);
 
     return 0;
-} /* -- sr_send_packet -- */
+} /* -- sr_send_frame -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_log_packet()
- * Scope: Local 
+ * Scope: Global
  *
  *---------------------------------------------------------------------------*/
 
 void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
 {
-    struct pcap_pkthdr h;
-    int size;
-
     /* REQUIRES */
     assert(sr);
 
     if(!sr->logfile)
     {return; }
 
-    size = min(PACKET_DUMP_SIZE, len);
-
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
-
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
+    /* -- copied into the capture ring, written by its own thread -- */
+    if(sr_dump_packet(sr->logfile, buf, len) != 0)
+    {
+        sr_stats_inc(sr, STATS_CAPTURE_DROPS);
+    }
 } /* -- sr_log_packet -- */
 
 /*-----------------------------------------------------------------------------
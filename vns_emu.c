@@ -0,0 +1,1549 @@
+/*-----------------------------------------------------------------------------
+ * File: vns_emu.c
+ *
+ * Description:
+ *
+ * Local stand-in for the VNS server. Hosts a whole emulated topology: the
+ * sr processes connect to it as they would to VNS (VNSOPEN, VNSHWINFO,
+ * VNSPACKET, VNSCLOSE), their interfaces are wired together as described
+ * in a topology file, and emulated end hosts answer ARP and ping and
+ * source/sink traffic flows. At the end of the run it reports, for every
+ * flow, the throughput, the loss and the latency, and for every link
+ * event the time each flow took to recover.
+ *
+ * Topology file, one statement per line, '#' starts a comment:
+ *
+ *   router <vhost> <iface> <ip> <mask> [mtu]
+ *   link   <vhost> <iface> <vhost> <iface> [delay ms] [Mbit/s]
+ *   host   <name> <ip> <vhost> <iface> [delay ms] [Mbit/s]
+ *   flow   <name> <src host> <dst host|ip> udp|udp-df|icmp <pps> <frame bytes>
+ *          <start s> <duration s> [tos]
+ *   event  <time s> down|up <vhost> <iface>
+ *
+ * Times are relative to the moment every router is connected. udp flows
+ * are measured one way at the destination host, icmp flows are pings
+ * whose replies are measured back at the source host.
+ *
+ * A router has up to EMU_MAX_PORTS interfaces, of any name shorter than
+ * 16 characters (see ports.emu).
+ *
+ * Interfaces have an MTU of 1500 unless given one, up to 9000, sent to
+ * the router with its hardware information (HWMTU). A frame larger than
+ * the MTU of the interface it leaves by is dropped on the wire. Hosts do
+ * not reassemble: a fragmented probe counts when its first fragment
+ * arrives. udp-df flows set DF, too large for a link on their path they
+ * come back as fragmentation needed errors.
+ *
+ * A link given a rate sends the frames of each direction one after the
+ * other at that rate and holds at most EMU_LINK_BUFFER seconds of them,
+ * the frames beyond are dropped, whatever they carry.
+ *
+ * A router connected on the Unix socket given with -u may hand over shared
+ * memory rings (VNS_SHM, see sr_shm.h), its VNSPACKET commands then go
+ * through them both ways.
+ *
+ * Usage: vns_emu [-p port] [-u socket path] [-d duration s] [-n] <topology file>
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "vnscommand.h"
+#include "sr_shm.h"
+
+#define EMU_DEFAULT_PORT 12345
+#define EMU_MAX_ROUTERS 32
+#define EMU_MAX_PORTS 16
+#define EMU_MAX_HOSTS 64
+#define EMU_MAX_FLOWS 64
+#define EMU_MAX_EVENTS 64
+#define EMU_MAX_CONNS (EMU_MAX_ROUTERS * 2)
+#define EMU_IN_BUF_SIZE 65536
+#define EMU_OUT_BUF_MAX (4 * 1024 * 1024)
+#define EMU_PROBE_MAGIC 0x70776f73   /* "pwos" */
+#define EMU_NAMELEN 32
+#define EMU_DRAIN_TIME 1.0           /* s, probes still in flight at the end */
+#define EMU_DEFAULT_MTU 1500
+#define EMU_MAX_MTU 9000
+#define EMU_MAX_FRAME (EMU_MAX_MTU + 14)  /* with the ethernet header */
+#define EMU_LINK_BUFFER 0.02         /* s of frames a link with a rate holds */
+
+
+/* -- one interface of an emulated router, and what it is wired to -- */
+struct emu_port
+{
+    char name[EMU_NAMELEN];
+    uint32_t ip;
+    uint32_t mask;
+    uint32_t mtu;
+    uint8_t mac[ETHER_ADDR_LEN];
+    int peer_router;              /* -1 if not linked to a router */
+    int peer_port;
+    int host;                     /* -1 if no end host attached */
+    double delay;                 /* seconds, towards the peer */
+    double rate;                  /* bytes per second, 0 for no limit */
+    double tx_busy;               /* the router sends until then */
+    double rx_busy;               /* the host sends until then */
+    int up;
+    unsigned long tx_frames;      /* -- sent by the router -- */
+    unsigned long drops;
+};
+
+struct emu_router
+{
+    char vhost[IDSIZE];
+    int port_num;
+    struct emu_port ports[EMU_MAX_PORTS];
+    int conn;                     /* -1 if not connected */
+};
+
+struct emu_host
+{
+    char name[EMU_NAMELEN];
+    uint32_t ip;
+    uint8_t mac[ETHER_ADDR_LEN];
+    int router;
+    int port;
+    unsigned long icmp_errors;
+};
+
+struct emu_flow
+{
+    char name[EMU_NAMELEN];
+    int src_host;
+    uint32_t dst;
+    uint8_t proto;
+    int df;                       /* udp-df, probes may not be fragmented */
+    uint8_t tos;
+    double pps;
+    unsigned int size;
+    double start;
+    double duration;
+
+    uint32_t total;               /* packets the flow sends */
+    uint32_t sent;
+    uint32_t received;
+    double* sent_at;
+    double* latency;              /* < 0 while not received */
+};
+
+struct emu_event
+{
+    double time;
+    int up;
+    int router;
+    int port;
+    int done;
+};
+
+/* -- a connection from an sr process, before and after VNSOPEN -- */
+struct emu_conn
+{
+    int fd;
+    int router;                   /* -1 until VNSOPEN */
+    uint8_t in[EMU_IN_BUF_SIZE];
+    unsigned int in_len;
+    uint8_t* out;
+    unsigned int out_len;
+    unsigned int out_size;
+    unsigned long out_drops;
+    int passed_fds[3];            /* SCM_RIGHTS of the VNS_SHM request */
+    int passed_num;
+    struct sr_shm_region* shm;    /* NULL until VNS_SHM, then packets use the rings */
+    struct sr_shm_queue shm_in;   /* from_router, we wait on its eventfd */
+    struct sr_shm_queue shm_out;  /* to_router */
+};
+
+/* -- frames held back by the link delay -- */
+struct emu_frame
+{
+    double due;
+    int router;                   /* destination router, or -1 for a host */
+    int port;
+    int host;
+    unsigned int len;
+    struct emu_frame* next;
+    uint8_t data[1];
+};
+
+struct emu_probe
+{
+    uint32_t magic;
+    uint16_t flow;
+    uint16_t pad;
+    uint32_t seq;
+} __attribute__ ((packed));
+
+
+static struct emu_router routers[EMU_MAX_ROUTERS];
+static int router_num = 0;
+static struct emu_host hosts[EMU_MAX_HOSTS];
+static int host_num = 0;
+static struct emu_flow flows[EMU_MAX_FLOWS];
+static int flow_num = 0;
+static struct emu_event events[EMU_MAX_EVENTS];
+static int event_num = 0;
+static struct emu_conn* conns[EMU_MAX_CONNS];
+
+static struct emu_frame* pending_first = NULL;
+static double t0 = -1;            /* every router connected */
+static volatile int stop = 0;
+
+
+static
+double emu_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static
+uint16_t emu_cksum(uint8_t* hdr, int len)
+{
+    uint32_t sum = 0;
+    while (len > 1)
+    {
+        sum += *((uint16_t*)(hdr));
+        hdr += 2;
+        len -= 2;
+    }
+    if (len)
+    {
+        sum += *hdr;
+    }
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return ~sum;
+}
+
+static
+void emu_stop(int sig)
+{
+    stop = 1;
+}
+
+
+/*-----------------------------------------------------------------------------
+ * Topology
+ *---------------------------------------------------------------------------*/
+
+static
+int find_router(const char* vhost)
+{
+    for (int i = 0; i < router_num; i++)
+    {
+        if (strncmp(routers[i].vhost, vhost, IDSIZE) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static
+int find_port(int router, const char* name)
+{
+    for (int i = 0; i < routers[router].port_num; i++)
+    {
+        if (strncmp(routers[router].ports[i].name, name, 16) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static
+int parse_port(const char* vhost, const char* iface, int* router, int* port, int line_num)
+{
+    *router = find_router(vhost);
+    *port = (*router < 0) ? -1 : find_port(*router, iface);
+    if (*port < 0)
+    {
+        fprintf(stderr, "line %d: unknown interface %s %s\n", line_num, vhost, iface);
+        return -1;
+    }
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: load_topology
+ *
+ * Returns 0 on success
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+int load_topology(const char* filename)
+{
+    FILE* fp = fopen(filename, "r");
+    if (fp == NULL)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    char line[512];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        line_num++;
+        char* comment = strchr(line, '#');
+        if (comment != NULL)
+        {
+            *comment = '\0';
+        }
+
+        char kw[16], a[64], b[64], c[64], d[64], e[64], f[64], g[64], h[64], tos[64];
+        int n = sscanf(line, "%15s %63s %63s %63s %63s %63s %63s %63s %63s %63s", kw, a, b, c, d, e, f, g, h, tos);
+        if (n <= 0)
+        {
+            continue;
+        }
+
+        struct in_addr addr, mask;
+        if ((strcmp(kw, "router") == 0) && ((n == 5) || (n == 6)) && inet_aton(c, &addr) && inet_aton(d, &mask))
+        {
+            int r = find_router(a);
+            if (r < 0)
+            {
+                if (router_num == EMU_MAX_ROUTERS)
+                {
+                    fprintf(stderr, "line %d: too many routers\n", line_num);
+                    return -1;
+                }
+                r = router_num++;
+                strncpy(routers[r].vhost, a, IDSIZE - 1);
+                routers[r].conn = -1;
+            }
+            if ((routers[r].port_num == EMU_MAX_PORTS) || (strlen(b) >= 16))
+            {
+                fprintf(stderr, "line %d: too many interfaces or name too long\n", line_num);
+                return -1;
+            }
+
+            struct emu_port* port = &routers[r].ports[routers[r].port_num];
+            strncpy(port->name, b, EMU_NAMELEN - 1);
+            port->ip = addr.s_addr;
+            port->mask = mask.s_addr;
+            port->mtu = (n == 6) ? atoi(e) : EMU_DEFAULT_MTU;
+            if ((port->mtu < 576) || (port->mtu > EMU_MAX_MTU))
+            {
+                fprintf(stderr, "line %d: MTU out of 576..%d\n", line_num, EMU_MAX_MTU);
+                return -1;
+            }
+            port->mac[0] = 0x00; port->mac[1] = 0x16; port->mac[2] = 0x3e;
+            port->mac[3] = r + 1; port->mac[4] = routers[r].port_num; port->mac[5] = 0x01;
+            port->peer_router = -1;
+            port->peer_port = -1;
+            port->host = -1;
+            port->up = 1;
+            routers[r].port_num++;
+        }
+        else if ((strcmp(kw, "link") == 0) && (n >= 5))
+        {
+            int ra, pa, rb, pb;
+            if ((parse_port(a, b, &ra, &pa, line_num) < 0) || (parse_port(c, d, &rb, &pb, line_num) < 0))
+            {
+                return -1;
+            }
+            double delay = (n > 5) ? atof(e) / 1000.0 : 0;
+            double rate = (n > 6) ? atof(f) * 125000.0 : 0;
+            routers[ra].ports[pa].peer_router = rb;
+            routers[ra].ports[pa].peer_port = pb;
+            routers[ra].ports[pa].delay = delay;
+            routers[ra].ports[pa].rate = rate;
+            routers[rb].ports[pb].peer_router = ra;
+            routers[rb].ports[pb].peer_port = pa;
+            routers[rb].ports[pb].delay = delay;
+            routers[rb].ports[pb].rate = rate;
+        }
+        else if ((strcmp(kw, "host") == 0) && (n >= 5) && inet_aton(b, &addr) && (host_num < EMU_MAX_HOSTS))
+        {
+            int r, p;
+            if (parse_port(c, d, &r, &p, line_num) < 0)
+            {
+                return -1;
+            }
+            struct emu_host* host = &hosts[host_num];
+            strncpy(host->name, a, EMU_NAMELEN - 1);
+            host->ip = addr.s_addr;
+            host->mac[0] = 0x00; host->mac[1] = 0x16; host->mac[2] = 0x3e;
+            host->mac[3] = 0xff; host->mac[4] = 0x00; host->mac[5] = host_num + 1;
+            host->router = r;
+            host->port = p;
+            routers[r].ports[p].host = host_num;
+            routers[r].ports[p].delay = (n > 5) ? atof(e) / 1000.0 : 0;
+            routers[r].ports[p].rate = (n > 6) ? atof(f) * 125000.0 : 0;
+            host_num++;
+        }
+        else if ((strcmp(kw, "flow") == 0) && (n >= 9) && (flow_num < EMU_MAX_FLOWS))
+        {
+            struct emu_flow* flow = &flows[flow_num];
+            strncpy(flow->name, a, EMU_NAMELEN - 1);
+            flow->src_host = -1;
+            for (int i = 0; i < host_num; i++)
+            {
+                if (strcmp(hosts[i].name, b) == 0)
+                {
+                    flow->src_host = i;
+                }
+                if (strcmp(hosts[i].name, c) == 0)
+                {
+                    flow->dst = hosts[i].ip;
+                }
+            }
+            if ((flow->dst == 0) && inet_aton(c, &addr))
+            {
+                flow->dst = addr.s_addr;
+            }
+            flow->proto = (strcmp(d, "icmp") == 0) ? IP_PROTO_ICMP : IP_PROTO_UDP;
+            flow->df = (strcmp(d, "udp-df") == 0);
+            flow->pps = atof(e);
+            flow->size = atoi(f);
+            flow->start = atof(g);
+            flow->duration = atof(h);
+            flow->tos = (n > 9) ? strtoul(tos, NULL, 0) : 0;
+            if ((flow->src_host < 0) || (flow->dst == 0) || (flow->pps <= 0) || (flow->duration <= 0))
+            {
+                fprintf(stderr, "line %d: invalid flow\n", line_num);
+                return -1;
+            }
+
+            unsigned int min_size = sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(sr_icmphdr) + sizeof(emu_probe);
+            if (flow->size < min_size)
+            {
+                flow->size = min_size;
+            }
+            if (flow->size > EMU_MAX_FRAME)
+            {
+                flow->size = EMU_MAX_FRAME;
+            }
+            flow->total = ((uint32_t)(flow->pps * flow->duration));
+            flow->sent_at = ((double*)(calloc(flow->total + 1, sizeof(double))));
+            flow->latency = ((double*)(malloc((flow->total + 1) * sizeof(double))));
+            for (uint32_t i = 0; i <= flow->total; i++)
+            {
+                flow->latency[i] = -1;
+            }
+            flow_num++;
+        }
+        else if ((strcmp(kw, "event") == 0) && (n == 5) && (event_num < EMU_MAX_EVENTS))
+        {
+            struct emu_event* event = &events[event_num];
+            event->time = atof(a);
+            event->up = (strcmp(b, "up") == 0);
+            if (parse_port(c, d, &event->router, &event->port, line_num) < 0)
+            {
+                return -1;
+            }
+            event_num++;
+        }
+        else
+        {
+            fprintf(stderr, "line %d: cannot parse: %s", line_num, line);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+} /* -- load_topology -- */
+
+
+/*-----------------------------------------------------------------------------
+ * Connections
+ *---------------------------------------------------------------------------*/
+
+static
+void conn_close(int c)
+{
+    struct emu_conn* conn = conns[c];
+    if (conn->router >= 0)
+    {
+        printf("[%8.3f] %s disconnected\n", (t0 < 0) ? 0 : emu_now() - t0, routers[conn->router].vhost);
+        routers[conn->router].conn = -1;
+    }
+    close(conn->fd);
+    for (int i = 0; i < conn->passed_num; i++)
+    {
+        close(conn->passed_fds[i]);
+    }
+    if (conn->shm != NULL)
+    {
+        munmap(conn->shm, sizeof(struct sr_shm_region));
+    }
+    free(conn->out);
+    free(conn);
+    conns[c] = NULL;
+}
+
+static
+void conn_flush(int c)
+{
+    struct emu_conn* conn = conns[c];
+    while (conn->out_len > 0)
+    {
+        ssize_t ret = send(conn->fd, conn->out, conn->out_len, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if ((errno != EAGAIN) && (errno != EINTR))
+            {
+                conn_close(c);
+            }
+            return;
+        }
+        memmove(conn->out, conn->out + ret, conn->out_len - ret);
+        conn->out_len -= ret;
+    }
+}
+
+/* Queues a message for the router, dropped if the router lags too far behind */
+static
+void conn_send(int c, void* msg, unsigned int len)
+{
+    struct emu_conn* conn = conns[c];
+    if (conn->out_len + len > EMU_OUT_BUF_MAX)
+    {
+        conn->out_drops++;
+        return;
+    }
+    if (conn->out_len + len > conn->out_size)
+    {
+        conn->out_size = (conn->out_len + len) * 2;
+        conn->out = ((uint8_t*)(realloc(conn->out, conn->out_size)));
+    }
+    memcpy(conn->out + conn->out_len, msg, len);
+    conn->out_len += len;
+    conn_flush(c);
+}
+
+static
+void send_close(int c, const char* reason)
+{
+    c_close msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.mLen = htonl(sizeof(msg));
+    msg.mType = htonl(VNSCLOSE);
+    strncpy(msg.mErrorMessage, reason, sizeof(msg.mErrorMessage) - 1);
+    conn_send(c, &msg, sizeof(msg));
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: send_hwinfo
+ *
+ * sr_handle_hwinfo() applies the address entries to the last interface
+ * added, so every interface is described right after its HWINTERFACE.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void send_hwinfo(int c, int r)
+{
+    c_hwinfo msg;
+    int n = 0;
+    memset(&msg, 0, sizeof(msg));
+
+    for (int p = 0; p < routers[r].port_num; p++)
+    {
+        struct emu_port* port = &routers[r].ports[p];
+        uint32_t speed = htonl(100);
+        uint32_t subnet = port->ip & port->mask;
+
+        msg.mHWInfo[n].mKey = htonl(HWINTERFACE);
+        strncpy(msg.mHWInfo[n++].value, port->name, 31);
+        msg.mHWInfo[n].mKey = htonl(HWSPEED);
+        memcpy(msg.mHWInfo[n++].value, &speed, 4);
+        msg.mHWInfo[n].mKey = htonl(HWSUBNET);
+        memcpy(msg.mHWInfo[n++].value, &subnet, 4);
+        msg.mHWInfo[n].mKey = htonl(HWETHER);
+        memcpy(msg.mHWInfo[n++].value, port->mac, ETHER_ADDR_LEN);
+        msg.mHWInfo[n].mKey = htonl(HWETHIP);
+        memcpy(msg.mHWInfo[n++].value, &port->ip, 4);
+        msg.mHWInfo[n].mKey = htonl(HWMASK);
+        memcpy(msg.mHWInfo[n++].value, &port->mask, 4);
+        uint32_t mtu = htonl(port->mtu);
+        msg.mHWInfo[n].mKey = htonl(HWMTU);
+        memcpy(msg.mHWInfo[n++].value, &mtu, 4);
+    }
+
+    unsigned int len = 2 * sizeof(uint32_t) + n * sizeof(c_hw_entry);
+    msg.mLen = htonl(len);
+    msg.mType = htonl(VNSHWINFO);
+    conn_send(c, &msg, len);
+}
+
+
+/*-----------------------------------------------------------------------------
+ * Forwarding between the routers and the end hosts
+ *---------------------------------------------------------------------------*/
+
+static void host_receive(int h, uint8_t* frame, unsigned int len);
+
+static
+void deliver_to_router(int r, int p, uint8_t* frame, unsigned int len)
+{
+    if (routers[r].conn < 0)
+    {
+        routers[r].ports[p].drops++;
+        return;
+    }
+
+    uint8_t msg[sizeof(c_packet_header) + EMU_MAX_FRAME];
+    c_packet_header* hdr = ((c_packet_header*)(msg));
+    if (len > EMU_MAX_FRAME)
+    {
+        return;
+    }
+
+    struct emu_conn* conn = conns[routers[r].conn];
+    if (conn->shm != NULL)
+    {
+        c_packet_header shm_hdr;
+        shm_hdr.mLen = htonl(sizeof(c_packet_header) + len);
+        shm_hdr.mType = htonl(VNSPACKET);
+        memset(shm_hdr.mInterfaceName, 0, sizeof(shm_hdr.mInterfaceName));
+        strncpy(shm_hdr.mInterfaceName, routers[r].ports[p].name, sizeof(shm_hdr.mInterfaceName));
+        if (sr_shm_push(&conn->shm_out, &shm_hdr, sizeof(shm_hdr), frame, len) < 0)
+        {
+            conn->out_drops++;
+        }
+        return;
+    }
+
+    hdr->mLen = htonl(sizeof(c_packet_header) + len);
+    hdr->mType = htonl(VNSPACKET);
+    memset(hdr->mInterfaceName, 0, sizeof(hdr->mInterfaceName));
+    strncpy(hdr->mInterfaceName, routers[r].ports[p].name, sizeof(hdr->mInterfaceName));
+    memcpy(msg + sizeof(c_packet_header), frame, len);
+    conn_send(routers[r].conn, msg, sizeof(c_packet_header) + len);
+}
+
+/* Hands the frame over now, or once the link delay has passed */
+static
+void schedule_frame(double delay, int r, int p, int h, uint8_t* frame, unsigned int len)
+{
+    if (delay <= 0)
+    {
+        if (r >= 0)
+        {
+            deliver_to_router(r, p, frame, len);
+        }
+        else
+        {
+            host_receive(h, frame, len);
+        }
+        return;
+    }
+
+    struct emu_frame* pending = ((emu_frame*)(malloc(sizeof(emu_frame) + len)));
+    pending->due = emu_now() + delay;
+    pending->router = r;
+    pending->port = p;
+    pending->host = h;
+    pending->len = len;
+    pending->next = NULL;
+    memcpy(pending->data, frame, len);
+
+    struct emu_frame** ptr = &pending_first;
+    while ((*ptr != NULL) && ((*ptr)->due <= pending->due))
+    {
+        ptr = &((*ptr)->next);
+    }
+    pending->next = *ptr;
+    *ptr = pending;
+}
+
+/* Adds the wait for the frames ahead and the time on the wire to delay,
+   returns -1 if the link buffer is full and the frame dropped */
+static
+int link_serialize(struct emu_port* port, double* busy, unsigned int len, double* delay)
+{
+    if (port->rate <= 0)
+    {
+        return 0;
+    }
+    double now = emu_now();
+    double start = (*busy > now) ? *busy : now;
+    if (start - now > EMU_LINK_BUFFER)
+    {
+        return -1;
+    }
+    *busy = start + (len / port->rate);
+    *delay += *busy - now;
+    return 0;
+}
+
+/* A frame sent by router r out of its port p */
+static
+void router_transmit(int r, int p, uint8_t* frame, unsigned int len)
+{
+    struct emu_port* port = &routers[r].ports[p];
+    double delay = port->delay;
+    port->tx_frames++;
+
+    if ((port->up == 0) || (len - sizeof(sr_ethernet_hdr) > port->mtu) ||
+        (link_serialize(port, &port->tx_busy, len, &delay) != 0))
+    {
+        port->drops++;
+    }
+    else if (port->peer_router >= 0)
+    {
+        schedule_frame(delay, port->peer_router, port->peer_port, -1, frame, len);
+    }
+    else if (port->host >= 0)
+    {
+        schedule_frame(delay, -1, -1, port->host, frame, len);
+    }
+}
+
+/* A frame sent by an end host to the router port it is attached to */
+static
+void host_transmit(int h, uint8_t* frame, unsigned int len)
+{
+    struct emu_port* port = &routers[hosts[h].router].ports[hosts[h].port];
+    double delay = port->delay;
+    if ((port->up == 0) || (len - sizeof(sr_ethernet_hdr) > port->mtu) ||
+        (link_serialize(port, &port->rx_busy, len, &delay) != 0))
+    {
+        port->drops++;
+        return;
+    }
+    schedule_frame(delay, hosts[h].router, hosts[h].port, -1, frame, len);
+}
+
+
+/*-----------------------------------------------------------------------------
+ * End hosts
+ *---------------------------------------------------------------------------*/
+
+static
+void probe_received(struct emu_probe* probe, double now)
+{
+    if ((ntohl(probe->magic) != EMU_PROBE_MAGIC) || (ntohs(probe->flow) >= flow_num))
+    {
+        return;
+    }
+    struct emu_flow* flow = &flows[ntohs(probe->flow)];
+    uint32_t seq = ntohl(probe->seq);
+    if ((seq < flow->sent) && (flow->latency[seq] < 0))
+    {
+        flow->latency[seq] = now - flow->sent_at[seq];
+        flow->received++;
+    }
+}
+
+static
+void host_receive(int h, uint8_t* frame, unsigned int len)
+{
+    struct emu_host* host = &hosts[h];
+    struct sr_ethernet_hdr* e_hdr = ((sr_ethernet_hdr*)(frame));
+    static const uint8_t broadcast[ETHER_ADDR_LEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+    if ((memcmp(e_hdr->ether_dhost, host->mac, ETHER_ADDR_LEN) != 0) &&
+        (memcmp(e_hdr->ether_dhost, broadcast, ETHER_ADDR_LEN) != 0))
+    {
+        return;
+    }
+
+    if ((ntohs(e_hdr->ether_type) == ETHERTYPE_ARP) && (len >= sizeof(sr_ethernet_hdr) + sizeof(sr_arphdr)))
+    {
+        struct sr_arphdr* arp_hdr = ((sr_arphdr*)(frame + sizeof(sr_ethernet_hdr)));
+        if ((ntohs(arp_hdr->ar_op) != ARP_REQUEST) || (arp_hdr->ar_tip != host->ip))
+        {
+            return;
+        }
+
+        uint8_t reply[sizeof(sr_ethernet_hdr) + sizeof(sr_arphdr)];
+        struct sr_ethernet_hdr* tx_e_hdr = ((sr_ethernet_hdr*)(reply));
+        struct sr_arphdr* tx_arp_hdr = ((sr_arphdr*)(reply + sizeof(sr_ethernet_hdr)));
+        memcpy(tx_e_hdr->ether_dhost, e_hdr->ether_shost, ETHER_ADDR_LEN);
+        memcpy(tx_e_hdr->ether_shost, host->mac, ETHER_ADDR_LEN);
+        tx_e_hdr->ether_type = htons(ETHERTYPE_ARP);
+        memcpy(tx_arp_hdr, arp_hdr, sizeof(sr_arphdr));
+        tx_arp_hdr->ar_op = htons(ARP_REPLY);
+        memcpy(tx_arp_hdr->ar_sha, host->mac, ETHER_ADDR_LEN);
+        tx_arp_hdr->ar_sip = host->ip;
+        memcpy(tx_arp_hdr->ar_tha, arp_hdr->ar_sha, ETHER_ADDR_LEN);
+        tx_arp_hdr->ar_tip = arp_hdr->ar_sip;
+        host_transmit(h, reply, sizeof(reply));
+        return;
+    }
+
+    if ((ntohs(e_hdr->ether_type) != ETHERTYPE_IP) || (len < sizeof(sr_ethernet_hdr) + sizeof(ip) + sizeof(sr_icmphdr)))
+    {
+        return;
+    }
+
+    struct ip* ip_hdr = ((ip*)(frame + sizeof(sr_ethernet_hdr)));
+    uint8_t* l4 = frame + sizeof(sr_ethernet_hdr) + (ip_hdr->ip_hl * 4);
+    unsigned int l4_len = len - sizeof(sr_ethernet_hdr) - (ip_hdr->ip_hl * 4);
+    if (ip_hdr->ip_dst.s_addr != host->ip)
+    {
+        return;
+    }
+
+    /* -- no reassembly, the rest of a fragmented probe carries nothing to measure -- */
+    int fragmented = ((ntohs(ip_hdr->ip_off) & (IP_MF | IP_OFFMASK)) != 0);
+    if (ntohs(ip_hdr->ip_off) & IP_OFFMASK)
+    {
+        return;
+    }
+
+    if (ip_hdr->ip_p == IP_PROTO_UDP)
+    {
+        if (l4_len >= 8 + sizeof(emu_probe))
+        {
+            probe_received(((emu_probe*)(l4 + 8)), emu_now());
+        }
+    }
+    else if (ip_hdr->ip_p == IP_PROTO_ICMP)
+    {
+        struct sr_icmphdr* icmp_hdr = ((sr_icmphdr*)(l4));
+        if (icmp_hdr->type == ICMP_ECHO_REQUEST_TYPE)
+        {
+            /* Echo reply in place, back to the router it came from */
+            uint8_t reply[EMU_MAX_FRAME];
+            if ((len > sizeof(reply)) || fragmented)
+            {
+                return;
+            }
+            memcpy(reply, frame, len);
+            struct sr_ethernet_hdr* tx_e_hdr = ((sr_ethernet_hdr*)(reply));
+            struct ip* tx_ip_hdr = ((ip*)(reply + sizeof(sr_ethernet_hdr)));
+            struct sr_icmphdr* tx_icmp_hdr = ((sr_icmphdr*)(reply + sizeof(sr_ethernet_hdr) + (ip_hdr->ip_hl * 4)));
+            memcpy(tx_e_hdr->ether_dhost, e_hdr->ether_shost, ETHER_ADDR_LEN);
+            memcpy(tx_e_hdr->ether_shost, host->mac, ETHER_ADDR_LEN);
+            tx_ip_hdr->ip_dst = ip_hdr->ip_src;
+            tx_ip_hdr->ip_src.s_addr = host->ip;
+            tx_ip_hdr->ip_ttl = 64;
+            tx_ip_hdr->ip_sum = 0;
+            tx_ip_hdr->ip_sum = emu_cksum(((uint8_t*)(tx_ip_hdr)), tx_ip_hdr->ip_hl * 4);
+            tx_icmp_hdr->type = ICMP_ECHO_REPLY_TYPE;
+            tx_icmp_hdr->code = ICMP_ECHO_REPLY_CODE;
+            tx_icmp_hdr->cksum = 0;
+            tx_icmp_hdr->cksum = emu_cksum(((uint8_t*)(tx_icmp_hdr)), l4_len);
+            host_transmit(h, reply, len);
+        }
+        else if (icmp_hdr->type == ICMP_ECHO_REPLY_TYPE)
+        {
+            if (l4_len >= sizeof(sr_icmphdr) + sizeof(emu_probe))
+            {
+                probe_received(((emu_probe*)(l4 + sizeof(sr_icmphdr))), emu_now());
+            }
+        }
+        else
+        {
+            host->icmp_errors++;
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: flow_send
+ *
+ * One probe of the flow from its source host, the destination MAC is
+ * the router port the host is attached to.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void flow_send(int f)
+{
+    struct emu_flow* flow = &flows[f];
+    struct emu_host* host = &hosts[flow->src_host];
+    uint8_t frame[EMU_MAX_FRAME];
+    memset(frame, 0, flow->size);
+
+    struct sr_ethernet_hdr* e_hdr = ((sr_ethernet_hdr*)(frame));
+    memcpy(e_hdr->ether_dhost, routers[host->router].ports[host->port].mac, ETHER_ADDR_LEN);
+    memcpy(e_hdr->ether_shost, host->mac, ETHER_ADDR_LEN);
+    e_hdr->ether_type = htons(ETHERTYPE_IP);
+
+    struct ip* ip_hdr = ((ip*)(frame + sizeof(sr_ethernet_hdr)));
+    ip_hdr->ip_v = 4;
+    ip_hdr->ip_hl = 5;
+    ip_hdr->ip_tos = flow->tos;
+    ip_hdr->ip_len = htons(flow->size - sizeof(sr_ethernet_hdr));
+    ip_hdr->ip_id = htons(flow->sent & 0xffff);
+    ip_hdr->ip_off = htons(flow->df ? IP_DF : 0);
+    ip_hdr->ip_ttl = 64;
+    ip_hdr->ip_p = flow->proto;
+    ip_hdr->ip_src.s_addr = host->ip;
+    ip_hdr->ip_dst.s_addr = flow->dst;
+    ip_hdr->ip_sum = emu_cksum(((uint8_t*)(ip_hdr)), sizeof(ip));
+
+    uint8_t* l4 = frame + sizeof(sr_ethernet_hdr) + sizeof(ip);
+    unsigned int l4_len = flow->size - sizeof(sr_ethernet_hdr) - sizeof(ip);
+    struct emu_probe probe;
+    probe.magic = htonl(EMU_PROBE_MAGIC);
+    probe.flow = htons(f);
+    probe.pad = 0;
+    probe.seq = htonl(flow->sent);
+
+    if (flow->proto == IP_PROTO_UDP)
+    {
+        uint16_t* udp_hdr = ((uint16_t*)(l4));
+        udp_hdr[0] = htons(40000 + f);
+        udp_hdr[1] = htons(5001);
+        udp_hdr[2] = htons(l4_len);
+        udp_hdr[3] = 0;
+        memcpy(l4 + 8, &probe, sizeof(probe));
+    }
+    else
+    {
+        struct sr_icmphdr* icmp_hdr = ((sr_icmphdr*)(l4));
+        icmp_hdr->type = ICMP_ECHO_REQUEST_TYPE;
+        icmp_hdr->code = ICMP_ECHO_REQUEST_CODE;
+        icmp_hdr->id = htons(f);
+        icmp_hdr->seq_n = htons(flow->sent & 0xffff);
+        memcpy(l4 + sizeof(sr_icmphdr), &probe, sizeof(probe));
+        icmp_hdr->cksum = emu_cksum(l4, l4_len);
+    }
+
+    flow->sent_at[flow->sent] = emu_now();
+    flow->sent++;
+    host_transmit(flow->src_host, frame, flow->size);
+}
+
+
+/*-----------------------------------------------------------------------------
+ * Report
+ *---------------------------------------------------------------------------*/
+
+static
+int compare_double(const void* a, const void* b)
+{
+    double x = *((const double*)(a));
+    double y = *((const double*)(b));
+    return (x > y) - (x < y);
+}
+
+static
+void report()
+{
+    printf("\n%-12s %-5s %8s %8s %7s %9s %9s %9s %9s %9s %9s\n", "flow", "proto", "sent", "recv", "loss %",
+        "rx pps", "rx Mbit/s", "min ms", "p50 ms", "p99 ms", "max ms");
+    for (int f = 0; f < flow_num; f++)
+    {
+        struct emu_flow* flow = &flows[f];
+        double* lat = ((double*)(malloc((flow->received + 1) * sizeof(double))));
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < flow->sent; i++)
+        {
+            if (flow->latency[i] >= 0)
+            {
+                lat[n++] = flow->latency[i] * 1000;
+            }
+        }
+        qsort(lat, n, sizeof(double), compare_double);
+
+        double span = (flow->sent > 0) ? flow->sent / flow->pps : 1;
+        printf("%-12s %-5s %8u %8u %7.2f %9.1f %9.3f", flow->name, (flow->proto == IP_PROTO_UDP) ? "udp" : "icmp",
+            flow->sent, flow->received, (flow->sent > 0) ? 100.0 * (flow->sent - flow->received) / flow->sent : 0,
+            flow->received / span, flow->received * flow->size * 8 / span / 1e6);
+        if (n > 0)
+        {
+            printf(" %9.3f %9.3f %9.3f %9.3f\n", lat[0], lat[n / 2], lat[(n * 99) / 100], lat[n - 1]);
+        }
+        else
+        {
+            printf(" %9s %9s %9s %9s\n", "-", "-", "-", "-");
+        }
+        free(lat);
+    }
+
+    /* Recovery: from the event to the first probe sent after the last
+     * probe lost before the next event */
+    for (int e = 0; e < event_num; e++)
+    {
+        if (events[e].done == 0)
+        {
+            continue;
+        }
+        double from = events[e].time;
+        double to = 1e30;
+        for (int o = 0; o < event_num; o++)
+        {
+            if ((events[o].done == 1) && (events[o].time > from) && (events[o].time < to))
+            {
+                to = events[o].time;
+            }
+        }
+
+        printf("\nevent %.1f s, %s %s %s\n", from, events[e].up ? "up" : "down", routers[events[e].router].vhost,
+            routers[events[e].router].ports[events[e].port].name);
+        for (int f = 0; f < flow_num; f++)
+        {
+            struct emu_flow* flow = &flows[f];
+            int64_t last_lost = -1;
+            uint32_t lost = 0;
+            for (uint32_t i = 0; i < flow->sent; i++)
+            {
+                double sent = flow->sent_at[i] - t0;
+                if ((sent >= from) && (sent < to) && (flow->latency[i] < 0))
+                {
+                    last_lost = i;
+                    lost++;
+                }
+            }
+            if (last_lost < 0)
+            {
+                printf("  %-12s no loss\n", flow->name);
+            }
+            else if (((uint32_t)(last_lost)) + 1 >= flow->sent)
+            {
+                printf("  %-12s not recovered, %u lost\n", flow->name, lost);
+            }
+            else
+            {
+                printf("  %-12s recovered after %.3f s, %u lost\n", flow->name, flow->sent_at[last_lost + 1] - t0 - from, lost);
+            }
+        }
+    }
+
+    printf("\n%-10s %-6s %10s %10s\n", "router", "iface", "tx frames", "drops");
+    for (int r = 0; r < router_num; r++)
+    {
+        for (int p = 0; p < routers[r].port_num; p++)
+        {
+            printf("%-10s %-6s %10lu %10lu\n", routers[r].vhost, routers[r].ports[p].name,
+                routers[r].ports[p].tx_frames, routers[r].ports[p].drops);
+        }
+    }
+    for (int h = 0; h < host_num; h++)
+    {
+        if (hosts[h].icmp_errors > 0)
+        {
+            printf("%s received %lu ICMP errors\n", hosts[h].name, hosts[h].icmp_errors);
+        }
+    }
+    fflush(stdout);
+}
+
+
+/*-----------------------------------------------------------------------------
+ * Method: handle_message
+ *
+ * One complete message read from an sr process
+ *
+ *---------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ * Method: shm_accept
+ *
+ * VNS_SHM request: maps the memfd the router passed along and answers, the
+ * router moves its packets to the rings once it reads the answer. Without
+ * usable descriptors the request is ignored and the socket carries on.
+ *
+ *---------------------------------------------------------------------------*/
+
+static
+void shm_accept(int c, c_shm* request)
+{
+    struct emu_conn* conn = conns[c];
+
+    if ((conn->passed_num != 3) || (ntohl(request->mSlotNum) != SHM_SLOT_NUM) ||
+        (ntohl(request->mSlotSize) != SHM_SLOT_SIZE))
+    {
+        printf("%s: ignoring VNS_SHM without a usable region\n", routers[conn->router].vhost);
+        return;
+    }
+
+    void* region = mmap(NULL, sizeof(struct sr_shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, conn->passed_fds[0], 0);
+    if ((region == MAP_FAILED) || (((struct sr_shm_region*)(region))->magic != SHM_MAGIC))
+    {
+        perror("mmap");
+        if (region != MAP_FAILED)
+        {
+            munmap(region, sizeof(struct sr_shm_region));
+        }
+        return;
+    }
+
+    conn->shm = ((struct sr_shm_region*)(region));
+    conn->shm_out.ring = &conn->shm->to_router;
+    conn->shm_out.efd = conn->passed_fds[1];
+    conn->shm_in.ring = &conn->shm->from_router;
+    conn->shm_in.efd = conn->passed_fds[2];
+    fcntl(conn->shm_in.efd, F_SETFL, fcntl(conn->shm_in.efd, F_GETFL) | O_NONBLOCK);
+
+    c_shm reply;
+    reply.mLen = htonl(sizeof(reply));
+    reply.mType = htonl(VNS_SHM);
+    reply.mSlotNum = htonl(SHM_SLOT_NUM);
+    reply.mSlotSize = htonl(SHM_SLOT_SIZE);
+    conn_send(c, &reply, sizeof(reply));
+    printf("%s: packets through shared memory\n", routers[conn->router].vhost);
+}
+
+static
+void handle_message(int c, uint8_t* msg, unsigned int len)
+{
+    struct emu_conn* conn = conns[c];
+    uint32_t type = ntohl(((c_base*)(msg))->mType);
+
+    if ((type == VNSOPEN) && (len >= sizeof(c_open)) && (conn->router < 0))
+    {
+        c_open* open_msg = ((c_open*)(msg));
+        char vhost[IDSIZE + 1];
+        memcpy(vhost, open_msg->mVirtualHostID, IDSIZE);
+        vhost[IDSIZE] = '\0';
+
+        int r = find_router(vhost);
+        if ((r < 0) || (routers[r].conn >= 0))
+        {
+            printf("rejecting %s, %s\n", vhost, (r < 0) ? "not in the topology" : "already connected");
+            send_close(c, (r < 0) ? "unknown virtual host" : "virtual host already in use");
+            conn_close(c);
+            return;
+        }
+
+        conn->router = r;
+        routers[r].conn = c;
+        printf("[%8.3f] %s connected\n", (t0 < 0) ? 0 : emu_now() - t0, vhost);
+        send_hwinfo(c, r);
+    }
+    else if ((type == VNSPACKET) && (conn->router >= 0) && (len > sizeof(c_packet_header)))
+    {
+        c_packet_header* hdr = ((c_packet_header*)(msg));
+        char name[17];
+        memcpy(name, hdr->mInterfaceName, 16);
+        name[16] = '\0';
+
+        int p = find_port(conn->router, name);
+        if (p >= 0)
+        {
+            router_transmit(conn->router, p, msg + sizeof(c_packet_header), len - sizeof(c_packet_header));
+        }
+    }
+    else if ((type == VNS_SHM) && (conn->router >= 0) && (conn->shm == NULL) && (len >= sizeof(c_shm)))
+    {
+        shm_accept(c, ((c_shm*)(msg)));
+    }
+    else if (type == VNSCLOSE)
+    {
+        conn_close(c);
+    }
+}
+
+/* Packets the router left in its ring */
+static
+void shm_drain(int c)
+{
+    struct emu_conn* conn = conns[c];
+    uint64_t count;
+    uint8_t* slot;
+
+    if (read(conn->shm_in.efd, &count, sizeof(count)) < 0)
+    {
+        /* -- nothing new since the last drain -- */
+    }
+    while ((conns[c] != NULL) && ((slot = sr_shm_peek(&conn->shm_in)) != NULL))
+    {
+        uint32_t len = ntohl(((c_base*)(slot))->mLen);
+        if ((len >= sizeof(c_base)) && (len <= SHM_SLOT_SIZE))
+        {
+            handle_message(c, slot, len);
+        }
+        sr_shm_pop(&conn->shm_in);
+    }
+}
+
+static
+void conn_read(int c)
+{
+    struct emu_conn* conn = conns[c];
+
+    /* -- recvmsg() for the descriptors passed with VNS_SHM -- */
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct iovec iov;
+    iov.iov_base = conn->in + conn->in_len;
+    iov.iov_len = EMU_IN_BUF_SIZE - conn->in_len;
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+
+    ssize_t ret = recvmsg(conn->fd, &mh, MSG_CMSG_CLOEXEC);
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&mh); cmsg != NULL; cmsg = CMSG_NXTHDR(&mh, cmsg))
+    {
+        if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS))
+        {
+            continue;
+        }
+        int num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int* fds = ((int*)(CMSG_DATA(cmsg)));
+        for (int i = 0; i < num; i++)
+        {
+            if (conn->passed_num < 3)
+            {
+                conn->passed_fds[conn->passed_num++] = fds[i];
+            }
+            else
+            {
+                close(fds[i]);
+            }
+        }
+    }
+    if (ret <= 0)
+    {
+        if ((ret < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+        {
+            return;
+        }
+        conn_close(c);
+        return;
+    }
+    conn->in_len += ret;
+
+    unsigned int offset = 0;
+    while (conn->in_len - offset >= sizeof(c_base))
+    {
+        uint32_t len = ntohl(((c_base*)(conn->in + offset))->mLen);
+        if ((len < sizeof(c_base)) || (len > EMU_IN_BUF_SIZE))
+        {
+            fprintf(stderr, "invalid message length %u\n", len);
+            conn_close(c);
+            return;
+        }
+        if (conn->in_len - offset < len)
+        {
+            break;
+        }
+        handle_message(c, conn->in + offset, len);
+        if (conns[c] == NULL)
+        {
+            return;
+        }
+        offset += len;
+    }
+    memmove(conn->in, conn->in + offset, conn->in_len - offset);
+    conn->in_len -= offset;
+}
+
+
+/*-----------------------------------------------------------------------------
+ * Main loop
+ *---------------------------------------------------------------------------*/
+
+static
+void usage(char* argv0)
+{
+    printf("Format: %s [-p port] [-u socket path] [-d duration s] [-n] <topology file>\n", argv0);
+    printf("   -u  also listen on a Unix socket, routers there may use shared memory\n");
+    printf("   -n  start the clock right away instead of when every router is connected\n");
+}
+
+int main(int argc, char** argv)
+{
+    int c;
+    unsigned short port = EMU_DEFAULT_PORT;
+    double duration = 0;
+    int no_wait = 0;
+    char* unix_path = NULL;
+
+    while ((c = getopt(argc, argv, "hp:u:d:n")) != EOF)
+    {
+        switch (c)
+        {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'u':
+                unix_path = optarg;
+                break;
+            case 'd':
+                duration = atof(optarg);
+                break;
+            case 'n':
+                no_wait = 1;
+                break;
+            default:
+                usage(argv[0]);
+                exit(0);
+        }
+    }
+    if ((optind >= argc) || (load_topology(argv[optind]) != 0))
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    if (duration <= 0)
+    {
+        for (int f = 0; f < flow_num; f++)
+        {
+            if (flows[f].start + flows[f].duration + 2 > duration)
+            {
+                duration = flows[f].start + flows[f].duration + 2;
+            }
+        }
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if ((bind(listen_fd, ((struct sockaddr*)(&addr)), sizeof(addr)) < 0) || (listen(listen_fd, 16) < 0))
+    {
+        perror("bind");
+        exit(1);
+    }
+
+    int unix_fd = -1;
+    if (unix_path != NULL)
+    {
+        struct sockaddr_un unix_addr;
+        memset(&unix_addr, 0, sizeof(unix_addr));
+        unix_addr.sun_family = AF_UNIX;
+        strncpy(unix_addr.sun_path, unix_path, sizeof(unix_addr.sun_path) - 1);
+        unlink(unix_path);
+        unix_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ((bind(unix_fd, ((struct sockaddr*)(&unix_addr)), sizeof(unix_addr)) < 0) || (listen(unix_fd, 16) < 0))
+        {
+            perror("bind");
+            exit(1);
+        }
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    signal(SIGINT, emu_stop);
+    signal(SIGTERM, emu_stop);
+    printf("vns_emu: %d routers, %d hosts, %d flows, %d events, listening on port %d\n",
+        router_num, host_num, flow_num, event_num, port);
+    if (no_wait)
+    {
+        t0 = emu_now();
+    }
+
+    while (stop == 0)
+    {
+        double now = emu_now();
+
+        /* -- the clock starts once the whole topology is connected -- */
+        if (t0 < 0)
+        {
+            int connected = 0;
+            for (int r = 0; r < router_num; r++)
+            {
+                connected += (routers[r].conn >= 0);
+            }
+            if (connected == router_num)
+            {
+                t0 = now;
+                printf("all routers connected, starting the clock\n");
+            }
+        }
+
+        double next = now + 1;
+        if (t0 >= 0)
+        {
+            double t = now - t0;
+            if ((duration > 0) && (t >= duration + EMU_DRAIN_TIME))
+            {
+                break;
+            }
+            uint8_t sending = (duration <= 0) || (t < duration);
+
+            for (int e = 0; e < event_num; e++)
+            {
+                if ((events[e].done == 0) && (t >= events[e].time))
+                {
+                    struct emu_port* ep = &routers[events[e].router].ports[events[e].port];
+                    ep->up = events[e].up;
+                    if (ep->peer_router >= 0)
+                    {
+                        routers[ep->peer_router].ports[ep->peer_port].up = events[e].up;
+                    }
+                    events[e].done = 1;
+                    printf("[%8.3f] link %s %s %s\n", t, routers[events[e].router].vhost, ep->name, ep->up ? "up" : "down");
+                }
+                else if ((events[e].done == 0) && (t0 + events[e].time < next))
+                {
+                    next = t0 + events[e].time;
+                }
+            }
+
+            for (int f = 0; f < flow_num; f++)
+            {
+                struct emu_flow* flow = &flows[f];
+                while (sending && (flow->sent < flow->total) && (t >= flow->start + flow->sent / flow->pps))
+                {
+                    flow_send(f);
+                }
+                if (sending && (flow->sent < flow->total) && (t0 + flow->start + flow->sent / flow->pps < next))
+                {
+                    next = t0 + flow->start + flow->sent / flow->pps;
+                }
+            }
+            if (sending && (duration > 0) && (t0 + duration < next))
+            {
+                next = t0 + duration;
+            }
+            else if ((duration > 0) && (t0 + duration + EMU_DRAIN_TIME < next))
+            {
+                next = t0 + duration + EMU_DRAIN_TIME;
+            }
+        }
+
+        while ((pending_first != NULL) && (pending_first->due <= now))
+        {
+            struct emu_frame* pending = pending_first;
+            pending_first = pending->next;
+            if (pending->router >= 0)
+            {
+                deliver_to_router(pending->router, pending->port, pending->data, pending->len);
+            }
+            else
+            {
+                host_receive(pending->host, pending->data, pending->len);
+            }
+            free(pending);
+        }
+        if ((pending_first != NULL) && (pending_first->due < next))
+        {
+            next = pending_first->due;
+        }
+
+
+        /* -- index: -1 and -2 for the listening sockets, the connection,
+         *    or EMU_MAX_CONNS + the connection for its ring -- */
+        struct pollfd fds[2 * EMU_MAX_CONNS + 2];
+        int index[2 * EMU_MAX_CONNS + 2];
+        int nfds = 0;
+        fds[nfds].fd = listen_fd;
+        fds[nfds].events = POLLIN;
+        index[nfds++] = -1;
+        if (unix_fd >= 0)
+        {
+            fds[nfds].fd = unix_fd;
+            fds[nfds].events = POLLIN;
+            index[nfds++] = -2;
+        }
+        for (int i = 0; i < EMU_MAX_CONNS; i++)
+        {
+            if (conns[i] != NULL)
+            {
+                fds[nfds].fd = conns[i]->fd;
+                fds[nfds].events = POLLIN | ((conns[i]->out_len > 0) ? POLLOUT : 0);
+                index[nfds++] = i;
+            }
+            if ((conns[i] != NULL) && (conns[i]->shm != NULL))
+            {
+                fds[nfds].fd = conns[i]->shm_in.efd;
+                fds[nfds].events = POLLIN;
+                index[nfds++] = EMU_MAX_CONNS + i;
+            }
+        }
+
+        int timeout = ((int)((next - emu_now()) * 1000));
+        if (timeout < 0)
+        {
+            timeout = 0;
+        }
+        if (poll(fds, nfds, timeout) < 0)
+        {
+            continue;
+        }
+
+        for (int i = 0; i < nfds; i++)
+        {
+            if (fds[i].revents == 0)
+            {
+                continue;
+            }
+            if (index[i] >= EMU_MAX_CONNS)
+            {
+                if (conns[index[i] - EMU_MAX_CONNS] != NULL)
+                {
+                    shm_drain(index[i] - EMU_MAX_CONNS);
+                }
+                continue;
+            }
+            if (index[i] < 0)
+            {
+                int fd = accept((index[i] == -1) ? listen_fd : unix_fd, NULL, NULL);
+                int slot = 0;
+                while ((slot < EMU_MAX_CONNS) && (conns[slot] != NULL))
+                {
+                    slot++;
+                }
+                if ((fd < 0) || (slot == EMU_MAX_CONNS))
+                {
+                    if (fd >= 0)
+                    {
+                        close(fd);
+                    }
+                    continue;
+                }
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                if (index[i] == -1)
+                {
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                }
+                conns[slot] = ((emu_conn*)(calloc(1, sizeof(emu_conn))));
+                conns[slot]->fd = fd;
+                conns[slot]->router = -1;
+                continue;
+            }
+            if ((conns[index[i]] != NULL) && (fds[i].revents & POLLOUT))
+            {
+                conn_flush(index[i]);
+            }
+            if ((conns[index[i]] != NULL) && (fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                conn_read(index[i]);
+            }
+        }
+    }
+
+    report();
+
+    for (int i = 0; i < EMU_MAX_CONNS; i++)
+    {
+        if (conns[i] != NULL)
+        {
+            send_close(i, "emulation finished");
+            conn_close(i);
+        }
+    }
+    close(listen_fd);
+    if (unix_fd >= 0)
+    {
+        close(unix_fd);
+        unlink(unix_path);
+    }
+
+    return 0;
+}
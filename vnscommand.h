@@ -16,6 +16,10 @@
 
 #define IDSIZE 32
 
+/* longest command taken from the server: a full c_hwinfo, or a VNSPACKET
+   of a 9014 byte jumbo frame */
+#define VNS_MAX_COMMAND 10000
+
 
 /*-----------------------------------------------------------------------------
                                  BASE
@@ -118,6 +122,7 @@ typedef struct
 #define HWETHER       32
 #define HWETHIP       64
 #define HWMASK       128
+#define HWMTU        256    /* vns_emu only, the MTU of the last HWINTERFACE */
 
 typedef struct
 {
@@ -140,6 +145,7 @@ typedef struct
 #define VNS_AUTH_REQUEST 128
 #define VNS_AUTH_REPLY   256
 #define VNS_AUTH_STATUS  512
+#define VNS_SHM         1024
 
 /* rtable */
 typedef struct
@@ -194,4 +200,15 @@ typedef struct
 
 }__attribute__ ((__packed__)) c_auth_status;
 
+/* shared memory transport, see sr_shm.h: the memfd and the eventfds of
+ * the rings to and from the router go with the request as SCM_RIGHTS,
+ * the server answers with the same message and no descriptors */
+typedef struct
+{
+    uint32_t mLen;
+    uint32_t mType;
+    uint32_t mSlotNum;
+    uint32_t mSlotSize;
+}__attribute__ ((__packed__)) c_shm;
+
 #endif  /* __VNSCOMMAND_H */